@@ -1,5 +1,6 @@
 //example of some shaders compiled
 flat basic.vs flat.fs
+flat_indirect indirect.vs flat.fs
 texture basic.vs texture.fs
 skybox basic.vs skybox.fs
 depth quad.vs depth.fs
@@ -14,6 +15,8 @@ lights_single basic.vs lights_single.fs
 
 //DEFERRED
 gbuffers basic.vs gbuffers.fs
+gbuffers_indirect indirect.vs gbuffers.fs
+gbuffers_arrays indirect.vs gbuffers_arrays.fs
 deferred_global quad.vs deferred_global.fs
 deferred_globalpos quad.vs deferred_globalpos.fs
 deferred_light_geometry basic.vs deferred_light_geometry.fs
@@ -70,6 +73,12 @@ uniform vec3 u_camera_position;
 uniform mat4 u_model;
 uniform mat4 u_viewprojection;
 
+//compact meshes store the vertex quantized inside its aabb and the uvs inside their bounds
+uniform vec3 u_vertex_offset = vec3(0.0);
+uniform vec3 u_vertex_scale = vec3(1.0);
+uniform vec2 u_uv_offset = vec2(0.0);
+uniform vec2 u_uv_scale = vec2(1.0);
+
 //this will store the color for the pixel shader
 out vec3 v_position;
 out vec3 v_world_position;
@@ -85,14 +94,14 @@ void main()
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
+	v_position = a_vertex * u_vertex_scale + u_vertex_offset;
 	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the color in the varying var to use it from the pixel shader
 	v_color = a_color;
 
 	//store the texture coordinates
-	v_uv = a_coord;
+	v_uv = a_coord * u_uv_scale + u_uv_offset;
 
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
@@ -250,6 +259,12 @@ uniform vec3 u_camera_position;
 
 uniform mat4 u_viewprojection;
 
+//compact meshes store the vertex quantized inside its aabb and the uvs inside their bounds
+uniform vec3 u_vertex_offset = vec3(0.0);
+uniform vec3 u_vertex_scale = vec3(1.0);
+uniform vec2 u_uv_offset = vec2(0.0);
+uniform vec2 u_uv_scale = vec2(1.0);
+
 //this will store the color for the pixel shader
 out vec3 v_position;
 out vec3 v_world_position;
@@ -262,11 +277,66 @@ void main()
 	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
 	
 	//calcule the vertex in object space
-	v_position = a_vertex;
-	v_world_position = (u_model * vec4( a_vertex, 1.0) ).xyz;
+	v_position = a_vertex * u_vertex_scale + u_vertex_offset;
+	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
 	
 	//store the texture coordinates
-	v_uv = a_coord;
+	v_uv = a_coord * u_uv_scale + u_uv_offset;
+
+	//calcule the position of the vertex using the matrices
+	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
+}
+
+
+\indirect.vs
+
+#version 330 core
+
+in vec3 a_vertex;
+in vec3 a_normal;
+in vec2 a_coord;
+
+//per draw data of the indirect commands
+in mat4 u_model;
+in vec4 a_vertex_offset;
+in vec4 a_vertex_scale;
+in vec4 a_uv_transform;
+//materials batched with their textures in arrays
+in vec4 a_material_color;
+in vec4 a_material_emissive;
+in vec4 a_material_layers;
+
+uniform vec3 u_camera_position;
+
+uniform mat4 u_viewprojection;
+
+//this will store the color for the pixel shader
+out vec3 v_position;
+out vec3 v_world_position;
+out vec3 v_normal;
+out vec2 v_uv;
+out vec4 v_color;
+flat out vec4 v_material_color;
+flat out vec3 v_material_emissive;
+flat out vec4 v_material_layers;
+
+void main()
+{	
+	//calcule the normal in camera space (the NormalMatrix is like ViewMatrix but without traslation)
+	v_normal = (u_model * vec4( a_normal, 0.0) ).xyz;
+
+	v_material_color = a_material_color;
+	v_material_emissive = a_material_emissive.xyz;
+	v_material_layers = a_material_layers;
+	
+	//calcule the vertex in object space (compact meshes store it quantized inside its aabb)
+	v_position = a_vertex * a_vertex_scale.xyz + a_vertex_offset.xyz;
+	v_world_position = (u_model * vec4( v_position, 1.0) ).xyz;
+	
+	v_color = vec4(1.0);
+
+	//store the texture coordinates
+	v_uv = a_coord * a_uv_transform.zw + a_uv_transform.xy;
 
 	//calcule the position of the vertex using the matrices
 	gl_Position = u_viewprojection * vec4( v_world_position, 1.0 );
@@ -379,6 +449,8 @@ mat3 cotangent_frame(vec3 N, vec3 p, vec2 uv)
 vec3 perturbNormal(vec3 N, vec3 WP, vec2 uv, vec3 normal_pixel)
 {
 	normal_pixel = normal_pixel * 255./127. - 128./127.;
+	//z from x and y, the block compressed normal maps (BC5) only store two channels
+	normal_pixel.z = sqrt(max(0.0, 1.0 - dot(normal_pixel.xy, normal_pixel.xy)));
 	mat3 TBN = cotangent_frame(N, WP, uv);
 	return normalize(TBN * normal_pixel);
 }
@@ -1176,6 +1248,65 @@ void main()
 	ExtraColor = vec4(emissive_light, roughness);
 }
 
+\gbuffers_arrays.fs
+
+#version 330 core
+
+in vec3 v_position;
+in vec3 v_world_position;
+in vec3 v_normal;
+in vec2 v_uv;
+flat in vec4 v_material_color;
+flat in vec3 v_material_emissive;
+flat in vec4 v_material_layers; //albedo, emissive, metallic roughness, normal map, -1 without texture
+
+//the textures of all the materials of the batch are layers of these arrays
+uniform sampler2DArray u_albedo_array;
+uniform sampler2DArray u_emissive_array;
+uniform sampler2DArray u_metallic_roughness_array;
+uniform sampler2DArray u_normal_array;
+
+#include "normalmaps"
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 NormalColor;
+layout(location = 2) out vec4 ExtraColor;
+
+//like the white texture when the material doesnt have one
+vec4 textureLayer(sampler2DArray array, float layer)
+{
+	return layer < 0.0 ? vec4(1.0) : texture(array, vec3(v_uv, layer));
+}
+
+void main()
+{
+	vec4 albedo = v_material_color * textureLayer(u_albedo_array, v_material_layers.x);
+	albedo.xyz = pow(albedo.xyz, vec3(2.2));
+
+	//same as gbuffers.fs for the opaque materials
+	if(albedo.a < 0.9)
+		discard;
+
+	vec3 N;
+	if(u_enable_normalmaps == 1 && v_material_layers.w >= 0.0)
+	{
+		vec3 normal_pixel = texture(u_normal_array, vec3(v_uv, v_material_layers.w)).xyz;
+		N = perturbNormal(v_normal, v_world_position, v_uv, normal_pixel);
+	}
+	else
+	{
+		N = normalize(v_normal);
+	}
+	vec3 emissive_light = v_material_emissive * textureLayer(u_emissive_array, v_material_layers.y).xyz;
+	emissive_light = pow(emissive_light, vec3(2.2));
+
+	vec3 occlusion_metallic_roughness = textureLayer(u_metallic_roughness_array, v_material_layers.z).xyz;
+
+	FragColor = vec4(albedo.xyz, occlusion_metallic_roughness.r);
+	NormalColor = vec4(N * 0.5 + vec3(0.5), occlusion_metallic_roughness.g);
+	ExtraColor = vec4(emissive_light, occlusion_metallic_roughness.b);
+}
+
 \deferred_global.fs
 
 #version 330 core
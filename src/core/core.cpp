@@ -49,7 +49,7 @@ void CORE::init()
 	//prepare SDL
 	SDL_Init(SDL_INIT_EVERYTHING);
 	Input::init();
-	TaskManager::background.startThread();
+	JobSystem::init(); //threads for the jobs and the background tasks
 }
 
 //create a window using SDL
@@ -263,8 +263,8 @@ void CORE::mainLoop(CORE::Window* window, BaseApplication* app)
 		//update app logic
 		app->update(elapsed_time);
 
-		//execute a task in the main task manager (blocking)
-		TaskManager::foreground.fetchTask();
+		//execute tasks in the main task manager (blocking) until the frame budget is spent
+		TaskManager::foreground.fetchTasks();
 
 		//check errors in opengl only when working in debug
 #ifdef _DEBUG
@@ -278,6 +278,8 @@ void CORE::mainLoop(CORE::Window* window, BaseApplication* app)
 void CORE::destroy()
 {
 	// Cleanup
+	JobSystem::shutdown(); //joins the threads, pending loads are cancelled
+
 #ifndef SKIP_IMGUI
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
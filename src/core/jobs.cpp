@@ -0,0 +1,478 @@
+#include "jobs.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <cassert>
+#include <cstdint>
+
+//Chase-Lev work stealing deque: the owner pushes and pops at the bottom, the other threads steal from the top
+class JobDeque
+{
+public:
+	std::atomic<long long> top;
+	char padding[64]; //top and bottom are written by different threads
+	std::atomic<long long> bottom;
+	std::atomic<Job*> jobs[JOBS_DEQUE_SIZE];
+
+	JobDeque()
+	{
+		top = 0;
+		bottom = 0;
+		for (int i = 0; i < JOBS_DEQUE_SIZE; ++i)
+			jobs[i] = nullptr;
+	}
+
+	//only the owner
+	bool push(Job* job)
+	{
+		long long b = bottom.load(std::memory_order_relaxed);
+		long long t = top.load(std::memory_order_acquire);
+		if (b - t >= JOBS_DEQUE_SIZE)
+			return false;
+		jobs[b & (JOBS_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	//only the owner, newest first
+	Job* pop()
+	{
+		long long b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long t = top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		Job* job = jobs[b & (JOBS_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			//the last one, a thief could be taking it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = nullptr;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	//only the owner, the newest one if it belongs to the counter
+	Job* popIf(JobCounter* counter)
+	{
+		//taken before looking at it, a thief could be running (and freeing) the last one
+		Job* job = pop();
+		if (job && job->counter != counter)
+		{
+			push(job); //there is room, it was just taken from the bottom
+			return nullptr;
+		}
+		return job;
+	}
+
+	//any thread, oldest first
+	Job* steal()
+	{
+		long long t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+		Job* job = jobs[t & (JOBS_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return job;
+	}
+};
+
+//bounded multi producer multi consumer queue (Vyukov), every cell has a sequence number that says if it can be written or read
+class JobQueue
+{
+public:
+	struct sCell {
+		std::atomic<size_t> sequence;
+		Job* job;
+	};
+
+	sCell cells[JOBS_QUEUE_SIZE];
+	char padding[64];
+	std::atomic<size_t> tail; //written by the producers
+	char padding2[64];
+	std::atomic<size_t> head; //written by the consumers
+
+	JobQueue()
+	{
+		for (size_t i = 0; i < JOBS_QUEUE_SIZE; ++i)
+			cells[i].sequence = i;
+		tail = 0;
+		head = 0;
+	}
+
+	//false if it is full
+	bool push(Job* job)
+	{
+		size_t pos = tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			sCell& cell = cells[pos & (JOBS_QUEUE_SIZE - 1)];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+			if (diff == 0)
+			{
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.job = job;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	//in order of arrival, NULL if it is empty
+	Job* pop()
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			sCell& cell = cells[pos & (JOBS_QUEUE_SIZE - 1)];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					Job* job = cell.job;
+					cell.sequence.store(pos + JOBS_QUEUE_SIZE, std::memory_order_release);
+					return job;
+				}
+			}
+			else if (diff < 0)
+				return nullptr;
+			else
+				pos = head.load(std::memory_order_relaxed);
+		}
+	}
+};
+
+unsigned int JobSystem::num_threads = 0;
+
+static JobDeque* deques = nullptr; //one per thread, the main thread is the first one
+static Job* pools[JOBS_MAX_THREADS];
+static unsigned int pools_next[JOBS_MAX_THREADS];
+static std::vector<std::thread*> workers; //never destroyed, like the thread of the old task manager, in case shutdown is not called
+static thread_local int current_thread = -1; //threads not created by the job system dont have a deque nor a pool
+
+static JobQueue shared_queue; //jobs added by other threads
+static JobQueue main_thread_queue; //foreground jobs
+
+//idle workers sleep until there are jobs
+static std::atomic<int> num_queued(0);
+static std::atomic<int> num_sleeping(0);
+static std::atomic<bool> running(false);
+static std::mutex sleep_mutex;
+static std::condition_variable sleep_condition;
+
+//counters with jobs waiting for them, so shutdown can release the ones that will never be done
+static std::mutex parked_mutex;
+static std::vector<JobCounter*> parked_counters;
+
+void JobSystem::init(unsigned int num_workers)
+{
+	assert(!num_threads && "JobSystem already initialized");
+	if (!num_workers)
+		num_workers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+	num_threads = std::min(num_workers + 1, (unsigned int)JOBS_MAX_THREADS);
+
+	deques = new JobDeque[num_threads];
+	for (unsigned int i = 0; i < num_threads; ++i)
+	{
+		pools[i] = new Job[JOBS_POOL_SIZE];
+		pools_next[i] = 0;
+		for (int j = 0; j < JOBS_POOL_SIZE; ++j)
+		{
+			pools[i][j].in_use = false;
+			pools[i][j].allocated = false;
+		}
+	}
+
+	current_thread = 0;
+	running = true;
+	for (unsigned int i = 1; i < num_threads; ++i)
+		workers.push_back(new std::thread(workerLoop, i));
+	std::cout << "Job system: " << num_threads << " threads" << std::endl;
+}
+
+void JobSystem::shutdown(bool execute_pending)
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		running = false;
+	}
+	sleep_condition.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->join();
+		delete workers[i];
+	}
+	workers.clear();
+
+	//the main thread is alone now, the jobs can add more jobs (or release the ones waiting for them) so it goes until all are empty
+	while (true)
+	{
+		Job* job = takeJob();
+		if (!job)
+			job = main_thread_queue.pop();
+		if (job)
+		{
+			if (execute_pending)
+				job->execute(job);
+			finish(job); //cancelled jobs are destroyed without executing them
+			continue;
+		}
+
+		//the rest wait for counters that will never be done, they are destroyed (and their counters released) without executing them
+		std::vector<JobCounter*> counters;
+		{
+			std::lock_guard<std::mutex> lock(parked_mutex);
+			counters.swap(parked_counters);
+		}
+		if (counters.empty())
+			break;
+		for (size_t i = 0; i < counters.size(); ++i)
+		{
+			Job* waiting = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(counters[i]->mutex);
+				waiting = counters[i]->waiting;
+				counters[i]->waiting = nullptr;
+			}
+			while (waiting)
+			{
+				Job* next = waiting->next;
+				finish(waiting);
+				waiting = next;
+			}
+		}
+	}
+}
+
+void JobSystem::workerLoop(unsigned int index)
+{
+	current_thread = index;
+	int idle = 0;
+	while (running)
+	{
+		if (executeJob())
+		{
+			idle = 0;
+			continue;
+		}
+
+		//spin a little before sleeping, new jobs usually come in bursts
+		if (++idle < 64)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		idle = 0;
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		num_sleeping++;
+		sleep_condition.wait(lock, []() { return num_queued > 0 || !running; });
+		num_sleeping--;
+	}
+}
+
+Job* JobSystem::allocateJob()
+{
+	if (current_thread != -1)
+	{
+		Job* pool = pools[current_thread];
+		unsigned int& next = pools_next[current_thread];
+		//a few tries, if they are taken the pool is probably full of pending jobs
+		for (int i = 0; i < 4; ++i)
+		{
+			Job* job = &pool[next++ & (JOBS_POOL_SIZE - 1)];
+			if (job->in_use.load(std::memory_order_acquire))
+				continue;
+			job->in_use.store(true, std::memory_order_relaxed);
+			return job;
+		}
+	}
+
+	Job* job = new Job();
+	job->allocated = true;
+	return job;
+}
+
+void JobSystem::submit(Job* job)
+{
+	if (current_thread != -1)
+	{
+		if (!deques[current_thread].push(job))
+		{
+			job->execute(job);
+			finish(job);
+			return;
+		}
+	}
+	else
+	{
+		//full, wait for the workers to take some
+		while (!shared_queue.push(job))
+			std::this_thread::yield();
+	}
+
+	num_queued++;
+	if (num_sleeping > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		sleep_condition.notify_one();
+	}
+}
+
+void JobSystem::submitAfter(Job* job, JobCounter* dependency)
+{
+	{
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (dependency->count > 0)
+		{
+			if (!dependency->waiting)
+			{
+				std::lock_guard<std::mutex> parked_lock(parked_mutex);
+				parked_counters.push_back(dependency);
+			}
+			job->next = dependency->waiting;
+			dependency->waiting = job;
+			return;
+		}
+	}
+	submit(job);
+}
+
+void JobSystem::submitToMainThread(Job* job)
+{
+	while (!main_thread_queue.push(job))
+	{
+		//full, the main thread can do it now, the others wait for it to take some
+		if (current_thread == 0)
+		{
+			job->execute(job);
+			finish(job);
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+void JobSystem::finish(Job* job)
+{
+	JobCounter* counter = job->counter;
+	job->destroy(job);
+	if (job->allocated)
+		delete job;
+	else
+		job->in_use.store(false, std::memory_order_release);
+
+	if (!counter)
+		return;
+
+	//the last decrement is done with the lock so wait() cannot return (and the counter be destroyed) before it is released
+	Job* waiting = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (--counter->count == 0 && counter->waiting)
+		{
+			waiting = counter->waiting;
+			counter->waiting = nullptr;
+			std::lock_guard<std::mutex> parked_lock(parked_mutex);
+			auto it = std::find(parked_counters.begin(), parked_counters.end(), counter);
+			if (it != parked_counters.end()) //not if shutdown is releasing it
+				parked_counters.erase(it);
+		}
+	}
+	while (waiting)
+	{
+		Job* next = waiting->next;
+		waiting->next = nullptr;
+		submit(waiting);
+		waiting = next;
+	}
+}
+
+Job* JobSystem::takeJob()
+{
+	Job* job = nullptr;
+	if (current_thread != -1)
+		job = deques[current_thread].pop();
+
+	//steal starting from the next thread so they dont all go for the same one
+	for (unsigned int i = 1; !job && i <= num_threads; ++i)
+	{
+		int victim = (current_thread + i) % num_threads;
+		if (victim != current_thread)
+			job = deques[victim].steal();
+	}
+
+	if (!job)
+		job = shared_queue.pop();
+	if (job)
+		num_queued--;
+	return job;
+}
+
+bool JobSystem::executeJob()
+{
+	Job* job = takeJob();
+	if (!job)
+		return false;
+	job->execute(job);
+	finish(job);
+	return true;
+}
+
+bool JobSystem::executeMainThreadJob()
+{
+	Job* job = main_thread_queue.pop();
+	if (!job)
+		return false;
+	job->execute(job);
+	finish(job);
+	return true;
+}
+
+void JobSystem::wait(JobCounter* counter)
+{
+	//the main thread only helps with the jobs of this counter that it queued itself, any other job could take long
+	//(a background load) or not expect to run inside whatever the main thread is doing, the workers take the rest
+	bool only_counter = current_thread == 0 && num_threads > 1;
+	while (!counter->isDone())
+	{
+		bool executed = false;
+		if (only_counter)
+		{
+			Job* job = deques[0].popIf(counter);
+			if (job)
+			{
+				num_queued--;
+				job->execute(job);
+				finish(job);
+				executed = true;
+			}
+		}
+		else
+			executed = executeJob();
+		if (!executed)
+			std::this_thread::yield();
+	}
+
+	//in case the last job is still releasing the lock
+	std::lock_guard<std::mutex> lock(counter->mutex);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+
+//Job system: a pool of threads (one per core, the main thread is the first one) with a lock-free deque per thread,
+//every thread runs the jobs of its own deque and steals the oldest ones from the others when it is empty.
+//Jobs are small functions stored in a pool of the thread that creates them, so running one doesnt allocate memory
+
+#define JOBS_DEQUE_SIZE 4096 //per thread, power of two, when it is full the job is executed right away
+#define JOBS_POOL_SIZE 1024 //jobs per thread, power of two, if all of them are pending new ones are allocated
+#define JOBS_DATA_SIZE 64 //bytes for the function and its captures, bigger ones are allocated
+#define JOBS_QUEUE_SIZE 4096 //jobs for the main thread and jobs added by threads outside the system, power of two
+#define JOBS_MAX_THREADS 64
+
+class JobCounter;
+
+struct Job
+{
+	void (*execute)(Job* job);
+	void (*destroy)(Job* job);
+	JobCounter* counter; //decremented when it finishes
+	Job* next; //in the list of jobs waiting for a counter
+	std::atomic<bool> in_use; //slot of the pool taken
+	bool allocated; //not from a pool
+	alignas(16) unsigned char data[JOBS_DATA_SIZE];
+};
+
+//number of unfinished jobs, it can be waited or used as a dependency of other jobs
+class JobCounter
+{
+public:
+	std::atomic<int> count;
+
+	JobCounter() { count = 0; waiting = nullptr; }
+	bool isDone() const { return count.load() == 0; }
+
+private:
+	friend class JobSystem;
+	std::mutex mutex; //protects waiting and the last decrement
+	Job* waiting; //jobs that run when count reaches zero
+};
+
+class JobSystem
+{
+public:
+	static unsigned int num_threads; //including the main thread, 0 until init
+
+	static void init(unsigned int num_workers = 0); //0 uses one thread per core
+	static void shutdown(bool execute_pending = false); //joins the threads, pending jobs are executed or destroyed without executing them (always the ones waiting for a counter that is never done)
+
+	//func() runs in any thread, the counter is incremented now and decremented when it finishes
+	//with a dependency it is not queued until the dependency counter is done
+	template<typename F> static void run(F&& func, JobCounter* counter = nullptr, JobCounter* dependency = nullptr);
+	//func() runs in the main thread when it calls executeMainThreadJob (for OpenGL)
+	template<typename F> static void runInMainThread(F&& func, JobCounter* counter = nullptr);
+	//func(start, end) for ranges of at least min_range items, the calling thread takes part in it and returns when all are done
+	template<typename F> static void parallelFor(unsigned int count, unsigned int min_range, const F& func);
+
+	static void wait(JobCounter* counter); //executes other jobs meanwhile, the main thread only the ones of the counter it queued itself
+	static bool executeJob(); //one job of this thread or stolen from another one, false if there was none
+	static bool executeMainThreadJob(); //in order of arrival, false if there was none
+
+private:
+	template<typename F> static Job* createJob(F&& func, JobCounter* counter);
+	template<typename Func, typename F> static void storeFunction(Job* job, F&& func, std::true_type fits);
+	template<typename Func, typename F> static void storeFunction(Job* job, F&& func, std::false_type fits);
+	static Job* allocateJob();
+	static Job* takeJob(); //from any queue but the main thread one
+	static void submit(Job* job);
+	static void submitAfter(Job* job, JobCounter* dependency);
+	static void submitToMainThread(Job* job);
+	static void finish(Job* job);
+	static void workerLoop(unsigned int index);
+};
+
+template<typename Func, typename F> void JobSystem::storeFunction(Job* job, F&& func, std::true_type)
+{
+	new (job->data) Func(std::forward<F>(func));
+	job->execute = [](Job* job) { (*(Func*)job->data)(); };
+	job->destroy = [](Job* job) { ((Func*)job->data)->~Func(); };
+}
+
+//too big for the job
+template<typename Func, typename F> void JobSystem::storeFunction(Job* job, F&& func, std::false_type)
+{
+	*(Func**)job->data = new Func(std::forward<F>(func));
+	job->execute = [](Job* job) { (**(Func**)job->data)(); };
+	job->destroy = [](Job* job) { delete *(Func**)job->data; };
+}
+
+template<typename F> Job* JobSystem::createJob(F&& func, JobCounter* counter)
+{
+	typedef typename std::decay<F>::type Func;
+	Job* job = allocateJob();
+	job->counter = counter;
+	job->next = nullptr;
+	storeFunction<Func>(job, std::forward<F>(func), std::integral_constant<bool, sizeof(Func) <= JOBS_DATA_SIZE && alignof(Func) <= 16>());
+	if (counter)
+		counter->count++;
+	return job;
+}
+
+template<typename F> void JobSystem::run(F&& func, JobCounter* counter, JobCounter* dependency)
+{
+	Job* job = createJob(std::forward<F>(func), counter);
+	if (dependency)
+		submitAfter(job, dependency);
+	else
+		submit(job);
+}
+
+template<typename F> void JobSystem::runInMainThread(F&& func, JobCounter* counter)
+{
+	submitToMainThread(createJob(std::forward<F>(func), counter));
+}
+
+template<typename F> void JobSystem::parallelFor(unsigned int count, unsigned int min_range, const F& func)
+{
+	if (!count)
+		return;
+
+	//a few ranges per thread so the ones that finish first can steal the rest
+	unsigned int num_ranges = std::min(count / std::max(min_range, 1u), num_threads * 4);
+	if (num_ranges <= 1)
+	{
+		func(0, count);
+		return;
+	}
+
+	unsigned int range = (count + num_ranges - 1) / num_ranges;
+	JobCounter counter;
+	for (unsigned int start = range; start < count; start += range)
+	{
+		unsigned int end = std::min(count, start + range);
+		run([&func, start, end]() { func(start, end); }, &counter);
+	}
+
+	//the first range is done here
+	func(0, range);
+	wait(&counter);
+}
@@ -1622,3 +1622,66 @@ std::ostream& operator<<(std::ostream& os, const Vector4f& v)
 	os << v.x << ',' << v.y << ',' << v.z << ',' << v.w;
 	return os;
 }
+
+uint16 floatToHalf(float v)
+{
+	uint32 f;
+	memcpy(&f, &v, sizeof(float));
+	uint32 sign = (f >> 16) & 0x8000;
+	int exponent = (int)((f >> 23) & 0xFF) - 127 + 15;
+	uint32 mantissa = f & 0x007FFFFF;
+
+	if (((f >> 23) & 0xFF) == 0xFF) //inf or nan
+		return (uint16)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31) //too big, becomes inf
+		return (uint16)(sign | 0x7C00);
+	if (exponent <= 0) //denormal or zero
+	{
+		if (exponent < -10)
+			return (uint16)sign;
+		mantissa |= 0x00800000;
+		uint32 shift = 14 - exponent;
+		uint32 result = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) //round
+			result++;
+		return (uint16)(sign | result);
+	}
+
+	uint32 result = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) //round, a carry to the exponent is still correct
+		result++;
+	return (uint16)result;
+}
+
+float halfToFloat(uint16 h)
+{
+	uint32 sign = (uint32)(h & 0x8000) << 16;
+	uint32 exponent = (h >> 10) & 0x1F;
+	uint32 mantissa = h & 0x3FF;
+	uint32 f;
+
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+			f = sign;
+		else //denormal, normalize it
+		{
+			exponent = 127 - 15 + 1;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3FF;
+			f = sign | (exponent << 23) | (mantissa << 13);
+		}
+	}
+	else if (exponent == 31)
+		f = sign | 0x7F800000 | (mantissa << 13);
+	else
+		f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+	float v;
+	memcpy(&v, &f, sizeof(float));
+	return v;
+}
@@ -409,6 +409,10 @@ float signedDistanceToPlane(const Vector4f& plane, const Vector3f& point);
 int planeBoxOverlap( const Vector4f& plane, const Vector3f& center, const Vector3f& halfsize );
 float ComputeSignedAngle( Vector2f a, Vector2f b); //returns the angle between both vectors in radians
 inline float ease(float f) { return f*f*f*(f*(f*6.0f - 15.0f) + 10.0f); }
+
+//IEEE 754 half floats (used for compact vertex streams and textures)
+uint16 floatToHalf(float v);
+float halfToFloat(uint16 h);
 bool RaySphereCollision(const Vector3f& center, const float& radius, const Vector3f& ray_origin, const Vector3f& ray_dir, Vector3f& coll, float& t);
 bool RayPlaneCollision( const Vector3f& plane_pos, const Vector3f& plane_normal, const Vector3f& ray_origin, const Vector3f& ray_dir, Vector3f& result );
 bool RayBoundingBoxCollision(const BoundingBox& box, const Vector3f& ray_origin, const Vector3f& ray_dir, Vector3f& coll);
@@ -1,79 +1,59 @@
 #include "task.h"
-#include <iostream>       // std::cout
-#include <thread>         // std::thread
 #include <chrono>		  //ms
-#include <cassert>
 
-TaskManager TaskManager::foreground;
+TaskManager TaskManager::foreground(true);
 TaskManager TaskManager::background;
 
-TaskManager::TaskManager()
+TaskManager::TaskManager(bool main_thread)
 {
-	must_loop = false;
-	_thread = NULL;
+	this->main_thread = main_thread;
+	time_budget = 2;
+	overrun = 0;
 }
 
-void TaskManager::loop()
+bool TaskManager::fetchTask()
 {
-	using namespace std::chrono_literals;
-	std::cout << "Starting Task Manager ..." << std::endl;
-
-	while (must_loop)
-	{
-		if (pending_tasks.empty())
-		{
-			std::this_thread::sleep_for(10ms);
-			continue;
-		}
-
-		fetchTask();
-	}
-
-	std::cout << "Ending Task Manager" << std::endl;
+	//background tasks share the queues with the other jobs, this thread helps with any of them
+	if (main_thread)
+		return JobSystem::executeMainThreadJob();
+	return JobSystem::executeJob();
 }
 
-void TaskManager::fetchTask()
+void TaskManager::fetchTasks()
 {
-	Task* task = NULL;
-	try
+	float budget = time_budget - overrun;
+	if (budget <= 0.0f)
 	{
-		//lock
-		const std::lock_guard<std::mutex> lock(tasks_mutex);
-		if (pending_tasks.empty())
-			return;
-		task = pending_tasks.front();
-		pending_tasks.pop_front();
-		//unlock after finishing scope
-	}
-	catch (std::logic_error&) {
-		std::cout << "[exception caught]\n";
+		overrun = -budget;
+		return;
 	}
 
-	if (task)
+	float elapsed_ms = 0.0f;
+	auto start = std::chrono::steady_clock::now();
+	while (fetchTask())
 	{
-		task->onExecute();
-		delete task;
-		task = NULL;
+		std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		elapsed_ms = elapsed.count();
+		if (elapsed_ms >= budget)
+			break;
 	}
+	overrun = elapsed_ms > budget ? elapsed_ms - budget : 0.0f;
 }
 
-void thread_loop_func(TaskManager* manager)
+void TaskManager::drain()
 {
-	manager->loop();
-	//join?
-}
-
-void TaskManager::startThread()
-{
-	assert(!_thread && "TaskManager already in a thread");
-	must_loop = true;
-	_thread = new std::thread(thread_loop_func, this);
+	while (fetchTask())
+		continue;
+	if (!main_thread)
+		JobSystem::wait(&pending);
 }
 
 void TaskManager::addTask(Task* task)
 {
-	//block pending_tasks
-	const std::lock_guard<std::mutex> lock(tasks_mutex);
-	pending_tasks.push_back(task);
-	//release pending_tasks automatically
-}
\ No newline at end of file
+	//the job owns the task, so it is deleted also if the job is cancelled
+	auto execute = [owned = std::unique_ptr<Task>(task)]() { owned->onExecute(); };
+	if (main_thread)
+		JobSystem::runInMainThread(std::move(execute), &pending);
+	else
+		JobSystem::run(std::move(execute), &pending);
+}
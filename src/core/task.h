@@ -1,10 +1,9 @@
 #pragma once
 
-#include <vector>
-#include <list>
-#include <mutex>
-#include <thread>         // std::thread
 #include <functional>
+#include <memory>
+
+#include "jobs.h"
 
 //any task executed in BG should inherit from this one
 class Task {
@@ -16,19 +15,20 @@ public:
 	virtual void onExecute() { if (callback) callback(); }
 };
 
+//tasks are jobs of the JobSystem: background ones are executed by any of its threads, foreground ones by the main thread in fetchTasks
 class TaskManager {
 public:
-	std::list<Task*> pending_tasks;
-	std::mutex tasks_mutex;  // protects pending_tasks
-	bool must_loop;
-	std::thread* _thread;
+	bool main_thread; //foreground
+	float time_budget; //ms that fetchTasks can spend per call
+	float overrun; //ms spent over the budget, taken from the next calls so a slow task doesnt make several frames slow
+	JobCounter pending; //tasks not finished
 
 	static TaskManager foreground;
 	static TaskManager background;
 
-	TaskManager();
-	void addTask(Task* task);
-	void fetchTask();
-	void loop();
-	void startThread();
-};
\ No newline at end of file
+	TaskManager(bool main_thread = false);
+	void addTask(Task* task); //the task is deleted after executing it
+	bool fetchTask(); //returns false if there was nothing to execute
+	void fetchTasks(); //executes tasks until the time budget is spent (at least one if there is budget left)
+	void drain(); //executes tasks until there are none, background tasks also wait for the ones running in other threads
+};
@@ -296,6 +296,12 @@ void SceneEditor::renderTexturesPanel()
 	if (ImGui::Begin("Textures", nullptr, flags))// Create a window
 	{
 		ImGui::Checkbox("Big", &show_big);
+		ImGui::SameLine();
+		ImGui::Checkbox("Streaming", &GFX::Texture::use_streaming);
+		int budget_mb = (int)(GFX::Texture::streaming_budget / (1024 * 1024));
+		if (ImGui::SliderInt("Streaming budget MB", &budget_mb, 16, 4096))
+			GFX::Texture::streaming_budget = (size_t)budget_mb * 1024 * 1024;
+		ImGui::Text("Streamed levels: %.1f / %d MB", GFX::Texture::streaming_bytes / (1024.0f * 1024.0f), budget_mb);
 		for (auto it : GFX::Texture::sTextures)
 		{
 			GFX::Texture* tex = it.second;
@@ -309,6 +315,11 @@ void SceneEditor::renderTexturesPanel()
 			if (ImGui::IsItemClicked(0))
 				selected_texture = selected_texture == tex->index ? -1 : tex->index;
 			ImGui::Text("%dx%d %s", (int)tex->width, (int)tex->height, tex->filename.c_str());
+			const GFX::sTextureStreaming& streaming = tex->streaming;
+			if (tex->streamed && streaming.num_levels)
+				ImGui::Text("Resident: %dx%d (level %d/%d) needed %d%s %.2f MB", std::max((int)tex->width >> streaming.resident_level, 1), std::max((int)tex->height >> streaming.resident_level, 1),
+					streaming.resident_level, streaming.num_levels - 1, streaming.needed_level, streaming.loading_level != -1 ? " loading" : "",
+					tex->getLevelsBytes(streaming.resident_level, streaming.num_levels) / (1024.0f * 1024.0f));
 		}
 	}
 	ImGui::End();
@@ -3,6 +3,7 @@
 #include <cmath>
 #include <cassert>
 #include <algorithm>
+#include <cstring>
 
 #include "../utils/utils.h"
 #include "hdre.h"
@@ -23,9 +24,10 @@ HDRE::HDRE(const char* filename)
 
 void HDRE::init()
 {
-    data = nullptr;
     width = height = 0;
     levels = N_MAX_LEVELS;
+    stored_levels = 0;
+    half = false;
 
     for (int j = 0; j < N_FACES; j++)
     {
@@ -40,7 +42,7 @@ void HDRE::init()
 
 HDRE::~HDRE()
 {
-	clean();
+	release();
 
 	auto it = s_loaded_hdres.find(filename);
 	if (it != s_loaded_hdres.end())
@@ -70,7 +72,7 @@ HDRE::~HDRE()
 
 float* HDRE::getData()
 {
-	return this->data;
+	return this->pixels_f[0][0]; // the levels go one after the other in the file
 }
 
 float** HDRE::getFacesf(int level)
@@ -104,58 +106,40 @@ short* HDRE::getFaceh(int level, int face)
 bool HDRE::load(const char* filename)
 {
 	assert(filename);
+	release();
 
-	FILE *f = fopen(filename,"rb");
-	if (f == nullptr)
+	if (!mapFile(filename, file))
 		return false;
 
-	sHDREHeader HDREHeader;
-
-	fread(&HDREHeader, sizeof(sHDREHeader), 1, f);
-
-	if (HDREHeader.type != 3) {
-        std::cout << "HDRE Header has wrong type: " << HDREHeader.type << std::endl;
-        throw ("ArrayType not supported. Please export in Float32Array.");
-    }
-
-    this->header = HDREHeader;
+	if (file.size < sizeof(sHDREHeader))
+	{
+		std::cout << "[ERROR]: HDRE file too small: " << filename << std::endl;
+		release();
+		return false;
+	}
+	memcpy(&this->header, file.data, sizeof(sHDREHeader));
+
+	// 3: Float32Array, 2: Uint16Array with half floats
+	size_t component_size = 0;
+	if (this->header.type == 3)
+		component_size = sizeof(float);
+	else if (this->header.type == 2 && this->header.bitsPerChannel == 16)
+		component_size = sizeof(short);
+	else
+	{
+		std::cout << "[ERROR]: HDRE array type not supported: " << this->header.type << ", export it in Float32Array or Uint16Array (half float)" << std::endl;
+		release();
+		return false;
+	}
+	this->half = component_size == sizeof(short);
 
-	int width = HDREHeader.width;
-	int height = HDREHeader.height;
+	int width = this->header.width;
+	int height = this->header.height;
 
 	this->width = width;
 	this->height = height;
 
-	int dataSize = 0;
 	int w = width;
-
-	// Get number of floats inside the HDRE
-	// Per channel & Per face
-	for (int i = 0; i < N_LEVELS; i++)
-	{
-		int mip_level = i + 1;
-		dataSize += w * w * N_FACES * HDREHeader.numChannels;
-
-		//w = std::max(8, (int)(width / pow(2.0, mip_level)));
-		w = fmax(8, (int)(width / pow(2.0, mip_level)));
-
-		if (this->header.version > 2.0)
-			w = (int)(width / pow(2.0, mip_level));
-	}
-
-	this->data = new float[dataSize];
-
-	fseek(f, HDREHeader.headerSize, SEEK_SET);
-
-	fread(this->data, sizeof(float) * dataSize, 1, f);
-	fclose(f);
-
-	// get separated levels
-
-	w = width;
-	int mapOffset = 0;
-    int mapPrevOffset = 0;
-
 	int nFullMips = 0;
 	while (w)
     {
@@ -164,85 +148,68 @@ bool HDRE::load(const char* filename)
     }
 	assert(nFullMips <= N_MAX_LEVELS);
 	levels = nFullMips;
-	w = width;
 
-    int i;
-    for (i = 0; i < N_LEVELS; i++)
+	// get separated levels, each one with its faces, pointing to the mapping
+	w = width;
+	size_t offset = this->header.headerSize;
+	int i;
+	for (i = 0; i < N_LEVELS && w > 0; i++)
 	{
 		int mip_level = i + 1;
-		int faceSize = w * w * HDREHeader.numChannels;
-		int mapSize = faceSize * N_FACES;
-
-		int faceOffset = 0;
+		size_t faceSize = (size_t)w * w * this->header.numChannels * component_size;
+		if (offset + faceSize * N_FACES > file.size)
+		{
+			std::cout << "[ERROR]: HDRE file truncated: " << filename << std::endl;
+			release();
+			return false;
+		}
 
 		for (int j = 0; j < N_FACES; j++)
 		{
-			// allocate memory
-			this->pixels_f[i][j] = new float[faceSize];
-
-			// set data
-			for (int k = 0; k < faceSize; k++) {
-
-				float value = this->data[mapOffset + faceOffset + k];
-
-				this->pixels_f[i][j][k] = value;
-			}
-
-			// update face offset
-			faceOffset += faceSize;
+			void* face = (void*)(file.data + offset + faceSize * j); // read only, nobody writes the faces
+			if (this->half)
+				this->pixels_h[i][j] = (short*)face;
+			else
+				this->pixels_f[i][j] = (float*)face;
 		}
 
-		// update level offset
-		mapPrevOffset = mapOffset;
-		mapOffset += mapSize;
+		offset += faceSize * N_FACES;
 		// reassign width for next level
-		//w = std::max(8, (int)(width / pow(2.0, mip_level)));
 		w = fmax(8, (int)(width / pow(2.0, mip_level)));
 
 		if (this->header.version > 2.0)
 			w = (int)(width / pow(2.0, mip_level));
 	}
-	std::cout << " + '" << filename << "' (v" << this->header.version << ") loaded successfully" << std::endl;
+	stored_levels = i;
+
+	std::cout << " + '" << filename << "' (v" << this->header.version << (this->half ? " half" : "") << ") mapped successfully" << std::endl;
 	return true;
 }
 
-bool HDRE::clean()
+void HDRE::release()
 {
-	try
+	unmapFile(file);
+	for (int j = 0; j < N_FACES; j++)
 	{
-		if (data)
-			delete data;
-
-        for (int j = 0; j < N_FACES; j++)
-        {
-            for (int i = 0; i < N_LEVELS; i++)
-            {
-				delete pixels_h[i][j];
-				pixels_h[i][j] = nullptr;
-			}
-            for (int i = 0; i < N_LEVELS; i++)
-            {
-                delete pixels_f[i][j];
-                pixels_f[i][j] = nullptr;
-            }
+		for (int i = 0; i < N_MAX_LEVELS; i++)
+		{
+			pixels_h[i][j] = nullptr;
+			pixels_f[i][j] = nullptr;
 		}
-
-		return true;
 	}
-	catch (const std::exception&)
-	{
-		std::cout << std::endl << "Error cleaning" << std::endl;
-		return false;
-	}
-
-	return false;
+	stored_levels = 0;
 }
 
 HDRE* HDRE::Get(const char* filename)
 {
 	auto it = s_loaded_hdres.find(filename);
 	if (it != s_loaded_hdres.end())
-		return it->second;
+	{
+		HDRE* hdre = it->second;
+		if (!hdre->isMapped() && !hdre->load(filename))
+			return nullptr;
+		return hdre;
+	}
 
 	HDRE* hdre = new HDRE();
 	if (!hdre->load(filename))
@@ -254,4 +221,12 @@ HDRE* HDRE::Get(const char* filename)
 
 	s_loaded_hdres[filename] = hdre;
 	return hdre;
-}
\ No newline at end of file
+}
+
+HDRE* HDRE::Find(const char* filename)
+{
+	auto it = s_loaded_hdres.find(filename);
+	if (it != s_loaded_hdres.end())
+		return it->second;
+	return nullptr;
+}
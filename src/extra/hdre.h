@@ -7,6 +7,8 @@
 #include <string>
 #include <map>
 
+#include "../utils/utils.h"
+
 typedef unsigned char byte;
 
 typedef struct {
@@ -50,13 +52,12 @@ class HDRE {
 private:
 
     std::string filename;
-	float* data; // only f32 now
+	sMappedFile file; // the faces point to the mapped file, nothing is copied
 
     float* pixels_f[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
     short* pixels_h[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
     byte* pixels_b[N_MAX_LEVELS][N_FACES]; // Xpos, Xneg, Ypos, Yneg, Zpos, Zneg
 
-	bool clean();
 	void init();
 
 public:
@@ -66,13 +67,18 @@ public:
 	int width;
 	int height;
     int levels = N_MAX_LEVELS;
+	int stored_levels = 0; // levels with pixels in the file (N_LEVELS at most)
+	bool half = false; // Uint16Array files store half floats, the faces are in pixels_h
+	int pending_levels = 0; // uploads of levels still queued that read the mapped file, it is unmapped when they are done
 
 	HDRE();
 	HDRE(const char* filename);
 	~HDRE();
 
-	bool load(const char* filename);
+	bool load(const char* filename); // maps the file, the pages are read when the faces are used
 	//bool load(void* data, int size);
+	void release(); // unmaps the file, the header (and the SH) is kept
+	bool isMapped() { return file.data != nullptr; }
 
 	// useful methods
 	float getMaxLuminance() { return this->header.maxLuminance; };
@@ -96,5 +102,6 @@ public:
 
 	//sHDRELevel getLevel(int level = 0);
 
-	static HDRE* Get(const char* filename);
+	static HDRE* Get(const char* filename); // maps it again if it was released
+	static HDRE* Find(const char* filename); // without loading it
 };
@@ -0,0 +1,781 @@
+#include "blockcompressor.h"
+
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include "../core/jobs.h"
+
+namespace GFX {
+
+#define BLOCK_MIN_ROWS_PER_JOB 4 //rows of blocks, smaller mips are encoded in one job
+
+//4x4 pixels of a mip, the ones outside repeat the border
+struct sBlockPixels
+{
+	float p[16][4];
+};
+
+unsigned int getBlockSize(eBlockFormat format)
+{
+	return format == BC1 ? 8 : 16;
+}
+
+const char* getBlockFormatName(eBlockFormat format)
+{
+	switch (format)
+	{
+		case BC1: return "BC1";
+		case BC3: return "BC3";
+		case BC5: return "BC5";
+		case BC7: return "BC7";
+	}
+	return "unknown";
+}
+
+static inline int clampByte(float v)
+{
+	return v < 0.0f ? 0 : (v > 255.0f ? 255 : (int)(v + 0.5f));
+}
+
+static void fetchBlock(const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int x0, unsigned int y0, sBlockPixels& block)
+{
+	for (int i = 0; i < 16; ++i)
+	{
+		unsigned int x = std::min(x0 + (i & 3), width - 1);
+		unsigned int y = std::min(y0 + (i >> 2), height - 1);
+		const unsigned char* pixel = rgba + (y * width + x) * 4;
+		for (int c = 0; c < 4; ++c)
+			block.p[i][c] = pixel[c];
+	}
+}
+
+//principal axis of the first num_channels channels by power iteration of the covariance matrix
+static void computePrincipalAxis(const sBlockPixels& block, int num_channels, float* mean, float* axis)
+{
+	float cov[4][4];
+	for (int c = 0; c < num_channels; ++c)
+	{
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; ++i)
+			mean[c] += block.p[i][c];
+		mean[c] /= 16.0f;
+	}
+	for (int a = 0; a < num_channels; ++a)
+		for (int b = a; b < num_channels; ++b)
+		{
+			float sum = 0.0f;
+			for (int i = 0; i < 16; ++i)
+				sum += (block.p[i][a] - mean[a]) * (block.p[i][b] - mean[b]);
+			cov[a][b] = cov[b][a] = sum;
+		}
+
+	//starts with the channel with more variance
+	int start = 0;
+	for (int c = 1; c < num_channels; ++c)
+		if (cov[c][c] > cov[start][start])
+			start = c;
+	for (int c = 0; c < num_channels; ++c)
+		axis[c] = cov[start][c];
+
+	for (int it = 0; it < 8; ++it)
+	{
+		float v[4];
+		float length = 0.0f;
+		for (int a = 0; a < num_channels; ++a)
+		{
+			v[a] = 0.0f;
+			for (int b = 0; b < num_channels; ++b)
+				v[a] += cov[a][b] * axis[b];
+			length = std::max(length, std::fabs(v[a]));
+		}
+		if (length < 1e-10f)
+			break;
+		for (int c = 0; c < num_channels; ++c)
+			axis[c] = v[c] / length;
+	}
+
+	float length = 0.0f;
+	for (int c = 0; c < num_channels; ++c)
+		length += axis[c] * axis[c];
+	if (length < 1e-10f)
+	{
+		//flat block
+		for (int c = 0; c < num_channels; ++c)
+			axis[c] = 1.0f;
+		length = (float)num_channels;
+	}
+	length = 1.0f / sqrtf(length);
+	for (int c = 0; c < num_channels; ++c)
+		axis[c] *= length;
+}
+
+//endpoints on the principal axis at the extremes of the pixels
+static void computeEndpoints(const sBlockPixels& block, int num_channels, float* e0, float* e1)
+{
+	float mean[4], axis[4];
+	computePrincipalAxis(block, num_channels, mean, axis);
+	float min_t = 3.4e+38F, max_t = -3.4e+38F;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < num_channels; ++c)
+			t += (block.p[i][c] - mean[c]) * axis[c];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+	for (int c = 0; c < num_channels; ++c)
+	{
+		e0[c] = mean[c] + axis[c] * max_t;
+		e1[c] = mean[c] + axis[c] * min_t;
+	}
+}
+
+//least squares endpoints for the current indices, every pixel is w * e0 + (1 - w) * e1, false if they are degenerated
+static bool refineEndpoints(const sBlockPixels& block, int num_channels, const float* weights, const unsigned char* indices, float* e0, float* e1)
+{
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		float w = weights[indices[i]];
+		aa += w * w;
+		bb += (1.0f - w) * (1.0f - w);
+		ab += w * (1.0f - w);
+		for (int c = 0; c < num_channels; ++c)
+		{
+			ax[c] += w * block.p[i][c];
+			bx[c] += (1.0f - w) * block.p[i][c];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (std::fabs(det) < 1e-6f)
+		return false;
+	det = 1.0f / det;
+	for (int c = 0; c < num_channels; ++c)
+	{
+		e0[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) * det));
+		e1[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) * det));
+	}
+	return true;
+}
+
+//BC1 *********************************
+
+static inline unsigned short packRGB565(const float* color)
+{
+	int r = clampByte(color[0] * 31.0f / 255.0f);
+	int g = clampByte(color[1] * 63.0f / 255.0f);
+	int b = clampByte(color[2] * 31.0f / 255.0f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static inline void unpackRGB565(unsigned short value, int* color)
+{
+	int r = (value >> 11) & 31;
+	int g = (value >> 5) & 63;
+	int b = value & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+//same integer math as the decoder, four colors mode (c0 > c1) or three colors and transparent black
+static void getBC1Palette(unsigned short c0, unsigned short c1, bool four_colors, int palette[4][4])
+{
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int c = 0; c < 3; ++c)
+	{
+		if (four_colors)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = four_colors ? 255 : 0;
+}
+
+//quantizes the endpoints and assigns the indices, returns the squared error
+static float encodeBC1Endpoints(const sBlockPixels& block, const float* e0, const float* e1, unsigned char* out, unsigned char* indices)
+{
+	unsigned short c0 = packRGB565(e0);
+	unsigned short c1 = packRGB565(e1);
+	//the four colors mode needs c0 > c1, the indices are assigned after the swap
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	int palette[4][4];
+	getBC1Palette(c0, c1, true, palette);
+	int num_colors = c0 == c1 ? 1 : 4;
+
+	float error = 0.0f;
+	unsigned int bits = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 0;
+		float best_error = 3.4e+38F;
+		for (int j = 0; j < num_colors; ++j)
+		{
+			float dr = block.p[i][0] - palette[j][0];
+			float dg = block.p[i][1] - palette[j][1];
+			float db = block.p[i][2] - palette[j][2];
+			float e = dr * dr + dg * dg + db * db;
+			if (e < best_error)
+			{
+				best_error = e;
+				best = j;
+			}
+		}
+		error += best_error;
+		indices[i] = (unsigned char)best;
+		bits |= best << (i * 2);
+	}
+
+	out[0] = c0 & 0xFF;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xFF;
+	out[3] = c1 >> 8;
+	for (int k = 0; k < 4; ++k)
+		out[4 + k] = (bits >> (k * 8)) & 0xFF;
+	return error;
+}
+
+static void encodeBC1Block(const sBlockPixels& block, unsigned char* out, int quality)
+{
+	//weight of c0 for every index
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+	float e0[4], e1[4];
+	computeEndpoints(block, 3, e0, e1);
+	unsigned char indices[16];
+	float error = encodeBC1Endpoints(block, e0, e1, out, indices);
+
+	int iterations = quality == BLOCK_QUALITY_FAST ? 0 : (quality == BLOCK_QUALITY_NORMAL ? 2 : 6);
+	for (int it = 0; it < iterations && error > 0.0f; ++it)
+	{
+		if (!refineEndpoints(block, 3, weights, indices, e0, e1))
+			break;
+		unsigned char candidate[8];
+		unsigned char candidate_indices[16];
+		float candidate_error = encodeBC1Endpoints(block, e0, e1, candidate, candidate_indices);
+		if (candidate_error >= error)
+			break;
+		error = candidate_error;
+		memcpy(out, candidate, 8);
+		memcpy(indices, candidate_indices, 16);
+	}
+}
+
+static void decodeBC1Block(const unsigned char* in, unsigned char* rgba, unsigned int pitch, bool force_four_colors)
+{
+	unsigned short c0 = in[0] | (in[1] << 8);
+	unsigned short c1 = in[2] | (in[3] << 8);
+	int palette[4][4];
+	getBC1Palette(c0, c1, force_four_colors || c0 > c1, palette);
+	unsigned int bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = (bits >> (i * 2)) & 3;
+		unsigned char* pixel = rgba + (i >> 2) * pitch + (i & 3) * 4;
+		for (int c = 0; c < 4; ++c)
+			pixel[c] = (unsigned char)palette[index][c];
+	}
+}
+
+//BC4 (one channel, used by BC3 for alpha and twice by BC5) *********************************
+
+static void getBC4Palette(int a0, int a1, int* palette)
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1)
+	{
+		for (int i = 2; i < 8; ++i)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	}
+	else
+	{
+		for (int i = 2; i < 6; ++i)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static float encodeBC4Endpoints(const float* values, int a0, int a1, unsigned char* out)
+{
+	int palette[8];
+	getBC4Palette(a0, a1, palette);
+	int num_values = a0 == a1 ? 1 : 8;
+
+	float error = 0.0f;
+	unsigned long long bits = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 0;
+		float best_error = 3.4e+38F;
+		for (int j = 0; j < num_values; ++j)
+		{
+			float d = values[i] - palette[j];
+			if (d * d < best_error)
+			{
+				best_error = d * d;
+				best = j;
+			}
+		}
+		error += best_error;
+		bits |= (unsigned long long)best << (i * 3);
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int k = 0; k < 6; ++k)
+		out[2 + k] = (bits >> (k * 8)) & 0xFF;
+	return error;
+}
+
+//eight values mode between the extremes, better qualities also try the endpoints around them
+static void encodeBC4Block(const float* values, unsigned char* out, int quality)
+{
+	float min = 255.0f, max = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		min = std::min(min, values[i]);
+		max = std::max(max, values[i]);
+	}
+	int a0 = clampByte(max);
+	int a1 = clampByte(min);
+	float error = encodeBC4Endpoints(values, a0, a1, out);
+	if (a0 == a1 || quality == BLOCK_QUALITY_FAST)
+		return;
+
+	int radius = quality == BLOCK_QUALITY_NORMAL ? 2 : 6;
+	unsigned char candidate[8];
+	for (int i0 = std::max(a1 + 1, a0 - radius); i0 <= a0; ++i0)
+		for (int i1 = a1; i1 <= std::min(i0 - 1, a1 + radius); ++i1)
+		{
+			if (i0 == a0 && i1 == a1)
+				continue;
+			float candidate_error = encodeBC4Endpoints(values, i0, i1, candidate);
+			if (candidate_error < error)
+			{
+				error = candidate_error;
+				memcpy(out, candidate, 8);
+			}
+		}
+}
+
+static void decodeBC4Block(const unsigned char* in, unsigned char* rgba, unsigned int pitch, int channel)
+{
+	int palette[8];
+	getBC4Palette(in[0], in[1], palette);
+	unsigned long long bits = 0;
+	for (int k = 0; k < 6; ++k)
+		bits |= (unsigned long long)in[2 + k] << (k * 8);
+	for (int i = 0; i < 16; ++i)
+		rgba[(i >> 2) * pitch + (i & 3) * 4 + channel] = (unsigned char)palette[(bits >> (i * 3)) & 7];
+}
+
+//BC7 mode 6: one subset, RGBA 7 bits endpoints with a shared bit each and 4 bits indices *********************************
+
+static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+//bits are written and read from the lowest one of the first byte
+struct sBitStream
+{
+	unsigned char* data;
+	int position;
+
+	sBitStream(unsigned char* data) { this->data = data; position = 0; }
+
+	void write(unsigned int value, int num_bits)
+	{
+		for (int i = 0; i < num_bits; ++i, ++position)
+			if (value & (1 << i))
+				data[position >> 3] |= 1 << (position & 7);
+	}
+
+	unsigned int read(int num_bits)
+	{
+		unsigned int value = 0;
+		for (int i = 0; i < num_bits; ++i, ++position)
+			value |= ((data[position >> 3] >> (position & 7)) & 1) << i;
+		return value;
+	}
+};
+
+static inline int quantizeBC7(float value, int p_bit)
+{
+	int q = (int)floorf((value - p_bit) / 2.0f + 0.5f);
+	return std::min(127, std::max(0, q));
+}
+
+//endpoints with their p bits, returns the squared error
+static float encodeBC7Endpoints(const sBlockPixels& block, const float* e0, const float* e1, int p0, int p1, int q[2][4], unsigned char* indices)
+{
+	int endpoints[2][4];
+	for (int c = 0; c < 4; ++c)
+	{
+		q[0][c] = quantizeBC7(e0[c], p0);
+		q[1][c] = quantizeBC7(e1[c], p1);
+		endpoints[0][c] = (q[0][c] << 1) | p0;
+		endpoints[1][c] = (q[1][c] << 1) | p1;
+	}
+
+	int palette[16][4];
+	for (int j = 0; j < 16; ++j)
+		for (int c = 0; c < 4; ++c)
+			palette[j][c] = ((64 - bc7_weights[j]) * endpoints[0][c] + bc7_weights[j] * endpoints[1][c] + 32) >> 6;
+
+	float error = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 0;
+		float best_error = 3.4e+38F;
+		for (int j = 0; j < 16; ++j)
+		{
+			float e = 0.0f;
+			for (int c = 0; c < 4; ++c)
+			{
+				float d = block.p[i][c] - palette[j][c];
+				e += d * d;
+			}
+			if (e < best_error)
+			{
+				best_error = e;
+				best = j;
+			}
+		}
+		error += best_error;
+		indices[i] = (unsigned char)best;
+	}
+	return error;
+}
+
+//the p bits that fit better, all the combinations in the best quality, opaque blocks keep alpha 255 with both to 1
+static float encodeBC7Candidate(const sBlockPixels& block, const float* e0, const float* e1, bool opaque, int quality, int q[2][4], int* p, unsigned char* indices)
+{
+	float best_error = 3.4e+38F;
+	for (int p0 = opaque ? 1 : 0; p0 < 2; ++p0)
+		for (int p1 = opaque ? 1 : 0; p1 < 2; ++p1)
+		{
+			if (quality != BLOCK_QUALITY_BEST && p0 != p1)
+				continue;
+			int candidate_q[2][4];
+			unsigned char candidate_indices[16];
+			float error = encodeBC7Endpoints(block, e0, e1, p0, p1, candidate_q, candidate_indices);
+			if (error >= best_error)
+				continue;
+			best_error = error;
+			memcpy(q, candidate_q, sizeof(candidate_q));
+			memcpy(indices, candidate_indices, 16);
+			p[0] = p0;
+			p[1] = p1;
+		}
+	return best_error;
+}
+
+static void encodeBC7Block(const sBlockPixels& block, unsigned char* out, int quality, bool opaque)
+{
+	//weight of e0 for every index
+	float weights[16];
+	for (int j = 0; j < 16; ++j)
+		weights[j] = (64 - bc7_weights[j]) / 64.0f;
+
+	float e0[4], e1[4];
+	computeEndpoints(block, 4, e0, e1);
+	int q[2][4], p[2];
+	unsigned char indices[16];
+	float error = encodeBC7Candidate(block, e0, e1, opaque, quality, q, p, indices);
+
+	int iterations = quality == BLOCK_QUALITY_FAST ? 0 : (quality == BLOCK_QUALITY_NORMAL ? 2 : 6);
+	for (int it = 0; it < iterations && error > 0.0f; ++it)
+	{
+		if (!refineEndpoints(block, 4, weights, indices, e0, e1))
+			break;
+		int candidate_q[2][4], candidate_p[2];
+		unsigned char candidate_indices[16];
+		float candidate_error = encodeBC7Candidate(block, e0, e1, opaque, quality, candidate_q, candidate_p, candidate_indices);
+		if (candidate_error >= error)
+			break;
+		error = candidate_error;
+		memcpy(q, candidate_q, sizeof(q));
+		memcpy(p, candidate_p, sizeof(p));
+		memcpy(indices, candidate_indices, 16);
+	}
+
+	//the first index is stored with 3 bits, its highest one must be 0
+	if (indices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(q[0][c], q[1][c]);
+		std::swap(p[0], p[1]);
+		for (int i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(out, 0, 16);
+	sBitStream stream(out);
+	stream.write(1 << 6, 7); //mode 6
+	for (int c = 0; c < 4; ++c)
+	{
+		stream.write(q[0][c], 7);
+		stream.write(q[1][c], 7);
+	}
+	stream.write(p[0], 1);
+	stream.write(p[1], 1);
+	stream.write(indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+		stream.write(indices[i], 4);
+}
+
+static bool decodeBC7Block(const unsigned char* in, unsigned char* rgba, unsigned int pitch)
+{
+	sBitStream stream((unsigned char*)in);
+	if (stream.read(7) != 1 << 6)
+	{
+		//other modes are not written by the encoder, magenta like a missing texture
+		for (int i = 0; i < 16; ++i)
+		{
+			unsigned char* pixel = rgba + (i >> 2) * pitch + (i & 3) * 4;
+			pixel[0] = pixel[2] = pixel[3] = 255;
+			pixel[1] = 0;
+		}
+		return false;
+	}
+
+	int endpoints[2][4];
+	for (int c = 0; c < 4; ++c)
+	{
+		endpoints[0][c] = stream.read(7) << 1;
+		endpoints[1][c] = stream.read(7) << 1;
+	}
+	int p0 = stream.read(1);
+	int p1 = stream.read(1);
+	for (int c = 0; c < 4; ++c)
+	{
+		endpoints[0][c] |= p0;
+		endpoints[1][c] |= p1;
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		int w = bc7_weights[stream.read(i ? 4 : 3)];
+		unsigned char* pixel = rgba + (i >> 2) * pitch + (i & 3) * 4;
+		for (int c = 0; c < 4; ++c)
+			pixel[c] = (unsigned char)(((64 - w) * endpoints[0][c] + w * endpoints[1][c] + 32) >> 6);
+	}
+	return true;
+}
+
+//mips *********************************
+
+static void encodeMip(const unsigned char* rgba, unsigned int width, unsigned int height, eBlockFormat format, int quality, bool opaque, sCompressedMip& mip)
+{
+	unsigned int blocks_x = (width + 3) / 4;
+	unsigned int blocks_y = (height + 3) / 4;
+	unsigned int block_size = getBlockSize(format);
+	mip.width = width;
+	mip.height = height;
+	mip.data.resize(blocks_x * blocks_y * block_size);
+
+	JobSystem::parallelFor(blocks_y, BLOCK_MIN_ROWS_PER_JOB, [&](unsigned int start, unsigned int end) {
+		sBlockPixels block;
+		float values[16];
+		for (unsigned int by = start; by < end; ++by)
+			for (unsigned int bx = 0; bx < blocks_x; ++bx)
+			{
+				unsigned char* out = &mip.data[(by * blocks_x + bx) * block_size];
+				fetchBlock(rgba, width, height, bx * 4, by * 4, block);
+				switch (format)
+				{
+					case BC1:
+						encodeBC1Block(block, out, quality);
+						break;
+					case BC3:
+						for (int i = 0; i < 16; ++i)
+							values[i] = block.p[i][3];
+						encodeBC4Block(values, out, quality);
+						encodeBC1Block(block, out + 8, quality);
+						break;
+					case BC5:
+						for (int c = 0; c < 2; ++c)
+						{
+							for (int i = 0; i < 16; ++i)
+								values[i] = block.p[i][c];
+							encodeBC4Block(values, out + c * 8, quality);
+						}
+						break;
+					case BC7:
+						encodeBC7Block(block, out, quality, opaque);
+						break;
+				}
+			}
+	});
+}
+
+void compressImage(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int num_channels, eBlockFormat format, sCompressedMip& mip, int quality)
+{
+	mip.width = mip.height = 0;
+	mip.data.clear();
+	if (!width || !height || !num_channels || num_channels > 4)
+		return;
+
+	//to RGBA
+	std::vector<unsigned char> rgba(width * height * 4);
+	bool opaque = true;
+	for (unsigned int i = 0; i < width * height; ++i)
+		for (unsigned int c = 0; c < 4; ++c)
+		{
+			rgba[i * 4 + c] = c < num_channels ? pixels[i * num_channels + c] : (c == 3 ? 255 : 0);
+			if (c == 3 && rgba[i * 4 + c] != 255)
+				opaque = false;
+		}
+
+	encodeMip(&rgba[0], width, height, format, quality, opaque, mip);
+}
+
+bool decompressImage(const sCompressedMip& mip, eBlockFormat format, std::vector<unsigned char>& rgba)
+{
+	unsigned int blocks_x = (mip.width + 3) / 4;
+	unsigned int blocks_y = (mip.height + 3) / 4;
+	unsigned int block_size = getBlockSize(format);
+	if (mip.data.size() < blocks_x * blocks_y * block_size)
+		return false;
+
+	//whole blocks first, the padding is cropped at the end
+	unsigned int pitch = blocks_x * 16;
+	std::vector<unsigned char> blocks(pitch * blocks_y * 4);
+	bool supported = true;
+	for (unsigned int by = 0; by < blocks_y; ++by)
+		for (unsigned int bx = 0; bx < blocks_x; ++bx)
+		{
+			const unsigned char* in = &mip.data[(by * blocks_x + bx) * block_size];
+			unsigned char* out = &blocks[by * 4 * pitch + bx * 16];
+			switch (format)
+			{
+				case BC1:
+					decodeBC1Block(in, out, pitch, false);
+					break;
+				case BC3:
+					decodeBC1Block(in + 8, out, pitch, true);
+					decodeBC4Block(in, out, pitch, 3);
+					break;
+				case BC5:
+					for (int i = 0; i < 16; ++i)
+					{
+						out[(i >> 2) * pitch + (i & 3) * 4 + 2] = 0;
+						out[(i >> 2) * pitch + (i & 3) * 4 + 3] = 255;
+					}
+					decodeBC4Block(in, out, pitch, 0);
+					decodeBC4Block(in + 8, out, pitch, 1);
+					break;
+				case BC7:
+					supported = decodeBC7Block(in, out, pitch) && supported;
+					break;
+			}
+		}
+
+	rgba.resize(mip.width * mip.height * 4);
+	for (unsigned int y = 0; y < mip.height; ++y)
+		memcpy(&rgba[y * mip.width * 4], &blocks[y * pitch], mip.width * 4);
+	return supported;
+}
+
+float computePSNR(const unsigned char* original, unsigned int original_channels, const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int num_channels)
+{
+	double error = 0.0;
+	for (unsigned int i = 0; i < width * height; ++i)
+		for (unsigned int c = 0; c < num_channels; ++c)
+		{
+			int value = c < original_channels ? original[i * original_channels + c] : (c == 3 ? 255 : 0);
+			double d = value - rgba[i * 4 + c];
+			error += d * d;
+		}
+	double mse = error / (width * height * num_channels);
+	if (mse <= 0.0)
+		return 99.0f; //identical
+	return (float)(10.0 * log10(255.0 * 255.0 / mse));
+}
+
+//KTX *********************************
+
+bool writeKTX(const char* filename, eBlockFormat format, const std::vector<sCompressedMip>& mips, const char* key, const char* value)
+{
+	static const unsigned char identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+	//GL enums of the internal and base formats
+	unsigned int internal_format = 0, base_format = 0;
+	switch (format)
+	{
+		case BC1: internal_format = 0x83F0; base_format = 0x1907; break; //GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_RGB
+		case BC3: internal_format = 0x83F3; base_format = 0x1908; break; //GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_RGBA
+		case BC5: internal_format = 0x8DBD; base_format = 0x8227; break; //GL_COMPRESSED_RG_RGTC2, GL_RG
+		case BC7: internal_format = 0x8E8C; base_format = 0x1908; break; //GL_COMPRESSED_RGBA_BPTC_UNORM, GL_RGBA
+	}
+
+	if (!mips.size())
+		return false;
+
+	//keyAndValueByteSize, key\0value\0 and the padding to 4 bytes
+	std::vector<unsigned char> key_value;
+	if (key && value)
+	{
+		unsigned int size = (unsigned int)(strlen(key) + strlen(value) + 2);
+		key_value.resize(4 + ((size + 3) & ~3u), 0);
+		memcpy(&key_value[0], &size, 4);
+		memcpy(&key_value[4], key, strlen(key));
+		memcpy(&key_value[4 + strlen(key) + 1], value, strlen(value));
+	}
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR]: KTX file cannot be written: " << filename << std::endl;
+		return false;
+	}
+
+	unsigned int header[13] = {
+		0x04030201, //endianness
+		0, //glType, compressed
+		1, //glTypeSize
+		0, //glFormat, compressed
+		internal_format,
+		base_format,
+		mips[0].width,
+		mips[0].height,
+		0, //depth
+		0, //array elements
+		1, //faces
+		(unsigned int)mips.size(),
+		(unsigned int)key_value.size()
+	};
+	bool ok = fwrite(identifier, sizeof(identifier), 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1;
+	if (ok && key_value.size())
+		ok = fwrite(&key_value[0], key_value.size(), 1, file) == 1;
+	//block sizes are multiples of 4 so there is no padding between mips
+	for (size_t i = 0; ok && i < mips.size(); ++i)
+	{
+		unsigned int size = (unsigned int)mips[i].data.size();
+		ok = fwrite(&size, sizeof(size), 1, file) == 1 && fwrite(&mips[i].data[0], size, 1, file) == 1;
+	}
+	fclose(file);
+
+	if (!ok)
+	{
+		std::cout << "[ERROR]: KTX file cannot be written: " << filename << std::endl;
+		remove(filename);
+	}
+	return ok;
+}
+
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+//CPU encoder for the block compressed formats of the GPU (4x4 pixels per block), used to cook the textures to KTX files
+//BC1: RGB 4 bits per pixel, BC3: BC1 + alpha 8 bpp, BC5: two channels 8 bpp (normal maps), BC7: RGBA 8 bpp (only mode 6)
+//The rows of blocks are encoded in parallel in the JobSystem
+
+namespace GFX {
+
+	enum eBlockFormat {
+		BC1,
+		BC3,
+		BC5,
+		BC7
+	};
+
+	#define BLOCK_QUALITY_FAST 0 //endpoints from the principal axis, no refinement
+	#define BLOCK_QUALITY_NORMAL 1 //a couple of least squares refinements of the endpoints
+	#define BLOCK_QUALITY_BEST 2 //more refinements and wider searches, color textures use BC7
+
+	#define BLOCK_COOKER_VERSION 1 //increase it when the encoders change so the cooked files are encoded again
+
+	struct sCompressedMip
+	{
+		unsigned int width;
+		unsigned int height;
+		std::vector<unsigned char> data;
+	};
+
+	unsigned int getBlockSize(eBlockFormat format); //bytes per block
+	const char* getBlockFormatName(eBlockFormat format);
+
+	//one level of the mip chain (they are built with the image, see Image::downsample), pixels have 1 to 4 channels (missing ones are 0 and alpha 255)
+	//normal maps (BC5) keep x and y in red and green
+	void compressImage(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int num_channels, eBlockFormat format, sCompressedMip& mip, int quality = BLOCK_QUALITY_NORMAL);
+
+	//to RGBA, false if a block uses a mode that is not decoded (BC7 modes other than 6, the ones written by compressImage)
+	bool decompressImage(const sCompressedMip& mip, eBlockFormat format, std::vector<unsigned char>& rgba);
+
+	//peak signal to noise ratio in dB of the first num_channels channels, original with its own number of channels and decoded RGBA
+	float computePSNR(const unsigned char* original, unsigned int original_channels, const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int num_channels);
+
+	//KTX 1.1 file with all the mips, the metadata is stored as key value pairs (key and value are strings)
+	bool writeKTX(const char* filename, eBlockFormat format, const std::vector<sCompressedMip>& mips, const char* key = NULL, const char* value = NULL);
+};
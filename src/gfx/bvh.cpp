@@ -0,0 +1,587 @@
+#include "bvh.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+#ifdef BVH_USE_SSE
+	#include <emmintrin.h>
+#endif
+
+namespace GFX {
+
+#define BVH_TRAVERSAL_COST 1.0f //cost of testing a node relative to a packet
+#define BVH_MIN_DET 1e-20f //smaller determinants are parallel to the ray (or degenerate lanes)
+
+//the Vector3f methods are not inlined, these are in the inner loops
+static inline float dot3(const Vector3f& a, const Vector3f& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline Vector3f cross3(const Vector3f& a, const Vector3f& b) { return Vector3f(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+static inline void growBox(Vector3f& min, Vector3f& max, const Vector3f& box_min, const Vector3f& box_max)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		min.v[k] = std::min(min.v[k], box_min.v[k]);
+		max.v[k] = std::max(max.v[k], box_max.v[k]);
+	}
+}
+
+static inline float halfArea(const Vector3f& min, const Vector3f& max)
+{
+	Vector3f size = max - min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static inline float numPackets(uint32 num_triangles)
+{
+	return (float)((num_triangles + BVH_PACKET_SIZE - 1) / BVH_PACKET_SIZE);
+}
+
+//build data of a triangle, they are moved (not their indices) when splitting so the passes over a range read memory in order
+struct sBuildTriangle
+{
+	Vector3f min;
+	Vector3f max;
+	Vector3f centroid;
+	unsigned int id;
+};
+
+struct sBVHBuilder
+{
+	const unsigned char* positions;
+	unsigned int stride;
+	const unsigned int* indices;
+	std::vector<sBuildTriangle> triangles; //every leaf is a range
+	TriangleBVH* bvh;
+
+	const Vector3f& getVertex(unsigned int triangle, int corner)
+	{
+		unsigned int i = triangle * 3 + corner;
+		return *(const Vector3f*)(positions + (size_t)(indices ? indices[i] : i) * stride);
+	}
+
+	void subdivide(uint32 node_index, uint32 start, uint32 count, int depth);
+	void makeLeaf(uint32 node_index, uint32 start, uint32 count);
+};
+
+void sBVHBuilder::makeLeaf(uint32 node_index, uint32 start, uint32 count)
+{
+	sBVHNode& node = bvh->nodes[node_index];
+	node.first = (uint32)bvh->packets.size();
+	node.count = count;
+
+	for (uint32 i = 0; i < count; i += BVH_PACKET_SIZE)
+	{
+		sBVHPacket packet;
+		memset(&packet, 0, sizeof(packet));
+		for (uint32 lane = 0; lane < BVH_PACKET_SIZE && i + lane < count; ++lane)
+		{
+			unsigned int triangle = triangles[start + i + lane].id;
+			const Vector3f& v0 = getVertex(triangle, 0);
+			Vector3f e1 = getVertex(triangle, 1) - v0;
+			Vector3f e2 = getVertex(triangle, 2) - v0;
+			for (int k = 0; k < 3; ++k)
+			{
+				packet.v0[k][lane] = v0.v[k];
+				packet.e1[k][lane] = e1.v[k];
+				packet.e2[k][lane] = e2.v[k];
+			}
+		}
+		bvh->packets.push_back(packet);
+	}
+}
+
+void sBVHBuilder::subdivide(uint32 node_index, uint32 start, uint32 count, int depth)
+{
+	Vector3f min(3.4e+38F), max(-3.4e+38F), cmin(3.4e+38F), cmax(-3.4e+38F);
+	for (uint32 i = start; i < start + count; ++i)
+	{
+		const sBuildTriangle& triangle = triangles[i];
+		growBox(min, max, triangle.min, triangle.max);
+		growBox(cmin, cmax, triangle.centroid, triangle.centroid);
+	}
+	sBVHNode& node = bvh->nodes[node_index];
+	node.min = min;
+	node.max = max;
+
+	if (count <= BVH_PACKET_SIZE)
+	{
+		makeLeaf(node_index, start, count);
+		return;
+	}
+
+	//binned SAH: the cost of a split is the area of every side times its packets
+	int best_axis = -1;
+	int best_bin = 0;
+	float best_cost = 3.4e+38F;
+	if (depth < BVH_MAX_DEPTH / 2)
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float extent = cmax.v[axis] - cmin.v[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			uint32 bin_count[BVH_NUM_BINS] = { 0 };
+			Vector3f bin_min[BVH_NUM_BINS], bin_max[BVH_NUM_BINS];
+			for (int b = 0; b < BVH_NUM_BINS; ++b)
+			{
+				bin_min[b].set(3.4e+38F, 3.4e+38F, 3.4e+38F);
+				bin_max[b].set(-3.4e+38F, -3.4e+38F, -3.4e+38F);
+			}
+
+			float scale = BVH_NUM_BINS / extent;
+			for (uint32 i = start; i < start + count; ++i)
+			{
+				const sBuildTriangle& triangle = triangles[i];
+				int b = std::min(BVH_NUM_BINS - 1, (int)((triangle.centroid.v[axis] - cmin.v[axis]) * scale));
+				bin_count[b]++;
+				growBox(bin_min[b], bin_max[b], triangle.min, triangle.max);
+			}
+
+			//right side costs from the end, then the left side is accumulated while testing the splits
+			float right_cost[BVH_NUM_BINS];
+			uint32 right_count[BVH_NUM_BINS];
+			Vector3f side_min(3.4e+38F), side_max(-3.4e+38F);
+			uint32 num = 0;
+			for (int b = BVH_NUM_BINS - 1; b > 0; --b)
+			{
+				num += bin_count[b];
+				if (bin_count[b])
+					growBox(side_min, side_max, bin_min[b], bin_max[b]);
+				right_count[b] = num;
+				right_cost[b] = num ? halfArea(side_min, side_max) * numPackets(num) : 0.0f;
+			}
+
+			side_min.set(3.4e+38F, 3.4e+38F, 3.4e+38F);
+			side_max.set(-3.4e+38F, -3.4e+38F, -3.4e+38F);
+			num = 0;
+			for (int b = 0; b < BVH_NUM_BINS - 1; ++b) //split between b and b + 1
+			{
+				num += bin_count[b];
+				if (bin_count[b])
+					growBox(side_min, side_max, bin_min[b], bin_max[b]);
+				if (!num || !right_count[b + 1])
+					continue;
+				float cost = halfArea(side_min, side_max) * numPackets(num) + right_cost[b + 1];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
+		}
+
+	//small ranges stay together when testing all their packets is cheaper than traversing a split
+	float area = halfArea(min, max);
+	if (count <= BVH_MAX_LEAF_SIZE && (best_axis == -1 || area * numPackets(count) <= area * BVH_TRAVERSAL_COST + best_cost))
+	{
+		makeLeaf(node_index, start, count);
+		return;
+	}
+
+	uint32 left_count = 0;
+	if (best_axis != -1)
+	{
+		float cmin_axis = cmin.v[best_axis];
+		float scale = BVH_NUM_BINS / (cmax.v[best_axis] - cmin_axis);
+		sBuildTriangle* middle = std::partition(&triangles[start], &triangles[start] + count, [&](const sBuildTriangle& triangle) {
+			return std::min(BVH_NUM_BINS - 1, (int)((triangle.centroid.v[best_axis] - cmin_axis) * scale)) <= best_bin;
+		});
+		left_count = (uint32)(middle - &triangles[start]);
+	}
+
+	//too deep or all the centroids in the same bin, halves at the median of the longest axis
+	if (left_count == 0 || left_count == count)
+	{
+		Vector3f extent = cmax - cmin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		left_count = count / 2;
+		std::nth_element(&triangles[start], &triangles[start] + left_count, &triangles[start] + count, [&](const sBuildTriangle& a, const sBuildTriangle& b) {
+			return a.centroid.v[axis] < b.centroid.v[axis];
+		});
+	}
+
+	//both children together, node can be invalidated by the push_back
+	uint32 first = (uint32)bvh->nodes.size();
+	bvh->nodes[node_index].first = first;
+	bvh->nodes[node_index].count = 0;
+	sBVHNode empty;
+	empty.first = empty.count = 0;
+	bvh->nodes.push_back(empty);
+	bvh->nodes.push_back(empty);
+	subdivide(first, start, left_count, depth + 1);
+	subdivide(first + 1, start + left_count, count - left_count, depth + 1);
+}
+
+void TriangleBVH::build(const unsigned char* positions, unsigned int stride, unsigned int num_vertices, const unsigned int* indices, unsigned int num_indices)
+{
+	clear();
+	unsigned int num_triangles = (indices ? num_indices : num_vertices) / 3;
+	if (!num_triangles)
+		return;
+
+	sBVHBuilder builder;
+	builder.positions = positions;
+	builder.stride = stride;
+	builder.indices = indices;
+	builder.bvh = this;
+	builder.triangles.resize(num_triangles);
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		sBuildTriangle& triangle = builder.triangles[i];
+		triangle.min = triangle.max = builder.getVertex(i, 0);
+		growBox(triangle.min, triangle.max, builder.getVertex(i, 1), builder.getVertex(i, 1));
+		growBox(triangle.min, triangle.max, builder.getVertex(i, 2), builder.getVertex(i, 2));
+		triangle.centroid = (triangle.min + triangle.max) * 0.5f;
+		triangle.id = i;
+	}
+
+	nodes.reserve(num_triangles / 2 + 1);
+	packets.reserve(num_triangles / 3 + 1);
+	sBVHNode root;
+	root.first = root.count = 0;
+	nodes.push_back(root);
+	builder.subdivide(0, 0, num_triangles, 0);
+	nodes.shrink_to_fit();
+	packets.shrink_to_fit();
+}
+
+void TriangleBVH::clear()
+{
+	nodes.clear();
+	nodes.shrink_to_fit();
+	packets.clear();
+	packets.shrink_to_fit();
+}
+
+void TriangleBVH::getTriangle(unsigned int packet_index, int lane, Vector3f* triangle)
+{
+	const sBVHPacket& packet = packets[packet_index];
+	triangle[0].set(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+	triangle[1].set(triangle[0].x + packet.e1[0][lane], triangle[0].y + packet.e1[1][lane], triangle[0].z + packet.e1[2][lane]);
+	triangle[2].set(triangle[0].x + packet.e2[0][lane], triangle[0].y + packet.e2[1][lane], triangle[0].z + packet.e2[2][lane]);
+}
+
+#ifdef BVH_USE_SSE
+
+//slab test, returns the entry distance or a negative value if the ray misses the box (or enters it after max_t)
+static inline float rayBox(const sBVHNode& node, __m128 origin, __m128 inv_dir, float max_t)
+{
+	//the fourth lane reads first/count, it is garbage but it is never used
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.min.x), origin), inv_dir);
+	__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.max.x), origin), inv_dir);
+	__m128 near4 = _mm_min_ps(t1, t2);
+	__m128 far4 = _mm_max_ps(t1, t2);
+	__m128 t_near = _mm_max_ss(_mm_max_ss(near4, _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(2, 2, 2, 2)));
+	__m128 t_far = _mm_min_ss(_mm_min_ss(far4, _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(1, 1, 1, 1))), _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(2, 2, 2, 2)));
+	t_near = _mm_max_ss(t_near, _mm_setzero_ps());
+	t_far = _mm_min_ss(t_far, _mm_set_ss(max_t));
+	float tn = _mm_cvtss_f32(t_near);
+	return tn <= _mm_cvtss_f32(t_far) ? tn : -1.0f;
+}
+
+//Moller-Trumbore with the 4 triangles of the packet at once, returns the lane of the closest hit before max_t or -1
+static inline int rayPacket(const sBVHPacket& packet, const Vector3f& origin, const Vector3f& dir, float max_t, float& t)
+{
+	__m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+	__m128 e1x = _mm_loadu_ps(packet.e1[0]), e1y = _mm_loadu_ps(packet.e1[1]), e1z = _mm_loadu_ps(packet.e1[2]);
+	__m128 e2x = _mm_loadu_ps(packet.e2[0]), e2y = _mm_loadu_ps(packet.e2[1]), e2z = _mm_loadu_ps(packet.e2[2]);
+
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.v0[0]));
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.v0[1]));
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.v0[2]));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+	__m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 mask = _mm_cmpgt_ps(abs_det, _mm_set1_ps(BVH_MIN_DET));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(dist, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(dist, _mm_set1_ps(max_t)));
+	int hits = _mm_movemask_ps(mask);
+	if (!hits)
+		return -1;
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, dist);
+	int best = -1;
+	for (int i = 0; i < 4; ++i)
+		if ((hits & (1 << i)) && (best == -1 || lanes[i] < t))
+		{
+			t = lanes[i];
+			best = i;
+		}
+	return best;
+}
+
+#else
+
+static inline float rayBox(const sBVHNode& node, const Vector3f& origin, const Vector3f& inv_dir, float max_t)
+{
+	float t_near = 0.0f;
+	float t_far = max_t;
+	for (int k = 0; k < 3; ++k)
+	{
+		float t1 = (node.min.v[k] - origin.v[k]) * inv_dir.v[k];
+		float t2 = (node.max.v[k] - origin.v[k]) * inv_dir.v[k];
+		t_near = std::max(t_near, std::min(t1, t2));
+		t_far = std::min(t_far, std::max(t1, t2));
+	}
+	return t_near <= t_far ? t_near : -1.0f;
+}
+
+static inline int rayPacket(const sBVHPacket& packet, const Vector3f& origin, const Vector3f& dir, float max_t, float& t)
+{
+	int best = -1;
+	for (int i = 0; i < 4; ++i)
+	{
+		Vector3f e1(packet.e1[0][i], packet.e1[1][i], packet.e1[2][i]);
+		Vector3f e2(packet.e2[0][i], packet.e2[1][i], packet.e2[2][i]);
+		Vector3f p = cross3(dir, e2);
+		float det = dot3(e1, p);
+		if (std::fabs(det) <= BVH_MIN_DET)
+			continue;
+		float inv_det = 1.0f / det;
+		Vector3f s = origin - Vector3f(packet.v0[0][i], packet.v0[1][i], packet.v0[2][i]);
+		float u = dot3(s, p) * inv_det;
+		if (u < 0.0f || u > 1.0f)
+			continue;
+		Vector3f q = cross3(s, e1);
+		float v = dot3(dir, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f)
+			continue;
+		float dist = dot3(e2, q) * inv_det;
+		if (dist < 0.0f || dist > max_t)
+			continue;
+		max_t = t = dist;
+		best = i;
+	}
+	return best;
+}
+
+#endif
+
+bool TriangleBVH::testRay(const Vector3f& origin, const Vector3f& direction, float max_t, float& t, Vector3f* triangle)
+{
+	if (nodes.empty())
+		return false;
+
+	//axis aligned rays would divide by zero
+	Vector3f inv_dir;
+	for (int k = 0; k < 3; ++k)
+		inv_dir.v[k] = 1.0f / (std::fabs(direction.v[k]) > 1e-20f ? direction.v[k] : (direction.v[k] < 0.0f ? -1e-20f : 1e-20f));
+
+#ifdef BVH_USE_SSE
+	__m128 ray_origin = _mm_set_ps(0.0f, origin.z, origin.y, origin.x);
+	__m128 ray_inv_dir = _mm_set_ps(0.0f, inv_dir.z, inv_dir.y, inv_dir.x);
+#else
+	const Vector3f& ray_origin = origin;
+	const Vector3f& ray_inv_dir = inv_dir;
+#endif
+
+	float best_t = max_t;
+	uint32 best_packet = 0;
+	int best_lane = -1;
+
+	if (rayBox(nodes[0], ray_origin, ray_inv_dir, best_t) < 0.0f)
+		return false;
+
+	//far children wait in the stack with their entry distance
+	uint32 stack[BVH_MAX_DEPTH];
+	float stack_t[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	uint32 current = 0;
+	while (true)
+	{
+		const sBVHNode& node = nodes[current];
+		if (node.count)
+		{
+			uint32 end = node.first + (node.count + BVH_PACKET_SIZE - 1) / BVH_PACKET_SIZE;
+			for (uint32 i = node.first; i < end; ++i)
+			{
+				float hit_t;
+				int lane = rayPacket(packets[i], origin, direction, best_t, hit_t);
+				if (lane == -1)
+					continue;
+				best_t = hit_t;
+				best_packet = i;
+				best_lane = lane;
+			}
+		}
+		else
+		{
+			float t0 = rayBox(nodes[node.first], ray_origin, ray_inv_dir, best_t);
+			float t1 = rayBox(nodes[node.first + 1], ray_origin, ray_inv_dir, best_t);
+			if (t0 >= 0.0f && t1 >= 0.0f)
+			{
+				bool first_near = t0 <= t1;
+				assert(stack_size < BVH_MAX_DEPTH);
+				stack[stack_size] = first_near ? node.first + 1 : node.first;
+				stack_t[stack_size++] = first_near ? t1 : t0;
+				current = first_near ? node.first : node.first + 1;
+				continue;
+			}
+			if (t0 >= 0.0f || t1 >= 0.0f)
+			{
+				current = t0 >= 0.0f ? node.first : node.first + 1;
+				continue;
+			}
+		}
+
+		//next waiting node that is not behind the closest hit
+		while (stack_size && stack_t[stack_size - 1] > best_t)
+			stack_size--;
+		if (!stack_size)
+			break;
+		current = stack[--stack_size];
+	}
+
+	if (best_lane == -1)
+		return false;
+	t = best_t;
+	if (triangle)
+		getTriangle(best_packet, best_lane, triangle);
+	return true;
+}
+
+//from Real-Time Collision Detection (Ericson), 5.1.5
+Vector3f closestPointInTriangle(const Vector3f& p, const Vector3f& a, const Vector3f& b, const Vector3f& c)
+{
+	Vector3f ab = b - a;
+	Vector3f ac = c - a;
+	Vector3f ap = p - a;
+	float d1 = dot3(ab, ap);
+	float d2 = dot3(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	Vector3f bp = p - b;
+	float d3 = dot3(ab, bp);
+	float d4 = dot3(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	Vector3f cp = p - c;
+	float d5 = dot3(ab, cp);
+	float d6 = dot3(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+//squared distance from the point to the box
+static inline float boxDistance2(const sBVHNode& node, const Vector3f& p)
+{
+	float dist2 = 0.0f;
+	for (int k = 0; k < 3; ++k)
+	{
+		float d = std::max(std::max(node.min.v[k] - p.v[k], p.v[k] - node.max.v[k]), 0.0f);
+		dist2 += d * d;
+	}
+	return dist2;
+}
+
+bool TriangleBVH::testSphere(const Vector3f& center, float radius, Vector3f& collision, Vector3f* triangle, const Matrix44* model)
+{
+	if (nodes.empty())
+		return false;
+
+	//the nodes are tested with the bounding sphere of the sphere in object space, the triangles in world space
+	Vector3f local_center = center;
+	float local_scale = 1.0f; //world to object distances (the largest)
+	if (model)
+	{
+		Matrix44 inv = *model;
+		inv.inverse();
+		local_center = inv * center;
+		Vector3f scale = Matrix44(*model).getScale();
+		float min_scale = std::min(scale.x, std::min(scale.y, scale.z));
+		if (min_scale <= 0.0f)
+			return false;
+		local_scale = 1.0f / min_scale;
+	}
+
+	//the search radius shrinks to the closest point found, the nearest children are visited first
+	float best_dist2 = radius * radius;
+	float local_limit2 = best_dist2 * local_scale * local_scale;
+	bool found = false;
+	uint32 stack[BVH_MAX_DEPTH];
+	float stack_dist2[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	stack[stack_size] = 0;
+	stack_dist2[stack_size++] = boxDistance2(nodes[0], local_center);
+	while (stack_size)
+	{
+		stack_size--;
+		if (stack_dist2[stack_size] > local_limit2)
+			continue;
+		const sBVHNode& node = nodes[stack[stack_size]];
+
+		if (!node.count)
+		{
+			float d0 = boxDistance2(nodes[node.first], local_center);
+			float d1 = boxDistance2(nodes[node.first + 1], local_center);
+			bool first_near = d0 <= d1;
+			assert(stack_size + 2 <= BVH_MAX_DEPTH);
+			stack[stack_size] = first_near ? node.first + 1 : node.first;
+			stack_dist2[stack_size++] = first_near ? d1 : d0;
+			stack[stack_size] = first_near ? node.first : node.first + 1;
+			stack_dist2[stack_size++] = first_near ? d0 : d1;
+			continue;
+		}
+
+		for (uint32 i = 0; i < node.count; ++i)
+		{
+			Vector3f vertices[3];
+			getTriangle(node.first + i / BVH_PACKET_SIZE, i % BVH_PACKET_SIZE, vertices);
+			if (model)
+				for (int k = 0; k < 3; ++k)
+					vertices[k] = *model * vertices[k];
+			Vector3f point = closestPointInTriangle(center, vertices[0], vertices[1], vertices[2]);
+			Vector3f delta = point - center;
+			float point_dist2 = dot3(delta, delta);
+			if (point_dist2 > best_dist2)
+				continue;
+			best_dist2 = point_dist2;
+			local_limit2 = best_dist2 * local_scale * local_scale;
+			collision = point;
+			if (triangle)
+				for (int k = 0; k < 3; ++k)
+					triangle[k] = vertices[k];
+			found = true;
+		}
+	}
+	return found;
+}
+
+};
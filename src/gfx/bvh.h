@@ -0,0 +1,57 @@
+#pragma once
+
+#include "../core/math.h"
+
+#include <vector>
+
+//Bounding volume hierarchy of the triangles of a mesh, used by the ray and sphere collisions of GFX::Mesh
+//It is built with the surface area heuristic, the leaves are packets of 4 triangles tested at once with SSE
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define BVH_USE_SSE
+#endif
+
+namespace GFX {
+
+	#define BVH_PACKET_SIZE 4 //triangles tested at once
+	#define BVH_MAX_LEAF_SIZE 16 //in triangles, leaves have consecutive packets
+	#define BVH_NUM_BINS 16 //split candidates per axis when building
+	#define BVH_MAX_DEPTH 64 //size of the traversal stack
+
+	struct sBVHNode
+	{
+		Vector3f min;
+		uint32 first; //leaves: index of the first packet, inner nodes: index of the first child (the second one goes after it)
+		Vector3f max;
+		uint32 count; //triangles in the leaf, 0 for inner nodes
+	};
+
+	//triangles as a vertex and two edges, one lane per triangle, the lanes after the end of the leaf are degenerate
+	struct sBVHPacket
+	{
+		float v0[3][4];
+		float e1[3][4];
+		float e2[3][4];
+	};
+
+	class TriangleBVH
+	{
+	public:
+		std::vector<sBVHNode> nodes; //nodes[0] is the root
+		std::vector<sBVHPacket> packets;
+
+		//positions with the given stride in bytes, indices can be NULL (then every three vertices is a triangle)
+		void build(const unsigned char* positions, unsigned int stride, unsigned int num_vertices, const unsigned int* indices, unsigned int num_indices);
+		void clear();
+		size_t getBytes() { return nodes.size() * sizeof(sBVHNode) + packets.size() * sizeof(sBVHPacket); }
+
+		//closest hit of origin + direction * t with t between 0 and max_t, triangle gets the vertices of the hit triangle
+		bool testRay(const Vector3f& origin, const Vector3f& direction, float max_t, float& t, Vector3f* triangle);
+		//closest point of the triangles to the center if it is inside the sphere, with a model the sphere, the point and the triangle are in world space
+		bool testSphere(const Vector3f& center, float radius, Vector3f& collision, Vector3f* triangle, const Matrix44* model = NULL);
+
+		void getTriangle(unsigned int packet, int lane, Vector3f* triangle);
+	};
+
+	Vector3f closestPointInTriangle(const Vector3f& p, const Vector3f& a, const Vector3f& b, const Vector3f& c);
+};
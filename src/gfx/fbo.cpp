@@ -1,10 +1,12 @@
 #include "fbo.h"
 #include <cassert>
+#include <algorithm>
 #include "../utils/utils.h"
 #include "gfx.h" //for
 
 namespace GFX
 {
+	std::vector<FBO*> FBO::sFBOs; //for the memory stats
 
 	FBO::FBO() : bufs{0,0,0,0}
 	{
@@ -18,6 +20,7 @@ namespace GFX
 		owns_textures = false;
 		width = 0;
 		height = 0;
+		sFBOs.push_back(this);
 	}
 
 	FBO::~FBO()
@@ -29,6 +32,9 @@ namespace GFX
 			glDeleteRenderbuffersEXT(1, &renderbuffer_color);
 		if (renderbuffer_depth)
 			glDeleteRenderbuffersEXT(1, &renderbuffer_depth);
+		auto it = std::find(sFBOs.begin(), sFBOs.end(), this);
+		if (it != sFBOs.end())
+			sFBOs.erase(it);
 	}
 
 	void FBO::freeTextures()
@@ -11,6 +11,8 @@ namespace GFX {
 
 	class FBO {
 	public:
+		static std::vector<FBO*> sFBOs; //all the existing ones
+
 		GLuint fbo_id;
 		Texture* color_textures[4];
 		Texture* depth_texture;
@@ -0,0 +1,464 @@
+#include "geometryarena.h"
+
+#include "../core/includes.h"
+#include "mesh.h"
+#include "shader.h"
+#include "gfx.h"
+
+#include <cassert>
+#include <iostream>
+
+namespace GFX {
+
+GeometryArena* GeometryArena::arenas[GeometryArena::NUM_LAYOUTS] = { NULL };
+
+GeometryArena* GeometryArena::Get(eLayout layout)
+{
+	if (!arenas[layout])
+		arenas[layout] = new GeometryArena(layout);
+	return arenas[layout];
+}
+
+GeometryArena::eLayout GeometryArena::getLayout(bool compact_vertices, bool short_indices)
+{
+	if (compact_vertices)
+		return short_indices ? COMPACT_16 : COMPACT;
+	return short_indices ? INTERLEAVED_16 : INTERLEAVED;
+}
+
+bool GeometryArena::isIndirectSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 4 || (major == 4 && minor >= 3) ||
+			(SDL_GL_ExtensionSupported("GL_ARB_multi_draw_indirect") && SDL_GL_ExtensionSupported("GL_ARB_base_instance"))) ? 1 : 0;
+		std::cout << " * Multi draw indirect: " << (supported ? "yes" : "no (one draw per command)") << std::endl;
+	}
+	return supported == 1;
+}
+
+GeometryArena::GeometryArena(eLayout layout)
+{
+	this->layout = layout;
+	compact_vertices = layout == COMPACT || layout == COMPACT_16;
+	vertex_size = compact_vertices ? sizeof(Mesh::tCompactVertex) : sizeof(Mesh::tInterleaved);
+	bool short_indices = layout == INTERLEAVED_16 || layout == COMPACT_16;
+	index_size = short_indices ? sizeof(unsigned short) : sizeof(unsigned int);
+	index_type = short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	vertices_vbo_id = indices_vbo_id = 0;
+	vertex_capacity = index_capacity = 0;
+	vertex_end = index_end = 0;
+	vao = vao_program = 0;
+	instances_vbo_id = commands_vbo_id = 0;
+	for (int i = 0; i < 7; ++i)
+		instance_locations[i] = -1;
+}
+
+GeometryArena::~GeometryArena()
+{
+	//the meshes keep pointing to the arena, it must outlive them
+	assert(!allocations.size() && "meshes still using the arena");
+	if (vertices_vbo_id)
+		glDeleteBuffers(1, &vertices_vbo_id);
+	if (indices_vbo_id)
+		glDeleteBuffers(1, &indices_vbo_id);
+	if (instances_vbo_id)
+		glDeleteBuffers(1, &instances_vbo_id);
+	if (commands_vbo_id)
+		glDeleteBuffers(1, &commands_vbo_id);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+}
+
+//first fit in the holes, otherwise after the end
+static bool takeRange(std::vector<GeometryArena::sRange>& free_ranges, unsigned int& end, unsigned int capacity, unsigned int size, unsigned int& start)
+{
+	for (size_t i = 0; i < free_ranges.size(); ++i)
+	{
+		GeometryArena::sRange& range = free_ranges[i];
+		if (range.size < size)
+			continue;
+		start = range.start;
+		range.start += size;
+		range.size -= size;
+		if (!range.size)
+			free_ranges.erase(free_ranges.begin() + i);
+		return true;
+	}
+
+	if (end + size > capacity)
+		return false;
+	start = end;
+	end += size;
+	return true;
+}
+
+//inserted sorted and merged with its neighbours, the holes touching the end are given back to it
+static void giveRange(std::vector<GeometryArena::sRange>& free_ranges, unsigned int& end, GeometryArena::sRange range)
+{
+	if (!range.size)
+		return;
+
+	size_t pos = 0;
+	while (pos < free_ranges.size() && free_ranges[pos].start < range.start)
+		++pos;
+	if (pos < free_ranges.size() && range.start + range.size == free_ranges[pos].start)
+	{
+		range.size += free_ranges[pos].size;
+		free_ranges.erase(free_ranges.begin() + pos);
+	}
+	if (pos > 0 && free_ranges[pos - 1].start + free_ranges[pos - 1].size == range.start)
+	{
+		--pos;
+		free_ranges[pos].size += range.size;
+		range = free_ranges[pos];
+		free_ranges.erase(free_ranges.begin() + pos);
+	}
+
+	if (range.start + range.size == end)
+		end = range.start;
+	else
+		free_ranges.insert(free_ranges.begin() + pos, range);
+}
+
+bool GeometryArena::allocate(Mesh* mesh, const void* vertices, unsigned int num_vertices, const void* indices, unsigned int num_indices)
+{
+	assert(!mesh->arena && "release the mesh first");
+	if (!num_vertices || !num_indices || (index_size == sizeof(unsigned short) && num_vertices > 0xFFFF))
+		return false;
+
+	sAllocation allocation;
+	allocation.mesh = mesh;
+	allocation.vertices.size = num_vertices;
+	allocation.indices.size = num_indices;
+
+	bool has_vertices = takeRange(free_vertices, vertex_end, vertex_capacity, num_vertices, allocation.vertices.start);
+	bool has_indices = has_vertices && takeRange(free_indices, index_end, index_capacity, num_indices, allocation.indices.start);
+	if (!has_indices)
+	{
+		if (has_vertices)
+			giveRange(free_vertices, vertex_end, allocation.vertices);
+
+		//compacting moves all the holes to the end, the buffers only grow if that is not enough
+		unsigned int used_vertices = vertex_end - getFreeVertices();
+		unsigned int used_indices = index_end - getFreeIndices();
+		unsigned int min_vertices = used_vertices + num_vertices;
+		unsigned int min_indices = used_indices + num_indices;
+		unsigned int new_vertex_capacity = vertex_capacity ? vertex_capacity : ARENA_MIN_VERTICES;
+		unsigned int new_index_capacity = index_capacity ? index_capacity : ARENA_MIN_INDICES;
+		while (new_vertex_capacity < min_vertices)
+			new_vertex_capacity *= 2;
+		while (new_index_capacity < min_indices)
+			new_index_capacity *= 2;
+		compact(new_vertex_capacity, new_index_capacity);
+
+		takeRange(free_vertices, vertex_end, vertex_capacity, num_vertices, allocation.vertices.start);
+		takeRange(free_indices, index_end, index_capacity, num_indices, allocation.indices.start);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo_id);
+	glBufferSubData(GL_ARRAY_BUFFER, (size_t)allocation.vertices.start * vertex_size, (size_t)num_vertices * vertex_size, vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (size_t)allocation.indices.start * index_size, (size_t)num_indices * index_size, indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	mesh->arena = this;
+	mesh->arena_vertex_start = allocation.vertices.start;
+	mesh->arena_index_start = allocation.indices.start;
+	allocations.push_back(allocation);
+	return checkGLErrors();
+}
+
+void GeometryArena::release(Mesh* mesh)
+{
+	assert(mesh->arena == this);
+	for (size_t i = 0; i < allocations.size(); ++i)
+	{
+		if (allocations[i].mesh != mesh)
+			continue;
+		giveRange(free_vertices, vertex_end, allocations[i].vertices);
+		giveRange(free_indices, index_end, allocations[i].indices);
+		allocations[i] = allocations.back();
+		allocations.pop_back();
+		break;
+	}
+	mesh->arena = NULL;
+	mesh->arena_vertex_start = mesh->arena_index_start = 0;
+}
+
+void GeometryArena::compact(unsigned int min_vertex_capacity, unsigned int min_index_capacity)
+{
+	unsigned int new_vertex_capacity = vertex_capacity > min_vertex_capacity ? vertex_capacity : min_vertex_capacity;
+	unsigned int new_index_capacity = index_capacity > min_index_capacity ? index_capacity : min_index_capacity;
+
+	GLuint new_vertices_vbo_id = 0;
+	GLuint new_indices_vbo_id = 0;
+	glGenBuffers(1, &new_vertices_vbo_id);
+	glGenBuffers(1, &new_indices_vbo_id);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_vertices_vbo_id);
+	glBufferData(GL_COPY_WRITE_BUFFER, (size_t)new_vertex_capacity * vertex_size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_indices_vbo_id);
+	glBufferData(GL_COPY_WRITE_BUFFER, (size_t)new_index_capacity * index_size, NULL, GL_STATIC_DRAW);
+
+	//copied in the GPU, indices are relative to the first vertex so they do not change
+	unsigned int vertex_pos = 0;
+	unsigned int index_pos = 0;
+	for (size_t i = 0; i < allocations.size(); ++i)
+	{
+		sAllocation& allocation = allocations[i];
+		glBindBuffer(GL_COPY_READ_BUFFER, vertices_vbo_id);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, new_vertices_vbo_id);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t)allocation.vertices.start * vertex_size, (size_t)vertex_pos * vertex_size, (size_t)allocation.vertices.size * vertex_size);
+		glBindBuffer(GL_COPY_READ_BUFFER, indices_vbo_id);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, new_indices_vbo_id);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t)allocation.indices.start * index_size, (size_t)index_pos * index_size, (size_t)allocation.indices.size * index_size);
+
+		allocation.vertices.start = vertex_pos;
+		allocation.indices.start = index_pos;
+		allocation.mesh->arena_vertex_start = vertex_pos;
+		allocation.mesh->arena_index_start = index_pos;
+		allocation.mesh->releaseVAOs(); //they point to the old buffers
+		vertex_pos += allocation.vertices.size;
+		index_pos += allocation.indices.size;
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (vertices_vbo_id)
+		glDeleteBuffers(1, &vertices_vbo_id);
+	if (indices_vbo_id)
+		glDeleteBuffers(1, &indices_vbo_id);
+	vertices_vbo_id = new_vertices_vbo_id;
+	indices_vbo_id = new_indices_vbo_id;
+	vertex_capacity = new_vertex_capacity;
+	index_capacity = new_index_capacity;
+	vertex_end = vertex_pos;
+	index_end = index_pos;
+	free_vertices.clear();
+	free_indices.clear();
+	vao_program = 0; //the vao points to the old buffers
+	checkGLErrors();
+
+	std::cout << " + Geometry arena " << (compact_vertices ? "compact" : "interleaved") << " (" << index_size * 8 << " bits indices): " << allocations.size() << " meshes, "
+		<< vertex_end << "/" << vertex_capacity << " vertices, " << index_end << "/" << index_capacity << " indices" << std::endl;
+}
+
+unsigned int GeometryArena::getFreeVertices()
+{
+	unsigned int total = 0;
+	for (size_t i = 0; i < free_vertices.size(); ++i)
+		total += free_vertices[i].size;
+	return total;
+}
+
+unsigned int GeometryArena::getFreeIndices()
+{
+	unsigned int total = 0;
+	for (size_t i = 0; i < free_indices.size(); ++i)
+		total += free_indices[i].size;
+	return total;
+}
+
+void GeometryArena::bindVAO(Shader* shader)
+{
+	if (!vao)
+		glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	if (vao_program == shader->program)
+		return;
+
+	//locations change with every shader, the ones of the previous one are disabled
+	for (size_t i = 0; i < vao_locations.size(); ++i)
+		glDisableVertexAttribArray(vao_locations[i]);
+	vao_locations.clear();
+
+	int location = -1;
+	glBindBuffer(GL_ARRAY_BUFFER, vertices_vbo_id);
+	if ((location = shader->getAttribLocation("a_vertex")) != -1)
+	{
+		if (compact_vertices)
+			glVertexAttribPointer(location, 3, GL_UNSIGNED_SHORT, GL_TRUE, vertex_size, (void*)offsetof(Mesh::tCompactVertex, position));
+		else
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, vertex_size, (void*)offsetof(Mesh::tInterleaved, vertex));
+		vao_locations.push_back(location);
+	}
+	if ((location = shader->getAttribLocation("a_normal")) != -1)
+	{
+		if (compact_vertices)
+			glVertexAttribPointer(location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertex_size, (void*)offsetof(Mesh::tCompactVertex, normal));
+		else
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, vertex_size, (void*)offsetof(Mesh::tInterleaved, normal));
+		vao_locations.push_back(location);
+	}
+	if ((location = shader->getAttribLocation("a_coord")) != -1)
+	{
+		if (compact_vertices)
+			glVertexAttribPointer(location, 2, GL_UNSIGNED_SHORT, GL_TRUE, vertex_size, (void*)offsetof(Mesh::tCompactVertex, uv));
+		else
+			glVertexAttribPointer(location, 2, GL_FLOAT, GL_FALSE, vertex_size, (void*)offsetof(Mesh::tInterleaved, uv));
+		vao_locations.push_back(location);
+	}
+	for (size_t i = 0; i < vao_locations.size(); ++i)
+		glEnableVertexAttribArray(vao_locations[i]);
+
+	//per draw data (a mat4 counts as four vec4 attributes)
+	instance_locations[0] = shader->getAttribLocation("u_model");
+	instance_locations[1] = shader->getAttribLocation("a_vertex_offset");
+	instance_locations[2] = shader->getAttribLocation("a_vertex_scale");
+	instance_locations[3] = shader->getAttribLocation("a_uv_transform");
+	instance_locations[4] = shader->getAttribLocation("a_material_color");
+	instance_locations[5] = shader->getAttribLocation("a_material_emissive");
+	instance_locations[6] = shader->getAttribLocation("a_material_layers");
+	assert(instance_locations[0] != -1 && "shader must have attribute mat4 u_model (not a uniform)");
+	glBindBuffer(GL_ARRAY_BUFFER, instances_vbo_id);
+	for (int i = 0; i < 7; ++i)
+	{
+		if (instance_locations[i] == -1)
+			continue;
+		for (int k = 0; k < (i == 0 ? 4 : 1); ++k)
+		{
+			glEnableVertexAttribArray(instance_locations[i] + k);
+			glVertexAttribDivisor(instance_locations[i] + k, 1);
+			vao_locations.push_back(instance_locations[i] + k);
+		}
+	}
+	setInstanceAttributes(0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id); //stored in the vao
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	vao_program = shader->program;
+}
+
+void GeometryArena::setInstanceAttributes(size_t offset)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instances_vbo_id);
+	if (instance_locations[0] != -1)
+		for (int k = 0; k < 4; ++k)
+			glVertexAttribPointer(instance_locations[0] + k, 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, model) + sizeof(float) * 4 * k));
+	if (instance_locations[1] != -1)
+		glVertexAttribPointer(instance_locations[1], 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, vertex_offset)));
+	if (instance_locations[2] != -1)
+		glVertexAttribPointer(instance_locations[2], 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, vertex_scale)));
+	if (instance_locations[3] != -1)
+		glVertexAttribPointer(instance_locations[3], 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, uv_transform)));
+	if (instance_locations[4] != -1)
+		glVertexAttribPointer(instance_locations[4], 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, material) + offsetof(sIndirectMaterial, color)));
+	if (instance_locations[5] != -1)
+		glVertexAttribPointer(instance_locations[5], 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, material) + offsetof(sIndirectMaterial, emissive)));
+	if (instance_locations[6] != -1)
+		glVertexAttribPointer(instance_locations[6], 4, GL_FLOAT, GL_FALSE, sizeof(sIndirectInstance), (void*)(offset + offsetof(sIndirectInstance, material) + offsetof(sIndirectMaterial, layers)));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::drawIndirect(Shader* shader, unsigned int primitive, const std::vector<sDrawElementsCommand>& commands, const std::vector<sIndirectInstance>& instances)
+{
+	if (!commands.size())
+		return;
+
+	if (!instances_vbo_id)
+	{
+		glGenBuffers(1, &instances_vbo_id);
+		glGenBuffers(1, &commands_vbo_id);
+	}
+
+	//orphaned every call, the driver does not have to wait for the previous draws
+	glBindBuffer(GL_ARRAY_BUFFER, instances_vbo_id);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(sIndirectInstance), &instances[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	bindVAO(shader);
+
+	if (isIndirectSupported())
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_vbo_id);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(sDrawElementsCommand), &commands[0], GL_STREAM_DRAW);
+		glMultiDrawElementsIndirect(primitive, index_type, NULL, (GLsizei)commands.size(), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else
+	{
+		//same result one draw at a time, without base instance the per draw data is selected moving the attributes
+		for (size_t i = 0; i < commands.size(); ++i)
+		{
+			const sDrawElementsCommand& command = commands[i];
+			setInstanceAttributes(command.base_instance * sizeof(sIndirectInstance));
+			glDrawElementsInstancedBaseVertex(primitive, command.count, index_type, (void*)((size_t)command.first_index * index_size), command.instance_count, command.base_vertex);
+		}
+		setInstanceAttributes(0);
+	}
+
+	glBindVertexArray(0);
+	checkGLErrors();
+
+	for (size_t i = 0; i < commands.size(); ++i)
+		Mesh::num_triangles_rendered += (commands[i].count / 3) * commands[i].instance_count;
+	Mesh::num_meshes_rendered += (long)instances.size();
+}
+
+IndirectDrawList::IndirectDrawList()
+{
+	arena = NULL;
+	material.color.set(1.0f, 1.0f, 1.0f, 1.0f);
+	material.emissive.set(0.0f, 0.0f, 0.0f, 0.0f);
+	material.layers.set(-1.0f, -1.0f, -1.0f, -1.0f);
+}
+
+void IndirectDrawList::clear()
+{
+	arena = NULL;
+	commands.clear();
+	instances.clear();
+}
+
+void IndirectDrawList::add(Mesh* mesh, const Matrix44& model, int lod, Camera* camera, bool cull_backfaces)
+{
+	assert(mesh->arena && (!arena || arena == mesh->arena) && "all the meshes must be in the same arena");
+	arena = mesh->arena;
+
+	//ranges of indices to draw, only the visible meshlets when culling
+	static std::vector<sIndexRange> ranges;
+	ranges.clear();
+	if (camera && lod == 0 && mesh->meshlets.size() > 1)
+	{
+		if (!mesh->cullMeshlets(model, camera, cull_backfaces, ranges))
+			return;
+	}
+	else
+	{
+		sIndexRange range;
+		mesh->getIndexRange(-1, lod, range.start, range.length);
+		ranges.push_back(range);
+	}
+
+	sIndirectInstance instance;
+	instance.model = model;
+	instance.vertex_offset = mesh->compact ? Vector4f(mesh->quantization_offset.x, mesh->quantization_offset.y, mesh->quantization_offset.z, 0.0f) : Vector4f(0.0f, 0.0f, 0.0f, 0.0f);
+	instance.vertex_scale = mesh->compact ? Vector4f(mesh->quantization_scale.x, mesh->quantization_scale.y, mesh->quantization_scale.z, 1.0f) : Vector4f(1.0f, 1.0f, 1.0f, 1.0f);
+	instance.uv_transform = mesh->compact ? Vector4f(mesh->uv_quantization_offset.x, mesh->uv_quantization_offset.y, mesh->uv_quantization_scale.x, mesh->uv_quantization_scale.y) : Vector4f(0.0f, 0.0f, 1.0f, 1.0f);
+	instance.material = material;
+
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		sDrawElementsCommand command;
+		command.count = ranges[i].length;
+		command.instance_count = 1;
+		command.first_index = mesh->arena_index_start + ranges[i].start;
+		command.base_vertex = (int)mesh->arena_vertex_start;
+		command.base_instance = (uint32)instances.size();
+		commands.push_back(command);
+	}
+	instances.push_back(instance);
+}
+
+void IndirectDrawList::draw(Shader* shader, unsigned int primitive)
+{
+	if (arena)
+		arena->drawIndirect(shader, primitive, commands, instances);
+}
+
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "../core/math.h"
+
+#include <vector>
+
+//Shared vertex and index buffers, meshes with the same vertex layout are suballocated in them
+//so a mesh is just a range of vertices and indices, and many meshes can be drawn with a single indirect call
+
+class Camera;
+
+namespace GFX {
+
+	class Mesh;
+	class Shader;
+
+	#define ARENA_MIN_VERTICES (1 << 16) //initial capacity of the buffers
+	#define ARENA_MIN_INDICES (1 << 18)
+
+	//as read by glMultiDrawElementsIndirect
+	struct sDrawElementsCommand
+	{
+		uint32 count;
+		uint32 instance_count;
+		uint32 first_index;
+		int base_vertex;
+		uint32 base_instance;
+	};
+
+	//material of the draw when the draws of different materials are batched (their textures are layers of the same texture arrays)
+	struct sIndirectMaterial
+	{
+		Vector4f color;
+		Vector4f emissive; //emissive factor
+		Vector4f layers; //albedo, emissive, metallic roughness and normal map, -1 without texture
+	};
+
+	//per draw data, read as instanced attributes (the base_instance of the command selects it)
+	struct sIndirectInstance
+	{
+		Matrix44 model;
+		Vector4f vertex_offset; //dequantization of compact meshes (zero and one otherwise)
+		Vector4f vertex_scale;
+		Vector4f uv_transform; //xy offset and zw scale of compact uvs
+		sIndirectMaterial material;
+	};
+
+	class GeometryArena
+	{
+	public:
+		enum eLayout {
+			INTERLEAVED, //Mesh::tInterleaved with 32 bits indices
+			COMPACT, //Mesh::tCompactVertex with 32 bits indices
+			INTERLEAVED_16, //16 bits indices, for meshes of up to 65535 vertices (indices are relative to their first vertex)
+			COMPACT_16,
+			NUM_LAYOUTS
+		};
+
+		struct sRange {
+			unsigned int start;
+			unsigned int size;
+		};
+
+		struct sAllocation {
+			Mesh* mesh;
+			sRange vertices;
+			sRange indices;
+		};
+
+		static GeometryArena* arenas[NUM_LAYOUTS];
+		static GeometryArena* Get(eLayout layout); //created on first use
+		static eLayout getLayout(bool compact_vertices, bool short_indices);
+		static bool isIndirectSupported(); //glMultiDrawElementsIndirect needs OpenGL 4.3 (or the ARB extensions), otherwise the commands are drawn one by one
+
+		eLayout layout;
+		bool compact_vertices; //Mesh::tCompactVertex
+		unsigned int vertex_size; //in bytes
+		unsigned int index_size; //2 or 4 bytes
+		unsigned int index_type; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+		unsigned int vertices_vbo_id;
+		unsigned int indices_vbo_id; //relative to the first vertex of the mesh
+		unsigned int vertex_capacity;
+		unsigned int index_capacity;
+		unsigned int vertex_end; //everything after them is free
+		unsigned int index_end;
+		std::vector<sRange> free_vertices; //holes before the end, sorted and merged
+		std::vector<sRange> free_indices;
+		std::vector<sAllocation> allocations;
+
+		GeometryArena(eLayout layout);
+		~GeometryArena();
+
+		//uploads the geometry and sets the range in the mesh, it reuses holes, compacts or grows the buffers when needed
+		//indices must be of the index type of the arena
+		bool allocate(Mesh* mesh, const void* vertices, unsigned int num_vertices, const void* indices, unsigned int num_indices);
+		void release(Mesh* mesh);
+
+		//moves all the ranges to the start of new buffers (at least of these capacities), the holes disappear
+		void compact(unsigned int min_vertex_capacity = 0, unsigned int min_index_capacity = 0);
+
+		unsigned int getFreeVertices(); //in holes, not counting the end
+		unsigned int getFreeIndices();
+
+		//draws all the commands with the current shader, the instances are uploaded every call
+		void drawIndirect(Shader* shader, unsigned int primitive, const std::vector<sDrawElementsCommand>& commands, const std::vector<sIndirectInstance>& instances);
+
+	private:
+		unsigned int vao;
+		unsigned int vao_program; //the attribute locations of the vao belong to this program
+		std::vector<int> vao_locations; //enabled in the vao
+		int instance_locations[7]; //u_model, a_vertex_offset, a_vertex_scale, a_uv_transform, a_material_color, a_material_emissive, a_material_layers
+		unsigned int instances_vbo_id;
+		unsigned int commands_vbo_id;
+
+		void bindVAO(Shader* shader);
+		void setInstanceAttributes(size_t offset); //offset in bytes inside the instances buffer
+	};
+
+	//commands of many meshes of the same arena, built in the CPU every frame
+	class IndirectDrawList
+	{
+	public:
+		GeometryArena* arena;
+		std::vector<sDrawElementsCommand> commands;
+		std::vector<sIndirectInstance> instances;
+		sIndirectMaterial material; //given to the instances added, the shaders that batch materials read it
+
+		IndirectDrawList();
+
+		void clear();
+		//with a camera, the full mesh is split in its visible meshlets (one command per range)
+		void add(Mesh* mesh, const Matrix44& model, int lod = 0, Camera* camera = NULL, bool cull_backfaces = true);
+		void draw(Shader* shader, unsigned int primitive);
+	};
+};
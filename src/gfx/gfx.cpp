@@ -185,14 +185,15 @@ namespace GFX {
 		int num = is_interleaved ? mesh->interleaved.size() : mesh->vertices.size();
 		assert(num && "no vertices found");
 
+		//the red channel at all the uvs at once
+		std::vector<float> heights(num);
+		GFX::sampleBilinear(heightmap->data, heightmap->width, heightmap->height, heightmap->num_channels, 0, &mesh->uvs[0].x, num, &heights[0]);
 		for (int i = 0; i < num; ++i)
 		{
-			Vector2f& uv = mesh->uvs[i];
-			Color c = heightmap->getPixelInterpolated(uv.x * heightmap->width, uv.y * heightmap->height);
 			if (is_interleaved)
-				mesh->interleaved[i].vertex.y = (c.x / 255.0f) * altitude;
+				mesh->interleaved[i].vertex.y = heights[i] * altitude;
 			else
-				mesh->vertices[i].y = (c.x / 255.0f) * altitude;
+				mesh->vertices[i].y = heights[i] * altitude;
 		}
 		mesh->box.center.y += altitude * 0.5f;
 		mesh->box.halfsize.y += altitude * 0.5f;
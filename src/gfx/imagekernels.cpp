@@ -0,0 +1,554 @@
+#include "imagekernels.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#ifdef IMAGE_USE_SSE
+	#include <emmintrin.h>
+#endif
+#ifdef IMAGE_USE_SSE4
+	#include <smmintrin.h>
+#endif
+#if defined(IMAGE_USE_AVX2) || defined(IMAGE_USE_F16C)
+	#include <immintrin.h>
+#endif
+
+namespace GFX {
+
+#define IMAGE_GAMMA 2.2f //like the shaders
+
+//bytes to 0..1, the first 256 with gamma and the next ones linear
+struct sByteTable
+{
+	float values[512];
+	sByteTable() {
+		for (int i = 0; i < 256; ++i)
+		{
+			values[i] = powf(i / 255.0f, IMAGE_GAMMA);
+			values[i + 256] = i / 255.0f;
+		}
+	}
+};
+static sByteTable byte_table;
+
+static inline uint32 floatBits(float value) { uint32 bits; memcpy(&bits, &value, 4); return bits; }
+static inline float bitsFloat(uint32 bits) { float value; memcpy(&value, &bits, 4); return value; }
+
+//like F16C and the SSE2 version, floatToHalf (math.h) rounds the ties up
+static inline uint16 floatToHalfNearestEven(float value)
+{
+	uint32 f = floatBits(value);
+	uint16 sign = (uint16)((f >> 16) & 0x8000);
+	f &= 0x7fffffff;
+	uint16 half;
+	if (f >= (127 + 16) << 23) //too big, infinity or NaN
+		half = f > 0x7f800000 ? 0x7e00 : 0x7c00;
+	else if (f < (127 - 14) << 23) //subnormal, adding a magic number aligns the mantissa so the FPU rounds it
+		half = (uint16)(floatBits(bitsFloat(f) + bitsFloat(126 << 23)) - (126 << 23));
+	else
+	{
+		uint32 mantissa_odd = (f >> 13) & 1;
+		f += (uint32)(15 - 127) * (1 << 23) + 0xfff; //exponent bias and rounding
+		f += mantissa_odd;
+		half = (uint16)(f >> 13);
+	}
+	return half | sign;
+}
+
+#ifdef IMAGE_USE_SSE
+//pow as exp2(log2(x) * exponent) with polynomials, relative error around 1e-6, 0 for x <= 0
+static inline __m128 log2_ps(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000))); //1..2
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f)); //to sqrt(0.5)..sqrt(2), the series converges faster
+	m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))), _mm_andnot_ps(big, m));
+	exponent = _mm_add_ps(exponent, _mm_and_ps(big, _mm_set1_ps(1.0f)));
+	//ln(m) = 2 * (t + t^3/3 + t^5/5...) with t = (m - 1) / (m + 1)
+	__m128 t = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+	__m128 t2 = _mm_mul_ps(t, t);
+	__m128 p = _mm_set1_ps(1.0f / 9.0f);
+	p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f / 7.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f / 5.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f / 3.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(1.0f));
+	return _mm_add_ps(exponent, _mm_mul_ps(_mm_mul_ps(p, t), _mm_set1_ps(2.0f / 0.69314718f)));
+}
+
+static inline __m128 exp2_ps(__m128 y)
+{
+	y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+	__m128i n = _mm_cvtps_epi32(y);
+	__m128 g = _mm_mul_ps(_mm_sub_ps(y, _mm_cvtepi32_ps(n)), _mm_set1_ps(0.69314718f));
+	__m128 p = _mm_set1_ps(1.0f / 5040.0f);
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(1.0f / 720.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(1.0f / 120.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(1.0f / 24.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(1.0f / 6.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(0.5f));
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(1.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, g), _mm_set1_ps(1.0f));
+	return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)));
+}
+
+static inline __m128 pow_ps(__m128 x, float exponent)
+{
+	__m128 valid = _mm_cmpgt_ps(x, _mm_set1_ps(1e-30f));
+	__m128 result = exp2_ps(_mm_mul_ps(log2_ps(_mm_max_ps(x, _mm_set1_ps(1e-30f))), _mm_set1_ps(exponent)));
+	return _mm_and_ps(valid, result);
+}
+
+static inline __m128 floor_ps(__m128 x)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+//same as floatToHalfNearestEven
+static inline __m128i floatToHalf_ps(__m128 f)
+{
+	__m128 sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+	__m128 absf = _mm_xor_ps(f, sign);
+	__m128i absi = _mm_castps_si128(absf);
+	__m128i is_regular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), absi);
+	__m128i nan_bit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200));
+	__m128i inf_or_nan = _mm_or_si128(nan_bit, _mm_set1_epi32(0x7c00));
+
+	__m128i is_subnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), absi);
+	__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(_mm_set1_epi32(126 << 23)))), _mm_set1_epi32(126 << 23));
+
+	__m128i mantissa_odd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31); //-1 if odd
+	__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absi, _mm_set1_epi32(0xfff - ((127 - 15) << 23))), mantissa_odd), 13);
+
+	__m128i value = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal), _mm_andnot_si128(is_subnormal, normal));
+	value = _mm_or_si128(_mm_and_si128(is_regular, value), _mm_andnot_si128(is_regular, inf_or_nan));
+	return _mm_or_si128(value, _mm_srai_epi32(_mm_castps_si128(sign), 16)); //sign extended so packs keeps it
+}
+
+static inline __m128 halfToFloat_ps(__m128i half)
+{
+	__m128i exponent_mantissa = _mm_and_si128(half, _mm_set1_epi32(0x7fff));
+	__m128i sign = _mm_slli_epi32(_mm_xor_si128(half, exponent_mantissa), 16);
+	//the multiplication fixes the exponent and the subnormals
+	__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(exponent_mantissa, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	__m128i was_inf_nan = _mm_cmpgt_epi32(exponent_mantissa, _mm_set1_epi32(0x7bff));
+	__m128 inf_nan_exponent = _mm_and_ps(_mm_castsi128_ps(was_inf_nan), _mm_castsi128_ps(_mm_set1_epi32(255 << 23)));
+	return _mm_or_ps(scaled, _mm_or_ps(_mm_castsi128_ps(sign), inf_nan_exponent));
+}
+#endif
+
+#ifdef IMAGE_USE_AVX2
+static inline __m256 log2_ps(__m256 x)
+{
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+	__m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+	exponent = _mm256_add_ps(exponent, _mm256_and_ps(big, _mm256_set1_ps(1.0f)));
+	__m256 t = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1.0f)), _mm256_add_ps(m, _mm256_set1_ps(1.0f)));
+	__m256 t2 = _mm256_mul_ps(t, t);
+	__m256 p = _mm256_set1_ps(1.0f / 9.0f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(1.0f / 7.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(1.0f / 5.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(1.0f / 3.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(1.0f));
+	return _mm256_add_ps(exponent, _mm256_mul_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(2.0f / 0.69314718f)));
+}
+
+static inline __m256 exp2_ps(__m256 y)
+{
+	y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(127.0f));
+	__m256i n = _mm256_cvtps_epi32(y);
+	__m256 g = _mm256_mul_ps(_mm256_sub_ps(y, _mm256_cvtepi32_ps(n)), _mm256_set1_ps(0.69314718f));
+	__m256 p = _mm256_set1_ps(1.0f / 5040.0f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(1.0f / 720.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(1.0f / 120.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(1.0f / 24.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(1.0f / 6.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(0.5f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(1.0f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, g), _mm256_set1_ps(1.0f));
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23)));
+}
+
+static inline __m256 pow_ps(__m256 x, float exponent)
+{
+	__m256 valid = _mm256_cmp_ps(x, _mm256_set1_ps(1e-30f), _CMP_GT_OQ);
+	__m256 result = exp2_ps(_mm256_mul_ps(log2_ps(_mm256_max_ps(x, _mm256_set1_ps(1e-30f))), _mm256_set1_ps(exponent)));
+	return _mm256_and_ps(valid, result);
+}
+#endif
+
+void flipRows(void* data, size_t row_bytes, unsigned int num_rows)
+{
+	if (num_rows < 2)
+		return;
+	uint8* top = (uint8*)data;
+	uint8* bottom = top + (num_rows - 1) * row_bytes;
+	for (unsigned int y = 0; y < num_rows / 2; ++y, top += row_bytes, bottom -= row_bytes)
+	{
+		size_t i = 0;
+#ifdef IMAGE_USE_AVX2
+		for (; i + 32 <= row_bytes; i += 32)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(top + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(bottom + i));
+			_mm256_storeu_si256((__m256i*)(top + i), b);
+			_mm256_storeu_si256((__m256i*)(bottom + i), a);
+		}
+#endif
+#ifdef IMAGE_USE_SSE
+		for (; i + 16 <= row_bytes; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(top + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(bottom + i));
+			_mm_storeu_si128((__m128i*)(top + i), b);
+			_mm_storeu_si128((__m128i*)(bottom + i), a);
+		}
+#endif
+		for (; i < row_bytes; ++i)
+			std::swap(top[i], bottom[i]);
+	}
+}
+
+void swapRedBlue(uint8* pixels, size_t num_pixels, unsigned int num_channels)
+{
+	size_t i = 0;
+	if (num_channels == 4)
+	{
+		//the pixels are 32 bit integers, red and blue are swapped with shifts
+#ifdef IMAGE_USE_AVX2
+		for (; i + 8 <= num_pixels; i += 8)
+		{
+			__m256i p = _mm256_loadu_si256((const __m256i*)(pixels + i * 4));
+			__m256i red_blue = _mm256_and_si256(p, _mm256_set1_epi32(0x00ff00ff));
+			p = _mm256_or_si256(_mm256_and_si256(p, _mm256_set1_epi32(0xff00ff00)), _mm256_or_si256(_mm256_slli_epi32(red_blue, 16), _mm256_srli_epi32(red_blue, 16)));
+			_mm256_storeu_si256((__m256i*)(pixels + i * 4), p);
+		}
+#endif
+#ifdef IMAGE_USE_SSE
+		for (; i + 4 <= num_pixels; i += 4)
+		{
+			__m128i p = _mm_loadu_si128((const __m128i*)(pixels + i * 4));
+			__m128i red_blue = _mm_and_si128(p, _mm_set1_epi32(0x00ff00ff));
+			p = _mm_or_si128(_mm_and_si128(p, _mm_set1_epi32(0xff00ff00)), _mm_or_si128(_mm_slli_epi32(red_blue, 16), _mm_srli_epi32(red_blue, 16)));
+			_mm_storeu_si128((__m128i*)(pixels + i * 4), p);
+		}
+#endif
+	}
+#ifdef IMAGE_USE_SSE4
+	else if (num_channels == 3)
+	{
+		//16 pixels in 3 registers, the pixels 5 and 10 are split between two of them
+		const __m128i shuffle_a = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, -1);
+		const __m128i shuffle_b = _mm_setr_epi8(0, -1, 4, 3, 2, 7, 6, 5, 10, 9, 8, 13, 12, 11, -1, 15);
+		const __m128i shuffle_c = _mm_setr_epi8(-1, 3, 2, 1, 6, 5, 4, 9, 8, 7, 12, 11, 10, 15, 14, 13);
+		const __m128i last_to_1 = _mm_setr_epi8(-1, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		const __m128i second_to_15 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1);
+		const __m128i first_to_14 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, -1);
+		const __m128i fourteenth_to_0 = _mm_setr_epi8(14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		for (; i + 16 <= num_pixels; i += 16)
+		{
+			__m128i* p = (__m128i*)(pixels + i * 3);
+			__m128i a = _mm_loadu_si128(p);
+			__m128i b = _mm_loadu_si128(p + 1);
+			__m128i c = _mm_loadu_si128(p + 2);
+			_mm_storeu_si128(p, _mm_or_si128(_mm_shuffle_epi8(a, shuffle_a), _mm_shuffle_epi8(b, second_to_15)));
+			_mm_storeu_si128(p + 1, _mm_or_si128(_mm_shuffle_epi8(b, shuffle_b), _mm_or_si128(_mm_shuffle_epi8(a, last_to_1), _mm_shuffle_epi8(c, first_to_14))));
+			_mm_storeu_si128(p + 2, _mm_or_si128(_mm_shuffle_epi8(c, shuffle_c), _mm_shuffle_epi8(b, fourteenth_to_0)));
+		}
+	}
+#endif
+
+	for (; i < num_pixels; ++i)
+		std::swap(pixels[i * num_channels], pixels[i * num_channels + 2]);
+}
+
+void convertRGBToRGBA(const uint8* rgb, uint8* rgba, size_t num_pixels, uint8 alpha)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSE4
+	//4 pixels of the 16 bytes read
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha_mask = _mm_set1_epi32((int)((uint32)alpha << 24));
+	for (; i * 3 + 16 <= num_pixels * 3; i += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(rgb + i * 3));
+		_mm_storeu_si128((__m128i*)(rgba + i * 4), _mm_or_si128(_mm_shuffle_epi8(p, shuffle), alpha_mask));
+	}
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		rgba[i * 4] = rgb[i * 3];
+		rgba[i * 4 + 1] = rgb[i * 3 + 1];
+		rgba[i * 4 + 2] = rgb[i * 3 + 2];
+		rgba[i * 4 + 3] = alpha;
+	}
+}
+
+void convertRGBAToRGB(const uint8* rgba, uint8* rgb, size_t num_pixels)
+{
+	size_t i = 0;
+#ifdef IMAGE_USE_SSE4
+	//16 pixels, 4 reads of 12 bytes joined in 3 writes
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	for (; i + 16 <= num_pixels; i += 16)
+	{
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rgba + i * 4)), shuffle);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rgba + i * 4 + 16)), shuffle);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rgba + i * 4 + 32)), shuffle);
+		__m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rgba + i * 4 + 48)), shuffle);
+		_mm_storeu_si128((__m128i*)(rgb + i * 3), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storeu_si128((__m128i*)(rgb + i * 3 + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+		_mm_storeu_si128((__m128i*)(rgb + i * 3 + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+	}
+#endif
+	for (; i < num_pixels; ++i)
+	{
+		rgb[i * 3] = rgba[i * 4];
+		rgb[i * 3 + 1] = rgba[i * 4 + 1];
+		rgb[i * 3 + 2] = rgba[i * 4 + 2];
+	}
+}
+
+void convertBytesToFloats(const uint8* bytes, float* values, size_t num_pixels, unsigned int num_channels, bool srgb)
+{
+	//where every channel starts in the table
+	int offsets[4];
+	for (int c = 0; c < 4; ++c)
+		offsets[c] = (srgb && c < 3) ? 0 : 256;
+
+	size_t count = num_pixels * num_channels;
+	size_t i = 0;
+#ifdef IMAGE_USE_AVX2
+	//only 4 channel pixels have alpha, the blocks of 8 start at a pixel
+	__m256i offset = num_channels == 4 ? _mm256_setr_epi32(offsets[0], offsets[1], offsets[2], offsets[3], offsets[0], offsets[1], offsets[2], offsets[3]) : _mm256_set1_epi32(offsets[0]);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i index = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(bytes + i))), offset);
+		_mm256_storeu_ps(values + i, _mm256_i32gather_ps(byte_table.values, index, 4));
+	}
+#endif
+	unsigned int c = (unsigned int)(i % num_channels);
+	for (; i < count; ++i)
+	{
+		values[i] = byte_table.values[bytes[i] + offsets[c]];
+		if (++c == num_channels)
+			c = 0;
+	}
+}
+
+void convertFloatsToBytes(const float* values, uint8* bytes, size_t num_pixels, unsigned int num_channels, bool srgb)
+{
+	size_t count = num_pixels * num_channels;
+	size_t i = 0;
+#if defined(IMAGE_USE_AVX2)
+	__m256 linear = num_channels == 4 ? _mm256_castsi256_ps(_mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1)) : _mm256_setzero_ps();
+	__m256i index[2];
+	for (; i + 16 <= count; i += 16)
+	{
+		for (int k = 0; k < 2; ++k)
+		{
+			__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + i + k * 8), _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+			if (srgb)
+				v = _mm256_blendv_ps(pow_ps(v, 1.0f / IMAGE_GAMMA), v, linear);
+			index[k] = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+		}
+		__m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(index[0], index[1]), 0xD8);
+		_mm_storeu_si128((__m128i*)(bytes + i), _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1)));
+	}
+#elif defined(IMAGE_USE_SSE)
+	__m128 linear = num_channels == 4 ? _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1)) : _mm_setzero_ps();
+	__m128i index[4];
+	for (; i + 16 <= count; i += 16)
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i + k * 4), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+			if (srgb)
+				v = _mm_or_ps(_mm_and_ps(linear, v), _mm_andnot_ps(linear, pow_ps(v, 1.0f / IMAGE_GAMMA)));
+			index[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+		}
+		_mm_storeu_si128((__m128i*)(bytes + i), _mm_packus_epi16(_mm_packs_epi32(index[0], index[1]), _mm_packs_epi32(index[2], index[3])));
+	}
+#endif
+	unsigned int c = (unsigned int)(i % num_channels);
+	for (; i < count; ++i)
+	{
+		float v = clamp(values[i], 0.0f, 1.0f);
+		if (srgb && c < 3)
+			v = powf(v, 1.0f / IMAGE_GAMMA);
+		bytes[i] = (uint8)(v * 255.0f + 0.5f);
+		if (++c == num_channels)
+			c = 0;
+	}
+}
+
+void convertGammaToLinear(const float* values, float* linear, size_t count)
+{
+	size_t i = 0;
+#if defined(IMAGE_USE_AVX2)
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(linear + i, pow_ps(_mm256_loadu_ps(values + i), IMAGE_GAMMA));
+#elif defined(IMAGE_USE_SSE)
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(linear + i, pow_ps(_mm_loadu_ps(values + i), IMAGE_GAMMA));
+#endif
+	for (; i < count; ++i)
+		linear[i] = values[i] > 0.0f ? powf(values[i], IMAGE_GAMMA) : 0.0f;
+}
+
+void convertFloatToHalf(const float* values, uint16* halfs, size_t count)
+{
+	size_t i = 0;
+#if defined(IMAGE_USE_F16C)
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i*)(halfs + i), _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(IMAGE_USE_SSE)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i a = floatToHalf_ps(_mm_loadu_ps(values + i));
+		__m128i b = floatToHalf_ps(_mm_loadu_ps(values + i + 4));
+		_mm_storeu_si128((__m128i*)(halfs + i), _mm_packs_epi32(a, b));
+	}
+#endif
+	for (; i < count; ++i)
+		halfs[i] = floatToHalfNearestEven(values[i]);
+}
+
+void convertHalfToFloat(const uint16* halfs, float* values, size_t count)
+{
+	size_t i = 0;
+#if defined(IMAGE_USE_F16C)
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(values + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(halfs + i))));
+#elif defined(IMAGE_USE_SSE)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i h = _mm_loadu_si128((const __m128i*)(halfs + i));
+		_mm_storeu_ps(values + i, halfToFloat_ps(_mm_unpacklo_epi16(h, _mm_setzero_si128())));
+		_mm_storeu_ps(values + i + 4, halfToFloat_ps(_mm_unpackhi_epi16(h, _mm_setzero_si128())));
+	}
+#endif
+	for (; i < count; ++i)
+		values[i] = halfToFloat(halfs[i]);
+}
+
+//pixel of a coordinate and the next one, with the weight of the next one
+static inline void bilinearAxis(float x, unsigned int size, bool repeat, unsigned int& i0, unsigned int& i1, float& weight)
+{
+	float start = floorf(clamp(x, -1e9f, 1e9f));
+	weight = x - start;
+	if (repeat)
+	{
+		float wrapped = std::min(start - floorf(start / size) * size, size - 1.0f);
+		i0 = (unsigned int)wrapped;
+		i1 = i0 + 1 == size ? 0 : i0 + 1;
+	}
+	else
+	{
+		i0 = (unsigned int)clamp(start, 0.0f, size - 1.0f);
+		i1 = (unsigned int)clamp(start + 1.0f, 0.0f, size - 1.0f);
+	}
+}
+
+void sampleBilinear(const uint8* pixels, unsigned int width, unsigned int height, unsigned int num_channels, float x, float y, bool repeat, float* values)
+{
+	unsigned int x0, x1, y0, y1;
+	float fx, fy;
+	bilinearAxis(x, width, repeat, x0, x1, fx);
+	bilinearAxis(y, height, repeat, y0, y1, fy);
+	const uint8* row0 = pixels + (size_t)y0 * width * num_channels;
+	const uint8* row1 = pixels + (size_t)y1 * width * num_channels;
+	for (unsigned int c = 0; c < num_channels; ++c)
+	{
+		float p00 = row0[x0 * num_channels + c];
+		float p01 = row0[x1 * num_channels + c];
+		float p10 = row1[x0 * num_channels + c];
+		float p11 = row1[x1 * num_channels + c];
+		float top = p00 + (p01 - p00) * fx;
+		float bottom = p10 + (p11 - p10) * fx;
+		values[c] = (top + (bottom - top) * fy) * (1.0f / 255.0f);
+	}
+}
+
+#ifdef IMAGE_USE_SSE
+static inline void bilinearAxis_ps(__m128 x, __m128 size, bool repeat, __m128i& i0, __m128i& i1, __m128& weight)
+{
+	__m128 start = floor_ps(_mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1e9f)), _mm_set1_ps(1e9f)));
+	__m128 last = _mm_sub_ps(size, _mm_set1_ps(1.0f));
+	weight = _mm_sub_ps(x, start);
+	if (repeat)
+	{
+		__m128 wrapped = _mm_min_ps(_mm_sub_ps(start, _mm_mul_ps(floor_ps(_mm_div_ps(start, size)), size)), last);
+		__m128 next = _mm_add_ps(wrapped, _mm_set1_ps(1.0f));
+		next = _mm_andnot_ps(_mm_cmpeq_ps(next, size), next);
+		i0 = _mm_cvttps_epi32(wrapped);
+		i1 = _mm_cvttps_epi32(next);
+	}
+	else
+	{
+		i0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(start, _mm_setzero_ps()), last));
+		i1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(start, _mm_set1_ps(1.0f)), _mm_setzero_ps()), last));
+	}
+}
+#endif
+
+void sampleBilinear(const uint8* pixels, unsigned int width, unsigned int height, unsigned int num_channels, unsigned int channel, const float* uvs, size_t count, float* values, bool repeat)
+{
+	size_t i = 0;
+	size_t row_size = (size_t)width * num_channels;
+	pixels += channel;
+#ifdef IMAGE_USE_SSE
+	//the coordinates and the filter are vectorized, SSE2 has no gathers so the pixels are read one by one
+	const __m128 size_x = _mm_set1_ps((float)width);
+	const __m128 size_y = _mm_set1_ps((float)height);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(uvs + i * 2);
+		__m128 b = _mm_loadu_ps(uvs + i * 2 + 4);
+		__m128 fx, fy;
+		__m128i x0, x1, y0, y1;
+		bilinearAxis_ps(_mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), size_x), size_x, repeat, x0, x1, fx);
+		bilinearAxis_ps(_mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), size_y), size_y, repeat, y0, y1, fy);
+
+		alignas(16) int ix0[4], ix1[4], iy0[4], iy1[4];
+		alignas(16) float p00[4], p01[4], p10[4], p11[4];
+		_mm_store_si128((__m128i*)ix0, x0);
+		_mm_store_si128((__m128i*)ix1, x1);
+		_mm_store_si128((__m128i*)iy0, y0);
+		_mm_store_si128((__m128i*)iy1, y1);
+		for (int k = 0; k < 4; ++k)
+		{
+			const uint8* row0 = pixels + iy0[k] * row_size;
+			const uint8* row1 = pixels + iy1[k] * row_size;
+			p00[k] = row0[ix0[k] * num_channels];
+			p01[k] = row0[ix1[k] * num_channels];
+			p10[k] = row1[ix0[k] * num_channels];
+			p11[k] = row1[ix1[k] * num_channels];
+		}
+
+		__m128 top = _mm_add_ps(_mm_load_ps(p00), _mm_mul_ps(_mm_sub_ps(_mm_load_ps(p01), _mm_load_ps(p00)), fx));
+		__m128 bottom = _mm_add_ps(_mm_load_ps(p10), _mm_mul_ps(_mm_sub_ps(_mm_load_ps(p11), _mm_load_ps(p10)), fx));
+		__m128 value = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy));
+		_mm_storeu_ps(values + i, _mm_mul_ps(value, _mm_set1_ps(1.0f / 255.0f)));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		unsigned int x0, x1, y0, y1;
+		float fx, fy;
+		bilinearAxis(uvs[i * 2] * width, width, repeat, x0, x1, fx);
+		bilinearAxis(uvs[i * 2 + 1] * height, height, repeat, y0, y1, fy);
+		const uint8* row0 = pixels + y0 * row_size;
+		const uint8* row1 = pixels + y1 * row_size;
+		float top = row0[x0 * num_channels] + (row0[x1 * num_channels] - (float)row0[x0 * num_channels]) * fx;
+		float bottom = row1[x0 * num_channels] + (row1[x1 * num_channels] - (float)row1[x0 * num_channels]) * fx;
+		values[i] = (top + (bottom - top) * fy) * (1.0f / 255.0f);
+	}
+}
+
+};
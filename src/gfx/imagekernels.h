@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+#include "../core/math.h"
+
+//Conversion and resampling kernels for the pixels of the images (tImage), the loaders and the code that reads them back from the GPU.
+//Every kernel has a scalar version (other CPUs and the pixels left after the vectorized blocks), SSE2 is always there in x86-64 (like the BVH),
+//SSSE3/SSE4.1, AVX2 and F16C are only used when the compiler targets them (-mavx2 -mf16c or /arch:AVX2)
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define IMAGE_USE_SSE
+#endif
+#if defined(IMAGE_USE_SSE) && (defined(__SSE4_1__) || defined(__AVX__))
+	#define IMAGE_USE_SSE4 //byte shuffles of the 3 channel pixels
+#endif
+#if defined(IMAGE_USE_SSE) && defined(__AVX2__)
+	#define IMAGE_USE_AVX2
+#endif
+#if defined(IMAGE_USE_SSE) && (defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__)))
+	#define IMAGE_USE_F16C //half conversions in hardware
+#endif
+
+namespace GFX {
+
+	//in place, the first row with the last one and so on
+	void flipRows(void* data, size_t row_bytes, unsigned int num_rows);
+
+	//BGR(A) <-> RGB(A) in place, 3 or 4 channels
+	void swapRedBlue(uint8* pixels, size_t num_pixels, unsigned int num_channels);
+	void convertRGBToRGBA(const uint8* rgb, uint8* rgba, size_t num_pixels, uint8 alpha = 255);
+	void convertRGBAToRGB(const uint8* rgba, uint8* rgb, size_t num_pixels);
+
+	//bytes to 0..1, srgb converts the color channels to linear (gamma 2.2 like the shaders), alpha (the fourth channel) is always linear
+	void convertBytesToFloats(const uint8* bytes, float* values, size_t num_pixels, unsigned int num_channels, bool srgb);
+	//the inverse, values are clamped to 0..1 and rounded
+	void convertFloatsToBytes(const float* values, uint8* bytes, size_t num_pixels, unsigned int num_channels, bool srgb);
+	//pow 2.2 of every value, values over 1 (HDR) too and the arrays can be the same one
+	void convertGammaToLinear(const float* values, float* linear, size_t count);
+
+	//IEEE half floats rounded to the nearest even, infinities and NaNs are kept
+	void convertFloatToHalf(const float* values, uint16* halfs, size_t count);
+	void convertHalfToFloat(const uint16* halfs, float* values, size_t count);
+
+	//bilinear filtering like Image::getPixelInterpolated: x and y in pixels (x = u * width), every pixel starts at its integer coordinate,
+	//without repeat the borders are clamped. Values are 0..1
+	void sampleBilinear(const uint8* pixels, unsigned int width, unsigned int height, unsigned int num_channels, float x, float y, bool repeat, float* values);
+	//one channel at many uv coordinates (pairs of floats, like the uvs of a mesh)
+	void sampleBilinear(const uint8* pixels, unsigned int width, unsigned int height, unsigned int num_channels, unsigned int channel, const float* uvs, size_t count, float* values, bool repeat = false);
+};
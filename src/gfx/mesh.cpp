@@ -5,16 +5,21 @@
 #include "../core/includes.h"
 #include "math.h"
 #include "gfx.h"
+#include "meshoptimizer.h"
+#include "objparser.h"
+#include "geometryarena.h"
 
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <mutex>
+#include <set>
 #include <sys/stat.h>
 
 #include "../pipeline/camera.h" //??
 #include "texture.h"
 //#include "animation.h"
-#include "../extra/coldet/coldet.h"
+#include "bvh.h"
 
 //#include "engine/application.h"
 
@@ -23,12 +28,29 @@ namespace GFX {
 bool Mesh::use_binary = false;			//checks if there is .wbin, it there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+bool Mesh::optimize_meshes = true;		//welds and reorders the geometry once, the result is stored in the .mbin
+bool Mesh::use_compact_vertices = false;	//quantizes the vertices in VRAM (half the memory and bandwidth)
+float Mesh::compact_position_tolerance = 0.001f;
+float Mesh::compact_uv_tolerance = 1.0f / 4096.0f; //a quarter of texel in a 1024 texture
+bool Mesh::generate_lods = true;		//simplified versions are generated once and stored in the .mbin
+float Mesh::lod_max_error = 0.02f;		//2% of the radius
+bool Mesh::build_meshlets = true;		//meshlets are built once and stored in the .mbin
+bool Mesh::keep_cpu_data = false;		//bins are uploaded from the file mapping and not kept in RAM
+bool Mesh::use_geometry_arena = true;	//no buffers per mesh, they are ranges of the shared buffers
+bool Mesh::use_vaos = true;		//one bind per draw instead of setting every attribute
+bool Mesh::bin_collision_models = false;	//the BVH would be built by whatever thread writes the bin, main one included
+bool Mesh::build_collisions_async = false;	//built on the first collision test
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
 long Mesh::num_triangles_rendered = 0;
 uint32 Mesh::s_last_index = 0;
 
+//every mesh alive, for the memory stats (meshes are created in the background threads too)
+//by pointer, the index is copied with the mesh when a loaded one is moved into its placeholder
+static std::set<Mesh*> all_meshes;
+static std::mutex all_meshes_mutex;
+
 #define FORMAT_ASE 1
 #define FORMAT_OBJ 2
 #define FORMAT_MBIN 3
@@ -36,10 +58,15 @@ uint32 Mesh::s_last_index = 0;
 
 Mesh::Mesh()
 {
+	all_meshes_mutex.lock();
 	index = s_last_index++;
+	all_meshes.insert(this);
+	all_meshes_mutex.unlock();
 	radius = 0;
 	vertices_vbo_id = uvs_vbo_id = uvs1_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = bones_vbo_id = weights_vbo_id = 0;
 	collision_model = NULL;
+	arena = NULL;
+	loading = false;
 
 	clear();
 }
@@ -47,6 +74,17 @@ Mesh::Mesh()
 Mesh::~Mesh()
 {
 	clear();
+	all_meshes_mutex.lock();
+	all_meshes.erase(this);
+	all_meshes_mutex.unlock();
+}
+
+void Mesh::getAllMeshes(std::vector<Mesh*>& meshes)
+{
+	all_meshes_mutex.lock();
+	meshes.clear();
+	meshes.assign(all_meshes.begin(), all_meshes.end());
+	all_meshes_mutex.unlock();
 }
 
 
@@ -94,8 +132,26 @@ void Mesh::clear()
     #endif
 
 
+	if (arena)
+		arena->release(this);
+	arena = NULL;
+	arena_vertex_start = arena_index_start = 0;
+	releaseVAOs();
+	vaos_version = 0;
+
 	//VBOs ids
 	vertices_vbo_id = uvs_vbo_id = normals_vbo_id = colors_vbo_id = interleaved_vbo_id = indices_vbo_id = weights_vbo_id = bones_vbo_id = uvs1_vbo_id = 0;
+	indices_type = GL_UNSIGNED_INT;
+	is_optimized = lods_generated = meshlets_built = false;
+	uv_density = 0.0f;
+	vram_num_vertices = vram_num_indices = 0;
+	bin_filename.clear();
+	bin_offset = 0;
+	compact = compact_colors = false;
+	quantization_offset.set(0, 0, 0);
+	quantization_scale.set(1, 1, 1);
+	uv_quantization_offset.set(0, 0);
+	uv_quantization_scale.set(1, 1);
 
 	//buffers
 	vertices.clear();
@@ -104,12 +160,16 @@ void Mesh::clear()
 	colors.clear();
 	interleaved.clear();
 	m_indices.clear();
+	lods.clear();
+	lod_indices.clear();
+	meshlets.clear();
 	bones.clear();
 	weights.clear();
 	m_uvs1.clear();
 
 	if (collision_model)
-		delete (CollisionModel3D*)collision_model;
+		delete collision_model;
+	collision_model = NULL;
 }
 
 int vertex_location = -1;
@@ -129,68 +189,113 @@ void Mesh::enableBuffers(Shader* sh)
 		return;
 	*/
 
-	int spacing = 0;
-	int offset_normal = 0;
-	int offset_uv = 0;
+	//meshes in an arena use its buffer, the base vertex is applied in the draw call
+	unsigned int interleaved_id = arena ? arena->vertices_vbo_id : interleaved_vbo_id;
 
-	if (interleaved.size())
+	if (compact)
 	{
-		spacing = sizeof(tInterleaved);
-		offset_normal = sizeof(Vector3f);
-		offset_uv = sizeof(Vector3f) + sizeof(Vector3f);
-	}
+		//quantized layout, positions are restored in the vertex shader
+		assert(interleaved_id && "compact meshes only exist in VRAM");
+		int stride = sizeof(tCompactVertex);
+		glBindBuffer(GL_ARRAY_BUFFER, interleaved_id);
+		if (vertex_location != -1)
+		{
+			glEnableVertexAttribArray(vertex_location);
+			glVertexAttribPointer(vertex_location, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(tCompactVertex, position));
+		}
+		sh->setUniform3("u_vertex_offset", quantization_offset);
+		sh->setUniform3("u_vertex_scale", quantization_scale);
+		sh->setUniform2("u_uv_offset", uv_quantization_offset.x, uv_quantization_offset.y);
+		sh->setUniform2("u_uv_scale", uv_quantization_scale.x, uv_quantization_scale.y);
 
-	if (vertex_location != -1)
-	{
-		glEnableVertexAttribArray(vertex_location);
-		if (vertices_vbo_id || interleaved_vbo_id)
+		normal_location = -1;
+		if (normals.size() || interleaved.size())
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+			normal_location = sh->getAttribLocation("a_normal");
+			if (normal_location != -1)
+			{
+				glEnableVertexAttribArray(normal_location);
+				glVertexAttribPointer(normal_location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(tCompactVertex, normal));
+			}
 		}
-		else
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
-		checkGLErrors();
-	}
 
-	normal_location = -1;
-	if (normals.size() || spacing)
-	{
-		normal_location = sh->getAttribLocation("a_normal");
-		if (normal_location != -1)
+		uv_location = -1;
+		if (uvs.size() || interleaved.size())
 		{
-			glEnableVertexAttribArray(normal_location);
-			if (normals_vbo_id || interleaved_vbo_id)
+			uv_location = sh->getAttribLocation("a_coord");
+			if (uv_location != -1)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				glEnableVertexAttribArray(uv_location);
+				glVertexAttribPointer(uv_location, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(tCompactVertex, uv));
 			}
-			else
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
 		}
 		checkGLErrors();
 	}
-
-	uv_location = -1;
-	if (uvs.size() || spacing)
+	else
 	{
-		uv_location = sh->getAttribLocation("a_coord");
-		if (uv_location != -1)
+		int spacing = 0;
+		int offset_normal = 0;
+		int offset_uv = 0;
+
+		if (interleaved.size() || interleaved_id)
 		{
-			glEnableVertexAttribArray(uv_location);
-			if (uvs_vbo_id || interleaved_vbo_id)
+			spacing = sizeof(tInterleaved);
+			offset_normal = sizeof(Vector3f);
+			offset_uv = sizeof(Vector3f) + sizeof(Vector3f);
+		}
+
+		if (vertex_location != -1)
+		{
+			glEnableVertexAttribArray(vertex_location);
+			if (vertices_vbo_id || interleaved_id)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glBindBuffer(GL_ARRAY_BUFFER, interleaved_id ? interleaved_id : vertices_vbo_id);
+				glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
 			}
 			else
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
+				glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
+			checkGLErrors();
+		}
+
+		normal_location = -1;
+		if (normals.size() || normals_vbo_id || spacing)
+		{
+			normal_location = sh->getAttribLocation("a_normal");
+			if (normal_location != -1)
+			{
+				glEnableVertexAttribArray(normal_location);
+				if (normals_vbo_id || interleaved_id)
+				{
+					glBindBuffer(GL_ARRAY_BUFFER, interleaved_id ? interleaved_id : normals_vbo_id);
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				}
+				else
+					glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
+			}
+			checkGLErrors();
+		}
+
+		uv_location = -1;
+		if (uvs.size() || uvs_vbo_id || spacing)
+		{
+			uv_location = sh->getAttribLocation("a_coord");
+			if (uv_location != -1)
+			{
+				glEnableVertexAttribArray(uv_location);
+				if (uvs_vbo_id || interleaved_id)
+				{
+					glBindBuffer(GL_ARRAY_BUFFER, interleaved_id ? interleaved_id : uvs_vbo_id);
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				}
+				else
+					glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
+			}
+			checkGLErrors();
 		}
-		checkGLErrors();
 	}
 
 	uv1_location = -1;
-	if (m_uvs1.size())
+	if (m_uvs1.size() || uvs1_vbo_id)
 	{
 		uv1_location = sh->getAttribLocation("a_coord1");
 		if (uv1_location != -1)
@@ -199,7 +304,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs1_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+				glVertexAttribPointer(uv1_location, 2, compact ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, 0, (void*)0);
 			}
 			else
 				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, &m_uvs1[0]);
@@ -208,7 +313,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (colors.size() || colors_vbo_id)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -217,7 +322,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (colors_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				if (compact_colors)
+					glVertexAttribPointer(color_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+				else
+					glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
@@ -226,7 +334,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -242,7 +350,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -251,7 +359,10 @@ void Mesh::enableBuffers(Shader* sh)
 			if (weights_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				if (compact)
+					glVertexAttribPointer(weights_location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, NULL);
+				else
+					glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
@@ -260,7 +371,62 @@ void Mesh::enableBuffers(Shader* sh)
 
 }
 
-void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
+//set while a mesh VAO is bound, the indices are already bound in it
+static GLuint bound_vao = 0;
+
+unsigned int Mesh::getVAO(Shader* shader)
+{
+	//client side streams cannot be stored in a VAO
+	if (!use_vaos || (!arena && !interleaved_vbo_id && !vertices_vbo_id) || (getNumIndices() && !arena && !indices_vbo_id))
+		return 0;
+
+	unsigned long long layout = shader->getAttribLayout();
+
+	//the ones of layouts no shader has anymore (recompiled or deleted) would never be used again
+	if (vaos_version != Shader::s_attrib_layouts_version)
+	{
+		for (size_t i = 0; i < vaos.size();)
+		{
+			if (Shader::isAttribLayoutUsed(vaos[i].first))
+			{
+				++i;
+				continue;
+			}
+			glDeleteVertexArrays(1, &vaos[i].second);
+			vaos[i] = vaos.back();
+			vaos.pop_back();
+		}
+		vaos_version = Shader::s_attrib_layouts_version;
+	}
+
+	for (size_t i = 0; i < vaos.size(); ++i)
+		if (vaos[i].first == layout)
+			return vaos[i].second;
+
+	//the same bindings enableBuffers does, recorded once
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	enableBuffers(shader);
+	if (arena || indices_vbo_id)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena ? arena->indices_vbo_id : indices_vbo_id);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	checkGLErrors();
+
+	vaos.push_back(std::make_pair(layout, (unsigned int)vao));
+	return vao;
+}
+
+void Mesh::releaseVAOs()
+{
+	for (size_t i = 0; i < vaos.size(); ++i)
+		glDeleteVertexArrays(1, &vaos[i].second);
+	vaos.clear();
+}
+
+void Mesh::render(unsigned int primitive, int submesh_id, int num_instances, int lod)
 {
     //return;
 
@@ -270,66 +436,121 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
-	enableBuffers(shader);
+	bound_vao = getVAO(shader);
+	if (bound_vao)
+	{
+		glBindVertexArray(bound_vao);
+		if (compact)
+		{
+			shader->setUniform3("u_vertex_offset", quantization_offset);
+			shader->setUniform3("u_vertex_scale", quantization_scale);
+			shader->setUniform2("u_uv_offset", uv_quantization_offset.x, uv_quantization_offset.y);
+			shader->setUniform2("u_uv_scale", uv_quantization_scale.x, uv_quantization_scale.y);
+		}
+	}
+	else
+		enableBuffers(shader);
 	checkGLErrors();
 
 	//draw call
-	drawCall(primitive, submesh_id, num_instances);
+	drawCall(primitive, submesh_id, num_instances, lod);
 	checkGLErrors();
 
 	//unbind them
-	disableBuffers(shader);
+	if (bound_vao)
+	{
+		glBindVertexArray(0);
+		bound_vao = 0;
+		if (compact)
+		{
+			shader->setUniform3("u_vertex_offset", 0.0f, 0.0f, 0.0f);
+			shader->setUniform3("u_vertex_scale", 1.0f, 1.0f, 1.0f);
+			shader->setUniform2("u_uv_offset", 0.0f, 0.0f);
+			shader->setUniform2("u_uv_scale", 1.0f, 1.0f);
+		}
+	}
+	else
+		disableBuffers(shader);
 	checkGLErrors();
 }
 
-void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
+void Mesh::getIndexRange(int submesh_id, int lod, int& start, int& size)
 {
-	int start = 0; //in primitives
-	int size = (int)vertices.size();
-	if (m_indices.size())
-		size = (int)m_indices.size();
-	else
-	if (interleaved.size())
-		size = (int)interleaved.size();
+	start = 0; //in primitives
+	size = (int)getNumVertices();
+	if (getNumIndices())
+		size = (int)getNumIndices();
 
 	if (submesh_id > -1)
 	{
 		assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
 		sSubmeshInfo& submesh = submeshes[submesh_id];
 		start = submesh.start;
-		size = submesh.start + submesh.length;
+		size = submesh.length;
+	}
+	else if (lod > 0 && lods.size())
+	{
+		sLODInfo& info = lods[(lod < (int)lods.size() ? lod : (int)lods.size()) - 1];
+		start = info.start;
+		size = info.length;
 	}
+}
+
+void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances, int lod)
+{
+	int start, size;
+	getIndexRange(submesh_id, lod, start, size);
 
 	//DRAW
-	if (m_indices.size())
+	if (arena)
+	{
+		//the range of the mesh inside the shared index buffer, indices are relative to its first vertex
+		size_t offset = (size_t)(arena_index_start + start) * arena->index_size;
+		if (!bound_vao)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->indices_vbo_id);
+		if (num_instances > 0)
+			glDrawElementsInstancedBaseVertex(primitive, size, arena->index_type, (void*)offset, num_instances, arena_vertex_start);
+		else
+			glDrawElementsBaseVertex(primitive, size, arena->index_type, (void*)offset, arena_vertex_start);
+		if (!bound_vao)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		checkGLErrors();
+	}
+	else if (getNumIndices())
 	{
+		//all submeshes share the same index buffer, we just offset inside it
+		size_t offset = start * getIndexSize();
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+			if (!bound_vao) //the vao has them, unbinding would remove them from it
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
 			#ifdef OPENGL_ES3
-				glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3u)), num_instances);
+				glDrawElementsInstanced(primitive, size, indices_type, (void*)offset, num_instances);
             #else
 				assert(0 && "not supported in OpenGL ES2");
             #endif
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			if (!bound_vao)
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		}
 		else
 		{
-			if (indices_vbo_id)
+			if (bound_vao)
+				glDrawElements(primitive, size, indices_type, (void*)offset);
+			else if (indices_vbo_id)
 			{
-				/*if (size != 90)*/ {
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u)));
-					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-				}
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
+				glDrawElements(primitive, size, indices_type, (void*)offset);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 				checkGLErrors();
 			}
+			else if (start >= (int)m_indices.size()) //a LOD
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&lod_indices[0] + start - m_indices.size()));
 			else
-				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its a vector3u pointer)
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //CPU indices are always 32 bits
 		}
 	}
 	else
@@ -359,6 +580,14 @@ void Mesh::disableBuffers(Shader* shader)
 	if (color_location != -1) glDisableVertexAttribArray(color_location);
 	if (bones_location != -1) glDisableVertexAttribArray(bones_location);
 	if (weights_location != -1) glDisableVertexAttribArray(weights_location);
+	if (compact)
+	{
+		//restore so other meshes using this shader are not affected
+		shader->setUniform3("u_vertex_offset", 0.0f, 0.0f, 0.0f);
+		shader->setUniform3("u_vertex_scale", 1.0f, 1.0f, 1.0f);
+		shader->setUniform2("u_uv_offset", 0.0f, 0.0f);
+		shader->setUniform2("u_uv_scale", 1.0f, 1.0f);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);    //if it crashes here, COMMENT THIS LINE ****************************
 	checkGLErrors();
 }
@@ -385,7 +614,13 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 		if (attribLocation == -1)
 			return; //this shader doesnt support instanced model
 
+		//the cached VAOs do not have the instance attributes, so the streams are bound without them
+		assert(!bound_vao);
+		glBindVertexArray(0);
+		enableBuffers(shader);
+
 		//mat4 count as 4 different attributes of vec4... (thanks opengl...)
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
 		for (int k = 0; k < 4; ++k)
 		{
 			glEnableVertexAttribArray(attribLocation + k );
@@ -395,8 +630,7 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 			glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 		}
 
-		//regular render
-		render(primitive, 0, num_instances);
+		drawCall(primitive, 0, num_instances, 0);
 
 		//disable instanced attribs
 		for (int k = 0; k < 4; ++k)
@@ -404,6 +638,8 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 			glDisableVertexAttribArray(attribLocation + k);
 			glVertexAttribDivisor(attribLocation + k, 0);
 		}
+		disableBuffers(shader);
+		checkGLErrors();
     #else
 		assert(0 && "not supported");
     #endif
@@ -504,7 +740,115 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 #define GL_ARRAY_BUFFER_ARB GL_ARRAY_BUFFER
 #define GL_STATIC_DRAW_ARB GL_STATIC_DRAW
 
-void Mesh::uploadToVRAM()
+static uint32 packNormal(Vector3f n)
+{
+	uint32 x = (uint32)(int)floor(clamp(n.x, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3FF;
+	uint32 y = (uint32)(int)floor(clamp(n.y, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3FF;
+	uint32 z = (uint32)(int)floor(clamp(n.z, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3FF;
+	return x | (y << 10) | (z << 20);
+}
+
+//the main streams in the layout of the arena, missing normals or uvs are left to zero
+static void packInterleaved(std::vector<Mesh::tInterleaved>& result, unsigned int num_vertices, const Vector3f* vertices, const Vector3f* normals, const Vector2f* uvs)
+{
+	result.resize(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		result[i].vertex = vertices[i];
+		result[i].normal = normals ? normals[i] : Vector3f(0.0f, 0.0f, 0.0f);
+		result[i].uv = uvs ? uvs[i] : Vector2f(0.0f, 0.0f);
+	}
+}
+
+//returns false if the quantization error is above the tolerance, then the mesh must use floats
+bool Mesh::packCompactVertices(std::vector<tCompactVertex>& result)
+{
+	unsigned int num_vertices = getNumVertices();
+	bool is_interleaved = interleaved.size() != 0;
+	bool has_normals = is_interleaved || normals.size();
+	bool has_uvs = is_interleaved || uvs.size();
+
+	//quantize inside the real aabb of the vertices
+	const float max_float = 10000000;
+	Vector3f min_pos(max_float, max_float, max_float);
+	Vector3f max_pos(-max_float, -max_float, -max_float);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		const Vector3f& pos = is_interleaved ? interleaved[i].vertex : vertices[i];
+		min_pos.setMin(pos);
+		max_pos.setMax(pos);
+	}
+	Vector3f scale = max_pos - min_pos;
+	float max_size = 0;
+	for (int k = 0; k < 3; ++k)
+	{
+		max_size = scale.v[k] > max_size ? scale.v[k] : max_size;
+		if (scale.v[k] <= 0)
+			scale.v[k] = 1; //flat axis
+	}
+	if (max_size / 65535.0f * 0.5f > compact_position_tolerance)
+		return false;
+
+	//uvs inside their own bounds, they can go beyond 0..1 (tiling, atlases)
+	Vector2f min_uv(0.0f, 0.0f);
+	Vector2f uv_scale(1.0f, 1.0f);
+	if (has_uvs && num_vertices)
+	{
+		Vector2f max_uv = min_uv = is_interleaved ? interleaved[0].uv : uvs[0];
+		for (unsigned int i = 1; i < num_vertices; ++i)
+		{
+			const Vector2f& uv = is_interleaved ? interleaved[i].uv : uvs[i];
+			for (int k = 0; k < 2; ++k)
+			{
+				min_uv.value[k] = uv.value[k] < min_uv.value[k] ? uv.value[k] : min_uv.value[k];
+				max_uv.value[k] = uv.value[k] > max_uv.value[k] ? uv.value[k] : max_uv.value[k];
+			}
+		}
+		for (int k = 0; k < 2; ++k)
+		{
+			uv_scale.value[k] = max_uv.value[k] - min_uv.value[k];
+			if (uv_scale.value[k] / 65535.0f * 0.5f > compact_uv_tolerance)
+				return false;
+			if (uv_scale.value[k] <= 0)
+				uv_scale.value[k] = 1; //flat axis
+		}
+	}
+
+	//the second uv set is not in the compact vertex, it goes as half floats
+
+	for (size_t i = 0; i < m_uvs1.size(); ++i)
+		for (int k = 0; k < 2; ++k)
+			if (fabs(halfToFloat(floatToHalf(m_uvs1[i].value[k])) - m_uvs1[i].value[k]) > compact_uv_tolerance)
+				return false;
+
+	result.resize(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		tCompactVertex& v = result[i];
+		const Vector3f& pos = is_interleaved ? interleaved[i].vertex : vertices[i];
+		for (int k = 0; k < 3; ++k)
+			v.position[k] = (uint16)(clamp((pos.v[k] - min_pos.v[k]) / scale.v[k], 0.0f, 1.0f) * 65535.0f + 0.5f);
+		v.position[3] = 0;
+
+		v.normal = has_normals ? packNormal(is_interleaved ? interleaved[i].normal : normals[i]) : 0;
+
+		v.uv[0] = v.uv[1] = 0;
+		if (has_uvs)
+		{
+			const Vector2f& uv = is_interleaved ? interleaved[i].uv : uvs[i];
+			for (int k = 0; k < 2; ++k)
+				v.uv[k] = (uint16)(clamp((uv.value[k] - min_uv.value[k]) / uv_scale.value[k], 0.0f, 1.0f) * 65535.0f + 0.5f);
+		}
+	}
+
+	quantization_offset = min_pos;
+	quantization_scale = scale;
+	uv_quantization_offset = min_uv;
+	uv_quantization_scale = uv_scale;
+	return true;
+}
+
+void Mesh::uploadToVRAM(bool compact_layout)
 {
 	assert(vertices.size() || interleaved.size());
 
@@ -514,7 +858,66 @@ void Mesh::uploadToVRAM()
 		exit(0);
 	}
 
-	if (interleaved.size())
+	if (arena)
+		arena->release(this);
+	releaseVAOs(); //they point to the old buffers
+
+	std::vector<tCompactVertex> compact_vertices;
+	if (compact_layout && !packCompactVertices(compact_vertices))
+		std::cout << "[NOT COMPACT: precision] ";
+	compact = compact_vertices.size() != 0;
+	compact_colors = false;
+
+	//meshes with only the main streams are ranges of the shared buffers of their layout
+	if (use_geometry_arena && m_indices.size() && !m_uvs1.size() && !colors.size() && !bones.size() && !weights.size())
+	{
+		std::vector<tInterleaved> packed;
+		const void* vertex_data = compact ? (const void*)&compact_vertices[0] : (const void*)(interleaved.size() ? &interleaved[0] : NULL);
+		if (!vertex_data)
+		{
+			packInterleaved(packed, (unsigned int)vertices.size(), &vertices[0], normals.size() ? &normals[0] : NULL, uvs.size() ? &uvs[0] : NULL);
+			vertex_data = &packed[0];
+		}
+
+		//LODs go after the full mesh, as in the index buffer of the mesh (16 bits with the same rule as below)
+		bool short_indices = getNumVertices() <= 0xFFFF;
+		std::vector<unsigned int> all_indices;
+		std::vector<unsigned short> all_indices16;
+		const void* index_data = NULL;
+		if (short_indices)
+		{
+			all_indices16.assign(m_indices.begin(), m_indices.end());
+			all_indices16.insert(all_indices16.end(), lod_indices.begin(), lod_indices.end());
+			index_data = &all_indices16[0];
+		}
+		else
+		{
+			all_indices = m_indices;
+			all_indices.insert(all_indices.end(), lod_indices.begin(), lod_indices.end());
+			index_data = &all_indices[0];
+		}
+		unsigned int num_all_indices = (unsigned int)(m_indices.size() + lod_indices.size());
+
+		GeometryArena* target = GeometryArena::Get(GeometryArena::getLayout(compact, short_indices));
+		if (target->allocate(this, vertex_data, getNumVertices(), index_data, num_all_indices))
+		{
+			indices_type = target->index_type;
+			vram_num_vertices = getNumVertices();
+			vram_num_indices = (unsigned int)m_indices.size();
+			checkGLErrors();
+			return;
+		}
+	}
+
+	if (compact)
+	{
+		// Vertex,Normal,UV quantized
+		if (interleaved_vbo_id == 0)
+			glGenBuffersARB(1, &interleaved_vbo_id);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, compact_vertices.size() * sizeof(tCompactVertex), &compact_vertices[0], GL_STATIC_DRAW_ARB);
+	}
+	else if (interleaved.size())
 	{
 		// Vertex,Normal,UV
 		if (interleaved_vbo_id == 0)
@@ -555,7 +958,18 @@ void Mesh::uploadToVRAM()
 		if (uvs1_vbo_id == 0)
 			glGenBuffersARB(1, &uvs1_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_uvs1.size() * sizeof(Vector2f), &m_uvs1[0], GL_STATIC_DRAW_ARB);
+		if (compact)
+		{
+			std::vector<uint16> uvs1_half(m_uvs1.size() * 2);
+			for (size_t i = 0; i < m_uvs1.size(); ++i)
+			{
+				uvs1_half[i * 2] = floatToHalf(m_uvs1[i].x);
+				uvs1_half[i * 2 + 1] = floatToHalf(m_uvs1[i].y);
+			}
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs1_half.size() * sizeof(uint16), &uvs1_half[0], GL_STATIC_DRAW_ARB);
+		}
+		else
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_uvs1.size() * sizeof(Vector2f), &m_uvs1[0], GL_STATIC_DRAW_ARB);
 	}
 
 	// Colors
@@ -564,7 +978,23 @@ void Mesh::uploadToVRAM()
 		if (colors_vbo_id == 0)
 			glGenBuffersARB(1, &colors_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4f), &colors[0], GL_STATIC_DRAW_ARB);
+
+		//HDR colors cannot be stored in unorm8
+		compact_colors = compact;
+		for (size_t i = 0; i < colors.size() && compact_colors; ++i)
+			for (int k = 0; k < 4; ++k)
+				if (colors[i].v[k] < 0.0f || colors[i].v[k] > 1.0f)
+					compact_colors = false;
+
+		if (compact_colors)
+		{
+			std::vector<Vector4ub> colors8(colors.size());
+			for (size_t i = 0; i < colors.size(); ++i)
+				colors8[i] = colors[i] * 255.0f + Vector4f(0.5f, 0.5f, 0.5f, 0.5f);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors8.size() * sizeof(Vector4ub), &colors8[0], GL_STATIC_DRAW_ARB);
+		}
+		else
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4f), &colors[0], GL_STATIC_DRAW_ARB);
 	}
 
 	if (bones.size())
@@ -579,7 +1009,15 @@ void Mesh::uploadToVRAM()
 		if (weights_vbo_id == 0)
 			glGenBuffersARB(1, &weights_vbo_id);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4f), &weights[0], GL_STATIC_DRAW_ARB);
+		if (compact)
+		{
+			std::vector<Vector4ub> weights8(weights.size());
+			for (size_t i = 0; i < weights.size(); ++i)
+				weights8[i] = weights[i] * 255.0f + Vector4f(0.5f, 0.5f, 0.5f, 0.5f);
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights8.size() * sizeof(Vector4ub), &weights8[0], GL_STATIC_DRAW_ARB);
+		}
+		else
+			glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4f), &weights[0], GL_STATIC_DRAW_ARB);
 	}
 
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
@@ -590,75 +1028,159 @@ void Mesh::uploadToVRAM()
 		if (indices_vbo_id == 0)
 			glGenBuffersARB(1, &indices_vbo_id);
 		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW_ARB);
+
+		//LODs go in the same buffer after the full mesh
+		std::vector<unsigned int> all_indices;
+		const std::vector<unsigned int>* indices = &m_indices;
+		if (lod_indices.size())
+		{
+			all_indices.reserve(m_indices.size() + lod_indices.size());
+			all_indices.insert(all_indices.end(), m_indices.begin(), m_indices.end());
+			all_indices.insert(all_indices.end(), lod_indices.begin(), lod_indices.end());
+			indices = &all_indices;
+		}
+
+		//use 16 bits indices when all the vertices can be addressed with them (half the memory and bandwidth)
+		if (getNumVertices() <= 0xFFFF)
+		{
+			std::vector<unsigned short> indices16(indices->begin(), indices->end());
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices16.size() * sizeof(unsigned short), &indices16[0], GL_STATIC_DRAW_ARB);
+			indices_type = GL_UNSIGNED_SHORT;
+		}
+		else
+		{
+			glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, indices->size() * sizeof(unsigned int), &(*indices)[0], GL_STATIC_DRAW_ARB);
+			indices_type = GL_UNSIGNED_INT;
+		}
 	}
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+	vram_num_vertices = getNumVertices();
+	vram_num_indices = (unsigned int)m_indices.size();
 	checkGLErrors();
 	//clear buffers to save memory
 }
 
-bool Mesh::createCollisionModel(bool is_static)
+unsigned int Mesh::getIndexSize()
 {
-	if (collision_model)
-		return true;
+	return indices_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
 
-	double time = getTime();
-	std::cout << "Creating collision model for: " << this->name << " (" << (interleaved.size() ? interleaved.size() : vertices.size()) / 3 << ") ...";
+size_t Mesh::getVertexBytes()
+{
+	return interleaved.size() * sizeof(tInterleaved) +
+		vertices.size() * sizeof(Vector3f) +
+		normals.size() * sizeof(Vector3f) +
+		uvs.size() * sizeof(Vector2f) +
+		m_uvs1.size() * sizeof(Vector2f) +
+		colors.size() * sizeof(Vector4f) +
+		bones.size() * sizeof(Vector4ub) +
+		weights.size() * sizeof(Vector4f);
+}
 
-	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
+size_t Mesh::getIndexBytes()
+{
+	return (m_indices.size() + lod_indices.size()) * getIndexSize();
+}
 
-	if (m_indices.size()) //indexed
-	{
-		collision_model->setTriangleNumber((int)m_indices.size() / 3);
+size_t Mesh::getRAMBytes()
+{
+	size_t bytes = getVertexBytes() + (m_indices.size() + lod_indices.size()) * sizeof(unsigned int) + meshlets.size() * sizeof(sMeshletInfo);
+	if (collision_model)
+		bytes += collision_model->getBytes();
+	return bytes;
+}
 
-		if (interleaved.size())
-			for (unsigned int i = 0; i < m_indices.size(); i+=3)
-			{
-				auto v1 = interleaved[m_indices[i+0]];
-				auto v2 = interleaved[m_indices[i+1]];
-				auto v3 = interleaved[m_indices[i+2]];
-				collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
-			}
-		else
-		for (unsigned int i = 0; i < m_indices.size(); i+=3)
-		{
-			auto v1 = vertices[m_indices[i+0]];
-			auto v2 = vertices[m_indices[i+1]];
-			auto v3 = vertices[m_indices[i+2]];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
-	}
-	else if (interleaved.size()) //is interleaved
+size_t Mesh::getVRAMBytes()
+{
+	if (arena)
 	{
-		collision_model->setTriangleNumber(interleaved.size() / 3);
-		for (unsigned int i = 0; i < interleaved.size(); i+=3)
+		for (size_t i = 0; i < arena->allocations.size(); ++i)
 		{
-			auto v1 = interleaved[i];
-			auto v2 = interleaved[i+1];
-			auto v3 = interleaved[i+2];
-			collision_model->addTriangle(v1.vertex.v, v2.vertex.v, v3.vertex.v);
+			const GeometryArena::sAllocation& allocation = arena->allocations[i];
+			if (allocation.mesh == this)
+				return (size_t)allocation.vertices.size * arena->vertex_size + (size_t)allocation.indices.size * arena->index_size;
 		}
+		return 0;
 	}
-	else if (vertices.size()) //non interleaved
+
+	//the size of the buffers, the streams may not be in RAM
+	unsigned int vbos[] = { vertices_vbo_id, uvs_vbo_id, normals_vbo_id, colors_vbo_id, indices_vbo_id, interleaved_vbo_id, bones_vbo_id, weights_vbo_id, uvs1_vbo_id };
+	size_t bytes = 0;
+	for (unsigned int vbo : vbos)
 	{
-		collision_model->setTriangleNumber((int)vertices.size() / 3);
-		for (unsigned int i = 0; i < (int)vertices.size(); i+=3)
-		{
-			auto v1 = vertices[i];
-			auto v2 = vertices[i + 1];
-			auto v3 = vertices[i + 2];
-			collision_model->addTriangle(v1.v, v2.v, v3.v);
-		}
+		if (!vbo)
+			continue;
+		GLint size = 0;
+		glBindBuffer(GL_COPY_READ_BUFFER, vbo); //not bound to the VAOs
+		glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+		bytes += size;
 	}
-	else
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	return bytes;
+}
+
+float Mesh::getUVDensity()
+{
+	if (uv_density == 0.0f && hasCPUData())
+	{
+		bool use_interleaved = interleaved.size() > 0;
+		unsigned int num_vertices = getNumVertices();
+		unsigned int num_indices = m_indices.size() ? (unsigned int)m_indices.size() : num_vertices;
+		double area = 0.0, uv_area = 0.0;
+		if (use_interleaved || uvs.size() == vertices.size())
+			for (unsigned int i = 0; i + 2 < num_indices; i += 3)
+			{
+				Vector3f p[3];
+				Vector2f uv[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					unsigned int index = m_indices.size() ? m_indices[i + k] : i + k;
+					p[k] = use_interleaved ? interleaved[index].vertex : vertices[index];
+					uv[k] = use_interleaved ? interleaved[index].uv : uvs[index];
+				}
+				area += (p[1] - p[0]).cross(p[2] - p[0]).length() * 0.5;
+				Vector2f e1 = uv[1] - uv[0];
+				Vector2f e2 = uv[2] - uv[0];
+				uv_area += fabs(e1.x * e2.y - e1.y * e2.x) * 0.5;
+			}
+		uv_density = area > 0.0 && uv_area > 0.0 ? (float)sqrt(uv_area / area) : -1.0f;
+	}
+
+	if (uv_density > 0.0f)
+		return uv_density;
+	return radius > 0.0f ? 0.5f / radius : 1.0f;
+}
+
+bool Mesh::createCollisionModel()
+{
+	if (collision_model)
+		return true;
+
+	//streams uploaded straight from the bin are not in RAM, the bin may have the BVH or we fetch them again
+	if (!hasCPUData())
 	{
-		assert(0 && "mesh without vertices, cannot create collision model");
-		std::cout << "[ERROR]" << std::endl;
-		return false;
+		if (!bin_filename.size())
+			return false;
+		if (readBinCollisionModel(bin_filename.c_str(), bin_offset))
+			return true;
+		if (!readBin(bin_filename.c_str(), false, bin_offset))
+			return false;
+		if (collision_model) //stored in the bin
+			return true;
 	}
-	collision_model->finalize();
-	this->collision_model = collision_model;
+
+	double time = getTime();
+	std::cout << "Creating collision model for: " << this->name << " (" << (m_indices.size() ? m_indices.size() : getNumVertices()) / 3 << ") ...";
+
+	TriangleBVH* bvh = new TriangleBVH();
+	unsigned int num_vertices = getNumVertices();
+	const unsigned int* indices = m_indices.size() ? &m_indices[0] : NULL;
+	if (interleaved.size())
+		bvh->build((const unsigned char*)&interleaved[0].vertex, sizeof(tInterleaved), num_vertices, indices, (unsigned int)m_indices.size());
+	else
+		bvh->build((const unsigned char*)&vertices[0], sizeof(Vector3f), num_vertices, indices, (unsigned int)m_indices.size());
+	this->collision_model = bvh;
 
 	std::cout << "[OK] Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 
@@ -679,22 +1201,47 @@ bool Mesh::testRayCollision(Matrix44 model, Vector3f start, Vector3f front, Vect
 			return false;
 	}
 
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	//the ray goes to object space, the direction is not normalized so the distances are still in world units
+	Matrix44 inv = model;
+	inv.inverse();
+	Vector3f local_start = inv * start;
+	Vector3f local_front = inv.rotateVector(front);
 
-	collision_model->setTransform( model.m );
-	if (collision_model->rayCollision( start.v , front.v, true,0.0, max_ray_dist) == false)
+	float t;
+	Vector3f triangle[3];
+	if (!collision_model->testRay(local_start, local_front, max_ray_dist, t, triangle))
 		return false;
 
-	collision_model->getCollisionPoint( collision.v, in_object_space);
+	if (in_object_space)
+		collision = local_start + local_front * t;
+	else
+	{
+		collision = start + front * t;
+		for (int i = 0; i < 3; ++i)
+			triangle[i] = model * triangle[i];
+	}
+
+	Vector3f v1 = triangle[1] - triangle[0];
+	Vector3f v2 = triangle[2] - triangle[0];
+	v1.normalize();
+	v2.normalize();
+	normal = v1.cross(v2);
+
+	return true;
+}
+
+bool Mesh::testSphereCollision(Matrix44 model, Vector3f center, float radius, Vector3f& collision, Vector3f& normal)
+{
+	if (!this->collision_model)
+		if (!createCollisionModel())
+			return false;
 
-	float t1[9],t2[9];
-	collision_model->getCollidingTriangles(t1,t2, in_object_space);
+	Vector3f triangle[3];
+	if (!collision_model->testSphere(center, radius, collision, triangle, &model))
+		return false;
 
-	Vector3f v1;
-	Vector3f v2;
-	v1=Vector3f(t1[3]-t1[0],t1[4]-t1[1],t1[5]-t1[2]);
-	v2=Vector3f(t1[6]-t1[0],t1[7]-t1[1],t1[8]-t1[2]);
+	Vector3f v1 = triangle[1] - triangle[0];
+	Vector3f v2 = triangle[2] - triangle[0];
 	v1.normalize();
 	v2.normalize();
 	normal = v1.cross(v2);
@@ -702,58 +1249,390 @@ bool Mesh::testRayCollision(Matrix44 model, Vector3f start, Vector3f front, Vect
 	return true;
 }
 
-bool Mesh::testSphereCollision(Matrix44 model, Vector3f center, float radius, Vector3f& collision, Vector3f& normal)
+bool Mesh::interleaveBuffers()
+{
+	if (!vertices.size() || !normals.size() || !uvs.size())
+		return false;
+
+	assert(vertices.size() == normals.size() && normals.size() == uvs.size());
+
+	interleaved.resize(vertices.size());
+
+	for (unsigned int i = 0; i < vertices.size(); ++i)
+	{
+		interleaved[i].vertex = vertices[i];
+		interleaved[i].normal = normals[i];
+		interleaved[i].uv = uvs[i];
+	}
+
+	vertices.resize(0);
+	normals.resize(0);
+	uvs.resize(0);
+
+	return true;
+}
+
+template<typename T> void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& remap, unsigned int num_vertices)
+{
+	if (!stream.size())
+		return;
+	std::vector<T> result(num_vertices);
+	for (size_t i = 0; i < remap.size(); ++i)
+		if (remap[i] != MESHOPT_INVALID_INDEX)
+			result[remap[i]] = stream[i];
+	stream.swap(result);
+}
+
+void Mesh::remapVertices(const std::vector<unsigned int>& remap, unsigned int num_vertices)
+{
+	assert(remap.size() == getNumVertices());
+	remapStream(vertices, remap, num_vertices);
+	remapStream(normals, remap, num_vertices);
+	remapStream(uvs, remap, num_vertices);
+	remapStream(m_uvs1, remap, num_vertices);
+	remapStream(colors, remap, num_vertices);
+	remapStream(interleaved, remap, num_vertices);
+	remapStream(bones, remap, num_vertices);
+	remapStream(weights, remap, num_vertices);
+
+	for (size_t i = 0; i < m_indices.size(); ++i)
+		m_indices[i] = remap[m_indices[i]];
+	for (size_t i = 0; i < lod_indices.size(); ++i)
+		lod_indices[i] = remap[lod_indices[i]];
+}
+
+//appends the bytes of one stream element, used to compare full vertices
+template<typename T> void packStream(std::vector<unsigned char>& data, const std::vector<T>& stream, unsigned int i)
+{
+	if (!stream.size())
+		return;
+	const unsigned char* bytes = (const unsigned char*)&stream[i];
+	data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+bool Mesh::optimize()
+{
+	unsigned int num_vertices = getNumVertices();
+	if (!num_vertices || (m_indices.size() ? m_indices.size() : num_vertices) % 3)
+		return false; //only triangle lists
+
+	//triangle soups become indexed
+	if (!m_indices.size())
+	{
+		m_indices.resize(num_vertices);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			m_indices[i] = i;
+	}
+
+	float acmr_before, atvr_before, acmr, atvr;
+	analyzeVertexCache(&m_indices[0], (unsigned int)m_indices.size(), num_vertices, acmr_before, atvr_before);
+
+	//weld identical vertices (all the streams must match)
+	std::vector<unsigned char> packed;
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		packStream(packed, vertices, i);
+		packStream(packed, normals, i);
+		packStream(packed, uvs, i);
+		packStream(packed, m_uvs1, i);
+		packStream(packed, colors, i);
+		packStream(packed, interleaved, i);
+		packStream(packed, bones, i);
+		packStream(packed, weights, i);
+	}
+	std::vector<unsigned int> remap;
+	unsigned int stride = (unsigned int)packed.size() / num_vertices;
+	num_vertices = generateVertexRemap(remap, &packed[0], num_vertices, stride);
+	remapVertices(remap, num_vertices);
+
+	std::vector<Vector3f> positions(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+
+	//reorder triangles inside every submesh, they must keep their ranges
+	std::vector<unsigned int> clusters;
+	if (submeshes.size())
+		for (size_t i = 0; i < submeshes.size(); ++i)
+		{
+			sSubmeshInfo& submesh = submeshes[i];
+			optimizeVertexCache(&m_indices[submesh.start], submesh.length, num_vertices, &clusters);
+			optimizeOverdraw(&m_indices[submesh.start], submesh.length, positions, clusters);
+		}
+	else
+	{
+		optimizeVertexCache(&m_indices[0], (unsigned int)m_indices.size(), num_vertices, &clusters);
+		optimizeOverdraw(&m_indices[0], (unsigned int)m_indices.size(), positions, clusters);
+	}
+
+	//vertices in the order they are used
+	num_vertices = optimizeVertexFetchRemap(remap, &m_indices[0], (unsigned int)m_indices.size(), num_vertices);
+	remapVertices(remap, num_vertices);
+
+	analyzeVertexCache(&m_indices[0], (unsigned int)m_indices.size(), num_vertices, acmr, atvr);
+	std::cout << "[OPT] ACMR: " << acmr_before << "->" << acmr << " ATVR: " << atvr_before << "->" << atvr << " ";
+
+	if (collision_model)
+	{
+		delete collision_model;
+		collision_model = NULL;
+	}
+
+	//triangles are not in the same order anymore
+	meshlets.clear();
+	meshlets_built = false;
+
+	is_optimized = true;
+	return true;
+}
+
+bool Mesh::buildMeshlets()
+{
+	meshlets.clear();
+	meshlets_built = true;
+	unsigned int num_vertices = getNumVertices();
+	if (!m_indices.size() || m_indices.size() % 3)
+		return false; //only indexed triangle lists
+
+	std::vector<Vector3f> positions(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+
+	//meshlets cannot cross submeshes, they must keep their ranges
+	std::vector<sSubmeshInfo> ranges = submeshes;
+	if (!ranges.size())
+	{
+		ranges.resize(1);
+		ranges[0].start = 0;
+		ranges[0].length = (int)m_indices.size();
+	}
+
+	std::vector<unsigned int> starts;
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		unsigned int* indices = &m_indices[ranges[i].start];
+		GFX::buildMeshlets(indices, ranges[i].length, positions, starts);
+		for (size_t j = 0; j < starts.size(); ++j)
+		{
+			sMeshletInfo meshlet;
+			meshlet.start = ranges[i].start + starts[j] * 3;
+			meshlet.length = (j + 1 < starts.size() ? starts[j + 1] * 3 : ranges[i].length) - starts[j] * 3;
+			computeMeshletBounds(&m_indices[meshlet.start], meshlet.length, positions, meshlet.center, meshlet.radius, meshlet.cone_apex, meshlet.cone_axis, meshlet.cone_cutoff);
+			meshlets.push_back(meshlet);
+		}
+	}
+
+	std::cout << "[MESHLETS: " << meshlets.size() << "] ";
+	return true;
+}
+
+unsigned int Mesh::cullMeshlets(const Matrix44& model, Camera* camera, bool cull_backfaces, std::vector<sIndexRange>& ranges)
 {
-	if (!this->collision_model)
-		if (!createCollisionModel())
-			return false;
-
-	CollisionModel3D* collision_model = (CollisionModel3D*)this->collision_model;
-	assert(collision_model && "CollisionModel3D must be created before using it, call createCollisionModel");
+	ranges.clear();
+
+	//cones are tested in object space, so they work with any scale
+	Matrix44 inv_model = model;
+	inv_model.inverse();
+	Vector3f local_eye = inv_model * camera->eye;
+	Vector3f local_front = inv_model.rotateVector(camera->center - camera->eye);
+	bool orthographic = camera->type == Camera::ORTHOGRAPHIC;
+
+	//mirrored transforms flip the winding, we do not cull by normal then
+	Vector3f axes[3] = { Vector3f(model.m[0], model.m[1], model.m[2]), Vector3f(model.m[4], model.m[5], model.m[6]), Vector3f(model.m[8], model.m[9], model.m[10]) };
+	if (dot(cross(axes[0], axes[1]), axes[2]) < 0)
+		cull_backfaces = false;
+
+	//spheres are tested in world space
+	float scale = 0;
+	for (int i = 0; i < 3; ++i)
+		scale = axes[i].length() > scale ? axes[i].length() : scale;
+
+	//visible ranges, consecutive meshlets are merged
+	int last_end = -1;
+	unsigned int num_indices = 0;
+	for (size_t i = 0; i < meshlets.size(); ++i)
+	{
+		sMeshletInfo& meshlet = meshlets[i];
+		if (camera->testSphereInFrustum(model * meshlet.center, meshlet.radius * scale) == CLIP_OUTSIDE)
+			continue;
+
+		if (cull_backfaces && meshlet.cone_cutoff < 1.0f)
+		{
+			Vector3f view = orthographic ? local_front : meshlet.cone_apex - local_eye;
+			if (dot(view.normalize(), meshlet.cone_axis) >= meshlet.cone_cutoff)
+				continue;
+		}
 
-	collision_model->setTransform(model.m);
-	if (collision_model->sphereCollision(center.v, radius) == false)
-		return false;
+		if (meshlet.start == last_end)
+			ranges.back().length += meshlet.length;
+		else
+		{
+			sIndexRange range;
+			range.start = meshlet.start;
+			range.length = meshlet.length;
+			ranges.push_back(range);
+		}
+		last_end = meshlet.start + meshlet.length;
+		num_indices += meshlet.length;
+	}
 
-	collision_model->getCollisionPoint(collision.v, false);
+	return num_indices;
+}
 
-	float t1[9], t2[9];
-	collision_model->getCollidingTriangles(t1, t2, false);
+void Mesh::renderMeshlets(unsigned int primitive, const Matrix44& model, Camera* camera, bool cull_backfaces)
+{
+	if (!meshlets.size() || (!indices_vbo_id && !arena))
+	{
+		render(primitive);
+		return;
+	}
 
-	Vector3f v1;
-	Vector3f v2;
-	v1 = Vector3f(t1[3] - t1[0], t1[4] - t1[1], t1[5] - t1[2]);
-	v2 = Vector3f(t1[6] - t1[0], t1[7] - t1[1], t1[8] - t1[2]);
-	v1.normalize();
-	v2.normalize();
-	normal = v1.cross(v2);
+	Shader* shader = Shader::current;
+	if (!shader || !shader->compiled)
+	{
+		assert(0 && "no shader or shader not compiled or enabled");
+		return;
+	}
 
-	return true;
-}
+	static std::vector<sIndexRange> ranges;
+	unsigned int num_indices = cullMeshlets(model, camera, cull_backfaces, ranges);
+	if (!ranges.size())
+		return;
 
-bool Mesh::interleaveBuffers()
-{
-	if (!vertices.size() || !normals.size() || !uvs.size())
-		return false;
+	static std::vector<GLsizei> counts;
+	static std::vector<const void*> offsets;
+	static std::vector<GLint> base_vertices;
+	counts.resize(ranges.size());
+	offsets.resize(ranges.size());
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		counts[i] = ranges[i].length;
+		offsets[i] = (const void*)((size_t)(ranges[i].start + (arena ? arena_index_start : 0)) * getIndexSize());
+	}
 
-	assert(vertices.size() == normals.size() && normals.size() == uvs.size());
+	GLuint vao = getVAO(shader);
+	if (vao)
+	{
+		glBindVertexArray(vao);
+		if (compact)
+		{
+			shader->setUniform3("u_vertex_offset", quantization_offset);
+			shader->setUniform3("u_vertex_scale", quantization_scale);
+			shader->setUniform2("u_uv_offset", uv_quantization_offset.x, uv_quantization_offset.y);
+			shader->setUniform2("u_uv_scale", uv_quantization_scale.x, uv_quantization_scale.y);
+		}
+	}
+	else
+	{
+		enableBuffers(shader);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena ? arena->indices_vbo_id : indices_vbo_id);
+	}
 
-	interleaved.resize(vertices.size());
+	if (arena)
+	{
+		base_vertices.assign(ranges.size(), (GLint)arena_vertex_start);
+		glMultiDrawElementsBaseVertex(primitive, &counts[0], indices_type, &offsets[0], (GLsizei)counts.size(), &base_vertices[0]);
+	}
+	else
+		glMultiDrawElements(primitive, &counts[0], indices_type, &offsets[0], (GLsizei)counts.size());
+	checkGLErrors();
 
-	for (unsigned int i = 0; i < vertices.size(); ++i)
+	if (vao)
 	{
-		interleaved[i].vertex = vertices[i];
-		interleaved[i].normal = normals[i];
-		interleaved[i].uv = uvs[i];
+		glBindVertexArray(0);
+		if (compact)
+		{
+			shader->setUniform3("u_vertex_offset", 0.0f, 0.0f, 0.0f);
+			shader->setUniform3("u_vertex_scale", 1.0f, 1.0f, 1.0f);
+			shader->setUniform2("u_uv_offset", 0.0f, 0.0f);
+			shader->setUniform2("u_uv_scale", 1.0f, 1.0f);
+		}
+	}
+	else
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		disableBuffers(shader);
 	}
 
-	vertices.resize(0);
-	normals.resize(0);
-	uvs.resize(0);
+	num_triangles_rendered += num_indices / 3;
+	num_meshes_rendered++;
+}
 
-	return true;
+bool Mesh::generateLODs(float max_error, int max_lods)
+{
+	lods.clear();
+	lod_indices.clear();
+	lods_generated = true;
+	unsigned int num_vertices = getNumVertices();
+	if (!m_indices.size() || m_indices.size() % 3)
+		return false; //only indexed triangle lists
+
+	std::vector<Vector3f> positions(num_vertices);
+	Vector3f min_pos, max_pos;
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		positions[i] = interleaved.size() ? interleaved[i].vertex : vertices[i];
+		if (i == 0)
+			min_pos = max_pos = positions[i];
+		min_pos.setMin(positions[i]);
+		max_pos.setMax(positions[i]);
+	}
+
+	//simplifyMesh errors are relative to the biggest side, ours to the radius (as the bounding used to select them)
+	Vector3f size = max_pos - min_pos;
+	float extent = size.x > size.y ? (size.x > size.z ? size.x : size.z) : (size.y > size.z ? size.y : size.z);
+	float mesh_radius = size.length() * 0.5f;
+	if (extent <= 0)
+		return false;
+	float extent_to_radius = extent / mesh_radius;
+
+	//every level is simplified from the previous one, so the errors add up
+	std::vector<unsigned int> current = m_indices;
+	std::vector<unsigned int> simplified;
+	float total_error = 0;
+	for (int i = 0; i < max_lods; ++i)
+	{
+		if (current.size() < 64 * 3 || total_error >= max_error)
+			break;
+		unsigned int target = (unsigned int)(current.size() / 6) * 3;
+		float error = 0;
+		unsigned int num_indices = simplifyMesh(simplified, &current[0], (unsigned int)current.size(), positions, target, (max_error - total_error) / extent_to_radius, &error);
+		if (num_indices > current.size() * 0.9f)
+			break; //not worth another level
+		total_error += error * extent_to_radius;
+
+		sLODInfo lod;
+		lod.start = (int)(m_indices.size() + lod_indices.size());
+		lod.length = (int)num_indices;
+		lod.error = total_error;
+		lods.push_back(lod);
+		lod_indices.insert(lod_indices.end(), simplified.begin(), simplified.end());
+		optimizeVertexCache(&lod_indices[lod.start - m_indices.size()], num_indices, num_vertices);
+		current.swap(simplified);
+	}
+
+	std::cout << "[LODS: " << lods.size() << "] ";
+	return lods.size() != 0;
 }
 
+//streams stored in the bin, their offsets are in the header
+enum eMeshBinStream {
+	MBIN_INTERLEAVED,
+	MBIN_VERTICES,
+	MBIN_NORMALS,
+	MBIN_UVS,
+	MBIN_UVS1,
+	MBIN_COLORS,
+	MBIN_INDICES, //m_indices followed by lod_indices, with index_size bytes each (as in VRAM)
+	MBIN_BONES,
+	MBIN_WEIGHTS,
+	MBIN_BONES_INFO,
+	MBIN_SUBMESHES,
+	MBIN_LODS,
+	MBIN_MESHLETS,
+	MBIN_BVH, //TriangleBVH nodes followed by its packets, at the end so the rest of streams dont depend on it
+	MBIN_MAX_STREAMS = 16
+};
+
 typedef struct 
 {
 	int version;
@@ -768,38 +1647,66 @@ typedef struct
 	int num_bones;
 	int num_submeshes;
 	Matrix44 bind_matrix;
-	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
-	char extra[32]; //unused
+	char optimized; //1 if Mesh::optimize was applied before writing it
+	char lods_generated; //1 if Mesh::generateLODs was applied
+	char index_size; //2 or 4
+	char meshlets_built; //1 if Mesh::buildMeshlets was applied
+	int num_lods;
+	int num_lod_indices;
+	unsigned int offsets[MBIN_MAX_STREAMS]; //from the start of the file, 0 if the stream is not stored
+	int num_meshlets;
+	int num_bvh_nodes; //0 if the collision BVH is not stored (older bins have zeros here)
+	int num_bvh_packets;
+	float uv_density; //0 if it was not computed (older bins have zeros here)
+	char extra[16]; //unused
 } sMeshInfo;
 
-bool Mesh::readBin(const char* filename)
+//upload a stream straight from the file mapping
+static void uploadBinStream(unsigned int& vbo_id, unsigned int target, const unsigned char* data, size_t bytes)
 {
-	FILE *f;
-	assert(filename);
+	if (vbo_id == 0)
+		glGenBuffersARB(1, &vbo_id);
+	glBindBufferARB(target, vbo_id);
+	glBufferDataARB(target, bytes, data, GL_STATIC_DRAW_ARB);
+}
 
-	struct stat stbuffer;
+template<typename T> void readBinStream(std::vector<T>& stream, const unsigned char* data, unsigned int offset, unsigned int num)
+{
+	if (!offset || !num)
+		return;
+	stream.resize(num);
+	memcpy((void*)&stream[0], data + offset, sizeof(T) * num);
+}
 
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
+bool Mesh::readBin(const char* filename, bool only_vram, size_t offset)
+{
+	assert(filename);
+
+	sMappedFile file;
+	if (!mapFile(filename, file))
 		return false;
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	bool result = offset < file.size && readBinData(file.data + offset, file.size - offset, only_vram, interleave_meshes, filename);
+	if (result && !hasCPUData())
+	{
+		bin_filename = filename;
+		bin_offset = offset;
+	}
+	unmapFile(file);
+	return result;
+}
 
+bool Mesh::readBinData(const unsigned char* data, size_t size, bool only_vram, bool interleave, const char* filename)
+{
 	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if (size < 4 + sizeof(sMeshInfo) || memcmp(data, "MBIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
 		return false;
 	}
 
-	char* pos = data + 4;
 	sMeshInfo info;
-	memcpy(&info,pos,sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
+	memcpy(&info, data + 4, sizeof(sMeshInfo));
 
 	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
 	{
@@ -807,88 +1714,194 @@ bool Mesh::readBin(const char* filename)
 		return false;
 	}
 
-	if (info.streams[0] == 'I')
-	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
-	}
-	else if (info.streams[0] == 'V')
+	//counts from a corrupted file could make the sizes below wrap
+	if (info.size <= 0 || info.num_indices < 0 || info.num_lod_indices < 0 || info.num_bones < 0 || info.num_submeshes < 0 || info.num_lods < 0 ||
+		info.num_meshlets < 0 || info.num_bvh_nodes < 0 || info.num_bvh_packets < 0 || (info.index_size != 2 && info.index_size != 4) ||
+		(!info.offsets[MBIN_INTERLEAVED] && !info.offsets[MBIN_VERTICES]))
 	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3f) * info.size);
-		pos += sizeof(Vector3f) * info.size;
+		std::cout << "[ERROR] loading BIN: corrupted header: " << filename << std::endl;
+		return false;
 	}
 
-	if (info.streams[1] == 'N')
-	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3f) * info.size);
-		pos += sizeof(Vector3f) * info.size;
-	}
+	//bytes of every stream, to validate them against the file size
+	size_t index_bytes = ((size_t)info.num_indices + info.num_lod_indices) * info.index_size;
+	size_t stream_bytes[MBIN_MAX_STREAMS] = { 0 };
+	stream_bytes[MBIN_INTERLEAVED] = sizeof(tInterleaved) * info.size;
+	stream_bytes[MBIN_VERTICES] = sizeof(Vector3f) * info.size;
+	stream_bytes[MBIN_NORMALS] = sizeof(Vector3f) * info.size;
+	stream_bytes[MBIN_UVS] = sizeof(Vector2f) * info.size;
+	stream_bytes[MBIN_UVS1] = sizeof(Vector2f) * info.size;
+	stream_bytes[MBIN_COLORS] = sizeof(Vector4f) * info.size;
+	stream_bytes[MBIN_INDICES] = index_bytes;
+	stream_bytes[MBIN_BONES] = sizeof(Vector4ub) * info.size;
+	stream_bytes[MBIN_WEIGHTS] = sizeof(Vector4f) * info.size;
+	stream_bytes[MBIN_BONES_INFO] = sizeof(BoneInfo) * info.num_bones;
+	stream_bytes[MBIN_SUBMESHES] = sizeof(sSubmeshInfo) * info.num_submeshes;
+	stream_bytes[MBIN_LODS] = sizeof(sLODInfo) * info.num_lods;
+	stream_bytes[MBIN_MESHLETS] = sizeof(sMeshletInfo) * info.num_meshlets;
+	stream_bytes[MBIN_BVH] = sizeof(sBVHNode) * info.num_bvh_nodes + sizeof(sBVHPacket) * info.num_bvh_packets;
+	for (int i = 0; i < MBIN_MAX_STREAMS; ++i)
+		if (info.offsets[i] && (info.offsets[i] % MESH_BIN_ALIGNMENT || info.offsets[i] > size || stream_bytes[i] > size - info.offsets[i]))
+		{
+			std::cout << "[ERROR] loading BIN: corrupted streams: " << filename << std::endl;
+			return false;
+		}
 
-	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2f) * info.size);
-		pos += sizeof(Vector2f) * info.size;
-	}
+	aabb_max = info.aabb_max;
+	aabb_min = info.aabb_min;
+	box.center = info.center;
+	box.halfsize = info.halfsize;
+	radius = info.radius;
+	uv_density = info.uv_density;
+	bind_matrix = info.bind_matrix;
+	is_optimized = info.optimized != 0;
+	lods_generated = info.lods_generated != 0;
+	meshlets_built = info.meshlets_built != 0;
+	readBinStream(bones_info, data, info.offsets[MBIN_BONES_INFO], info.num_bones);
+	readBinStream(submeshes, data, info.offsets[MBIN_SUBMESHES], info.num_submeshes);
+	readBinStream(lods, data, info.offsets[MBIN_LODS], info.num_lods);
+	readBinStream(meshlets, data, info.offsets[MBIN_MESHLETS], info.num_meshlets);
+
+	vram_num_vertices = info.size;
+	vram_num_indices = info.offsets[MBIN_INDICES] ? info.num_indices : 0;
 
-	if (info.streams[3] == 'C')
+	//bins that still need some processing in Mesh::Get must be loaded to RAM
+	bool needs_processing = (optimize_meshes && !is_optimized) || (generate_lods && !lods_generated) || (build_meshlets && !meshlets_built) ||
+		(interleave && !info.offsets[MBIN_INTERLEAVED] && info.offsets[MBIN_NORMALS] && info.offsets[MBIN_UVS]);
+
+	if (only_vram && !needs_processing)
 	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4f) * info.size);
-		pos += sizeof(Vector4f) * info.size;
+		//no copies, the driver reads from the mapping
+		compact = compact_colors = false;
+		releaseVAOs();
+
+		//meshes with only the main streams go to the shared buffers of their index size, separated streams need a conversion
+		if (use_geometry_arena && info.offsets[MBIN_INDICES] && !info.offsets[MBIN_UVS1] && !info.offsets[MBIN_COLORS] && !info.offsets[MBIN_BONES] && !info.offsets[MBIN_WEIGHTS])
+		{
+			std::vector<tInterleaved> packed;
+			const void* vertex_data = data + info.offsets[MBIN_INTERLEAVED];
+			if (!info.offsets[MBIN_INTERLEAVED])
+			{
+				packInterleaved(packed, info.size, (const Vector3f*)(data + info.offsets[MBIN_VERTICES]),
+					info.offsets[MBIN_NORMALS] ? (const Vector3f*)(data + info.offsets[MBIN_NORMALS]) : NULL,
+					info.offsets[MBIN_UVS] ? (const Vector2f*)(data + info.offsets[MBIN_UVS]) : NULL);
+				vertex_data = &packed[0];
+			}
+
+			unsigned int num_all_indices = info.num_indices + info.num_lod_indices;
+			GeometryArena* target = GeometryArena::Get(GeometryArena::getLayout(false, info.index_size == 2));
+			if (target->allocate(this, vertex_data, info.size, data + info.offsets[MBIN_INDICES], num_all_indices))
+			{
+				indices_type = target->index_type;
+				checkGLErrors();
+				return true;
+			}
+		}
+
+		if (info.offsets[MBIN_INTERLEAVED])
+			uploadBinStream(interleaved_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_INTERLEAVED], stream_bytes[MBIN_INTERLEAVED]);
+		if (info.offsets[MBIN_VERTICES])
+			uploadBinStream(vertices_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_VERTICES], stream_bytes[MBIN_VERTICES]);
+		if (info.offsets[MBIN_NORMALS])
+			uploadBinStream(normals_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_NORMALS], stream_bytes[MBIN_NORMALS]);
+		if (info.offsets[MBIN_UVS])
+			uploadBinStream(uvs_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_UVS], stream_bytes[MBIN_UVS]);
+		if (info.offsets[MBIN_UVS1])
+			uploadBinStream(uvs1_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_UVS1], stream_bytes[MBIN_UVS1]);
+		if (info.offsets[MBIN_COLORS])
+			uploadBinStream(colors_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_COLORS], stream_bytes[MBIN_COLORS]);
+		if (info.offsets[MBIN_BONES])
+			uploadBinStream(bones_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_BONES], stream_bytes[MBIN_BONES]);
+		if (info.offsets[MBIN_WEIGHTS])
+			uploadBinStream(weights_vbo_id, GL_ARRAY_BUFFER_ARB, data + info.offsets[MBIN_WEIGHTS], stream_bytes[MBIN_WEIGHTS]);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+		if (info.offsets[MBIN_INDICES])
+		{
+			uploadBinStream(indices_vbo_id, GL_ELEMENT_ARRAY_BUFFER, data + info.offsets[MBIN_INDICES], index_bytes);
+			indices_type = info.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+			glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+		checkGLErrors();
+		return true;
 	}
 
-	if (info.streams[4] == 'I')
+	readBinStream(interleaved, data, info.offsets[MBIN_INTERLEAVED], info.size);
+	readBinStream(vertices, data, info.offsets[MBIN_VERTICES], info.size);
+	readBinStream(normals, data, info.offsets[MBIN_NORMALS], info.size);
+	readBinStream(uvs, data, info.offsets[MBIN_UVS], info.size);
+	readBinStream(m_uvs1, data, info.offsets[MBIN_UVS1], info.size);
+	readBinStream(colors, data, info.offsets[MBIN_COLORS], info.size);
+	readBinStream(bones, data, info.offsets[MBIN_BONES], info.size);
+	readBinStream(weights, data, info.offsets[MBIN_WEIGHTS], info.size);
+
+	//CPU indices are always 32 bits
+	if (info.offsets[MBIN_INDICES])
 	{
 		m_indices.resize(info.num_indices);
-		memcpy((void*)&m_indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
+		lod_indices.resize(info.num_lod_indices);
+		const unsigned char* indices = data + info.offsets[MBIN_INDICES];
+		for (int i = 0; i < info.num_indices + info.num_lod_indices; ++i)
+		{
+			unsigned int index = info.index_size == 2 ? ((const unsigned short*)indices)[i] : ((const unsigned int*)indices)[i];
+			if (i < info.num_indices)
+				m_indices[i] = index;
+			else
+				lod_indices[i - info.num_indices] = index;
+		}
 	}
 
-	if (info.streams[5] == 'B')
+	if (info.offsets[MBIN_BVH] && info.num_bvh_nodes)
 	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
+		if (collision_model)
+			delete collision_model;
+		collision_model = new TriangleBVH();
+		readBinStream(collision_model->nodes, data, info.offsets[MBIN_BVH], info.num_bvh_nodes);
+		readBinStream(collision_model->packets, data, info.offsets[MBIN_BVH] + sizeof(sBVHNode) * info.num_bvh_nodes, info.num_bvh_packets);
 	}
 
-	if (info.streams[6] == 'W')
+	return true;
+}
+
+bool Mesh::readBinCollisionModel(const char* filename, size_t offset)
+{
+	sMappedFile file;
+	if (!mapFile(filename, file))
+		return false;
+
+	//the header was validated when the streams were uploaded from this bin
+	sMeshInfo info;
+	bool result = offset + 4 + sizeof(sMeshInfo) <= file.size;
+	if (result)
 	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4f) * info.size);
-		pos += sizeof(Vector4f) * info.size;
+		memcpy(&info, file.data + offset + 4, sizeof(sMeshInfo));
+		result = info.offsets[MBIN_BVH] && info.num_bvh_nodes &&
+			offset + info.offsets[MBIN_BVH] + sizeof(sBVHNode) * info.num_bvh_nodes + sizeof(sBVHPacket) * info.num_bvh_packets <= file.size;
 	}
-
-	if (info.streams[7] == 'u')
+	if (result)
 	{
-		m_uvs1.resize(info.size);
-		memcpy((void*)&m_uvs1[0], pos, sizeof(Vector2f) * info.size);
-		pos += sizeof(Vector2f) * info.size;
+		collision_model = new TriangleBVH();
+		readBinStream(collision_model->nodes, file.data + offset, info.offsets[MBIN_BVH], info.num_bvh_nodes);
+		readBinStream(collision_model->packets, file.data + offset, info.offsets[MBIN_BVH] + sizeof(sBVHNode) * info.num_bvh_nodes, info.num_bvh_packets);
 	}
+	unmapFile(file);
+	return result;
+}
 
-	if (info.num_bones)
+//pads the file to the alignment and writes the stream, storing where it starts (relative to the start of the mesh)
+static void writeBinStream(FILE* f, long start, sMeshInfo& info, int stream, const void* data, size_t bytes)
+{
+	if (!bytes)
+		return;
+	static const char zeros[MESH_BIN_ALIGNMENT] = { 0 };
+	long pos = ftell(f);
+	if (pos % MESH_BIN_ALIGNMENT)
 	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
+		fwrite(zeros, MESH_BIN_ALIGNMENT - pos % MESH_BIN_ALIGNMENT, 1, f);
+		pos = ftell(f);
 	}
-
-	aabb_max = info.aabb_max;
-	aabb_min = info.aabb_min;
-	box.center = info.center;
-	box.halfsize = info.halfsize;
-	radius = info.radius;
-	bind_matrix = info.bind_matrix;
-
-	submeshes.resize(info.num_submeshes);
-	memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
-	pos += sizeof(sSubmeshInfo) * info.num_submeshes;
-
-	createCollisionModel();
-	return true;
+	info.offsets[stream] = (unsigned int)(pos - start);
+	fwrite(data, bytes, 1, f);
 }
 
 bool Mesh::writeBin(const char* filename)
@@ -904,6 +1917,17 @@ bool Mesh::writeBin(const char* filename)
 		return false;
 	}
 
+	writeBinData(f);
+	fclose(f);
+	return true;
+}
+
+void Mesh::writeBinData(FILE* f)
+{
+	assert( vertices.size() || interleaved.size() );
+	long start = ftell(f);
+	assert(start % MESH_BIN_ALIGNMENT == 0 && "streams would be misaligned");
+
 	//watermark
 	fwrite("MBIN",sizeof(char),4,f);
 
@@ -918,53 +1942,79 @@ bool Mesh::writeBin(const char* filename)
 	info.center = box.center;
 	info.halfsize = box.halfsize;
 	info.radius = radius;
+	if (hasCPUData())
+		getUVDensity();
+	info.uv_density = uv_density;
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
-
-	info.streams[0] = interleaved.size() ? 'I' : 'V';
-	info.streams[1] = normals.size() ? 'N' : ' ';
-	info.streams[2] = uvs.size() ? 'U' : ' ';
-	info.streams[3] = colors.size() ? 'C' : ' ';
-	info.streams[4] = m_indices.size() ? 'I' : ' ';
-	info.streams[5] = bones.size() ? 'B' : ' ';
-	info.streams[6] = weights.size() ? 'W' : ' ';
-	info.streams[7] = m_uvs1.size() ? 'u' : ' '; //uv second set
-
-	//write info
+	info.optimized = is_optimized ? 1 : 0;
+	info.lods_generated = lods_generated ? 1 : 0;
+	info.meshlets_built = meshlets_built ? 1 : 0;
+	info.num_meshlets = meshlets.size();
+	info.num_lods = lods.size();
+	info.num_lod_indices = lod_indices.size();
+	info.index_size = getNumVertices() <= 0xFFFF ? 2 : 4; //same rule as uploadToVRAM
+
+	//write info, it is written again at the end with the offsets
 	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
 
 	//write streams
 	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
+		writeBinStream(f, start, info, MBIN_INTERLEAVED, &interleaved[0], interleaved.size() * sizeof(tInterleaved));
 	else
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3f), 1, f);
+		writeBinStream(f, start, info, MBIN_VERTICES, &vertices[0], vertices.size() * sizeof(Vector3f));
 		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(Vector3f), 1, f);
+			writeBinStream(f, start, info, MBIN_NORMALS, &normals[0], normals.size() * sizeof(Vector3f));
 		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2f), 1, f);
+			writeBinStream(f, start, info, MBIN_UVS, &uvs[0], uvs.size() * sizeof(Vector2f));
 	}
-
+	if (m_uvs1.size())
+		writeBinStream(f, start, info, MBIN_UVS1, &m_uvs1[0], m_uvs1.size() * sizeof(Vector2f));
 	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4f), 1, f);
+		writeBinStream(f, start, info, MBIN_COLORS, &colors[0], colors.size() * sizeof(Vector4f));
 
 	if (m_indices.size())
-		fwrite((void*)&m_indices[0], m_indices.size() * sizeof(unsigned int), 1, f);
+	{
+		std::vector<unsigned int> indices(m_indices);
+		indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+		if (info.index_size == 2)
+		{
+			std::vector<unsigned short> indices16(indices.begin(), indices.end());
+			writeBinStream(f, start, info, MBIN_INDICES, &indices16[0], indices16.size() * sizeof(unsigned short));
+		}
+		else
+			writeBinStream(f, start, info, MBIN_INDICES, &indices[0], indices.size() * sizeof(unsigned int));
+	}
 
 	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
+		writeBinStream(f, start, info, MBIN_BONES, &bones[0], bones.size() * sizeof(Vector4ub));
 	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4f), 1, f);
+		writeBinStream(f, start, info, MBIN_WEIGHTS, &weights[0], weights.size() * sizeof(Vector4f));
 	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
-	if (m_uvs1.size())
-		fwrite((void*)&m_uvs1[0], m_uvs1.size() * sizeof(Vector2f), 1, f);
-
-	fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
-
-	fclose(f);
-	return true;
+		writeBinStream(f, start, info, MBIN_BONES_INFO, &bones_info[0], bones_info.size() * sizeof(BoneInfo));
+	if (submeshes.size())
+		writeBinStream(f, start, info, MBIN_SUBMESHES, &submeshes[0], submeshes.size() * sizeof(sSubmeshInfo));
+	if (lods.size())
+		writeBinStream(f, start, info, MBIN_LODS, &lods[0], lods.size() * sizeof(sLODInfo));
+	if (meshlets.size())
+		writeBinStream(f, start, info, MBIN_MESHLETS, &meshlets[0], meshlets.size() * sizeof(sMeshletInfo));
+
+	if (bin_collision_models)
+		createCollisionModel();
+	if (collision_model && collision_model->nodes.size())
+	{
+		//the packets go right after the nodes, they keep the alignment
+		info.num_bvh_nodes = collision_model->nodes.size();
+		info.num_bvh_packets = collision_model->packets.size();
+		writeBinStream(f, start, info, MBIN_BVH, &collision_model->nodes[0], collision_model->nodes.size() * sizeof(sBVHNode));
+		fwrite(&collision_model->packets[0], collision_model->packets.size() * sizeof(sBVHPacket), 1, f);
+	}
+
+	fseek(f, start + 4, SEEK_SET);
+	fwrite((void*)&info, sizeof(sMeshInfo), 1, f);
+	fseek(f, 0, SEEK_END);
 }
 
 bool Mesh::loadASE(const char* filename)
@@ -1099,138 +2149,23 @@ bool Mesh::loadASE(const char* filename)
 
 bool Mesh::loadOBJ(const char* filename)
 {
-	std::string data;
-	if(!readFile(filename,data))
+	//indexed, vertices sharing position, uv and normal are merged
+	if (!parseOBJ(filename, vertices, normals, uvs, m_indices, submeshes))
 		return false;
-	char* pos = &data[0];
-	char line[255];
-	int i = 0;
-
-	std::vector<Vector3f> indexed_positions;
-	std::vector<Vector3f> indexed_normals;
-	std::vector<Vector2f> indexed_uvs;
 
 	const float max_float = 10000000;
 	const float min_float = -10000000;
 	aabb_min.set(max_float,max_float,max_float);
 	aabb_max.set(min_float,min_float,min_float);
-
-	unsigned int vertex_i = 0;
-
-	sSubmeshInfo submesh_info;
-	int last_submesh_vertex = 0;
-	memset(&submesh_info, 0, sizeof(submesh_info));
-
-	//parse file
-	while(*pos != 0)
+	for (size_t i = 0; i < vertices.size(); ++i)
 	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3f v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
-		{
-			Vector2f v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
-		{
-			Vector3f v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh: ????
-			//if (uvs.size() == 0 && indexed_uvs.size() )
-			//	uvs.resize(1);
-		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-			else
-				strcpy(submesh_info.material, tokens[1].c_str());
-		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
-			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy( submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
-			}
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3f v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
-			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
-				}
-			}
-		}
+		aabb_min.setMin(vertices[i]);
+		aabb_max.setMax(vertices[i]);
 	}
 
 	box.center = (aabb_max + aabb_min) * 0.5f;
 	box.halfsize = (aabb_max - box.center);
 	radius = (float)fmax( aabb_max.length(), aabb_min.length() );
-
-	submesh_info.length = vertices.size() - last_submesh_vertex;
-	submeshes.push_back(submesh_info);
 	return true;
 }
 
@@ -1674,11 +2609,42 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 		return NULL;
 
 	Mesh* m = new Mesh();
-	std::string name = filename;
+	if (!m->load(filename, auto_upload_to_vram))
+	{
+		delete m;
+		return NULL;
+	}
+
+	m->registerMesh(filename);
+	return m;
+}
+
+Mesh* Mesh::GetAsync(const char* filename)
+{
+	//check if exists
+	Mesh* mesh = Get(filename, true);
+	if (mesh)
+		return mesh;
+
+	//empty mesh until it is loaded, it is not rendered
+	Mesh* temp = new Mesh();
+	temp->loading = true;
+	temp->registerMesh(filename);
+
+	//add action to BG Thread
+	LoadMeshTask* task = new LoadMeshTask(filename);
+	TaskManager::background.addTask(task);
+
+	return temp;
+}
+
+bool Mesh::load(const char* filename, bool upload_to_vram)
+{
+	std::string path = filename;
 
 	//detect format
 	char file_format = 0;
-	std::string ext = name.substr(name.find_last_of(".")+1);
+	std::string ext = path.substr(path.find_last_of(".")+1);
 	if (ext == "ase" || ext == "ASE")
 		file_format = FORMAT_ASE;
 	else if (ext == "obj" || ext == "OBJ")
@@ -1690,7 +2656,7 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 	else 
 	{
 		//if (ext.size()) std::cerr << "Unknown mesh format: " << filename << std::endl;
-		return NULL;
+		return false;
 	}
 
 	//stats
@@ -1702,65 +2668,90 @@ Mesh* Mesh::Get(const char* filename, bool skip_load)
 		binfilename = binfilename + ".mbin";
 
 	//try loading the binary version
-	if (use_binary && m->readBin(binfilename.c_str()) )
+	//compact vertices are quantized from the streams in RAM
+	bool only_vram = upload_to_vram && !keep_cpu_data && !use_compact_vertices;
+	if (use_binary && readBin(binfilename.c_str(), only_vram) )
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
+		if (!hasCPUData())
+			std::cout << "[MMAP VRAM] ";
+		else
 		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
-		}
+			//bins from before the optimization, LOD or interleave stages are processed and stored again
+			bool updated = false;
+			if (optimize_meshes && !is_optimized && optimize())
+				updated = true;
+			if (build_meshlets && !meshlets_built && buildMeshlets())
+				updated = true;
+			if (generate_lods && !lods_generated && generateLODs(lod_max_error))
+				updated = true;
+
+			if (interleave_meshes && interleaved.size() == 0)
+			{
+				std::cout << "[INTERL] ";
+				if (interleaveBuffers())
+					updated = true;
+			}
 
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
+			if (updated && file_format != FORMAT_MBIN)
+				writeBin(filename);
+
+			if (upload_to_vram)
+			{
+				std::cout << "[VRAM] ";
+				uploadToVRAM(use_compact_vertices);
+			}
 		}
 
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		std::cout << "[OK BIN]  Faces: " << getNumVertices() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(filename);
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
+		loaded = loadASE(filename);
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
+		loaded = loadMESH(filename);
 
 	if (!loaded)
 	{
-		delete m;
 		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
+		return false;
 	}
 
+	//weld and reorder, only done once as the result goes to the bin
+	if (optimize_meshes)
+		optimize();
+	if (build_meshlets)
+		buildMeshlets();
+	if (generate_lods)
+		generateLODs(lod_max_error);
+
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
 		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
+		interleaveBuffers();
 	}
 
 	//and upload them to VRAM
-	if (auto_upload_to_vram)
+	if (upload_to_vram)
 	{
 		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
+		uploadToVRAM(use_compact_vertices);
 	}
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	std::cout << "[OK]  Faces: " << vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
 	if (use_binary)
 	{
 		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
+		writeBin(filename);
 		std::cout << "[OK]" << std::endl;
 	}
 
-	m->registerMesh(name);
-	return m;
+	return true;
 }
 
 void Mesh::registerMesh( std::string name )
@@ -1779,4 +2770,85 @@ void Mesh::Release()
 	sMeshesLoaded.clear();
 }
 
-};
\ No newline at end of file
+};
+
+//*********************
+
+LoadMeshTask::LoadMeshTask(const char* str)
+{
+	filename = str;
+}
+
+void LoadMeshTask::onExecute()
+{
+	//no OpenGL here, the upload is done in the main thread
+	GFX::Mesh* mesh = new GFX::Mesh();
+	if (!mesh->load(filename.c_str(), false))
+	{
+		delete mesh;
+		//the placeholder stays empty, it is not waiting anymore
+		std::string name = filename;
+		TaskManager::foreground.addTask(new Task([name]() {
+			auto it = GFX::Mesh::sMeshesLoaded.find(name);
+			if (it != GFX::Mesh::sMeshesLoaded.end())
+				it->second->loading = false;
+			std::cout << "[ERROR]: Mesh failed to load in background: " << name << std::endl;
+		}));
+		return;
+	}
+
+	//the streams are still in RAM, no need to read them again later
+	if (GFX::Mesh::build_collisions_async)
+		mesh->createCollisionModel();
+
+	//mesh loaded, ready to go back to main thread
+	UploadMeshTask* upload_task = new UploadMeshTask(mesh, filename.c_str());
+	TaskManager::foreground.addTask(upload_task);
+}
+
+UploadMeshTask::UploadMeshTask(GFX::Mesh* mesh, const char* filename)
+{
+	this->mesh = mesh;
+	if (filename)
+		this->filename = filename;
+	assert(mesh && "mesh cannot be null");
+}
+
+UploadMeshTask::~UploadMeshTask()
+{
+	//cancelled before executing, the mesh loaded in the background is not owned by anyone else
+	if (filename.size() && mesh)
+		delete mesh;
+}
+
+void UploadMeshTask::onExecute()
+{
+	GFX::Mesh* target = mesh;
+	if (filename.size())
+	{
+		//in case it was released or loaded while I was loading it in the background
+		auto it = GFX::Mesh::sMeshesLoaded.find(filename);
+		if (it == GFX::Mesh::sMeshesLoaded.end() || !it->second->loading)
+		{
+			delete mesh;
+			mesh = NULL;
+			std::cout << "Warning: mesh loaded in background not found in foreground thread" << std::endl;
+			return;
+		}
+
+		//the placeholder takes the data, none of them has buffers in VRAM yet
+		target = it->second;
+		uint32 index = target->index;
+		*target = *mesh;
+		target->index = index; //unique per mesh
+		target->name = filename;
+		mesh->collision_model = NULL; //owned by the placeholder now
+		delete mesh;
+		mesh = NULL;
+	}
+
+	//upload to GPU
+	if (GFX::Mesh::auto_upload_to_vram)
+		target->uploadToVRAM(GFX::Mesh::use_compact_vertices);
+	target->loading = false;
+}
@@ -3,22 +3,29 @@
 
 #include <vector>
 #include "../core/math.h"
+#include "../core/task.h"
 
 #include <map>
 #include <string>
+#include <cstdio>
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
 	Matrix44 bind_pose;
 };
 
+class Camera; //for meshlet culling
+
 namespace GFX {
 
 	class Shader; //for binding
 	class Skeleton; //for skinned meshes
+	class GeometryArena; //shared buffers
+	class TriangleBVH; //collisions
 
-	//version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+	//version 12: streams at aligned offsets so they can be used straight from a file mapping
+#define MESH_BIN_VERSION 12 //this is used to regenerate bins if the format changes
+#define MESH_BIN_ALIGNMENT 16 //every stream in the bin starts at a multiple of this
 
 	struct sSubmeshInfo
 	{
@@ -28,6 +35,32 @@ namespace GFX {
 		int length;//in primitive
 	};
 
+	struct sLODInfo
+	{
+		int start; //in the VRAM index buffer (after m_indices)
+		int length;
+		float error; //max geometric error relative to the mesh radius
+	};
+
+	//range of the index buffer to draw
+	struct sIndexRange
+	{
+		int start; //in m_indices
+		int length;
+	};
+
+	//group of triangles that can be culled on its own
+	struct sMeshletInfo
+	{
+		int start; //in m_indices
+		int length;
+		Vector3f center; //bounding sphere
+		float radius;
+		Vector3f cone_apex; //all triangles are back facing when dot(normalize(cone_apex - eye), cone_axis) >= cone_cutoff
+		Vector3f cone_axis;
+		float cone_cutoff; //1 means never back facing
+	};
+
 	class Mesh
 	{
 	public:
@@ -35,6 +68,18 @@ namespace GFX {
 		static bool use_binary; //always load the binary version of a mesh when possible
 		static bool interleave_meshes; //loaded meshes will me automatically interleaved
 		static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+		static bool optimize_meshes; //loaded meshes will be welded and reordered for the vertex cache
+		static bool use_compact_vertices; //loaded meshes will use tCompactVertex in VRAM when precision allows it
+		static float compact_position_tolerance; //max quantization error allowed in positions (object units)
+		static float compact_uv_tolerance; //max quantization error allowed in uvs (the second set is stored as half floats)
+		static bool generate_lods; //loaded meshes will get a chain of simplified versions (stored in the bin)
+		static bool build_meshlets; //loaded meshes will be split in meshlets to cull them by parts (stored in the bin)
+		static bool keep_cpu_data; //keep the streams in RAM after uploading bins (needed to modify them, collisions reload them when needed)
+		static bool use_geometry_arena; //meshes with only positions, normals and uvs are uploaded to the shared buffers of their layout
+		static bool use_vaos; //the bindings of the streams in VRAM are cached in a VAO per shader attribute layout
+		static bool bin_collision_models; //the collision BVH is built when writing bins and stored in them, so it never has to be built again (a BVH already built is always stored)
+		static bool build_collisions_async; //meshes loaded with GetAsync build their collision BVH in the background thread instead of on the first test
+		static float lod_max_error; //max error of the coarsest LOD relative to the mesh radius
 		static long num_meshes_rendered;
 		static long num_triangles_rendered;
 		static uint32 s_last_index;
@@ -58,7 +103,27 @@ namespace GFX {
 
 		std::vector< tInterleaved > interleaved; //to render interleaved
 
+		//VRAM only layout, 16 bytes per vertex instead of 32
+		struct tCompactVertex {
+			uint16 position[4]; //unorm16 inside the aabb, w is padding
+			uint32 normal; //snorm 10:10:10:2
+			uint16 uv[2]; //unorm16 inside the uv bounds
+		};
+		bool compact; //VRAM buffers use tCompactVertex (positions are dequantized in the shader)
+		bool compact_colors; //colors are stored as unorm8 (only when all of them are in the 0..1 range)
+		Vector3f quantization_offset; //position = offset + unorm16 * scale
+		Vector3f quantization_scale;
+		Vector2f uv_quantization_offset; //uv = offset + unorm16 * scale
+		Vector2f uv_quantization_scale;
+
 		std::vector<unsigned int> m_indices; //for indexed meshes
+		unsigned int indices_type; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, as stored in the indices VBO
+
+		//simplified versions, they reuse the vertex buffer and their indices go after m_indices in VRAM
+		std::vector<sLODInfo> lods; //lods[0] is the first simplified level (LOD 1)
+		std::vector<unsigned int> lod_indices;
+
+		std::vector<sMeshletInfo> meshlets; //contiguous ranges of m_indices (only for the full mesh)
 
 		//for animated meshes
 		std::vector< Vector4ub > bones; //tells which bones afect the vertex (4 max)
@@ -71,6 +136,18 @@ namespace GFX {
 		BoundingBox box;
 
 		float radius;
+		float uv_density; //uv units per object unit (sqrt of the uv area over the surface area), 0 if not computed, negative if it cannot be
+
+		bool loading; //placeholder waiting for the data loaded in the background, it is not rendered
+		bool is_optimized; //optimize() has been applied (also stored in the bin)
+		bool lods_generated; //generateLODs() has been applied, even if no LOD was worth it (also stored in the bin)
+		bool meshlets_built; //buildMeshlets() has been applied (also stored in the bin)
+
+		//sizes of what is in VRAM, still valid when the CPU streams are not in RAM
+		unsigned int vram_num_vertices;
+		unsigned int vram_num_indices; //without the LODs
+		std::string bin_filename; //set when the streams were uploaded straight from this bin without keeping them
+		size_t bin_offset; //where the mesh starts inside bin_filename (bins can be embedded in other files)
 
 		unsigned int vertices_vbo_id;
 		unsigned int uvs_vbo_id;
@@ -83,38 +160,68 @@ namespace GFX {
 		unsigned int weights_vbo_id;
 		unsigned int uvs1_vbo_id;
 
+		//when set the streams are not in the VBOs above but in the shared buffers, indices are of the type of the arena and relative to arena_vertex_start
+		GeometryArena* arena;
+		unsigned int arena_vertex_start;
+		unsigned int arena_index_start;
+
+		//created when rendered with a shader of a new attribute layout (see Shader::getAttribLayout), they store the streams and indices bindings
+		std::vector< std::pair<unsigned long long, unsigned int> > vaos;
+		unsigned int vaos_version; //Shader::s_attrib_layouts_version when the unused ones were last released
+
 		Mesh();
 		~Mesh();
 
 		void clear();
 
-		void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
+		void render(unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0);
 		void renderInstanced(unsigned int primitive, const Matrix44* instanced_models, int number);
+		void renderMeshlets(unsigned int primitive, const Matrix44& model, Camera* camera, bool cull_backfaces = true); //only the meshlets visible from the camera
 		void renderBounding(const Matrix44& model, bool world_bounding = true);
 		void renderFixedPipeline(int primitive); //sloooooooow
 		//void renderAnimated(unsigned int primitive, Skeleton *sk);
 
 		void enableBuffers(Shader* shader);
-		void drawCall(unsigned int primitive, int submesh_id = -1, int num_instances = 0);
+		void drawCall(unsigned int primitive, int submesh_id = -1, int num_instances = 0, int lod = 0); //lod is ignored when rendering a submesh
+		void getIndexRange(int submesh_id, int lod, int& start, int& size); //what drawCall renders (in vertices if there are no indices)
+		unsigned int cullMeshlets(const Matrix44& model, Camera* camera, bool cull_backfaces, std::vector<sIndexRange>& ranges); //visible ranges (consecutive meshlets merged), returns the number of indices
 		void disableBuffers(Shader* shader);
+		unsigned int getVAO(Shader* shader); //0 if some stream is not in VRAM, then enableBuffers must be used
+		void releaseVAOs(); //when the buffers change
 
-		bool readBin(const char* filename);
+		bool readBin(const char* filename, bool only_vram = false, size_t offset = 0); //only_vram uploads the streams from the file mapping without copying them to RAM
+		bool readBinData(const unsigned char* data, size_t size, bool only_vram, bool interleave, const char* filename); //interleave: the bin will be interleaved, so it must be in RAM
 		bool writeBin(const char* filename);
+		void writeBinData(FILE* f); //at the current position, that must be aligned to MESH_BIN_ALIGNMENT
 
 		unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-		unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+		unsigned int getNumLODs() { return (unsigned int)lods.size() + 1; } //including the original
+		unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (vertices.size() ? (unsigned int)vertices.size() : vram_num_vertices); }
+		unsigned int getNumIndices() { return m_indices.size() ? (unsigned int)m_indices.size() : vram_num_indices; } //without the LODs
+		bool hasCPUData() { return interleaved.size() || vertices.size(); }
+		unsigned int getIndexSize(); //in bytes, 2 or 4
+		size_t getVertexBytes(); //bytes used by all the vertex streams
+		size_t getIndexBytes(); //bytes used by the index buffer in VRAM
+		size_t getRAMBytes(); //streams, indices, meshlets and collision model
+		size_t getVRAMBytes(); //its buffers, or its ranges of the arena
+		float getUVDensity(); //computed the first time if the streams are in RAM, otherwise estimated as a texture covering the mesh once
 
 		//collision testing
-		void* collision_model;
-		bool createCollisionModel(bool is_static = false); //is_static sets if the inv matrix should be computed after setTransform (true) or before rayCollision (false)
+		TriangleBVH* collision_model;
+		bool createCollisionModel(); //lazy, streams uploaded straight from a bin read the BVH stored in it (or the streams to build it)
 		//help: model is the transform of the mesh, ray origin and direction, a Vector3 where to store the collision if found, a Vector3 where to store the normal if there was a collision, max ray distance in case the ray should go to infintiy, and in_object_space to get the collision point in object space or world space
 		bool testRayCollision(Matrix44 model, Vector3f ray_origin, Vector3f ray_direction, Vector3f& collision, Vector3f& normal, float max_ray_dist = 3.4e+38F, bool in_object_space = false);
 		bool testSphereCollision(Matrix44 model, Vector3f center, float radius, Vector3f& collision, Vector3f& normal);
 
+		//load without using the manager, it doesnt call OpenGL if upload_to_vram is false (so it can run in a background thread)
+		bool load(const char* filename, bool upload_to_vram = true);
+
 		//loader
 		static Mesh* Get(const char* filename, bool skip_load = false);
+		static Mesh* GetAsync(const char* filename); //returns an empty mesh that is filled once loaded
 		static void Release();
 		void registerMesh(std::string name);
+		static void getAllMeshes(std::vector<Mesh*>& meshes); //registered or not
 
 		//create help meshes
 		void createQuad(float center_x, float center_y, float w, float h, bool flip_uvs);
@@ -130,16 +237,43 @@ namespace GFX {
 		void updateBoundingBox();
 
 		//optimize meshes
-		void uploadToVRAM();
+		void uploadToVRAM(bool compact_layout = false); //compact_layout falls back to floats if the precision is not enough
 		bool interleaveBuffers();
+		bool optimize(); //welds vertices and reorders triangles (vertex cache and overdraw) and vertices (fetch)
+		void remapVertices(const std::vector<unsigned int>& remap, unsigned int num_vertices); //moves every vertex i to remap[i]
+		bool generateLODs(float max_error = 0.02f, int max_lods = 4); //every level has around half the triangles of the previous one
+		bool buildMeshlets(); //reorders the triangles inside every submesh in meshlets
 
 	private:
 		bool loadASE(const char* filename);
 		bool loadOBJ(const char* filename);
 		bool loadMESH(const char* filename); //personal format used for animations
+		bool readBinCollisionModel(const char* filename, size_t offset); //only the BVH stream, false if the bin doesnt have it
+		bool packCompactVertices(std::vector<tCompactVertex>& result);
 		//bool loadOBJTiny(const char* filename);
 	};
 
 };
 
+//Meshes are loaded asynchronously like textures: parsed in a background thread and uploaded to VRAM
+//in the main thread, every upload is a foreground task so they are spread in several frames
+
+class LoadMeshTask : public Task {
+public:
+	std::string filename;
+
+	LoadMeshTask(const char* filename);
+	void onExecute();
+};
+
+class UploadMeshTask : public Task {
+public:
+	std::string filename; //placeholder to fill, empty to upload the mesh itself
+	GFX::Mesh* mesh; //with a filename it is owned by the task until it is executed
+
+	UploadMeshTask(GFX::Mesh* mesh, const char* filename = NULL);
+	~UploadMeshTask();
+	void onExecute();
+};
+
 #endif
@@ -0,0 +1,732 @@
+#include "meshoptimizer.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+namespace GFX {
+
+//FNV-1a, good enough to weld vertices
+static unsigned int hashVertex(const unsigned char* data, unsigned int size)
+{
+	unsigned int hash = 2166136261u;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+unsigned int generateVertexRemap(std::vector<unsigned int>& remap, const unsigned char* vertex_data, unsigned int num_vertices, unsigned int stride)
+{
+	remap.resize(num_vertices);
+
+	//open addressing hash table, at least twice the number of vertices
+	unsigned int table_size = 16;
+	while (table_size < num_vertices * 2)
+		table_size *= 2;
+	unsigned int mask = table_size - 1;
+	std::vector<unsigned int> table(table_size, MESHOPT_INVALID_INDEX);
+
+	unsigned int num_unique = 0;
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		const unsigned char* vertex = vertex_data + (size_t)i * stride;
+		unsigned int bucket = hashVertex(vertex, stride) & mask;
+
+		while (table[bucket] != MESHOPT_INVALID_INDEX)
+		{
+			unsigned int other = table[bucket];
+			if (memcmp(vertex_data + (size_t)other * stride, vertex, stride) == 0)
+				break;
+			bucket = (bucket + 1) & mask;
+		}
+
+		if (table[bucket] == MESHOPT_INVALID_INDEX)
+		{
+			table[bucket] = i;
+			remap[i] = num_unique++;
+		}
+		else
+			remap[i] = remap[table[bucket]];
+	}
+
+	return num_unique;
+}
+
+void optimizeVertexCache(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, std::vector<unsigned int>* clusters, unsigned int cache_size)
+{
+	assert(num_indices % 3 == 0);
+	unsigned int num_triangles = num_indices / 3;
+	if (!num_triangles)
+		return;
+
+	//how many triangles still not emitted use every vertex
+	std::vector<unsigned int> live(num_vertices, 0);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		live[indices[i]]++;
+
+	//triangles adjacent to every vertex
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		offsets[i + 1] = offsets[i] + live[i];
+	std::vector<unsigned int> adjacency(num_indices);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	std::vector<unsigned int> cache_time(num_vertices, 0);
+	std::vector<char> emitted(num_triangles, 0);
+	std::vector<unsigned int> dead_end;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result;
+	dead_end.reserve(num_indices);
+	result.reserve(num_indices);
+
+	unsigned int timestamp = cache_size + 1;
+	unsigned int cursor = 0;
+
+	if (clusters)
+	{
+		clusters->clear();
+		clusters->push_back(0);
+	}
+
+	//start from the first referenced vertex
+	int fanning = (int)indices[0];
+	while (fanning >= 0)
+	{
+		//emit all the triangles around the fanning vertex
+		candidates.clear();
+		for (unsigned int j = offsets[fanning]; j < offsets[fanning + 1]; ++j)
+		{
+			unsigned int t = adjacency[j];
+			if (emitted[t])
+				continue;
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = indices[t * 3 + k];
+				result.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (timestamp - cache_time[v] > cache_size) //not in cache
+					cache_time[v] = timestamp++;
+			}
+			emitted[t] = 1;
+		}
+
+		//next fanning vertex: the oldest candidate that will still be in cache after emitting its triangles
+		int best = -1;
+		int best_priority = -1;
+		for (size_t j = 0; j < candidates.size(); ++j)
+		{
+			unsigned int v = candidates[j];
+			if (!live[v])
+				continue;
+			int priority = 0;
+			if (timestamp - cache_time[v] + 2 * live[v] <= cache_size)
+				priority = timestamp - cache_time[v];
+			if (priority > best_priority)
+			{
+				best = (int)v;
+				best_priority = priority;
+			}
+		}
+
+		if (best == -1)
+		{
+			//dead end, use recently used vertices first and then any vertex left
+			while (!dead_end.empty() && best == -1)
+			{
+				unsigned int v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v])
+					best = (int)v;
+			}
+			while (best == -1 && cursor < num_vertices)
+			{
+				if (live[cursor])
+					best = (int)cursor;
+				cursor++;
+			}
+
+			//locality is broken here, so the overdraw pass can move this group freely
+			if (best != -1 && clusters)
+				clusters->push_back((unsigned int)result.size() / 3);
+		}
+
+		fanning = best;
+	}
+
+	assert(result.size() == num_indices);
+	memcpy(indices, &result[0], num_indices * sizeof(unsigned int));
+}
+
+struct sOverdrawCluster {
+	unsigned int start; //in triangles
+	unsigned int end;
+	float sort_key;
+};
+
+void optimizeOverdraw(unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, const std::vector<unsigned int>& clusters)
+{
+	unsigned int num_triangles = num_indices / 3;
+	if (clusters.size() < 2)
+		return;
+
+	//area weighted centroid of the mesh
+	Vector3f mesh_centroid;
+	float mesh_area = 0;
+	for (unsigned int t = 0; t < num_triangles; ++t)
+	{
+		const Vector3f& a = positions[indices[t * 3]];
+		const Vector3f& b = positions[indices[t * 3 + 1]];
+		const Vector3f& c = positions[indices[t * 3 + 2]];
+		float area = cross(b - a, c - a).length();
+		mesh_centroid += (a + b + c) * (area / 3.0f);
+		mesh_area += area;
+	}
+	if (mesh_area > 0)
+		mesh_centroid /= mesh_area;
+
+	//clusters facing outwards from the center should be rendered first
+	std::vector<sOverdrawCluster> sorted(clusters.size());
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		sOverdrawCluster& cluster = sorted[i];
+		cluster.start = clusters[i];
+		cluster.end = i + 1 < clusters.size() ? clusters[i + 1] : num_triangles;
+
+		Vector3f centroid;
+		Vector3f normal;
+		float area = 0;
+		for (unsigned int t = cluster.start; t < cluster.end; ++t)
+		{
+			const Vector3f& a = positions[indices[t * 3]];
+			const Vector3f& b = positions[indices[t * 3 + 1]];
+			const Vector3f& c = positions[indices[t * 3 + 2]];
+			Vector3f n = cross(b - a, c - a); //length is twice the area
+			float triangle_area = n.length();
+			centroid += (a + b + c) * (triangle_area / 3.0f);
+			normal += n;
+			area += triangle_area;
+		}
+		if (area > 0)
+			centroid /= area;
+		if (normal.length() > 0)
+			normal.normalize();
+		cluster.sort_key = dot(centroid - mesh_centroid, normal);
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(), [](const sOverdrawCluster& a, const sOverdrawCluster& b) { return a.sort_key > b.sort_key; });
+
+	std::vector<unsigned int> result;
+	result.reserve(num_indices);
+	for (size_t i = 0; i < sorted.size(); ++i)
+		result.insert(result.end(), indices + sorted[i].start * 3, indices + sorted[i].end * 3);
+	memcpy(indices, &result[0], num_indices * sizeof(unsigned int));
+}
+
+unsigned int optimizeVertexFetchRemap(std::vector<unsigned int>& remap, const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices)
+{
+	remap.assign(num_vertices, MESHOPT_INVALID_INDEX);
+	unsigned int next = 0;
+	for (unsigned int i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (remap[v] == MESHOPT_INVALID_INDEX)
+			remap[v] = next++;
+	}
+	return next;
+}
+
+void buildMeshlets(unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, std::vector<unsigned int>& meshlets, unsigned int max_vertices, unsigned int max_triangles)
+{
+	assert(num_indices % 3 == 0);
+	meshlets.clear();
+	unsigned int num_triangles = num_indices / 3;
+	unsigned int num_vertices = (unsigned int)positions.size();
+	if (!num_triangles)
+		return;
+
+	//triangles adjacent to every vertex
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		offsets[indices[i] + 1]++;
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		offsets[i + 1] += offsets[i];
+	std::vector<unsigned int> adjacency(num_indices);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int i = 0; i < num_indices; ++i)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	std::vector<Vector3f> normals(num_triangles);
+	for (unsigned int t = 0; t < num_triangles; ++t)
+	{
+		const Vector3f& a = positions[indices[t * 3]];
+		Vector3f n = cross(positions[indices[t * 3 + 1]] - a, positions[indices[t * 3 + 2]] - a);
+		float length = n.length();
+		normals[t] = length > 0 ? n * (1.0f / length) : n;
+	}
+
+	std::vector<char> emitted(num_triangles, 0);
+	std::vector<unsigned int> vertex_meshlet(num_vertices, MESHOPT_INVALID_INDEX); //last meshlet using every vertex
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result;
+	result.reserve(num_indices);
+
+	unsigned int cursor = 0;
+	unsigned int meshlet_vertices = 0;
+	unsigned int meshlet_triangles = 0;
+	Vector3f meshlet_normal;
+
+	while (result.size() < num_indices)
+	{
+		//best candidate: adds the fewest vertices and keeps the normals together (for the cone)
+		int best = -1;
+		float best_score = 0;
+		Vector3f axis = meshlet_normal.length() > 0 ? normalize(meshlet_normal) : meshlet_normal;
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			unsigned int t = candidates[i];
+			if (emitted[t])
+			{
+				candidates[i--] = candidates.back();
+				candidates.pop_back();
+				continue;
+			}
+			unsigned int new_vertices = 0;
+			for (int k = 0; k < 3; ++k)
+				if (vertex_meshlet[indices[t * 3 + k]] != meshlets.size() - 1)
+					new_vertices++;
+			if (meshlet_vertices + new_vertices > max_vertices)
+				continue;
+			float score = new_vertices + 1.0f - dot(normals[t], axis);
+			if (best == -1 || score < best_score)
+			{
+				best = (int)t;
+				best_score = score;
+			}
+		}
+
+		//full or nothing connected left, start a new meshlet from the next triangle in the input order
+		if (best == -1 || meshlet_triangles == max_triangles)
+		{
+			while (emitted[cursor])
+				cursor++;
+			best = (int)cursor;
+			meshlets.push_back((unsigned int)result.size() / 3);
+			candidates.clear();
+			meshlet_vertices = meshlet_triangles = 0;
+			meshlet_normal.set(0, 0, 0);
+		}
+
+		unsigned int meshlet_id = (unsigned int)meshlets.size() - 1;
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = indices[best * 3 + k];
+			result.push_back(v);
+			if (vertex_meshlet[v] == meshlet_id)
+				continue;
+			vertex_meshlet[v] = meshlet_id;
+			meshlet_vertices++;
+			for (unsigned int j = offsets[v]; j < offsets[v + 1]; ++j)
+				if (!emitted[adjacency[j]])
+					candidates.push_back(adjacency[j]);
+		}
+		emitted[best] = 1;
+		meshlet_triangles++;
+		meshlet_normal += normals[best];
+	}
+
+	memcpy(indices, &result[0], num_indices * sizeof(unsigned int));
+}
+
+void computeMeshletBounds(const unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, Vector3f& center, float& radius, Vector3f& cone_apex, Vector3f& cone_axis, float& cone_cutoff)
+{
+	//sphere around the aabb center
+	const float max_float = 10000000;
+	Vector3f min_pos(max_float, max_float, max_float);
+	Vector3f max_pos(-max_float, -max_float, -max_float);
+	for (unsigned int i = 0; i < num_indices; ++i)
+	{
+		min_pos.setMin(positions[indices[i]]);
+		max_pos.setMax(positions[indices[i]]);
+	}
+	center = (min_pos + max_pos) * 0.5f;
+	radius = 0;
+	for (unsigned int i = 0; i < num_indices; ++i)
+	{
+		float dist = positions[indices[i]].distance(center);
+		radius = dist > radius ? dist : radius;
+	}
+
+	//cone containing all the normals
+	std::vector<Vector3f> normals;
+	std::vector<Vector3f> corners; //one point of every plane
+	normals.reserve(num_indices / 3);
+	corners.reserve(num_indices / 3);
+	Vector3f axis;
+	for (unsigned int i = 0; i < num_indices; i += 3)
+	{
+		const Vector3f& a = positions[indices[i]];
+		Vector3f n = cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+		float length = n.length();
+		if (length <= 0)
+			continue; //degenerated triangles are never visible
+		n /= length;
+		normals.push_back(n);
+		corners.push_back(a);
+		axis += n;
+	}
+
+	cone_apex = center;
+	cone_axis.set(0, 0, 0);
+	cone_cutoff = 1; //never culled
+	if (axis.length() <= 0)
+		return;
+	axis.normalize();
+
+	float min_dot = 1;
+	for (size_t i = 0; i < normals.size(); ++i)
+	{
+		float d = dot(normals[i], axis);
+		min_dot = d < min_dot ? d : min_dot;
+	}
+	cone_axis = axis;
+	if (min_dot <= 0.1f)
+		return; //too wide, some triangles face every side
+
+	//apex behind all the planes, so any camera in the cone is behind all of them too
+	float max_t = 0;
+	for (size_t i = 0; i < normals.size(); ++i)
+	{
+		float t = dot(center - corners[i], normals[i]) / dot(axis, normals[i]);
+		max_t = t > max_t ? t : max_t;
+	}
+	cone_apex = center - axis * max_t;
+	cone_cutoff = sqrt(1.0f - min_dot * min_dot);
+}
+
+//symmetric 4x4 matrix, sum of squared distances to planes
+struct sQuadric {
+	double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+
+	sQuadric() { a00 = a01 = a02 = a03 = a11 = a12 = a13 = a22 = a23 = a33 = 0; }
+
+	void addPlane(double x, double y, double z, double d, double w)
+	{
+		a00 += w * x * x; a01 += w * x * y; a02 += w * x * z; a03 += w * x * d;
+		a11 += w * y * y; a12 += w * y * z; a13 += w * y * d;
+		a22 += w * z * z; a23 += w * z * d;
+		a33 += w * d * d;
+	}
+
+	void operator += (const sQuadric& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+		a11 += q.a11; a12 += q.a12; a13 += q.a13;
+		a22 += q.a22; a23 += q.a23; a33 += q.a33;
+	}
+
+	double evaluate(const Vector3f& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double r = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+			+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+			+ a22 * z * z + 2 * a23 * z + a33;
+		return r > 0 ? r : 0;
+	}
+};
+
+struct sCollapse {
+	unsigned int from; //canonical vertices
+	unsigned int to;
+	double cost;
+};
+
+//finds for every wedge of "from" the wedge of "to" that shares a triangle with it, fails if it is missing or ambiguous (collapse across a seam)
+static bool mapWedges(std::vector<std::pair<unsigned int, unsigned int> >& mapping, unsigned int from, unsigned int to, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& canonical, const unsigned int* adjacency, unsigned int num_adjacent)
+{
+	mapping.clear();
+	for (unsigned int j = 0; j < num_adjacent; ++j)
+	{
+		const unsigned int* tri = &indices[adjacency[j] * 3];
+		unsigned int wedge_from = MESHOPT_INVALID_INDEX;
+		unsigned int wedge_to = MESHOPT_INVALID_INDEX;
+		for (int k = 0; k < 3; ++k)
+		{
+			if (canonical[tri[k]] == from) wedge_from = tri[k];
+			else if (canonical[tri[k]] == to) wedge_to = tri[k];
+		}
+
+		size_t m = 0;
+		while (m < mapping.size() && mapping[m].first != wedge_from)
+			++m;
+		if (m == mapping.size())
+			mapping.push_back(std::make_pair(wedge_from, wedge_to));
+		else if (mapping[m].second == MESHOPT_INVALID_INDEX)
+			mapping[m].second = wedge_to;
+		else if (wedge_to != MESHOPT_INVALID_INDEX && mapping[m].second != wedge_to)
+			return false;
+	}
+
+	for (size_t m = 0; m < mapping.size(); ++m)
+		if (mapping[m].second == MESHOPT_INVALID_INDEX)
+			return false;
+	return true;
+}
+
+unsigned int simplifyMesh(std::vector<unsigned int>& result, const unsigned int* input_indices, unsigned int num_indices, const std::vector<Vector3f>& input_positions, unsigned int target_num_indices, float max_error, float* result_error)
+{
+	assert(num_indices % 3 == 0);
+	result.assign(input_indices, input_indices + num_indices);
+	if (result_error)
+		*result_error = 0;
+	unsigned int num_vertices = (unsigned int)input_positions.size();
+	if (num_indices <= target_num_indices || !num_vertices)
+		return num_indices;
+
+	//work in a unit box so errors are relative to the mesh size
+	const float max_float = 10000000;
+	Vector3f min_pos(max_float, max_float, max_float);
+	Vector3f max_pos(-max_float, -max_float, -max_float);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		min_pos.setMin(input_positions[i]);
+		max_pos.setMax(input_positions[i]);
+	}
+	Vector3f size = max_pos - min_pos;
+	float extent = size.x > size.y ? (size.x > size.z ? size.x : size.z) : (size.y > size.z ? size.y : size.z);
+	float inv_extent = extent > 0 ? 1.0f / extent : 1.0f;
+	std::vector<Vector3f> positions(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		positions[i] = (input_positions[i] - min_pos) * inv_extent;
+
+	//vertices with the same position (uv or normal seams) are the same canonical vertex
+	std::vector<unsigned int> canonical;
+	generateVertexRemap(canonical, (const unsigned char*)&positions[0], num_vertices, sizeof(Vector3f));
+	{
+		std::vector<unsigned int> first(num_vertices, MESHOPT_INVALID_INDEX);
+		for (unsigned int i = 0; i < num_vertices; ++i)
+		{
+			if (first[canonical[i]] == MESHOPT_INVALID_INDEX)
+				first[canonical[i]] = i;
+			canonical[i] = first[canonical[i]];
+		}
+	}
+
+	//open borders and non manifold edges are locked to preserve the silhouette
+	std::vector<char> locked(num_vertices, 0);
+	{
+		std::vector<std::pair<unsigned long long, int> > edges;
+		edges.reserve(num_indices);
+		for (unsigned int i = 0; i < num_indices; i += 3)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned long long a = canonical[result[i + k]];
+				unsigned long long b = canonical[result[i + (k + 1) % 3]];
+				if (a > b)
+					std::swap(a, b);
+				edges.push_back(std::make_pair((a << 32) | b, 0));
+			}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j].first == edges[i].first)
+				++j;
+			if (j - i != 2)
+			{
+				locked[edges[i].first >> 32] = 1;
+				locked[edges[i].first & 0xFFFFFFFF] = 1;
+			}
+			i = j;
+		}
+	}
+
+	//area weighted plane quadrics
+	std::vector<sQuadric> quadrics(num_vertices);
+	for (unsigned int i = 0; i < num_indices; i += 3)
+	{
+		const Vector3f& a = positions[result[i]];
+		const Vector3f& b = positions[result[i + 1]];
+		const Vector3f& c = positions[result[i + 2]];
+		Vector3f n = cross(b - a, c - a);
+		float area = n.length();
+		if (area <= 0)
+			continue;
+		n /= area;
+		double d = -dot(n, a);
+		for (int k = 0; k < 3; ++k)
+			quadrics[canonical[result[i + k]]].addPlane(n.x, n.y, n.z, d, area * 0.5);
+	}
+
+	double max_cost = (double)max_error * max_error;
+	double worst_cost = 0;
+	std::vector<unsigned int> remap(num_vertices);
+	std::vector<char> touched(num_vertices);
+	std::vector<unsigned int> offsets(num_vertices + 1);
+	std::vector<unsigned int> adjacency;
+	std::vector<sCollapse> collapses;
+	std::vector<std::pair<unsigned int, unsigned int> > mapping;
+
+	while (result.size() > target_num_indices)
+	{
+		unsigned int num_triangles = (unsigned int)result.size() / 3;
+
+		//triangles around every canonical vertex
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (size_t i = 0; i < result.size(); ++i)
+			offsets[canonical[result[i]] + 1]++;
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			offsets[i + 1] += offsets[i];
+		adjacency.resize(result.size());
+		{
+			std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < result.size(); ++i)
+				adjacency[fill[canonical[result[i]]]++] = (unsigned int)i / 3;
+		}
+
+		//candidates, cheapest direction of every edge
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int a = canonical[result[i + k]];
+				unsigned int b = canonical[result[i + (k + 1) % 3]];
+				if (a == b || (locked[a] && locked[b]))
+					continue;
+				sQuadric q = quadrics[a];
+				q += quadrics[b];
+				double cost_ab = locked[a] ? 1e30 : q.evaluate(positions[b]);
+				double cost_ba = locked[b] ? 1e30 : q.evaluate(positions[a]);
+				sCollapse collapse;
+				collapse.from = cost_ab <= cost_ba ? a : b;
+				collapse.to = cost_ab <= cost_ba ? b : a;
+				collapse.cost = cost_ab <= cost_ba ? cost_ab : cost_ba;
+				if (collapse.cost <= max_cost)
+					collapses.push_back(collapse);
+			}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const sCollapse& a, const sCollapse& b) { return a.cost < b.cost; });
+
+		//every collapse removes around two triangles
+		unsigned int max_collapses = (num_triangles - target_num_indices / 3) / 2 + 1;
+		unsigned int num_collapsed = 0;
+		for (unsigned int i = 0; i < num_vertices; ++i)
+			remap[i] = i;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (size_t i = 0; i < collapses.size() && num_collapsed < max_collapses; ++i)
+		{
+			const sCollapse& collapse = collapses[i];
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			const unsigned int* adjacent = &adjacency[offsets[collapse.from]];
+			unsigned int num_adjacent = offsets[collapse.from + 1] - offsets[collapse.from];
+
+			//triangles must not flip when the vertex moves
+			bool flips = false;
+			const Vector3f& target = positions[collapse.to];
+			for (unsigned int j = 0; j < num_adjacent && !flips; ++j)
+			{
+				const unsigned int* tri = &result[adjacent[j] * 3];
+				Vector3f p[3];
+				bool has_target = false;
+				for (int k = 0; k < 3; ++k)
+				{
+					p[k] = positions[tri[k]];
+					has_target = has_target || canonical[tri[k]] == collapse.to;
+				}
+				if (has_target)
+					continue; //will become degenerate
+				Vector3f n0 = cross(p[1] - p[0], p[2] - p[0]);
+				for (int k = 0; k < 3; ++k)
+					if (canonical[tri[k]] == collapse.from)
+						p[k] = target;
+				Vector3f n1 = cross(p[1] - p[0], p[2] - p[0]);
+				if (dot(n0, n1) <= 0.25f * n0.length() * n1.length())
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			if (!mapWedges(mapping, collapse.from, collapse.to, result, canonical, adjacent, num_adjacent))
+				continue;
+
+			for (size_t m = 0; m < mapping.size(); ++m)
+				remap[mapping[m].first] = mapping[m].second;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			touched[collapse.from] = touched[collapse.to] = 1;
+			//vertices around also change their triangles this pass
+			for (unsigned int j = 0; j < num_adjacent; ++j)
+				for (int k = 0; k < 3; ++k)
+					touched[canonical[result[adjacent[j] * 3 + k]]] = 1;
+
+			if (collapse.cost > worst_cost)
+				worst_cost = collapse.cost;
+			num_collapsed++;
+		}
+
+		if (!num_collapsed)
+			break;
+
+		//apply and remove degenerated triangles
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			unsigned int a = remap[result[i]];
+			unsigned int b = remap[result[i + 1]];
+			unsigned int c = remap[result[i + 2]];
+			if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[a] == canonical[c])
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	if (result_error)
+		*result_error = (float)sqrt(worst_cost);
+	return (unsigned int)result.size();
+}
+
+void analyzeVertexCache(const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, float& acmr, float& atvr, unsigned int cache_size)
+{
+	acmr = atvr = 0;
+	if (num_indices < 3)
+		return;
+
+	//FIFO cache simulation
+	std::vector<unsigned int> cache_time(num_vertices, 0);
+	std::vector<char> used(num_vertices, 0);
+	unsigned int timestamp = cache_size + 1;
+	unsigned int misses = 0;
+	unsigned int num_used = 0;
+	for (unsigned int i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (timestamp - cache_time[v] > cache_size)
+		{
+			cache_time[v] = timestamp++;
+			misses++;
+		}
+		if (!used[v])
+		{
+			used[v] = 1;
+			num_used++;
+		}
+	}
+
+	acmr = misses / (float)(num_indices / 3);
+	atvr = misses / (float)num_used;
+}
+
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../core/math.h"
+
+#include <vector>
+
+//Geometry optimization helpers used by Mesh::optimize
+//All of them work on triangle lists with 32 bits indices
+
+namespace GFX {
+
+	#define MESHOPT_CACHE_SIZE 16 //post-transform cache size assumed when reordering and measuring
+	#define MESHOPT_INVALID_INDEX 0xFFFFFFFF
+	#define MESHOPT_MESHLET_VERTICES 64
+	#define MESHOPT_MESHLET_TRIANGLES 124
+
+	//returns the number of unique vertices, remap contains for every vertex the index of its unique version
+	unsigned int generateVertexRemap(std::vector<unsigned int>& remap, const unsigned char* vertex_data, unsigned int num_vertices, unsigned int stride);
+
+	//Tipsify (Sander et al. 2007), reorders the triangles to improve the post-transform cache hits
+	//clusters receives the first triangle of every group of triangles that can be reordered freely for overdraw
+	void optimizeVertexCache(unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, std::vector<unsigned int>* clusters = NULL, unsigned int cache_size = MESHOPT_CACHE_SIZE);
+
+	//sorts the clusters so the ones facing outwards are rendered first (reduces overdraw), keeps the triangle order inside every cluster
+	void optimizeOverdraw(unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, const std::vector<unsigned int>& clusters);
+
+	//remap to have the vertices sorted by first use in the index buffer, returns the number of used vertices
+	unsigned int optimizeVertexFetchRemap(std::vector<unsigned int>& remap, const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices);
+
+	//reorders the triangles so they form small connected groups (meshlets) that can be culled independently
+	//meshlets receives the first triangle of every meshlet
+	void buildMeshlets(unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, std::vector<unsigned int>& meshlets, unsigned int max_vertices = MESHOPT_MESHLET_VERTICES, unsigned int max_triangles = MESHOPT_MESHLET_TRIANGLES);
+
+	//bounding sphere and normal cone of a group of triangles
+	//all of them are back facing when dot(normalize(cone_apex - camera_pos), cone_axis) >= cone_cutoff
+	void computeMeshletBounds(const unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, Vector3f& center, float& radius, Vector3f& cone_apex, Vector3f& cone_axis, float& cone_cutoff);
+
+	//quadric error edge collapse (Garland & Heckbert), vertices collapse into existing ones so the result can share the vertex buffer
+	//returns the number of indices of the simplified mesh, result_error receives the error relative to the mesh extent
+	unsigned int simplifyMesh(std::vector<unsigned int>& result, const unsigned int* indices, unsigned int num_indices, const std::vector<Vector3f>& positions, unsigned int target_num_indices, float max_error, float* result_error = NULL);
+
+	//ACMR: average vertex transforms per triangle, ATVR: average transforms per vertex (1.0 is the best possible)
+	void analyzeVertexCache(const unsigned int* indices, unsigned int num_indices, unsigned int num_vertices, float& acmr, float& atvr, unsigned int cache_size = MESHOPT_CACHE_SIZE);
+};
@@ -0,0 +1,459 @@
+#include "objparser.h"
+#include "../utils/utils.h"
+#include "../core/jobs.h"
+
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <iostream>
+
+namespace GFX {
+
+#define OBJ_NO_INDEX INT_MIN //corner without uv or normal
+#define OBJ_RELATIVE_INDEX (INT_MIN / 2) //added to indices relative to the chunk (they can point to previous chunks)
+
+//what a thread extracts from its part of the file
+struct sOBJChunk {
+	const char* begin;
+	const char* end;
+
+	std::vector<Vector3f> positions;
+	std::vector<Vector3f> normals;
+	std::vector<Vector2f> uvs;
+	std::vector<int> corners; //position, uv, normal for every triangle corner, see encodeOBJIndex
+
+	struct sEvent {
+		unsigned int corner; //first corner affected
+		const char* name; //inside the file, not null terminated
+		int length;
+		bool is_material; //usemtl or g
+	};
+	std::vector<sEvent> events;
+};
+
+static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+inline bool isOBJSpace(char c) { return c == ' ' || c == '\t'; }
+inline bool isOBJDigit(char c) { return c >= '0' && c <= '9'; }
+
+const char* parseOBJFloat(const char* p, const char* end, float& result)
+{
+	while (p < end && isOBJSpace(*p))
+		p++;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	//up to 19 significant digits fit in the mantissa, the rest only move the exponent
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	for (; p < end && isOBJDigit(*p); ++p)
+		if (digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				digits++;
+		}
+		else
+			exponent++;
+
+	if (p < end && *p == '.')
+		for (++p; p < end && isOBJDigit(*p); ++p)
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int exp_value = 0;
+		p = parseOBJInt(p + 1, end, exp_value);
+		exponent += exp_value;
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0)
+		value = exponent >= -22 ? value / powers_of_ten[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powers_of_ten[exponent] : value * pow(10.0, exponent);
+
+	result = (float)(negative ? -value : value);
+	return p;
+}
+
+const char* parseOBJInt(const char* p, const char* end, int& result)
+{
+	while (p < end && isOBJSpace(*p))
+		p++;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	int value = 0;
+	for (; p < end && isOBJDigit(*p); ++p)
+		value = value * 10 + (*p - '0');
+	result = negative ? -value : value;
+	return p;
+}
+
+//OBJ indices start at 1, negative ones count from the last element read
+//we store absolute ones starting at 0 and relative ones from the chunk start plus OBJ_RELATIVE_INDEX, fixed when merging
+inline int encodeOBJIndex(int index, size_t num_read)
+{
+	if (index > 0)
+		return index - 1;
+	if (index < 0)
+		return (int)num_read + index + OBJ_RELATIVE_INDEX;
+	return OBJ_NO_INDEX;
+}
+
+inline bool startsWith(const char* p, const char* end, const char* word)
+{
+	for (; *word; ++p, ++word)
+		if (p >= end || *p != *word)
+			return false;
+	return p >= end || isOBJSpace(*p);
+}
+
+static void parseOBJChunk(sOBJChunk* chunk)
+{
+	const char* p = chunk->begin;
+	const char* end = chunk->end;
+
+	//around 30 bytes per line
+	size_t estimated_lines = (end - p) / 30;
+	chunk->positions.reserve(estimated_lines / 3);
+	chunk->corners.reserve(estimated_lines * 3);
+
+	int face[3 * 3]; //first, previous and current corners
+	while (p < end)
+	{
+		while (p < end && (isOBJSpace(*p) || *p == '\r' || *p == '\n'))
+			p++;
+		if (p >= end)
+			break;
+
+		if (p[0] == 'v' && p + 1 < end)
+		{
+			Vector3f v;
+			if (isOBJSpace(p[1]))
+			{
+				p = parseOBJFloat(p + 1, end, v.x);
+				p = parseOBJFloat(p, end, v.y);
+				p = parseOBJFloat(p, end, v.z);
+				chunk->positions.push_back(v);
+			}
+			else if (p[1] == 't')
+			{
+				p = parseOBJFloat(p + 2, end, v.x);
+				p = parseOBJFloat(p, end, v.y);
+				chunk->uvs.push_back(Vector2f(v.x, 1.0f - v.y));
+			}
+			else if (p[1] == 'n')
+			{
+				p = parseOBJFloat(p + 2, end, v.x);
+				p = parseOBJFloat(p, end, v.y);
+				p = parseOBJFloat(p, end, v.z);
+				chunk->normals.push_back(v);
+			}
+		}
+		else if (p[0] == 'f' && p + 1 < end && isOBJSpace(p[1]))
+		{
+			//polygons are triangulated as a fan
+			p++;
+			int num_corners = 0;
+			while (true)
+			{
+				while (p < end && isOBJSpace(*p))
+					p++;
+				if (p >= end || !(isOBJDigit(*p) || *p == '-'))
+					break;
+
+				int* corner = &face[(num_corners < 2 ? num_corners : 2) * 3];
+				int index = 0;
+				p = parseOBJInt(p, end, index);
+				corner[0] = encodeOBJIndex(index, chunk->positions.size());
+				corner[1] = corner[2] = OBJ_NO_INDEX;
+				if (p < end && *p == '/')
+				{
+					if (p + 1 < end && p[1] != '/')
+					{
+						p = parseOBJInt(p + 1, end, index);
+						corner[1] = encodeOBJIndex(index, chunk->uvs.size());
+					}
+					else
+						p++;
+					if (p < end && *p == '/')
+					{
+						p = parseOBJInt(p + 1, end, index);
+						corner[2] = encodeOBJIndex(index, chunk->normals.size());
+					}
+				}
+
+				num_corners++;
+				if (num_corners >= 3)
+				{
+					chunk->corners.insert(chunk->corners.end(), face, face + 9);
+					memcpy(&face[3], &face[6], sizeof(int) * 3); //current becomes previous
+				}
+			}
+		}
+		else if (startsWith(p, end, "usemtl") || startsWith(p, end, "g"))
+		{
+			sOBJChunk::sEvent event;
+			event.is_material = p[0] == 'u';
+			p += event.is_material ? 6 : 1;
+			while (p < end && isOBJSpace(*p))
+				p++;
+			event.name = p;
+			while (p < end && *p != '\r' && *p != '\n')
+				p++;
+			event.length = (int)(p - event.name);
+			event.corner = (unsigned int)chunk->corners.size() / 3;
+			chunk->events.push_back(event);
+		}
+
+		//skip the rest of the line (comments, s, o, mtllib...)
+		while (p < end && *p != '\n')
+			p++;
+	}
+}
+
+//vertices are unique by position, uv and normal
+struct sOBJVertexTable {
+	std::vector<int> keys; //3 per slot
+	std::vector<unsigned int> values;
+	unsigned int mask;
+	unsigned int num_used;
+
+	void init(unsigned int size)
+	{
+		unsigned int table_size = 16;
+		while (table_size < size * 2)
+			table_size *= 2;
+		keys.assign(table_size * 3, OBJ_NO_INDEX);
+		values.assign(table_size, 0xFFFFFFFF);
+		mask = table_size - 1;
+		num_used = 0;
+	}
+
+	static unsigned int hash(const int* key)
+	{
+		return (unsigned int)key[0] * 73856093u ^ (unsigned int)key[1] * 19349663u ^ (unsigned int)key[2] * 83492791u;
+	}
+
+	//returns the slot of the key, or the empty slot where it should go
+	unsigned int find(const int* key)
+	{
+		unsigned int slot = hash(key) & mask;
+		while (values[slot] != 0xFFFFFFFF && memcmp(&keys[slot * 3], key, sizeof(int) * 3) != 0)
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	void grow()
+	{
+		std::vector<int> old_keys;
+		std::vector<unsigned int> old_values;
+		old_keys.swap(keys);
+		old_values.swap(values);
+		init((unsigned int)old_values.size());
+		for (size_t i = 0; i < old_values.size(); ++i)
+			if (old_values[i] != 0xFFFFFFFF)
+			{
+				unsigned int slot = find(&old_keys[i * 3]);
+				memcpy(&keys[slot * 3], &old_keys[i * 3], sizeof(int) * 3);
+				values[slot] = old_values[i];
+				num_used++;
+			}
+	}
+};
+
+bool parseOBJ(const char* filename, std::vector<Vector3f>& positions, std::vector<Vector3f>& normals, std::vector<Vector2f>& uvs, std::vector<unsigned int>& indices, std::vector<sSubmeshInfo>& submeshes, unsigned int num_threads)
+{
+	sMappedFile file;
+	if (!mapFile(filename, file))
+		return false;
+	const char* data = (const char*)file.data;
+	const char* data_end = data + file.size;
+
+	//split in chunks at line ends
+	//one chunk per thread of the job system
+	if (!num_threads)
+		num_threads = JobSystem::num_threads ? JobSystem::num_threads : 1;
+	unsigned int max_chunks = (unsigned int)(file.size / OBJ_MIN_CHUNK_SIZE) + 1;
+	unsigned int num_chunks = num_threads < max_chunks ? num_threads : max_chunks;
+	if (num_chunks < 1)
+		num_chunks = 1;
+	std::vector<sOBJChunk> chunks(num_chunks);
+	const char* start = data;
+	for (unsigned int i = 0; i < num_chunks; ++i)
+	{
+		const char* stop = i + 1 < num_chunks ? data + file.size * (i + 1) / num_chunks : data_end;
+		if (stop < start)
+			stop = start;
+		while (stop < data_end && *stop != '\n')
+			stop++;
+		chunks[i].begin = start;
+		chunks[i].end = stop;
+		start = stop;
+	}
+
+	//chunks as jobs, the calling thread (usually a worker loading in the background) takes part too
+	JobSystem::parallelFor(num_chunks, 1, [&](unsigned int start, unsigned int end) {
+		for (unsigned int i = start; i < end; ++i)
+			parseOBJChunk(&chunks[i]);
+	});
+
+	//merge the attributes
+	size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_corners = 0;
+	for (unsigned int i = 0; i < num_chunks; ++i)
+	{
+		num_positions += chunks[i].positions.size();
+		num_uvs += chunks[i].uvs.size();
+		num_normals += chunks[i].normals.size();
+		num_corners += chunks[i].corners.size() / 3;
+	}
+	std::vector<Vector3f> file_positions;
+	std::vector<Vector3f> file_normals;
+	std::vector<Vector2f> file_uvs;
+	file_positions.reserve(num_positions);
+	file_uvs.reserve(num_uvs);
+	file_normals.reserve(num_normals);
+
+	positions.clear();
+	normals.clear();
+	uvs.clear();
+	indices.clear();
+	submeshes.clear();
+	indices.reserve(num_corners);
+
+	sOBJVertexTable table;
+	table.init((unsigned int)num_positions);
+	std::vector<int> vertex_keys; //attributes of every unique vertex, they can be defined after the faces (in a later chunk)
+	vertex_keys.reserve(num_positions * 3);
+	sSubmeshInfo submesh;
+	memset(&submesh, 0, sizeof(submesh));
+	char group[64] = { 0 };
+	bool valid = true;
+
+	for (unsigned int i = 0; i < num_chunks && valid; ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		int bases[3] = { (int)file_positions.size(), (int)file_uvs.size(), (int)file_normals.size() };
+		int counts[3] = { (int)num_positions, (int)num_uvs, (int)num_normals };
+		file_positions.insert(file_positions.end(), chunk.positions.begin(), chunk.positions.end());
+		file_uvs.insert(file_uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+		file_normals.insert(file_normals.end(), chunk.normals.begin(), chunk.normals.end());
+
+		size_t next_event = 0;
+		unsigned int num_chunk_corners = (unsigned int)chunk.corners.size() / 3;
+		for (unsigned int j = 0; j <= num_chunk_corners && valid; ++j)
+		{
+			//a new submesh starts with every usemtl, g only names it
+			for (; next_event < chunk.events.size() && chunk.events[next_event].corner == j; ++next_event)
+			{
+				const sOBJChunk::sEvent& event = chunk.events[next_event];
+				int length = event.length < 63 ? event.length : 63;
+				bool is_empty = (int)indices.size() == submesh.start;
+				if (event.is_material)
+				{
+					if (!is_empty)
+					{
+						submesh.length = (int)indices.size() - submesh.start;
+						submeshes.push_back(submesh);
+						submesh.start = (int)indices.size();
+					}
+					memcpy(submesh.material, event.name, length);
+					submesh.material[length] = 0;
+					strcpy(submesh.name, group[0] ? group : submesh.material);
+				}
+				else
+				{
+					memcpy(group, event.name, length);
+					group[length] = 0;
+					if (is_empty)
+						strcpy(submesh.name, group);
+				}
+			}
+			if (j == num_chunk_corners)
+				break;
+
+			//resolve the indices to the whole file
+			int key[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				int index = chunk.corners[j * 3 + k];
+				if (index == OBJ_NO_INDEX || !counts[k])
+				{
+					key[k] = -1;
+					continue;
+				}
+				key[k] = index < 0 ? bases[k] + index - OBJ_RELATIVE_INDEX : index;
+				if (key[k] < 0 || key[k] >= counts[k])
+				{
+					std::cout << "[ERROR] OBJ index out of range: " << filename << std::endl;
+					valid = false;
+				}
+			}
+			if (!valid || key[0] < 0)
+			{
+				valid = false;
+				break;
+			}
+
+			unsigned int slot = table.find(key);
+			if (table.values[slot] == 0xFFFFFFFF)
+			{
+				if ((table.num_used + 1) * 2 > table.values.size())
+				{
+					table.grow();
+					slot = table.find(key);
+				}
+				memcpy(&table.keys[slot * 3], key, sizeof(int) * 3);
+				table.values[slot] = table.num_used++;
+				vertex_keys.insert(vertex_keys.end(), key, key + 3);
+			}
+			indices.push_back(table.values[slot]);
+		}
+	}
+
+	unmapFile(file);
+	if (!valid)
+	{
+		positions.clear();
+		normals.clear();
+		uvs.clear();
+		indices.clear();
+		submeshes.clear();
+		return false;
+	}
+
+	//now that all the attributes are known, build the vertices
+	unsigned int num_vertices = (unsigned int)vertex_keys.size() / 3;
+	positions.resize(num_vertices);
+	uvs.resize(num_uvs ? num_vertices : 0);
+	normals.resize(num_normals ? num_vertices : 0);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+	{
+		const int* key = &vertex_keys[i * 3];
+		positions[i] = file_positions[key[0]];
+		if (num_uvs)
+			uvs[i] = key[1] >= 0 ? file_uvs[key[1]] : Vector2f(0, 0);
+		if (num_normals)
+			normals[i] = key[2] >= 0 ? file_normals[key[2]] : Vector3f(0, 0, 0);
+	}
+
+	submesh.length = (int)indices.size() - submesh.start;
+	submeshes.push_back(submesh);
+	return true;
+}
+
+};
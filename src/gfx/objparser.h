@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../core/math.h"
+#include "mesh.h"
+
+#include <vector>
+
+//Streaming OBJ parser used by Mesh::loadOBJ
+//The file is mapped in memory and split in chunks (at line ends) that are parsed in parallel,
+//lines are never copied so there is no per line allocation nor line length limit
+
+namespace GFX {
+
+	#define OBJ_MIN_CHUNK_SIZE (1 << 20) //smaller chunks are not worth a thread
+
+	//output is indexed, vertices sharing position, uv and normal are merged
+	//uvs and normals are empty if the file doesnt have them, submeshes are ranges of indices (one per usemtl)
+	bool parseOBJ(const char* filename, std::vector<Vector3f>& positions, std::vector<Vector3f>& normals, std::vector<Vector2f>& uvs, std::vector<unsigned int>& indices, std::vector<sSubmeshInfo>& submeshes, unsigned int num_threads = 0);
+
+	//fast text to number conversions, p must point to the number (or spaces before it), returns the position after it
+	const char* parseOBJFloat(const char* p, const char* end, float& result);
+	const char* parseOBJInt(const char* p, const char* end, int& result);
+};
@@ -0,0 +1,158 @@
+#include "readback.h"
+
+#include "../core/includes.h"
+#include "texture.h"
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+namespace GFX {
+
+unsigned int Readback::num_stalls = 0;
+
+struct sReadbackSlot
+{
+	unsigned int pbo;
+	size_t capacity; //bytes of the buffer
+	size_t bytes; //of this read
+	unsigned int width;
+	unsigned int height;
+	GLsync fence;
+	ReadbackCallback callback;
+};
+
+//pending reads go from the first one, in the order they were requested (the GPU finishes them in that order too)
+static sReadbackSlot slots[READBACK_RING_SIZE];
+static unsigned int first_slot = 0;
+static unsigned int num_pending = 0;
+
+bool Readback::isAsyncSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 3 || (major == 3 && minor >= 2) || SDL_GL_ExtensionSupported("GL_ARB_sync")) ? 1 : 0;
+		std::cout << " * Async readback: " << (supported ? "yes" : "no (reads wait for the GPU)") << std::endl;
+	}
+	return supported == 1;
+}
+
+unsigned int Readback::getPixelBytes(unsigned int format, unsigned int type)
+{
+	unsigned int channels = 4;
+	if (format == GL_RED || format == GL_DEPTH_COMPONENT)
+		channels = 1;
+	else if (format == GL_RG)
+		channels = 2;
+	else if (format == GL_RGB || format == GL_BGR)
+		channels = 3;
+
+	if (type == GL_UNSIGNED_BYTE || type == GL_BYTE)
+		return channels;
+	if (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT)
+		return channels * 2;
+	return channels * 4; //GL_FLOAT, GL_UNSIGNED_INT
+}
+
+unsigned int Readback::getNumPending()
+{
+	return num_pending;
+}
+
+//the first pending one, wait says if it can stall until the GPU reaches its fence
+static bool finishFirst(bool wait)
+{
+	sReadbackSlot& slot = slots[first_slot];
+	GLenum result = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0); //1 second
+	while (wait && result == GL_TIMEOUT_EXPIRED)
+		result = glClientWaitSync(slot.fence, 0, 1000000000ull);
+	if (result == GL_TIMEOUT_EXPIRED)
+		return false;
+	if (result == GL_WAIT_FAILED)
+		std::cout << "[ERROR]: readback fence failed" << std::endl;
+
+	glDeleteSync(slot.fence);
+	slot.fence = NULL;
+	ReadbackCallback callback;
+	std::swap(callback, slot.callback);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.bytes, GL_MAP_READ_BIT);
+	if (pixels)
+		callback(pixels, slot.width, slot.height);
+	else
+		std::cout << "[ERROR]: readback buffer cannot be mapped" << std::endl;
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	first_slot = (first_slot + 1) % READBACK_RING_SIZE;
+	num_pending--;
+	return true;
+}
+
+void Readback::readTexture(Texture* texture, unsigned int format, unsigned int type, ReadbackCallback callback)
+{
+	assert(texture && callback && texture->texture_type == GL_TEXTURE_2D);
+	unsigned int width = (unsigned int)texture->width;
+	unsigned int height = (unsigned int)texture->height;
+	size_t bytes = (size_t)width * height * getPixelBytes(format, type);
+
+	if (!isAsyncSupported())
+	{
+		std::vector<uint8> pixels(bytes);
+		texture->bind();
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, 0, format, type, &pixels[0]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		callback(&pixels[0], width, height);
+		return;
+	}
+
+	if (num_pending == READBACK_RING_SIZE)
+	{
+		num_stalls++;
+		finishFirst(true);
+	}
+
+	sReadbackSlot& slot = slots[(first_slot + num_pending) % READBACK_RING_SIZE];
+	if (!slot.pbo)
+		glGenBuffers(1, &slot.pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	if (slot.capacity < bytes)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		slot.capacity = bytes;
+	}
+
+	//with a pack buffer bound the pixels go to it and the call returns without waiting
+	texture->bind();
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, format, type, NULL);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.bytes = bytes;
+	slot.width = width;
+	slot.height = height;
+	slot.callback = callback;
+	num_pending++;
+}
+
+void Readback::update()
+{
+	while (num_pending && finishFirst(false))
+		continue;
+}
+
+void Readback::finishAll()
+{
+	while (num_pending)
+		finishFirst(true);
+}
+
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <functional>
+
+//Asynchronous reads of textures to the CPU: the pixels are copied by the GPU to a pixel buffer object (a ring of them) followed by a fence,
+//and the callback receives them in a later frame once the fence is passed, so rendering goes on instead of waiting for every read
+
+namespace GFX {
+
+	class Texture;
+
+	#define READBACK_RING_SIZE 16 //reads in flight, when all of them are pending a new one waits for the oldest
+
+	//the pixels are only valid during the call (the buffer is mapped), it runs in the main thread and cannot request other reads
+	typedef std::function<void(const void* pixels, unsigned int width, unsigned int height)> ReadbackCallback;
+
+	class Readback
+	{
+	public:
+		static unsigned int num_stalls; //reads that had to wait for the GPU because the ring was full
+
+		static bool isAsyncSupported(); //fences need OpenGL 3.2 (or GL_ARB_sync), otherwise the callback is called right away
+
+		//first level of a 2D texture, format and type like glGetTexImage (rows are packed without alignment)
+		static void readTexture(Texture* texture, unsigned int format, unsigned int type, ReadbackCallback callback);
+
+		static void update(); //every frame: callbacks of the reads the GPU has finished, in order
+		static void finishAll(); //waits for the pending reads and calls their callbacks
+		static unsigned int getNumPending();
+		static unsigned int getPixelBytes(unsigned int format, unsigned int type);
+	};
+};
@@ -59,12 +59,59 @@ std::map<std::string,Shader*> Shader::s_Shaders;
 bool Shader::s_ready = false;
 Shader* Shader::current = NULL;
 std::vector<char> Shader::lines_with_error;
+bool Shader::use_binary_cache = true;
+std::string Shader::s_binary_cache_folder;
+std::map<unsigned long long, int> Shader::s_attrib_layouts;
+unsigned int Shader::s_attrib_layouts_version = 0; //meshes check it to release their unused VAOs
+
+#define SHADER_BIN_VERSION 1
+
+//before the program binary in the files of the cache
+struct sShaderBinHeader {
+	char tag[4]; //SBIN
+	int version;
+	unsigned long long key; //hash of the code and the driver
+	unsigned int format; //given by glGetProgramBinary
+	unsigned int size;
+};
+
+static unsigned int num_binaries_loaded = 0; //in the last LoadAtlas
+
+//the binaries are only valid for the same driver
+static unsigned long long getDriverHash()
+{
+	static unsigned long long hash = 0;
+	if (!hash)
+	{
+		std::string driver;
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (GLenum name : names)
+		{
+			const char* str = (const char*)glGetString(name);
+			driver += str ? str : "";
+			driver += "\n";
+		}
+		hash = hashBytes(driver.c_str(), driver.size());
+	}
+	return hash;
+}
+
+//one file per shader, the old binary is replaced when the code changes
+static std::string getBinaryFilename(const char* name)
+{
+	std::string filename = name;
+	for (size_t i = 0; i < filename.size(); ++i)
+		if (!isalnum((unsigned char)filename[i]) && filename[i] != '_' && filename[i] != '-')
+			filename[i] = '_';
+	return Shader::s_binary_cache_folder + "/" + filename + ".sbin";
+}
 
 Shader::Shader()
 {
 	if(!Shader::s_ready)
 		Shader::init();
 	program = vs = fs = cs = 0;
+	attrib_layout = 0;
 	compiled = false;
 	from_atlas = false;
 
@@ -215,6 +262,8 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		return false;
 	}
 
+	if (use_binary_cache && isBinaryCacheSupported())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
 	assert (glGetError() == GL_NO_ERROR);
 
@@ -236,6 +285,7 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 
 	compiled = true;
 	locations.clear(); //regenerate table
+	releaseAttribLayout(); //locations may have changed
 
 	return true;
 }
@@ -354,6 +404,7 @@ void Shader::release()
 	}
 
 	locations.clear();
+	releaseAttribLayout();
 
 	compiled = false;
 }
@@ -486,6 +537,38 @@ int Shader::getAttribLocation(const char* varname)
 	return loc;
 }
 
+unsigned long long Shader::getAttribLayout()
+{
+	if (attrib_layout)
+		return attrib_layout;
+
+	//same names and order as Mesh::enableBuffers, 6 bits per location (plus one, -1 is zero)
+	static const char* names[] = { "a_vertex", "a_normal", "a_coord", "a_coord1", "a_color", "a_bones", "a_weights" };
+	attrib_layout = 1ULL << 63; //never zero
+	for (int i = 0; i < 7; ++i)
+		attrib_layout |= (unsigned long long)(getAttribLocation(names[i]) + 1) << (i * 6);
+	s_attrib_layouts[attrib_layout]++;
+	return attrib_layout;
+}
+
+void Shader::releaseAttribLayout()
+{
+	if (!attrib_layout)
+		return;
+	auto it = s_attrib_layouts.find(attrib_layout);
+	if (it != s_attrib_layouts.end() && --it->second <= 0)
+	{
+		s_attrib_layouts.erase(it);
+		s_attrib_layouts_version++;
+	}
+	attrib_layout = 0;
+}
+
+bool Shader::isAttribLayoutUsed(unsigned long long layout)
+{
+	return s_attrib_layouts.find(layout) != s_attrib_layouts.end();
+}
+
 int Shader::getUniformLocation(const char* varname)
 {
 	int loc = getLocation(varname);
@@ -923,6 +1006,13 @@ bool Shader::LoadAtlas(const char* filename, const char* base_path_cstr)
 
 	//separate subfiles
 	s_shader_atlas_filename = filename;
+	long time = getTime();
+	int num_programs = 0;
+	num_binaries_loaded = 0;
+	s_binary_cache_folder = getFolderName(filename);
+	s_binary_cache_folder += s_binary_cache_folder.size() ? "/shader_cache" : "shader_cache";
+	if (use_binary_cache && isBinaryCacheSupported() && !createFolder(s_binary_cache_folder))
+		std::cout << "[ERROR]: cannot create the shader cache folder: " << s_binary_cache_folder << std::endl;
 	std::vector<std::string> lines = tokenize(content, "\n");
 	std::string subfile_name = "";
 	std::string subfile_content = "";
@@ -1002,10 +1092,12 @@ bool Shader::LoadAtlas(const char* filename, const char* base_path_cstr)
 			shader->vs_filename = vs_filename;
 			shader->fs_filename = fs_filename;
 			shader->from_atlas = true;
+			num_programs++;
 			std::cout << " + Shader from atlas: " << TermColor::CYAN << name << TermColor::DEFAULT << std::endl;
 		}
 	}
 
+	std::cout << " * Shader atlas: " << num_programs << " programs (" << num_binaries_loaded << " from the binary cache) in " << (getTime() - time) << "ms" << std::endl;
 	return true;
 }
 
@@ -1102,6 +1194,20 @@ Shader* Shader::CompileShader(const char* name, const char* vs_code, const char*
 	else
 		shader = it2->second;
 
+	//keyed by the final code (with the macros) and the driver, any change compiles it again
+	unsigned long long key = 0;
+	std::string binary_filename;
+	if (use_binary_cache && isBinaryCacheSupported())
+	{
+		key = hashBytes(vs.c_str(), vs.size(), hashBytes(fs.c_str(), fs.size(), getDriverHash()));
+		binary_filename = getBinaryFilename(name);
+		if (shader->loadBinary(binary_filename, key))
+		{
+			num_binaries_loaded++;
+			return shader;
+		}
+	}
+
 	if (!shader->compileFromMemory(vs.c_str(), fs.c_str()))
 	{
 		delete shader;
@@ -1109,6 +1215,9 @@ Shader* Shader::CompileShader(const char* name, const char* vs_code, const char*
 		return nullptr; //stop here
 	}
 
+	if (key)
+		shader->saveBinary(binary_filename, key);
+
 	//shader->vs_filename = subshader.vs_name;
 	//shader->ps_filename = subshader.fs_name;
 	//if(macros)
@@ -1117,6 +1226,100 @@ Shader* Shader::CompileShader(const char* name, const char* vs_code, const char*
 	return shader;
 }
 
+bool Shader::isBinaryCacheSupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0, num_formats = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 4 || (major == 4 && minor >= 1) || SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) ? 1 : 0;
+		if (supported)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+		supported = num_formats > 0 ? 1 : 0;
+		std::cout << " * Program binaries: " << (supported ? "yes" : "no (shaders are compiled every run)") << std::endl;
+	}
+	return supported == 1;
+}
+
+bool Shader::loadBinary(const std::string& filename, unsigned long long key)
+{
+	std::vector<unsigned char> buffer;
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > (long)sizeof(sShaderBinHeader))
+	{
+		buffer.resize(size);
+		if (fread(&buffer[0], 1, size, f) != (size_t)size)
+			buffer.clear();
+	}
+	fclose(f);
+	if (buffer.empty())
+		return false;
+
+	sShaderBinHeader header;
+	memcpy(&header, &buffer[0], sizeof(header));
+	if (memcmp(header.tag, "SBIN", 4) != 0 || header.version != SHADER_BIN_VERSION || header.key != key || header.size != buffer.size() - sizeof(header))
+		return false;
+
+	release();
+	program = glCreateProgram();
+	glProgramBinary(program, header.format, &buffer[sizeof(header)], header.size);
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) //the driver can reject it (after an update), then it is compiled
+	{
+		glDeleteProgram(program);
+		program = 0;
+		glGetError(); //clear it
+		std::cout << " - Program binary rejected: " << filename << std::endl;
+		return false;
+	}
+
+	compiled = true;
+	locations.clear(); //regenerate table
+	releaseAttribLayout(); //locations may have changed
+	return true;
+}
+
+bool Shader::saveBinary(const std::string& filename, unsigned long long key)
+{
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return false;
+
+	std::vector<unsigned char> binary(size);
+	GLenum format = 0;
+	GLsizei length = 0;
+	glGetProgramBinary(program, size, &length, &format, &binary[0]);
+	if (length <= 0)
+		return false;
+
+	sShaderBinHeader header;
+	memcpy(header.tag, "SBIN", 4);
+	header.version = SHADER_BIN_VERSION;
+	header.key = key;
+	header.format = format;
+	header.size = (unsigned int)length;
+
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (!f)
+	{
+		std::cout << "[ERROR]: cannot write the program binary: " << filename << std::endl;
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(&binary[0], 1, length, f);
+	fclose(f);
+	return true;
+}
+
 bool Shader::GetShaderFile(const char* filename, std::string& content)
 {
 	auto it = s_shader_files.find(filename);
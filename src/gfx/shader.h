@@ -105,6 +105,9 @@ namespace GFX {
 		void setTexture(const char* varname, Texture* texture, int slot);
 
 		int getAttribLocation(const char* varname);
+		unsigned long long getAttribLayout(); //signature of the locations of the mesh attributes, meshes share a VAO for all the shaders with the same one
+		static bool isAttribLayoutUsed(unsigned long long layout); //by some compiled shader
+		static unsigned int s_attrib_layouts_version; //changes when a layout stops being used, meshes drop their VAOs of it then
 		int getUniformLocation(const char* varname);
 		int getUniformBlockLocation(const char* varname);
 
@@ -127,6 +130,9 @@ namespace GFX {
 		GLuint fs;
 		GLuint cs; //compute
 		GLuint program;
+		unsigned long long attrib_layout; //cached, 0 until getAttribLayout is called after a compilation
+		static std::map<unsigned long long, int> s_attrib_layouts; //in use, with the number of shaders using each one
+		void releaseAttribLayout(); //when the locations may change
 		std::string info_log;
 		std::string log;
 
@@ -161,6 +167,14 @@ namespace GFX {
 		static bool LoadAtlas(const char* filename, const char* base_path = nullptr);
 		static bool GetShaderFile(const char* filename, std::string& content);
 
+		//the programs compiled from the atlas are stored linked (glGetProgramBinary) in s_binary_cache_folder, the next runs load them
+		//with glProgramBinary while the expanded code and the driver are the same (they are compiled if the driver rejects the binary)
+		static bool use_binary_cache;
+		static std::string s_binary_cache_folder; //next to the atlas
+		static bool isBinaryCacheSupported(); //OpenGL 4.1 or GL_ARB_get_program_binary, with some binary format
+		bool loadBinary(const std::string& filename, unsigned long long key); //false if missing, from other code or driver, or rejected
+		bool saveBinary(const std::string& filename, unsigned long long key);
+
 		//UberShaders allow permutations, use @ as the first char in the name to specify it
 		class UberShader {
 		public:
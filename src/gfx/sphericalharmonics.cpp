@@ -1,5 +1,7 @@
 #include "sphericalharmonics.h"
 
+#include <mutex>
+
 //system axis
 Vector3f cubemapFaceNormals[6][3] = {
     {{0, 0, -1} ,{0, -1, 0},{1, 0, 0} },  // posx
@@ -15,6 +17,7 @@ Vector3f cubemapFaceNormals[6][3] = {
 const int sh_length = 9;
 std::vector< std::vector<Vector3f> > cubeMapVecs;
 int cubeMapVecs_size = 0;
+std::mutex cubeMapVecs_mutex; //the probes are projected in jobs, all of them with the same size
 
 float areaElement(float x, float y) {
     return atan2(x * y, sqrtf(x * x + y * y + 1.0f));
@@ -45,10 +48,10 @@ float texelSolidAngle(float aU, float aV, float width, float height) {
 SphericalHarmonics computeSH( FloatImage images[], bool degamma ) {
 	assert(images[0].width == images[0].height && images[0].width != 0 && "Image is not square");
     int size = images[0].width;
-    int channels = 3;
     SphericalHarmonics sh;
 
     // generate cube map vectors
+    std::unique_lock<std::mutex> lock(cubeMapVecs_mutex);
     if (cubeMapVecs_size != size)
     {
         cubeMapVecs_size = size;
@@ -73,16 +76,23 @@ SphericalHarmonics computeSH( FloatImage images[], bool degamma ) {
             cubeMapVecs.push_back(faceVecs);
         }
     }
+    lock.unlock();
 
     // generate spherical harmonics
     float weightAccum = 0;
+    std::vector<float> linear_row(degamma ? size * 4 : 0);
 
     for (int index = 0; index < 6; ++index)
     {
         FloatImage& face = images[index];
-        float* pixels = face.data;
-        bool gammaCorrect = degamma;
+        int face_channels = face.num_channels;
         for (int y = 0; y < size; y++) {
+            const float* row = face.data + y * size * face_channels;
+            if (degamma)
+            {
+                GFX::convertGammaToLinear(row, &linear_row[0], size * face_channels);
+                row = &linear_row[0];
+            }
             for (int x = 0; x < size; x++) {
                 Vector3f texelVect = cubeMapVecs[index][y * size + x];
                 float weight = texelSolidAngle(x, y, size, size);
@@ -97,10 +107,9 @@ SphericalHarmonics computeSH( FloatImage images[], bool degamma ) {
                 float dy = texelVect[1];
                 float dz = texelVect[2];
 
-                Vector3f value = face.getPixel(x,y).xyz();
-                if (gammaCorrect)
-                    value = Vector3f(pow(value.x, 2.2), pow(value.y, 2.2), pow(value.z, 2.2));
-                    
+                const float* pixel = row + x * face_channels;
+                Vector3f value(pixel[0], pixel[1], pixel[2]);
+
                 sh.coeffs[0] += value * weight1;
                 sh.coeffs[1] += value * weight2 * dy;
                 sh.coeffs[2] += value * weight2 * dz;
@@ -3,11 +3,17 @@
 #include <iostream> //to output
 #include <cmath>
 #include <cassert>
+#include <map>
+#include <mutex>
+#include <algorithm>
 
 #include "texture.h"
 #include "fbo.h"
 #include "mesh.h"
 #include "shader.h"
+#include "blockcompressor.h"
+#include "texturepacker.h"
+#include "readback.h"
 
 #include "../utils/utils.h"
 #include "../extra/picopng.h"
@@ -21,31 +27,15 @@
 
 //bilinear interpolation
 Color Image::getPixelInterpolated(float x, float y, bool repeat) {
-	int ix = repeat ? fmod(x,width) : clamp(x,0,width-1);
-	int iy = repeat ? fmod(y,height) : clamp(y, 0, height - 1);
-	if (ix < 0) ix += width;
-	if (iy < 0) iy += height;
-	float fx = (x - (int)x);
-	float fy = (y - (int)y);
-	int ix2 = ix < width - 1 ? ix + 1 : 0;
-	int iy2 = iy < height - 1 ? iy + 1 : 0;
-	Color top = lerp( getPixel(ix, iy), getPixel(ix2, iy), fx );
-	Color bottom = lerp( getPixel(ix, iy2), getPixel(ix2, iy2), fx);
-	return lerp(top, bottom, fy);
+	float values[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	GFX::sampleBilinear(data, width, height, num_channels, x, y, repeat, values);
+	return Color((uint8)(values[0] * 255.0f + 0.5f), (uint8)(values[1] * 255.0f + 0.5f), (uint8)(values[2] * 255.0f + 0.5f), (uint8)(values[3] * 255.0f + 0.5f));
 };
 
 Vector4f Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
-	int ix = repeat ? fmod(x, width) : clamp(x, 0, width - 1);
-	int iy = repeat ? fmod(y, height) : clamp(y, 0, height - 1);
-	if (ix < 0) ix += width;
-	if (iy < 0) iy += height;
-	float fx = (x - (int)x);
-	float fy = (y - (int)y);
-	int ix2 = ix < width - 1 ? ix + 1 : 0;
-	int iy2 = iy < height - 1 ? iy + 1 : 0;
-	Vector4f top = lerp( getPixel(ix, iy).toVector4f(), getPixel(ix2, iy).toVector4f(), fx);
-	Vector4f bottom = lerp(getPixel(ix, iy2).toVector4f(), getPixel(ix2, iy2).toVector4f(), fx);
-	return lerp(top, bottom, fy);
+	float values[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	GFX::sampleBilinear(data, width, height, num_channels, x, y, repeat, values);
+	return Vector4f(values[0], values[1], values[2], values[3]) * 255.0f;
 };
 
 namespace GFX
@@ -53,11 +43,20 @@ namespace GFX
 
 	std::map<std::string, Texture*> Texture::sTexturesLoaded;
 	std::map<unsigned int, Texture*> Texture::sTextures;
+	std::map<unsigned long long, Texture*> Texture::sTexturesByContent; //decoded from memory, by hash
 	unsigned int Texture::s_last_index = 0;
 
 	int Texture::default_mag_filter = GL_LINEAR;
 	int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 	FBO* Texture::global_fbo = NULL;
+	bool Texture::use_block_compression = true; //the first load of every texture is slower, it is encoded and saved
+	int Texture::block_compression_quality = BLOCK_QUALITY_NORMAL;
+	eMipFilter Texture::mip_filter = MIP_FILTER_BOX;
+	bool Texture::use_streaming = true; //only for the textures loaded after changing it
+	size_t Texture::streaming_budget = 256 * 1024 * 1024; //the levels needed by the textures on screen can go over it
+	size_t Texture::streaming_bytes = 0;
+	unsigned int Texture::streaming_frame = 0;
+	unsigned int Texture::num_completed = 0; //the renderer packs the new ones when it changes
 
 	Texture::Texture()
 	{
@@ -70,6 +69,10 @@ namespace GFX
 		type = 0;
 		texture_type = GL_TEXTURE_2D;
 		loading = false;
+		streamed = false;
+		streaming.num_levels = 0;
+		streaming.packed = false;
+		content_hash = 0;
 		index = s_last_index++;
 		sTextures.insert(std::pair<unsigned int, Texture*>(index, this));
 		near_far.set(0.1f, 1000.0f);
@@ -78,7 +81,11 @@ namespace GFX
 	Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
 	{
 		loading = false;
+		streamed = false;
+		streaming.num_levels = 0;
+		streaming.packed = false;
 		texture_id = 0;
+		content_hash = 0;
 		index = s_last_index++;
 		sTextures.insert(std::pair<unsigned int, Texture*>(index, this));
 		near_far.set(0.1f, 1000.0f);
@@ -88,7 +95,11 @@ namespace GFX
 	Texture::Texture(::Image* img)
 	{
 		loading = false;
+		streamed = false;
+		streaming.num_levels = 0;
+		streaming.packed = false;
 		texture_id = 0;
+		content_hash = 0;
 		index = s_last_index++;
 		sTextures.insert(std::pair<unsigned int, Texture*>(index,this));
 		near_far.set(0.1f, 1000.0f);
@@ -97,6 +108,7 @@ namespace GFX
 
 	Texture::~Texture()
 	{
+		TexturePacker::remove(this);
 		clear();
 		auto it = sTextures.find(index);
 		if (it != sTextures.end())
@@ -118,12 +130,26 @@ namespace GFX
 			texture_id = 0;
 		}
 
+		if (streamed && streaming.num_levels)
+		{
+			streaming_bytes -= getLevelsBytes(streaming.resident_level, streaming.num_levels);
+			streaming.num_levels = 0;
+		}
+
 		if (filename.size())
 		{
 			auto it = sTexturesLoaded.find(filename);
 			if (it != sTexturesLoaded.end())
 				sTexturesLoaded.erase(it);
 		}
+
+		if (content_hash)
+		{
+			auto it = sTexturesByContent.find(content_hash);
+			if (it != sTexturesByContent.end() && it->second == this)
+				sTexturesByContent.erase(it);
+			content_hash = 0;
+		}
 	}
 
 	void Texture::Release()
@@ -238,6 +264,20 @@ namespace GFX
 		return NULL;
 	}
 
+	Texture* Texture::FindByContent(unsigned long long hash)
+	{
+		auto it = sTexturesByContent.find(hash);
+		if (it != sTexturesByContent.end())
+			return it->second;
+		return NULL;
+	}
+
+	void Texture::setContentHash(unsigned long long hash)
+	{
+		content_hash = hash;
+		sTexturesByContent[hash] = this;
+	}
+
 	Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 	{
 		//load it
@@ -256,7 +296,34 @@ namespace GFX
 		return texture;
 	}
 
-	Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap)
+	//textures waiting for a thread to decode them
+	struct sPendingDecode {
+		float importance;
+		unsigned int order; //same importance, first requested goes first
+		eTextureUsage usage;
+		float alpha_cutoff;
+		int level; //of a streamed texture, -1 the tail
+	};
+	static std::mutex pending_decodes_mutex;
+	static std::map<std::string, sPendingDecode> pending_decodes;
+	static unsigned int pending_decodes_order = 0;
+
+	//a BG task decodes the most important pending texture when it runs (not necessarily this one)
+	static void queueDecode(const std::string& filename, float importance, eTextureUsage usage, float alpha_cutoff, int level)
+	{
+		{
+			std::lock_guard<std::mutex> lock(pending_decodes_mutex);
+			sPendingDecode& pending = pending_decodes[filename];
+			pending.importance = importance;
+			pending.order = pending_decodes_order++;
+			pending.usage = usage;
+			pending.alpha_cutoff = alpha_cutoff;
+			pending.level = level;
+		}
+		TaskManager::background.addTask(new LoadTextureTask());
+	}
+
+	Texture* Texture::GetAsync(const char* filename, bool mipmaps, bool wrap, float importance, eTextureUsage usage, float alpha_cutoff)
 	{
 		//disable loading textures in thread
 		//return Get(filename, mipmaps, wrap);
@@ -275,13 +342,314 @@ namespace GFX
 		temp->setName(filename);
 		temp->loading = true;
 
-		//add action to BG Thread 
-		LoadTextureTask* task = new LoadTextureTask(filename);
-		TaskManager::background.addTask(task);
+		//only the tail first, the rest when they are needed
+		if (use_streaming)
+		{
+			temp->streamed = true;
+			sTextureStreaming& streaming = temp->streaming;
+			streaming.num_levels = 0;
+			streaming.resident_level = 0;
+			streaming.loading_level = -1;
+			streaming.needed_level = 0;
+			streaming.requested_level = 32; //coarser than any level
+			streaming.last_used_frame = streaming_frame;
+			streaming.usage = usage;
+			streaming.alpha_cutoff = alpha_cutoff;
+		}
 
+		queueDecode(filename, importance, usage, alpha_cutoff, use_streaming ? -1 : 0);
 		return temp;
 	}
 
+	void Texture::raiseLoadImportance(float importance)
+	{
+		if (!loading)
+			return;
+		std::lock_guard<std::mutex> lock(pending_decodes_mutex);
+		auto it = pending_decodes.find(filename);
+		if (it != pending_decodes.end() && it->second.importance < importance)
+			it->second.importance = importance;
+	}
+
+	//a task per pending texture, so every call takes one
+	static bool takeMostImportantDecode(std::string& filename, eTextureUsage& usage, float& alpha_cutoff, int& level)
+	{
+		std::lock_guard<std::mutex> lock(pending_decodes_mutex);
+		auto best = pending_decodes.end();
+		for (auto it = pending_decodes.begin(); it != pending_decodes.end(); ++it)
+			if (best == pending_decodes.end() || it->second.importance > best->second.importance ||
+				(it->second.importance == best->second.importance && it->second.order < best->second.order))
+				best = it;
+		if (best == pending_decodes.end())
+			return false;
+		filename = best->first;
+		usage = best->second.usage;
+		alpha_cutoff = best->second.alpha_cutoff;
+		level = best->second.level;
+		pending_decodes.erase(best);
+		return true;
+	}
+
+	void Texture::requestLevel(int level)
+	{
+		if (!streamed)
+			return;
+		if (streaming.last_used_frame != streaming_frame || level < streaming.requested_level)
+			streaming.requested_level = level;
+		streaming.last_used_frame = streaming_frame;
+	}
+
+	size_t Texture::getLevelBytes(int level)
+	{
+		unsigned int w = std::max(1, (int)width >> level);
+		unsigned int h = std::max(1, (int)height >> level);
+		if (internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+			return ((w + 3) / 4) * ((h + 3) / 4) * 8;
+		if (internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT || internal_format == GL_COMPRESSED_RG_RGTC2 || internal_format == GL_COMPRESSED_RGBA_BPTC_UNORM)
+			return ((w + 3) / 4) * ((h + 3) / 4) * 16;
+		switch (internal_format)
+		{
+			case GL_RGBA32F: case GL_RGB32F: return w * h * 16; //RGB padded like the bytes ones
+			case GL_RGBA16F: case GL_RGB16F: case GL_RG32F: return w * h * 8;
+			case GL_RG16F: case GL_R32F: case GL_DEPTH_COMPONENT32F: case GL_DEPTH_COMPONENT24: return w * h * 4;
+			case GL_R16F: case GL_RG8: case GL_DEPTH_COMPONENT16: return w * h * 2;
+			case GL_R8: return w * h;
+		}
+		//created with the format deduced from the type
+		if (format == GL_DEPTH_COMPONENT)
+			return w * h * 4;
+		if (type == GL_FLOAT)
+			return w * h * 16;
+		if (type == GL_HALF_FLOAT)
+			return w * h * 8;
+		return w * h * 4; //RGB is usually stored with 4 bytes too
+	}
+
+	size_t Texture::getVRAMBytes()
+	{
+		if (!texture_id)
+			return 0;
+		if (streamed)
+			return streaming.num_levels ? getLevelsBytes(streaming.resident_level, streaming.num_levels) : 0;
+
+		//the levels allowed (cubemaps from HDRE grow them while streaming)
+		int num_levels = 1;
+		if (mipmaps)
+		{
+			GLint max_level = 1000;
+			glBindTexture(texture_type, texture_id);
+			glGetTexParameteriv(texture_type, GL_TEXTURE_MAX_LEVEL, &max_level);
+			glBindTexture(texture_type, 0);
+			num_levels = std::min((int)floor(log2(std::max(width, height))) + 1, max_level + 1);
+		}
+		size_t bytes = getLevelsBytes(0, num_levels);
+		if (texture_type == GL_TEXTURE_CUBE_MAP)
+			bytes *= 6;
+		else if (texture_type == GL_TEXTURE_2D_ARRAY || texture_type == GL_TEXTURE_3D)
+			bytes *= std::max(1, (int)depth);
+		return bytes;
+	}
+
+	size_t Texture::getRAMBytes()
+	{
+		return image.data ? (size_t)image.width * image.height * image.num_channels : 0;
+	}
+
+	size_t Texture::getLevelsBytes(int first_level, int end_level)
+	{
+		size_t bytes = 0;
+		for (int i = first_level; i < end_level; ++i)
+			bytes += getLevelBytes(i);
+		return bytes;
+	}
+
+	int Texture::getTailLevel()
+	{
+		int level = 0;
+		while (level < streaming.num_levels - 1 && std::max((int)width >> level, (int)height >> level) > TEXTURE_STREAMING_TAIL_SIZE)
+			level++;
+		return level;
+	}
+
+	void Texture::evictLevel()
+	{
+		int level = streaming.resident_level;
+		streaming_bytes -= getLevelBytes(level);
+		streaming.resident_level++;
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streaming.resident_level);
+		//an empty level frees its memory
+		glTexImage2D(GL_TEXTURE_2D, level, internal_format, 0, 0, 0, format, GL_UNSIGNED_BYTE, NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	void Texture::updateStreaming()
+	{
+		//the requests of this frame are done
+		std::vector<Texture*> textures;
+		size_t loading_bytes = 0;
+		for (auto it : sTextures)
+		{
+			Texture* texture = it.second;
+			sTextureStreaming& streaming = texture->streaming;
+			if (!texture->streamed || !streaming.num_levels)
+				continue;
+			int tail_level = texture->getTailLevel();
+			streaming.needed_level = streaming.last_used_frame == streaming_frame ? clamp(streaming.requested_level, 0, tail_level) : tail_level;
+			if (streaming.loading_level != -1)
+				loading_bytes += texture->getLevelsBytes(streaming.loading_level, streaming.resident_level);
+			textures.push_back(texture);
+		}
+		streaming_frame++;
+
+		//least recently used first
+		std::sort(textures.begin(), textures.end(), [](Texture* a, Texture* b) { return a->streaming.last_used_frame < b->streaming.last_used_frame; });
+
+		size_t wanted_bytes = 0;
+		for (size_t i = 0; i < textures.size(); ++i)
+		{
+			sTextureStreaming& streaming = textures[i]->streaming;
+			if (streaming.loading_level == -1 && streaming.needed_level < streaming.resident_level)
+				wanted_bytes += textures[i]->getLevelsBytes(streaming.needed_level, streaming.resident_level);
+		}
+
+		//the packed ones are drawn from their arrays, the levels that no other pass needs are released even if they fit
+		for (size_t i = 0; i < textures.size(); ++i)
+		{
+			Texture* texture = textures[i];
+			while (texture->streaming.packed && texture->streaming.loading_level == -1 && texture->streaming.resident_level < texture->streaming.needed_level)
+				texture->evictLevel();
+		}
+
+		//the texture arrays share the budget with the streamed levels
+		size_t budget = streaming_budget > TexturePacker::packed_bytes ? streaming_budget - TexturePacker::packed_bytes : 0;
+
+		//make room for the levels wanted evicting the ones not needed
+		for (size_t i = 0; i < textures.size() && streaming_bytes + loading_bytes + wanted_bytes > budget; ++i)
+		{
+			Texture* texture = textures[i];
+			while (texture->streaming.resident_level < texture->streaming.needed_level && streaming_bytes + loading_bytes + wanted_bytes > budget)
+				texture->evictLevel();
+		}
+
+		//load the ones that fit, if the needed level does not fit a coarser one is loaded
+		for (int i = (int)textures.size() - 1; i >= 0; --i)
+		{
+			Texture* texture = textures[i];
+			sTextureStreaming& streaming = texture->streaming;
+			if (streaming.loading_level != -1 || streaming.needed_level >= streaming.resident_level)
+				continue;
+			int level = streaming.needed_level;
+			while (level < streaming.resident_level && streaming_bytes + loading_bytes + texture->getLevelsBytes(level, streaming.resident_level) > budget)
+				level++;
+			if (level == streaming.resident_level)
+				continue;
+			loading_bytes += texture->getLevelsBytes(level, streaming.resident_level);
+			streaming.loading_level = level;
+			queueDecode(texture->filename, (float)(streaming.resident_level - level), streaming.usage, streaming.alpha_cutoff, level);
+		}
+	}
+
+	#define COOKED_TEXTURE_KEY "cooker" //KTX metadata with the settings used to cook it
+
+	//everything that changes the cooked result
+	static std::string getCookedTextureSettings(eTextureUsage usage, float alpha_cutoff)
+	{
+		return "version " + std::to_string(BLOCK_COOKER_VERSION) + " usage " + std::to_string((int)usage) + " alpha_cutoff " + std::to_string(alpha_cutoff) +
+			" quality " + std::to_string(Texture::block_compression_quality) + " mip_filter " + std::to_string((int)Texture::mip_filter);
+	}
+
+	//the cooked file is valid if it is newer than the image and it was cooked with the same settings
+	static bool readCookedTexture(const std::string& filename, eTextureUsage usage, float alpha_cutoff, std::vector<unsigned char>& ktx)
+	{
+		size_t size;
+		long long image_time, ktx_time;
+		std::string ktx_filename = filename + ".ktx";
+		if (!getFileInfo(ktx_filename, size, ktx_time) || !getFileInfo(filename, size, image_time) || ktx_time < image_time)
+			return false;
+		if (!readFileBin(ktx_filename, ktx))
+			return false;
+
+		//the metadata is a list of keyAndValueByteSize, key\0value and padding to 4 bytes
+		std::string settings;
+		ddsktx_texture_info tc = { 0 };
+		if (ktx.size() && ddsktx_parse(&tc, &ktx[0], (int)ktx.size(), NULL) && tc.metadata_offset > 0 && tc.metadata_offset + tc.metadata_size <= (int)ktx.size())
+		{
+			const unsigned char* data = &ktx[tc.metadata_offset];
+			const unsigned char* end = data + tc.metadata_size;
+			while (end - data >= 4)
+			{
+				unsigned int pair_size;
+				memcpy(&pair_size, data, 4);
+				data += 4;
+				if (pair_size > (size_t)(end - data))
+					break;
+				std::string pair((const char*)data, pair_size);
+				size_t separator = pair.find('\0');
+				if (separator != std::string::npos && pair.compare(0, separator, COOKED_TEXTURE_KEY) == 0)
+					settings = pair.c_str() + separator + 1;
+				data += (pair_size + 3) & ~3u;
+			}
+		}
+		if (settings != getCookedTextureSettings(usage, alpha_cutoff))
+		{
+			ktx.clear();
+			return false;
+		}
+		return true;
+	}
+
+	//levels from the second one down to 1x1
+	static void buildMips(Image* image, eTextureUsage usage, float alpha_cutoff, std::vector<Image*>& mips)
+	{
+		bool alpha_test = alpha_cutoff > 0.0f && image->num_channels == 4;
+		float coverage = alpha_test ? image->computeAlphaCoverage(alpha_cutoff) : 0.0f;
+		const Image* level = image;
+		while (level->width > 1 || level->height > 1)
+		{
+			Image* mip = new Image();
+			level->downsample(*mip, Texture::mip_filter, usage == TEXTURE_COLOR, usage == TEXTURE_NORMALMAP);
+			if (alpha_test)
+				mip->scaleAlphaToCoverage(coverage, alpha_cutoff);
+			mips.push_back(mip);
+			level = mip;
+		}
+	}
+
+	//encodes the image and its mips and saves them as filename.ktx
+	static bool cookTexture(const std::string& filename, Image* image, const std::vector<Image*>& mips, eTextureUsage usage, float alpha_cutoff)
+	{
+		bool normal_map = usage == TEXTURE_NORMALMAP;
+		bool alpha = false;
+		if (image->num_channels == 4)
+			for (unsigned int i = 0; i < image->width * image->height && !alpha; ++i)
+				alpha = image->data[i * 4 + 3] != 255;
+
+		int quality = Texture::block_compression_quality;
+		eBlockFormat format = alpha ? BC3 : BC1;
+		if (normal_map)
+			format = BC5;
+		else if (quality == BLOCK_QUALITY_BEST)
+			format = BC7;
+
+		double time = getTime();
+		std::vector<sCompressedMip> levels(mips.size() + 1);
+		for (size_t i = 0; i < levels.size(); ++i)
+		{
+			Image* level = i ? mips[i - 1] : image;
+			compressImage(level->data, level->width, level->height, level->num_channels, format, levels[i], quality);
+		}
+		if (!levels[0].data.size() || !writeKTX((filename + ".ktx").c_str(), format, levels, COOKED_TEXTURE_KEY, getCookedTextureSettings(usage, alpha_cutoff).c_str()))
+			return false;
+
+		//error of the first level, normal maps only keep x and y
+		std::vector<unsigned char> decoded;
+		decompressImage(levels[0], format, decoded);
+		float psnr = computePSNR(image->data, image->num_channels, &decoded[0], image->width, image->height, normal_map ? 2 : (alpha ? 4 : 3));
+		std::cout << " + Texture cooked: " << filename << ".ktx " << getBlockFormatName(format) << " " << levels.size() << " mips PSNR: " << psnr << "dB Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
+	}
+
 	bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
 	{
 		//non-image based formats
@@ -330,6 +698,90 @@ namespace GFX
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
+	void Texture::loadFromImage(::Image* image, const std::vector<::Image*>& mips, bool wrap)
+	{
+		unsigned int format = image->num_channels == 3 ? GL_RGB : GL_RGBA;
+
+		//the rows of the small RGB levels are not aligned to 4 bytes
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		create(image->width, image->height, format, GL_UNSIGNED_BYTE, false, image->data);
+		glBindTexture(this->texture_type, texture_id);
+		for (size_t i = 0; i < mips.size(); ++i)
+			glTexImage2D(this->texture_type, (GLint)i + 1, format, mips[i]->width, mips[i]->height, 0, format, GL_UNSIGNED_BYTE, mips[i]->data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		this->mipmaps = mips.size() > 0;
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, (GLint)mips.size());
+		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glBindTexture(this->texture_type, 0);
+		assert(checkGLErrors() && "Error uploading texture");
+	}
+
+	void Texture::uploadLevels(::Image* image, const std::vector<::Image*>& mips, int first_level)
+	{
+		unsigned int format = image->num_channels == 3 ? GL_RGB : GL_RGBA;
+		int last_level = prepareLevelsUpload(image->width, image->height, (int)mips.size() + 1, format, format, first_level);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int i = first_level; i <= last_level; ++i)
+		{
+			::Image* level = i ? mips[i - 1] : image;
+			glTexImage2D(GL_TEXTURE_2D, i, format, level->width, level->height, 0, format, GL_UNSIGNED_BYTE, level->data);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		finishLevelsUpload(first_level);
+		assert(checkGLErrors() && "Error uploading texture levels");
+	}
+
+	int Texture::prepareLevelsUpload(unsigned int width, unsigned int height, int num_levels, unsigned int format, unsigned int internal_format, int& first_level)
+	{
+		//the first upload replaces the 1x1 texture, and if the file changed the levels resident are not valid
+		if (!streaming.num_levels || streaming.num_levels != num_levels || this->internal_format != internal_format)
+		{
+			if (streaming.num_levels)
+				streaming_bytes -= getLevelsBytes(streaming.resident_level, streaming.num_levels);
+			if (texture_id)
+				glDeleteTextures(1, &texture_id);
+			glGenTextures(1, &texture_id);
+			this->texture_type = GL_TEXTURE_2D;
+			this->width = (float)width;
+			this->height = (float)height;
+			this->format = format;
+			this->internal_format = internal_format;
+			this->type = GL_UNSIGNED_BYTE;
+			this->mipmaps = num_levels > 1;
+			streaming.num_levels = num_levels;
+			streaming.resident_level = num_levels;
+		}
+
+		if (first_level < 0)
+			first_level = getTailLevel();
+		first_level = clamp(first_level, 0, num_levels - 1);
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		return streaming.resident_level - 1;
+	}
+
+	void Texture::finishLevelsUpload(int first_level)
+	{
+		if (first_level < streaming.resident_level)
+		{
+			streaming_bytes += getLevelsBytes(first_level, streaming.resident_level);
+			streaming.resident_level = first_level;
+		}
+
+		//the levels not resident are outside the range
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streaming.resident_level);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, streaming.num_levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
 	void Texture::upload(::Image* img)
 	{
 		create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
@@ -530,7 +982,7 @@ namespace GFX
 		return loadKTX(buffer);
 	}
 
-	bool Texture::loadKTX(std::vector<unsigned char>& buffer)
+	bool Texture::loadKTX(std::vector<unsigned char>& buffer, int first_level)
 	{
 		std::vector<unsigned char> out_image;
 
@@ -538,11 +990,45 @@ namespace GFX
 		if (!ddsktx_parse(&tc, &buffer[0], buffer.size(), NULL))
 			return false;
 
+		//only 2D block compressed textures, the ones cooked by the engine
+		if (tc.flags & (DDSKTX_TEXTURE_FLAG_CUBEMAP | DDSKTX_TEXTURE_FLAG_VOLUME) || tc.num_layers > 1)
+		{
+			std::cout << "[ERROR]: KTX cubemaps, volumes and arrays are not supported" << std::endl;
+			return false;
+		}
+
+		unsigned int compressed_format = 0;
+		switch (tc.format)
+		{
+			case DDSKTX_FORMAT_BC1: compressed_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+			case DDSKTX_FORMAT_BC3: compressed_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+			case DDSKTX_FORMAT_BC5: compressed_format = GL_COMPRESSED_RG_RGTC2; break;
+			case DDSKTX_FORMAT_BC7: compressed_format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+			default:
+				std::cout << "[ERROR]: KTX format not supported: " << ddsktx_format_str(tc.format) << std::endl;
+				return false;
+		}
+
+		if (streamed)
+		{
+			unsigned int format = compressed_format == GL_COMPRESSED_RG_RGTC2 ? GL_RG : (compressed_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? GL_RGB : GL_RGBA);
+			int last_level = prepareLevelsUpload(tc.width, tc.height, tc.num_mips, format, compressed_format, first_level);
+			for (int mip = first_level; mip <= last_level; mip++) {
+				ddsktx_sub_data sub_data;
+				ddsktx_get_sub(&tc, &sub_data, &buffer[0], (int)buffer.size(), 0, 0, mip);
+				glCompressedTexImage2D(GL_TEXTURE_2D, mip, compressed_format, sub_data.width, sub_data.height, 0, sub_data.size_bytes, sub_data.buff);
+			}
+			finishLevelsUpload(first_level);
+			return checkGLErrors();
+		}
+
 		this->texture_type = GL_TEXTURE_2D;
-		if (tc.flags & DDSKTX_TEXTURE_FLAG_CUBEMAP)
-			this->texture_type = GL_TEXTURE_CUBE_MAP;
-		else if (tc.flags & DDSKTX_TEXTURE_FLAG_VOLUME)
-			this->texture_type = GL_TEXTURE_3D;
+		this->width = (float)tc.width;
+		this->height = (float)tc.height;
+		this->format = compressed_format == GL_COMPRESSED_RG_RGTC2 ? GL_RG : (compressed_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? GL_RGB : GL_RGBA);
+		this->type = GL_UNSIGNED_BYTE;
+		this->internal_format = compressed_format;
+		this->mipmaps = tc.num_mips > 1;
 
 		if (texture_id == 0)
 			glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
@@ -550,18 +1036,18 @@ namespace GFX
 
 		for (int mip = 0; mip < tc.num_mips; mip++) {
 			ddsktx_sub_data sub_data;
-			ddsktx_get_sub(&tc, &sub_data, &buffer[0], buffer.size(), 0, 0, mip);
-			// Fill/Set texture sub resource data (mips in this case)
-			/*
-			if (ddsktx_format_compressed(tc.format))
-				//glCompressedTexImage2D(this->texture_type,mip,
-			else
-				glTexImage2D(this->texture_type, mip, internal_format == 0 ? format : internal_format, width, height, 0, format, type, data);
-				//glTexImage2D(..);
-			*/
+			ddsktx_get_sub(&tc, &sub_data, &buffer[0], (int)buffer.size(), 0, 0, mip);
+			glCompressedTexImage2D(this->texture_type, mip, compressed_format, sub_data.width, sub_data.height, 0, sub_data.size_bytes, sub_data.buff);
 		}
 
-		return true;
+		//the file has the whole chain, no need to generate it
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, tc.num_mips - 1);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+		glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glBindTexture(this->texture_type, 0);
+		return checkGLErrors();
 	}
 
 
@@ -723,13 +1209,14 @@ void Image::fromTexture(GFX::Texture* texture)
 {
 	assert(texture);
 
-	if(data && (width != texture->width || height != texture->height ))
+	if(data && (width != texture->width || height != texture->height || num_channels != 4))
 		clear();
 
 	if (!data)
 	{
 		width = texture->width;
 		height = texture->height;
+		num_channels = 4;
 		data = new uint8[width * height * 4];
 	}
 	
@@ -737,6 +1224,186 @@ void Image::fromTexture(GFX::Texture* texture)
 	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 }
 
+void Image::fromTextureAsync(GFX::Texture* texture, std::function<void()> callback)
+{
+	assert(texture);
+	Image* image = this;
+	GFX::Readback::readTexture(texture, GL_RGBA, GL_UNSIGNED_BYTE, [image, callback](const void* pixels, unsigned int width, unsigned int height) {
+		if (!image->data || image->width != width || image->height != height || image->num_channels != 4)
+			image->resize(width, height, 4);
+		memcpy(image->data, pixels, width * height * 4);
+		if (callback)
+			callback();
+	});
+}
+
+struct sMipFilterTap
+{
+	unsigned int index;
+	float weight;
+};
+
+static float besselI0(float x)
+{
+	float sum = 1.0f;
+	float term = 1.0f;
+	for (int k = 1; k < 20; ++k)
+	{
+		float f = x / (2.0f * k);
+		term *= f * f;
+		sum += term;
+	}
+	return sum;
+}
+
+//source pixels and weights of every pixel of the mip in one axis
+static void computeMipFilterTaps(unsigned int size, unsigned int mip_size, eMipFilter filter, std::vector< std::vector<sMipFilterTap> >& taps)
+{
+	const float kaiser_radius = 1.5f; //in pixels of the mip
+	const float kaiser_alpha = 4.0f;
+	float scale = size / (float)mip_size;
+	taps.resize(mip_size);
+	for (unsigned int x = 0; x < mip_size; ++x)
+	{
+		std::vector<sMipFilterTap>& pixel_taps = taps[x];
+		pixel_taps.clear();
+		float start = x * scale;
+		float end = (x + 1) * scale;
+		float center = (start + end) * 0.5f;
+		if (filter == MIP_FILTER_KAISER)
+		{
+			start = center - kaiser_radius * scale;
+			end = center + kaiser_radius * scale;
+		}
+
+		float total = 0.0f;
+		for (int i = (int)floorf(start); i < (int)ceilf(end); ++i)
+		{
+			float weight;
+			if (filter == MIP_FILTER_BOX)
+				weight = std::min(i + 1.0f, end) - std::max((float)i, start); //overlap
+			else
+			{
+				float t = (i + 0.5f - center) / scale;
+				float w = t / kaiser_radius;
+				if (fabsf(w) >= 1.0f)
+					continue;
+				float sinc = fabsf(t) < 1e-5f ? 1.0f : sinf((float)PI * t) / ((float)PI * t);
+				weight = sinc * besselI0(kaiser_alpha * sqrtf(1.0f - w * w)) / besselI0(kaiser_alpha);
+			}
+			if (weight == 0.0f)
+				continue;
+			sMipFilterTap tap;
+			tap.index = (unsigned int)std::min(std::max(i, 0), (int)size - 1);
+			tap.weight = weight;
+			pixel_taps.push_back(tap);
+			total += weight;
+		}
+		for (size_t i = 0; i < pixel_taps.size(); ++i)
+			pixel_taps[i].weight /= total;
+	}
+}
+
+void Image::downsample(Image& mip, eMipFilter filter, bool srgb, bool normal_map) const
+{
+	assert(data && "no image to downsample");
+	unsigned int mip_width = std::max(1u, width / 2);
+	unsigned int mip_height = std::max(1u, height / 2);
+	mip.resize(mip_width, mip_height, num_channels);
+
+	std::vector< std::vector<sMipFilterTap> > taps_x, taps_y;
+	computeMipFilterTaps(width, mip_width, filter, taps_x);
+	computeMipFilterTaps(height, mip_height, filter, taps_y);
+
+	//horizontal pass to linear values (gamma 2.2 like the shaders, alpha is always linear), then the vertical one
+	std::vector<float> rows(mip_width * height * num_channels);
+	std::vector<float> line(std::max(width, mip_width) * num_channels);
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		GFX::convertBytesToFloats(data + y * width * num_channels, &line[0], width, num_channels, srgb);
+		for (unsigned int x = 0; x < mip_width; ++x)
+		{
+			float* pixel = &rows[(y * mip_width + x) * num_channels];
+			for (unsigned int c = 0; c < num_channels; ++c)
+				pixel[c] = 0.0f;
+			const std::vector<sMipFilterTap>& pixel_taps = taps_x[x];
+			for (size_t i = 0; i < pixel_taps.size(); ++i)
+			{
+				const float* src = &line[pixel_taps[i].index * num_channels];
+				for (unsigned int c = 0; c < num_channels; ++c)
+					pixel[c] += pixel_taps[i].weight * src[c];
+			}
+		}
+	}
+
+	for (unsigned int y = 0; y < mip_height; ++y)
+	{
+		for (unsigned int x = 0; x < mip_width; ++x)
+		{
+			float* pixel = &line[x * num_channels];
+			for (unsigned int c = 0; c < num_channels; ++c)
+				pixel[c] = 0.0f;
+			const std::vector<sMipFilterTap>& pixel_taps = taps_y[y];
+			for (size_t i = 0; i < pixel_taps.size(); ++i)
+			{
+				const float* src = &rows[(pixel_taps[i].index * mip_width + x) * num_channels];
+				for (unsigned int c = 0; c < num_channels; ++c)
+					pixel[c] += pixel_taps[i].weight * src[c];
+			}
+
+			//the average of unit vectors is shorter
+			if (normal_map && num_channels >= 3)
+			{
+				Vector3f n(pixel[0] * 2.0f - 1.0f, pixel[1] * 2.0f - 1.0f, pixel[2] * 2.0f - 1.0f);
+				if (n.length() > 1e-4f)
+				{
+					n.normalize();
+					pixel[0] = n.x * 0.5f + 0.5f;
+					pixel[1] = n.y * 0.5f + 0.5f;
+					pixel[2] = n.z * 0.5f + 0.5f;
+				}
+			}
+		}
+		//clamped, the kaiser filter has negative lobes
+		GFX::convertFloatsToBytes(&line[0], mip.data + y * mip_width * num_channels, mip_width, num_channels, srgb);
+	}
+}
+
+float Image::computeAlphaCoverage(float alpha_cutoff, float alpha_scale) const
+{
+	if (num_channels != 4 || !width || !height)
+		return 1.0f;
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < width * height; ++i)
+		if (data[i * 4 + 3] / 255.0f * alpha_scale > alpha_cutoff)
+			count++;
+	return count / (float)(width * height);
+}
+
+//the smaller mips average the alpha with the transparent pixels, so alpha tested surfaces get thinner with the distance
+void Image::scaleAlphaToCoverage(float coverage, float alpha_cutoff)
+{
+	if (num_channels != 4)
+		return;
+
+	//binary search, the coverage grows with the scale
+	float min_scale = 0.0f;
+	float max_scale = 4.0f;
+	for (int i = 0; i < 10; ++i)
+	{
+		float scale = (min_scale + max_scale) * 0.5f;
+		if (computeAlphaCoverage(alpha_cutoff, scale) < coverage)
+			min_scale = scale;
+		else
+			max_scale = scale;
+	}
+	//small mips have few pixels, the closest one
+	float scale = fabsf(computeAlphaCoverage(alpha_cutoff, min_scale) - coverage) < fabsf(computeAlphaCoverage(alpha_cutoff, max_scale) - coverage) ? min_scale : max_scale;
+
+	for (unsigned int i = 0; i < width * height; ++i)
+		data[i * 4 + 3] = (uint8)std::min(255.0f, data[i * 4 + 3] * scale + 0.5f);
+}
+
 bool Image::load(const char* filename)
 {
 	std::string str = filename;
@@ -834,13 +1501,7 @@ bool Image::loadTGA(const char* filename)
 		origin_topleft = true;
     
 	//flip BGR to RGB pixels
-	#pragma omp simd
-    for (GLuint i = 0; i < int(imageSize); i += num_channels)
-    {
-        uint8 temp = data[i];
-        data[i] = data[i + 2];
-        data[i + 2] = temp;
-    }
+	GFX::swapRedBlue(data, width * height, num_channels);
     
     fclose(file);
 	return true;
@@ -934,44 +1595,22 @@ bool Image::saveTGA(const char* filename, bool flip_y)
 	fwrite(TGAheader, 1, sizeof(TGAheader), file);
 	fwrite(header, 1, 6, file);
 
-	//convert pixels to unsigned char
+	//BGRA pixels, the rows from the bottom one
 	unsigned char* bytes = new unsigned char[width*height * 4];
-	for (unsigned int y = 0; y < height; ++y)
-		for (unsigned int x = 0; x < width; ++x)
-		{
-			Uint8* p = data + (height - y - 1)*width*4 + x*4;
-			unsigned int pos = (y*width + x) * 4;
-			if(flip_y)
-				pos = ((height - y - 1)*width + x) * 4;
-			bytes[pos + 2] = *p;
-			bytes[pos + 1] = *(p+1);
-			bytes[pos] = *(p+2);
-			bytes[pos + 3] = *(p+3);
-		}
+	if (num_channels == 4)
+		memcpy(bytes, data, width*height * 4);
+	else
+		GFX::convertRGBToRGBA(data, bytes, width*height);
+	GFX::swapRedBlue(bytes, width*height, 4);
+	if (!flip_y)
+		GFX::flipRows(bytes, width * 4, height);
 
 	fwrite(bytes, 1, width*height * 4, file);
 	fclose(file);
+	delete[] bytes;
 	return true;
 }
 
-template<typename T>
-void tImage<T>::flipY()
-{
-	assert(data);
-	int row_size = num_channels * width;
-	T* temp_row = new T[row_size];
-#pragma omp simd
-	for (int y = 0; y < height*0.5; y += 1)
-	{
-		uint8* pos = data + y*row_size;
-		memcpy(temp_row, pos, row_size);
-		uint8* pos2 = data + (height - y - 1)*row_size;
-		memcpy(pos, pos2, row_size);
-		memcpy(pos2, temp_row, row_size);
-	}
-	delete[] temp_row;
-}
-
 struct tImageHeader {
 	int width;
 	int height;
@@ -1017,7 +1656,7 @@ bool FloatImage::loadIBIN(const char* filename)
 void FloatImage::fromTexture(GFX::Texture* texture)
 {
 	assert(texture);
-	assert(texture->type == GL_FLOAT);
+	assert((texture->type == GL_FLOAT || texture->type == GL_HALF_FLOAT) && "not a float texture");
 	if (data && (width != texture->width || height != texture->height))
 		clear();
 	if (!data)
@@ -1028,7 +1667,35 @@ void FloatImage::fromTexture(GFX::Texture* texture)
 	}
 
 	texture->bind();
-	glGetTexImage(GL_TEXTURE_2D, 0, num_channels == 3 ? GL_RGB : GL_RGBA, GL_FLOAT, data);
+	unsigned int format = num_channels == 3 ? GL_RGB : GL_RGBA;
+	if (texture->type == GL_HALF_FLOAT)
+	{
+		//half the bytes to read back, converted here
+		std::vector<uint16> halfs(width * height * num_channels);
+		glGetTexImage(GL_TEXTURE_2D, 0, format, GL_HALF_FLOAT, &halfs[0]);
+		GFX::convertHalfToFloat(&halfs[0], data, halfs.size());
+	}
+	else
+		glGetTexImage(GL_TEXTURE_2D, 0, format, GL_FLOAT, data);
+}
+
+void FloatImage::fromTextureAsync(GFX::Texture* texture, std::function<void()> callback)
+{
+	assert(texture);
+	assert((texture->type == GL_FLOAT || texture->type == GL_HALF_FLOAT) && "not a float texture");
+	bool half = texture->type == GL_HALF_FLOAT; //half the bytes to read back
+	FloatImage* image = this;
+	GFX::Readback::readTexture(texture, num_channels == 3 ? GL_RGB : GL_RGBA, half ? GL_HALF_FLOAT : GL_FLOAT, [image, half, callback](const void* pixels, unsigned int width, unsigned int height) {
+		if (!image->data || image->width != width || image->height != height)
+			image->resize(width, height, image->num_channels);
+		size_t count = width * height * image->num_channels;
+		if (half)
+			GFX::convertHalfToFloat((const uint16*)pixels, image->data, count);
+		else
+			memcpy(image->data, pixels, count * sizeof(float));
+		if (callback)
+			callback();
+	});
 }
 
 void FloatImage::fromScreen(int width, int height)
@@ -1051,30 +1718,61 @@ bool isPowerOfTwo( int n )
 	return (n & (n - 1)) == 0;
 }
 
+//the faces of a level, read from the mapped file
+static Uint8** getHDREFaces(HDRE* hdre, int level)
+{
+	return hdre->half ? (Uint8**)hdre->getFacesh(level) : (Uint8**)hdre->getFacesf(level);
+}
+
+//the texture only uses the levels uploaded (the others are not complete)
+static void setCubemapMaxLevel(GFX::Texture* texture, int level)
+{
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture->texture_id);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, level);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+//one of the lower levels of a cubemap from CubemapFromHDRE, the file is unmapped after the last pending one (of every cubemap made from it)
+static void uploadHDRELevel(const std::string& filename, int level)
+{
+	HDRE* hdre = HDRE::Find(filename.c_str());
+	if (!hdre)
+		return;
+	GFX::Texture* texture = GFX::Texture::Find(filename.c_str());
+	if (hdre->isMapped() && texture && texture->texture_type == GL_TEXTURE_CUBE_MAP && level < hdre->stored_levels)
+	{
+		texture->uploadCubemap(texture->format, texture->type, false, getHDREFaces(hdre, level), texture->internal_format, level);
+		setCubemapMaxLevel(texture, level);
+	}
+	if (--hdre->pending_levels <= 0)
+	{
+		hdre->pending_levels = 0;
+		hdre->release();
+	}
+}
+
 GFX::Texture* CubemapFromHDRE(const char* filename, GFX::Texture* output)
 {
 	HDRE* hdre = HDRE::Get(filename);
 	if (!hdre)
 		return NULL;
 
+	//only the first level now, the data (float or half) goes from the mapped file to GL without copies
 	GFX::Texture* texture = output ? output : new GFX::Texture();
-	if (hdre->getFacesf(0))
+	texture->createCubemap(hdre->width, hdre->height, getHDREFaces(hdre, 0),
+		hdre->header.numChannels == 3 ? GL_RGB : GL_RGBA, hdre->half ? GL_HALF_FLOAT : GL_FLOAT);
+	setCubemapMaxLevel(texture, 0);
+	texture->setName(filename); //the levels find it by name
+
+	//the lower levels (used by rough reflections) one per task, so they are spread in the next frames
+	std::string name = filename;
+	for (int i = 1; i < hdre->stored_levels; ++i)
 	{
-		texture->createCubemap(hdre->width, hdre->height, (Uint8**)hdre->getFacesf(0),
-			hdre->header.numChannels == 3 ? GL_RGB : GL_RGBA, GL_FLOAT);
-		for (int i = 1; i < hdre->levels; ++i)
-			texture->uploadCubemap(texture->format, texture->type, false,
-				(Uint8**)hdre->getFacesf(i), GL_RGBA32F, i);
+		hdre->pending_levels++;
+		TaskManager::foreground.addTask(new Task([name, i]() { uploadHDRELevel(name, i); }));
 	}
-	else
-		if (hdre->getFacesh(0))
-		{
-			texture->createCubemap(hdre->width, hdre->height, (Uint8**)hdre->getFacesh(0),
-				hdre->header.numChannels == 3 ? GL_RGB : GL_RGBA, GL_HALF_FLOAT);
-			for (int i = 1; i < hdre->levels; ++i)
-				texture->uploadCubemap(texture->format, texture->type, false,
-					(Uint8**)hdre->getFacesh(i), GL_RGBA16F, i);
-		}
+	if (!hdre->pending_levels)
+		hdre->release();
 	return texture;
 }
 
@@ -1083,41 +1781,91 @@ GFX::Texture* CubemapFromHDRE(const char* filename, GFX::Texture* output)
 
 LoadTextureTask::LoadTextureTask(const char* str)
 {
-	filename = str;
+	if (str)
+		filename = str;
+	usage = GFX::TEXTURE_COLOR;
+	alpha_cutoff = 0.0f;
+	level = 0;
 	image = NULL;
 }
 
 void LoadTextureTask::onExecute()
 {
+	if (filename.empty() && !GFX::takeMostImportantDecode(filename, usage, alpha_cutoff, level))
+		return;
+
+	//already cooked
+	std::vector<unsigned char> ktx;
+	if (GFX::Texture::use_block_compression && GFX::readCookedTexture(filename, usage, alpha_cutoff, ktx))
+	{
+		TaskManager::foreground.addTask(new UploadTextureTask(filename.c_str(), ktx, level));
+		return;
+	}
+
 	image = new Image();
 	if (!image->load(filename.c_str()))
 	{
 		delete image;
 		image = NULL;
+		//the texture keeps what it has, it is not waiting anymore
+		std::string name = filename;
+		TaskManager::foreground.addTask(new Task([name]() {
+			auto it = GFX::Texture::sTexturesLoaded.find(name);
+			if (it != GFX::Texture::sTexturesLoaded.end())
+			{
+				it->second->loading = false;
+				it->second->streaming.loading_level = -1;
+			}
+			std::cout << "[ERROR]: Image failed to decode in background: " << name << std::endl;
+		}));
+		return;
+	}
+
+	//in this thread, so the main thread only uploads them
+	GFX::buildMips(image, usage, alpha_cutoff, mips);
+
+	//if it cannot be cooked the image is uploaded as always
+	if (GFX::Texture::use_block_compression && GFX::cookTexture(filename, image, mips, usage, alpha_cutoff) && readFileBin(filename + ".ktx", ktx))
+	{
+		delete image;
+		image = NULL;
+		for (size_t i = 0; i < mips.size(); ++i)
+			delete mips[i];
+		mips.clear();
+		TaskManager::foreground.addTask(new UploadTextureTask(filename.c_str(), ktx, level));
 		return;
 	}
 
 	//image loaded, ready to go back to main thread
-	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), image);
+	UploadTextureTask* upload_task = new UploadTextureTask(filename.c_str(), image, mips, level);
 	TaskManager::foreground.addTask(upload_task);
 }
 
-UploadTextureTask::UploadTextureTask(const char* filename, Image* image)
+UploadTextureTask::UploadTextureTask(const char* filename, Image* image, std::vector<Image*>& mips, int level)
 {
 	this->filename = filename;
+	this->level = level;
 	this->image = image;
+	this->mips.swap(mips);
 	assert(image && "image cannot be null");
 }
 
+UploadTextureTask::UploadTextureTask(const char* filename, std::vector<unsigned char>& ktx, int level)
+{
+	this->filename = filename;
+	this->level = level;
+	this->image = NULL;
+	this->ktx.swap(ktx);
+}
+
 void UploadTextureTask::onExecute()
 {
 	GFX::Texture* texture = NULL;
-	if (!image)
+	if (!image && ktx.empty())
 	{
 		std::cerr << "Image is null: " << filename << std::endl;
 		return;
 	}
-	assert(image && "image cant be null");
 
 	//in case somehow it got loaded while I was loading it in the background
 	auto it = GFX::Texture::sTexturesLoaded.find(filename);
@@ -1128,7 +1876,10 @@ void UploadTextureTask::onExecute()
 		if (!texture)
 			texture = new Texture();
 		*/
-		delete image;
+		if (image)
+			delete image;
+		for (size_t i = 0; i < mips.size(); ++i)
+			delete mips[i];
 		std::cout << "Warning: image loaded in background not found foreground thread" << std::endl;
 		return;
 	}
@@ -1136,9 +1887,20 @@ void UploadTextureTask::onExecute()
 	texture = it->second;
 
 	//upload to GPU
-	texture->loadFromImage(image);
+	if (texture->streamed && image)
+		texture->uploadLevels(image, mips, level);
+	else if (image)
+		texture->loadFromImage(image, mips);
+	else if (!texture->loadKTX(ktx, level))
+		std::cout << "[ERROR]: cooked texture cannot be uploaded: " << filename << ".ktx" << std::endl;
 	texture->loading = false;
+	texture->streaming.loading_level = -1;
+	if (!texture->streamed || texture->streaming.resident_level == 0)
+		GFX::Texture::num_completed++; //all its levels are in VRAM, it can be packed
 
 	//delete image
-	delete image;
+	if (image)
+		delete image;
+	for (size_t i = 0; i < mips.size(); ++i)
+		delete mips[i];
 }
@@ -7,6 +7,7 @@
 #include "../core/includes.h"
 #include "../core/math.h"
 #include "../core/task.h"
+#include "imagekernels.h"
 #include <map>
 #include <set>
 #include <string>
@@ -31,6 +32,20 @@ namespace GFX {
 	#define GL_TEXTURE_EXTERNAL_OES 0x8D65
 #endif
 
+//block compressed formats of the cooked textures
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+	#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+	#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
 //Simple class to handle images
 template <typename T> class tImage
 {
@@ -47,7 +62,13 @@ public:
 
 	void resize(int w, int h, int num_channels = 3) { if (data) delete[] data; width = w; height = h; this->num_channels = num_channels; data = new T[w * h * num_channels]; memset(data, 0, w * h * sizeof(T) * num_channels); }
 	void clear() { if (data) delete[]data; data = NULL; width = height = 0; }
-	void flipY();
+	void flipY() { assert(data); GFX::flipRows(data, width * num_channels * sizeof(T), height); }
+};
+
+//filters of the mips built on the CPU
+enum eMipFilter {
+	MIP_FILTER_BOX, //average of the pixels covered
+	MIP_FILTER_KAISER //windowed sinc, sharper
 };
 
 class Image : public tImage<uint8>
@@ -56,7 +77,7 @@ public:
 	Color getPixel(int x, int y) {
 		assert(x >= 0 && x < (int)width && y >= 0 && y < (int)height && "reading of memory");
 		int pos = y*width* num_channels + x* num_channels;
-		return Color(data[pos], data[pos + 1], data[pos + 2], num_channels == 4 ? 255 : data[pos + 3]);
+		return Color(data[pos], data[pos + 1], data[pos + 2], num_channels == 4 ? data[pos + 3] : 255);
 	};
 	void setPixel(int x, int y, Color v) {
 		assert(x >= 0 && x < (int)width && y >= 0 && y < (int)height && "writing of memory");
@@ -68,8 +89,17 @@ public:
 	Vector4f getPixelInterpolatedHigh(float x, float y, bool repeat = false); //returns a Vector4 (floats)
 
 	void fromTexture(GFX::Texture* texture);
+	//the pixels arrive in a later frame (GFX::Readback) and then the callback is called, the image must exist until then
+	void fromTextureAsync(GFX::Texture* texture, std::function<void()> callback = nullptr);
 	void fromScreen(int width, int height);
 
+	//next level of the mip chain, half the size rounded down so NPOT images work too
+	//srgb filters the color in linear space (gamma 2.2 like the shaders), normal maps are renormalized
+	void downsample(Image& mip, eMipFilter filter = MIP_FILTER_BOX, bool srgb = true, bool normal_map = false) const;
+	//scales the alpha so the fraction of pixels above the cutoff is the given one (alpha tested mips dont fade away)
+	void scaleAlphaToCoverage(float coverage, float alpha_cutoff);
+	float computeAlphaCoverage(float alpha_cutoff, float alpha_scale = 1.0f) const;
+
 	bool load(const char* filename);
 
 	bool loadTGA(const char* filename);
@@ -98,6 +128,7 @@ public:
 			data[pos + 3] = v.w;
 	};
 	void fromTexture(GFX::Texture* texture);
+	void fromTextureAsync(GFX::Texture* texture, std::function<void()> callback = nullptr); //like Image::fromTextureAsync, halfs are converted when they arrive
 	void fromScreen(int width, int height);
 	bool loadIBIN(const char* filename);
 	bool saveIBIN(const char* filename);
@@ -105,6 +136,28 @@ public:
 
 namespace GFX {
 
+	//how the content of a texture is filtered and compressed
+	enum eTextureUsage {
+		TEXTURE_COLOR, //gamma encoded (albedo, emissive)
+		TEXTURE_LINEAR, //data (metallic roughness, occlusion, opacity)
+		TEXTURE_NORMALMAP
+	};
+
+	#define TEXTURE_STREAMING_TAIL_SIZE 64 //levels of this size or smaller are always resident
+
+	//levels in VRAM of a streamed texture, the resident ones go from resident_level to the last one
+	struct sTextureStreaming {
+		int num_levels; //of the whole chain, 0 until the first levels are uploaded
+		int resident_level;
+		int loading_level; //being decoded, -1 if none
+		int needed_level; //estimated in the last frame
+		int requested_level; //finest one requested by the render calls of this frame
+		unsigned int last_used_frame;
+		eTextureUsage usage;
+		float alpha_cutoff;
+		bool packed; //a copy is in a texture array (GFX::TexturePacker), the levels not requested are evicted right away
+	};
+
 	// TEXTURE CLASS
 	class Texture
 	{
@@ -112,12 +165,21 @@ namespace GFX {
 		static int default_mag_filter;
 		static int default_min_filter;
 		static FBO* global_fbo;
+		static bool use_block_compression; //the textures loaded async are cooked to a KTX next to the file and loaded from it
+		static int block_compression_quality; //BLOCK_QUALITY_FAST, NORMAL or BEST (color textures use BC7)
+		static eMipFilter mip_filter; //of the mips built in the decode of the textures loaded async
+		static bool use_streaming; //the textures loaded async start with the small levels, the rest are loaded when the renderer needs them
+		static size_t streaming_budget; //bytes of VRAM for the levels of the streamed textures
+		static size_t streaming_bytes; //used now
+		static unsigned int streaming_frame;
+		static unsigned int num_completed; //increased every time a texture gets all its levels in VRAM
 
 		//a general struct to store all the information about a TGA file
 
 		//textures manager
 		static std::map<std::string, Texture*> sTexturesLoaded;
 		static std::map<unsigned int, Texture*> sTextures;
+		static std::map<unsigned long long, Texture*> sTexturesByContent; //the ones decoded from images in memory (like the ones embedded in a .glb), by the hash of the encoded bytes
 		static unsigned int s_last_index;
 
 		GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
@@ -128,6 +190,7 @@ namespace GFX {
 		bool loading;
 		vec2 near_far; //used for depth textures
 		unsigned int index;
+		unsigned long long content_hash; //0 if it is not in sTexturesByContent
 
 		unsigned int format; //GL_RGB, GL_RGBA, GL_DEPTH_COMPONENT
 		unsigned int type; //GL_UNSIGNED_INT, GL_FLOAT
@@ -138,6 +201,9 @@ namespace GFX {
 		unsigned int wrapS;
 		unsigned int wrapT;
 
+		bool streamed;
+		sTextureStreaming streaming;
+
 		//original data info
 		::Image image;
 
@@ -163,7 +229,11 @@ namespace GFX {
 		void uploadAsArray(unsigned int texture_size, bool mipmaps = true);
 
 		bool loadKTX(const char* filename);
-		bool loadKTX(std::vector<unsigned char>& buffer);
+		bool loadKTX(std::vector<unsigned char>& buffer, int first_level = 0); //streamed textures only upload the levels from first_level that are not resident (-1 the tail)
+		//levels of a streamed texture, like loadKTX
+		void uploadLevels(::Image* image, const std::vector<::Image*>& mips, int first_level);
+		int prepareLevelsUpload(unsigned int width, unsigned int height, int num_levels, unsigned int format, unsigned int internal_format, int& first_level); //returns the last level to upload
+		void finishLevelsUpload(int first_level);
 
 		void bind();
 		void unbind();
@@ -177,16 +247,34 @@ namespace GFX {
 		//load without using the manager
 		bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
 		void loadFromImage(::Image* image, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+		//with the rest of the levels built on the CPU, nothing is generated by the GPU and NPOT textures have mips too
+		void loadFromImage(::Image* image, const std::vector<::Image*>& mips, bool wrap = true);
 
 		//load using the manager (caching loaded ones to avoid reloading them)
 		static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
-		static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true);
+		//alpha_cutoff is for the textures of MASK materials, their mips keep the coverage of the first level
+		static Texture* GetAsync(const char* filename, bool mipmaps = true, bool wrap = true, float importance = 0.0f, eTextureUsage usage = TEXTURE_COLOR, float alpha_cutoff = 0.0f);
 		static Texture* Find(const char* filename);
+		static Texture* FindByContent(unsigned long long hash);
+		void setContentHash(unsigned long long hash);
 		void setName(const char* name) {
 			filename = name;
 			sTexturesLoaded[filename] = this;
 		}
 
+		//while loading, the decodes with more importance (estimated size on screen) are done first
+		void raiseLoadImportance(float importance);
+
+		//streaming: the render calls request the level they need every frame, updateStreaming loads and evicts levels after them
+		void requestLevel(int level);
+		size_t getLevelBytes(int level);
+		size_t getLevelsBytes(int first_level, int end_level); //[first, end)
+		size_t getVRAMBytes(); //all the levels allocated (resident ones if streamed), estimated from the formats
+		size_t getRAMBytes(); //the copy of the pixels in image
+		int getTailLevel(); //first level always resident
+		void evictLevel(); //the finest resident one
+		static void updateStreaming();
+
 		void generateMipmaps();
 
 		//show the texture on the current viewport
@@ -209,13 +297,21 @@ bool isPowerOfTwo(int n);
 //When loading textures asyncrhonously, first we load them from the hard drive in a background thread
 //afterwards we pass the data to the main thread as bg threads cannot access opengl, and main thread
 //uploads to GPU. While loading a fake 1x1 texture is created
+//The decodes run in parallel in the threads of the JobSystem, every task takes the most important pending texture
+//The mips are built in the decode too, with block compression the image and its mips are cooked once to a KTX file,
+//later loads only read the KTX
+//Streamed textures decode the whole file every time a level is requested but only upload the levels that are not resident
 
 class LoadTextureTask : public Task {
 public:
 	std::string filename;
+	GFX::eTextureUsage usage;
+	float alpha_cutoff;
+	int level; //first level to upload of a streamed texture, -1 the tail
 	Image* image;
+	std::vector<Image*> mips; //from the second level
 
-	LoadTextureTask(const char* filename);
+	LoadTextureTask(const char* filename = NULL); //NULL takes the most important texture waiting to be decoded
 	void onExecute();
 };
 
@@ -223,8 +319,12 @@ class UploadTextureTask : public Task {
 public:
 	std::string filename;
 	Image* image;
+	std::vector<Image*> mips;
+	std::vector<unsigned char> ktx; //cooked file, used when there is no image
+	int level; //streamed textures only upload the levels from this one
 
-	UploadTextureTask(const char* filename, Image* image);
+	UploadTextureTask(const char* filename, Image* image, std::vector<Image*>& mips, int level = 0); //takes the mips
+	UploadTextureTask(const char* filename, std::vector<unsigned char>& ktx, int level = 0); //takes the content of the buffer
 	void onExecute();
 };
 
@@ -0,0 +1,235 @@
+#include "texturepacker.h"
+
+#include "../core/includes.h"
+#include "texture.h"
+#include "gfx.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <string>
+
+namespace GFX {
+
+std::vector<Texture*> TexturePacker::arrays;
+std::map<Texture*, sTextureLayer> TexturePacker::packed;
+unsigned int TexturePacker::num_packed = 0;
+size_t TexturePacker::packed_bytes = 0;
+unsigned int TexturePacker::version = 1; //0 is never packed
+
+//what a texture must share with the others of its array, read from OpenGL
+struct sPackInfo
+{
+	Texture* texture;
+	size_t index; //in the textures given
+	unsigned int width;
+	unsigned int height;
+	int internal_format;
+	int compressed;
+	int num_levels;
+	int wrap_s;
+	int wrap_t;
+
+	bool operator < (const sPackInfo& other) const {
+		if (width != other.width) return width < other.width;
+		if (height != other.height) return height < other.height;
+		if (internal_format != other.internal_format) return internal_format < other.internal_format;
+		if (num_levels != other.num_levels) return num_levels < other.num_levels;
+		if (wrap_s != other.wrap_s) return wrap_s < other.wrap_s;
+		return wrap_t < other.wrap_t;
+	}
+	bool sameArray(const sPackInfo& other) const { return !(*this < other) && !(other < *this); }
+};
+
+bool TexturePacker::isCopySupported()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		supported = (major > 4 || (major == 4 && minor >= 3) || SDL_GL_ExtensionSupported("GL_ARB_copy_image")) ? 1 : 0;
+		std::cout << " * Copy image: " << (supported ? "yes" : "no (textures are packed through the CPU)") << std::endl;
+	}
+	return supported == 1;
+}
+
+static bool getPackInfo(Texture* texture, sPackInfo& info)
+{
+	if (!texture || !texture->texture_id || texture->loading || texture->texture_type != GL_TEXTURE_2D)
+		return false;
+	if (texture->streamed && (!texture->streaming.num_levels || texture->streaming.resident_level != 0))
+		return false;
+	info.texture = texture;
+	info.width = (unsigned int)texture->width;
+	info.height = (unsigned int)texture->height;
+	if (info.width > TEXTURE_PACK_MAX_SIZE || info.height > TEXTURE_PACK_MAX_SIZE)
+		return false;
+
+	glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &info.internal_format);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &info.compressed);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &info.wrap_s);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, &info.wrap_t);
+	//the levels allocated, without mips only the first one
+	int max_levels = (int)floor(log2((float)std::max(info.width, info.height))) + 1;
+	info.num_levels = 0;
+	while (info.num_levels < max_levels)
+	{
+		GLint level_width = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, info.num_levels, GL_TEXTURE_WIDTH, &level_width);
+		if (!level_width)
+			break;
+		info.num_levels++;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	//float textures are render targets, not material textures
+	return info.num_levels > 0 && (info.compressed || texture->type == GL_UNSIGNED_BYTE);
+}
+
+//the infos of the same array, all the layers are copied
+static Texture* createArray(const sPackInfo* infos, int num_layers)
+{
+	const sPackInfo& first = infos[0];
+	Texture* array = new Texture();
+	array->texture_type = GL_TEXTURE_2D_ARRAY;
+	array->width = (float)first.width;
+	array->height = (float)first.height;
+	array->depth = (float)num_layers;
+	array->format = GL_RGBA;
+	array->type = GL_UNSIGNED_BYTE;
+	array->internal_format = first.internal_format;
+	array->mipmaps = first.num_levels > 1;
+	array->wrapS = first.wrap_s;
+	array->wrapT = first.wrap_t;
+	array->setName(("texture array " + std::to_string(TexturePacker::arrays.size())).c_str());
+
+	glGenTextures(1, &array->texture_id);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture_id);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.num_levels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, first.wrap_s);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, first.wrap_t);
+
+	bool gpu_copy = TexturePacker::isCopySupported();
+	std::vector<uint8> pixels;
+	for (int level = 0; level < first.num_levels; ++level)
+	{
+		unsigned int level_width = std::max(1u, first.width >> level);
+		unsigned int level_height = std::max(1u, first.height >> level);
+		GLint level_bytes = level_width * level_height * 4;
+		if (first.compressed)
+		{
+			glBindTexture(GL_TEXTURE_2D, first.texture->texture_id);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &level_bytes);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internal_format, level_width, level_height, num_layers, 0, level_bytes * num_layers, NULL);
+		}
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, first.internal_format, level_width, level_height, num_layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		TexturePacker::packed_bytes += (size_t)level_bytes * num_layers;
+
+		for (int layer = 0; layer < num_layers; ++layer)
+		{
+			Texture* texture = infos[layer].texture;
+			if (gpu_copy)
+			{
+				glCopyImageSubData(texture->texture_id, GL_TEXTURE_2D, level, 0, 0, 0, array->texture_id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, level_width, level_height, 1);
+				continue;
+			}
+
+			//through the CPU
+			pixels.resize(level_bytes);
+			glBindTexture(GL_TEXTURE_2D, texture->texture_id);
+			if (first.compressed)
+				glGetCompressedTexImage(GL_TEXTURE_2D, level, &pixels[0]);
+			else
+				glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture_id);
+			if (first.compressed)
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, level_width, level_height, 1, first.internal_format, level_bytes, &pixels[0]);
+			else
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, level_width, level_height, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	assert(checkGLErrors() && "Error packing textures");
+	return array;
+}
+
+unsigned int TexturePacker::pack(const std::vector<Texture*>& textures, std::vector<sTextureLayer>& layers)
+{
+	layers.resize(textures.size());
+	std::vector<sPackInfo> infos;
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		layers[i].array = NULL;
+		layers[i].layer = 0;
+		auto it = packed.find(textures[i]);
+		if (it != packed.end())
+		{
+			layers[i] = it->second;
+			continue;
+		}
+		sPackInfo info;
+		if (!getPackInfo(textures[i], info))
+			continue;
+		info.index = i;
+		infos.push_back(info);
+	}
+	std::stable_sort(infos.begin(), infos.end());
+
+	GLint max_layers = 256;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+	unsigned int num_new = 0;
+	for (size_t start = 0; start < infos.size(); )
+	{
+		size_t end = start + 1;
+		while (end < infos.size() && end - start < (size_t)max_layers && infos[end].sameArray(infos[start]))
+			end++;
+		int num_layers = (int)(end - start);
+		if (num_layers >= TEXTURE_PACK_MIN_LAYERS)
+		{
+			Texture* array = createArray(&infos[start], num_layers);
+			arrays.push_back(array);
+			for (int i = 0; i < num_layers; ++i)
+			{
+				sTextureLayer& entry = layers[infos[start + i].index];
+				entry.array = array;
+				entry.layer = i;
+				packed[infos[start + i].texture] = entry;
+				infos[start + i].texture->streaming.packed = true;
+			}
+			num_new += num_layers;
+		}
+		start = end;
+	}
+	num_packed += num_new;
+	return num_new;
+}
+
+void TexturePacker::remove(Texture* texture)
+{
+	if (packed.erase(texture))
+		num_packed--;
+}
+
+void TexturePacker::clear()
+{
+	for (auto it : packed)
+		it.first->streaming.packed = false;
+	packed.clear();
+	for (size_t i = 0; i < arrays.size(); ++i)
+		delete arrays[i];
+	arrays.clear();
+	num_packed = 0;
+	packed_bytes = 0;
+	version++;
+}
+
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <map>
+
+//Packing of small textures in 2D texture arrays: textures with the same size, format, levels and wrap are copied to the layers of one array,
+//so draws that use different textures of the same arrays dont need to change the bindings (the layer goes with the draw).
+//The original textures are kept, the passes that are not batched still use them (the streamed ones release the levels only the arrays use)
+
+namespace GFX {
+
+	class Texture;
+
+	#define TEXTURE_PACK_MAX_SIZE 1024 //bigger textures are not packed, they are streamed and would double their memory
+	#define TEXTURE_PACK_MIN_LAYERS 2 //groups with fewer textures stay as they are
+
+	struct sTextureLayer
+	{
+		Texture* array; //NULL if the texture was not packed
+		int layer;
+	};
+
+	class TexturePacker
+	{
+	public:
+		static std::vector<Texture*> arrays;
+		static std::map<Texture*, sTextureLayer> packed; //the textures in the arrays
+		static unsigned int num_packed; //textures in the arrays
+		static size_t packed_bytes; //VRAM of the arrays
+		static unsigned int version; //changes every time the arrays are destroyed, so the entries kept by others can be validated
+
+		static bool isCopySupported(); //glCopyImageSubData needs OpenGL 4.3 (or GL_ARB_copy_image), otherwise the levels are copied through the CPU
+
+		//layers has an entry per texture. Only 2D textures of bytes or block compressed ones can be packed, with all their levels in VRAM (not loading
+		//and streamed ones with the full chain resident). The ones already packed keep their layer, the rest go to new arrays. Returns the textures packed now
+		static unsigned int pack(const std::vector<Texture*>& textures, std::vector<sTextureLayer>& layers);
+		static void remove(Texture* texture); //when it is destroyed, its layer is left unused
+		static void clear(); //destroys the arrays, the entries given by pack are not valid anymore
+	};
+};
@@ -23,8 +23,12 @@ namespace SCN {
 	struct Sampler {
 		GFX::Texture* texture;
 		int uv_channel;
+		//copy of the texture in a texture array (GFX::TexturePacker), only valid while pack_version is the version of the packer
+		GFX::Texture* array;
+		int layer;
+		unsigned int pack_version;
 
-		Sampler() { texture = NULL; uv_channel = 0; }
+		Sampler() { texture = NULL; uv_channel = 0; array = NULL; layer = 0; pack_version = 0; }
 	};
 
 	enum eTextureChannel {
@@ -0,0 +1,212 @@
+#include "memorystats.h"
+
+#include "scene.h"
+#include "light.h"
+#include "prefab.h"
+#include "material.h"
+#include "../gfx/texture.h"
+#include "../gfx/mesh.h"
+#include "../gfx/fbo.h"
+#include "../gfx/geometryarena.h"
+#include "../gfx/texturepacker.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace SCN {
+
+sMemoryUsage MemoryStats::types[NUM_MEMORY_TYPES];
+std::vector<sEntityMemory> MemoryStats::entities;
+
+//given by the renderer for the next compute
+static std::set<GFX::Texture*> probe_textures;
+static std::set<GFX::FBO*> probe_fbos;
+static size_t probe_ram = 0;
+
+const char* MemoryStats::getTypeName(eMemoryType type)
+{
+	static const char* names[NUM_MEMORY_TYPES] = { "Textures", "Texture arrays", "Meshes", "FBOs", "Probes" };
+	return names[type];
+}
+
+void MemoryStats::addProbeTexture(GFX::Texture* texture)
+{
+	if (texture)
+		probe_textures.insert(texture);
+}
+
+void MemoryStats::addProbeFBO(GFX::FBO* fbo)
+{
+	if (fbo)
+		probe_fbos.insert(fbo);
+}
+
+void MemoryStats::addProbeRAM(size_t bytes)
+{
+	probe_ram += bytes;
+}
+
+//the sizes of every resource are read once, the entities reuse them
+struct sResourceBytes
+{
+	size_t ram;
+	size_t vram;
+};
+
+static sResourceBytes getTextureBytes(GFX::Texture* texture, std::map<GFX::Texture*, sResourceBytes>& cache)
+{
+	auto it = cache.find(texture);
+	if (it != cache.end())
+		return it->second;
+	sResourceBytes bytes = { texture->getRAMBytes(), texture->getVRAMBytes() };
+	cache[texture] = bytes;
+	return bytes;
+}
+
+static sResourceBytes getMeshBytes(GFX::Mesh* mesh, std::map<GFX::Mesh*, sResourceBytes>& cache)
+{
+	auto it = cache.find(mesh);
+	if (it != cache.end())
+		return it->second;
+	sResourceBytes bytes = { mesh->getRAMBytes(), mesh->getVRAMBytes() };
+	cache[mesh] = bytes;
+	return bytes;
+}
+
+//textures and renderbuffers, the textures are added to counted
+static size_t getFBOBytes(GFX::FBO* fbo, std::set<GFX::Texture*>& counted, std::map<GFX::Texture*, sResourceBytes>& cache)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < 5; ++i)
+	{
+		GFX::Texture* texture = i < 4 ? fbo->color_textures[i] : fbo->depth_texture;
+		if (!texture || !counted.insert(texture).second)
+			continue;
+		bytes += getTextureBytes(texture, cache).vram;
+	}
+	size_t renderbuffer_bytes = (size_t)fbo->width * fbo->height * 4;
+	if (fbo->renderbuffer_color)
+		bytes += renderbuffer_bytes;
+	if (fbo->renderbuffer_depth)
+		bytes += renderbuffer_bytes;
+	return bytes;
+}
+
+static void getNodeResources(Node* node, std::set<GFX::Mesh*>& meshes, std::set<GFX::Texture*>& textures)
+{
+	if (node->mesh)
+		meshes.insert(node->mesh);
+	if (node->material)
+		for (int i = 0; i < eTextureChannel::ALL; ++i)
+			if (node->material->textures[i].texture)
+				textures.insert(node->material->textures[i].texture);
+	for (size_t i = 0; i < node->children.size(); ++i)
+		getNodeResources(node->children[i], meshes, textures);
+}
+
+void MemoryStats::compute(Scene* scene)
+{
+	for (int i = 0; i < NUM_MEMORY_TYPES; ++i)
+		types[i] = sMemoryUsage();
+	entities.clear();
+
+	std::map<GFX::Texture*, sResourceBytes> texture_bytes;
+	std::map<GFX::Mesh*, sResourceBytes> mesh_bytes;
+	std::set<GFX::Texture*> counted; //textures already in a type
+
+	//probes
+	sMemoryUsage& probes = types[MEMORY_PROBES];
+	probes.ram_bytes += probe_ram;
+	for (GFX::FBO* fbo : probe_fbos)
+		probes.add(0, getFBOBytes(fbo, counted, texture_bytes));
+	for (GFX::Texture* texture : probe_textures)
+		if (counted.insert(texture).second)
+		{
+			sResourceBytes bytes = getTextureBytes(texture, texture_bytes);
+			probes.add(bytes.ram, bytes.vram);
+		}
+
+	//render targets
+	for (GFX::FBO* fbo : GFX::FBO::sFBOs)
+		if (!probe_fbos.count(fbo))
+			types[MEMORY_FBOS].add(0, getFBOBytes(fbo, counted, texture_bytes));
+
+	//the texture arrays, the originals are counted as textures
+	for (GFX::Texture* array : GFX::TexturePacker::arrays)
+		if (counted.insert(array).second)
+		{
+			sResourceBytes bytes = getTextureBytes(array, texture_bytes);
+			types[MEMORY_TEXTURE_ARRAYS].add(bytes.ram, bytes.vram);
+		}
+
+	//the rest of textures
+	for (auto it : GFX::Texture::sTextures)
+	{
+		GFX::Texture* texture = it.second;
+		if (!texture || counted.count(texture))
+			continue;
+		sResourceBytes bytes = getTextureBytes(texture, texture_bytes);
+		types[MEMORY_TEXTURES].add(bytes.ram, bytes.vram);
+	}
+
+	//meshes, the ones in arenas are counted with the whole buffers of the arena (free space included)
+	std::vector<GFX::Mesh*> meshes;
+	GFX::Mesh::getAllMeshes(meshes);
+	for (GFX::Mesh* mesh : meshes)
+	{
+		sResourceBytes bytes = getMeshBytes(mesh, mesh_bytes);
+		types[MEMORY_MESHES].add(bytes.ram, mesh->arena ? 0 : bytes.vram);
+	}
+	for (int i = 0; i < GFX::GeometryArena::NUM_LAYOUTS; ++i)
+	{
+		GFX::GeometryArena* arena = GFX::GeometryArena::arenas[i];
+		if (arena)
+			types[MEMORY_MESHES].vram_bytes += (size_t)arena->vertex_capacity * arena->vertex_size + (size_t)arena->index_capacity * arena->index_size;
+	}
+
+	//entities, with the resources of their nodes
+	if (scene)
+		for (BaseEntity* entity : scene->entities)
+		{
+			sEntityMemory entry;
+			entry.name = entity->name;
+			entry.type = entity->getTypeAsStr();
+
+			std::set<GFX::Mesh*> entity_meshes;
+			std::set<GFX::Texture*> entity_textures;
+			getNodeResources(&entity->root, entity_meshes, entity_textures);
+			for (GFX::Mesh* mesh : entity_meshes)
+			{
+				sResourceBytes bytes = getMeshBytes(mesh, mesh_bytes);
+				entry.usage.add(bytes.ram, bytes.vram);
+			}
+			for (GFX::Texture* texture : entity_textures)
+			{
+				sResourceBytes bytes = getTextureBytes(texture, texture_bytes);
+				entry.usage.add(bytes.ram, bytes.vram);
+			}
+
+			if (entity->getType() == eEntityType::LIGHT)
+			{
+				LightEntity* light = (LightEntity*)entity;
+				if (light->shadowmap_fbo)
+				{
+					std::set<GFX::Texture*> fbo_textures;
+					entry.usage.add(0, getFBOBytes(light->shadowmap_fbo, fbo_textures, texture_bytes));
+				}
+			}
+
+			if (entry.usage.count)
+				entities.push_back(entry);
+		}
+	std::sort(entities.begin(), entities.end(), [](const sEntityMemory& a, const sEntityMemory& b) {
+		return a.usage.ram_bytes + a.usage.vram_bytes > b.usage.ram_bytes + b.usage.vram_bytes;
+	});
+
+	probe_textures.clear();
+	probe_fbos.clear();
+	probe_ram = 0;
+}
+
+};
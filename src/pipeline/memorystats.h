@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Memory used by the resources in RAM and VRAM, by type and by entity of the scene, to find duplicated resources and the ones never released.
+//It is computed on demand, some sizes are read from OpenGL
+
+namespace GFX {
+	class Texture;
+	class FBO;
+}
+
+namespace SCN {
+
+	class Scene;
+
+	enum eMemoryType {
+		MEMORY_TEXTURES,
+		MEMORY_TEXTURE_ARRAYS, //copies of the material textures for the gbuffers batches (GFX::TexturePacker)
+		MEMORY_MESHES, //with the geometry arenas
+		MEMORY_FBOS, //with their textures
+		MEMORY_PROBES, //irradiance and reflection probes, with their textures and FBOs
+		NUM_MEMORY_TYPES
+	};
+
+	struct sMemoryUsage
+	{
+		size_t ram_bytes = 0;
+		size_t vram_bytes = 0;
+		unsigned int count = 0; //resources
+
+		void add(size_t ram, size_t vram) { ram_bytes += ram; vram_bytes += vram; count++; }
+	};
+
+	struct sEntityMemory
+	{
+		std::string name;
+		const char* type;
+		sMemoryUsage usage;
+	};
+
+	class MemoryStats
+	{
+	public:
+		static sMemoryUsage types[NUM_MEMORY_TYPES]; //of the last compute
+		static std::vector<sEntityMemory> entities; //sorted by bytes, the resources used by several entities are in all of them
+
+		static const char* getTypeName(eMemoryType type);
+
+		//the probes are owned by the renderer, it gives their resources before every compute so they are not counted as textures or FBOs
+		static void addProbeTexture(GFX::Texture* texture);
+		static void addProbeFBO(GFX::FBO* fbo);
+		static void addProbeRAM(size_t bytes);
+
+		static void compute(Scene* scene);
+	};
+};
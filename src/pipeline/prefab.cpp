@@ -11,6 +11,7 @@
 #include "../utils/utils.h"
 #include "../core/math.h"
 
+#include <cstddef>
 #include <iostream>
 
 using namespace SCN;
@@ -18,7 +19,7 @@ using namespace SCN;
 int Node::s_NodeID = 0;
 Node* Node::s_selected = nullptr;
 
-Node::Node() : parent(nullptr), mesh(nullptr), material(nullptr), visible(true)
+Node::Node() : parent(nullptr), mesh(nullptr), material(nullptr), visible(true), lod(0)
 {
 	m_Id = s_NodeID++;
 }
@@ -150,6 +151,7 @@ void Node::operator = (const Node& node)
 
 Prefab::Prefab()
 {
+	loading = false;
 }
 
 Prefab::~Prefab()
@@ -168,6 +170,7 @@ void Prefab::updateBounding()
 }
 
 std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
+bool Prefab::use_binary = true;
 
 Prefab* Prefab::Get(const char* filename)
 {
@@ -178,8 +181,22 @@ Prefab* Prefab::Get(const char* filename)
 
 	Prefab* prefab = nullptr;
 	{
+		std::string bin_filename = getBinFilename(filename);
+		if (use_binary)
+		{
+			prefab = new Prefab();
+			if (!prefab->readBin(bin_filename.c_str()))
+			{
+				delete prefab;
+				prefab = nullptr;
+			}
+		}
 		if (!prefab)
+		{
 			prefab = loadGLTF(filename);
+			if (prefab && use_binary)
+				prefab->writeBin(bin_filename.c_str());
+		}
 		if (!prefab) {
 			std::cout << "[ERROR]: Prefab not found: " << filename << std::endl;
 			return NULL;
@@ -192,6 +209,21 @@ Prefab* Prefab::Get(const char* filename)
 	return prefab;
 }
 
+Prefab* Prefab::GetAsync(const char* filename)
+{
+	assert(filename);
+	std::map<std::string, Prefab*>::iterator it = sPrefabsLoaded.find(filename);
+	if (it != sPrefabsLoaded.end())
+		return it->second;
+
+	//empty until the background thread finishes
+	Prefab* prefab = new Prefab();
+	prefab->loading = true;
+	prefab->registerPrefab(filename);
+	loadGLTFAsync(filename);
+	return prefab;
+}
+
 void Prefab::registerPrefab(std::string name)
 {
 	this->name = name;
@@ -220,3 +252,660 @@ void Prefab::updateNodesByName()
 	nodes_by_name.clear();
 	updateInDepth(nodes_by_name, &root);
 }
+
+//COOKED PREFABS
+//"PBIN" + header + sources + nodes + materials + images + strings + meshes (as MBIN) + mesh table
+
+#define PREFAB_BIN_VERSION 4 //this is used to cook them again if the format changes
+
+struct sPrefabBinHeader {
+	int version;
+	int header_bytes;
+	int num_sources;
+	int num_nodes;
+	int num_materials;
+	int num_meshes;
+	unsigned int sources; //offsets from the start of the file
+	unsigned int nodes;
+	unsigned int materials;
+	unsigned int strings;
+	unsigned int strings_size;
+	int num_images;
+	unsigned int images;
+	unsigned long long meshes; //the table goes after the meshes, so it can be past 4GB
+};
+
+//file used to cook the prefab, timestamps are checked first and the hash only if they differ
+struct sPrefabBinSource {
+	unsigned int filename; //offset in the strings
+	unsigned int extra; //unused
+	unsigned long long size;
+	long long modified_time;
+	unsigned long long hash;
+};
+
+struct sPrefabBinNode {
+	int parent; //parents are always before their children, -1 for the root
+	unsigned int name;
+	int mesh; //-1 if none
+	int material; //-1 if none
+	int visible;
+	Matrix44 model;
+};
+
+struct sPrefabBinMaterial {
+	unsigned int name; //0 if unnamed
+	int alpha_mode;
+	float alpha_cutoff;
+	int two_sided;
+	Vector4f color;
+	float roughness_factor;
+	float metallic_factor;
+	Vector3f emissive_factor;
+	unsigned int textures[eTextureChannel::ALL]; //filenames, 0 if it has no texture or it is embedded
+	int images[eTextureChannel::ALL]; //embedded textures, -1 if none
+	int uv_channels[eTextureChannel::ALL];
+};
+
+//texture decoded from a range of a source file, like the gltf loader does
+struct sPrefabBinImage {
+	unsigned int name; //0 if unnamed
+	unsigned int mime;
+	int source;
+	unsigned int extra; //unused
+	unsigned long long offset;
+	unsigned long long size;
+	unsigned long long hash; //to share it if it is already decoded
+};
+
+struct sPrefabBinMesh {
+	unsigned int name; //0 if unnamed
+	unsigned int extra; //unused
+	unsigned long long offset; //of its MBIN from the start of the file
+	unsigned long long size;
+};
+
+//all the strings in one block, offset 0 is the empty string
+struct sPrefabBinStrings {
+	std::string data;
+	sPrefabBinStrings() { data.push_back('\0'); }
+	unsigned int add(const std::string& str)
+	{
+		if (str.empty())
+			return 0;
+		unsigned int offset = (unsigned int)data.size();
+		data.append(str);
+		data.push_back('\0');
+		return offset;
+	}
+};
+
+//ftell is 32 bits on windows
+static unsigned long long tellFile(FILE* f)
+{
+#ifdef _WIN32
+	return (unsigned long long)_ftelli64(f);
+#else
+	return (unsigned long long)ftello(f);
+#endif
+}
+
+static bool hashFile(const std::string& filename, unsigned long long& hash)
+{
+	sMappedFile file;
+	if (!mapFile(filename, file))
+		return false;
+	hash = hashBytes(file.data, file.size);
+	unmapFile(file);
+	return true;
+}
+
+//checks the header, the blocks and the sources (unless they were checked already), returns the header if it can be used
+//new_times gets the current timestamps of the sources if any of them changed but not its content
+static const sPrefabBinHeader* checkPrefabBin(const sMappedFile& file, const char* filename, bool check_sources, std::vector<long long>* new_times = NULL)
+{
+	if (file.size < 4 + sizeof(sPrefabBinHeader) || memcmp(file.data, "PBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading PBIN: invalid content: " << filename << std::endl;
+		return NULL;
+	}
+
+	const sPrefabBinHeader* header = (const sPrefabBinHeader*)(file.data + 4);
+	if (header->version != PREFAB_BIN_VERSION || header->header_bytes != sizeof(sPrefabBinHeader) || header->strings_size == 0)
+	{
+		std::cout << "[WARN] loading PBIN: old version: " << filename << std::endl;
+		return NULL;
+	}
+
+	if (header->sources + (size_t)header->num_sources * sizeof(sPrefabBinSource) > file.size ||
+		header->nodes + (size_t)header->num_nodes * sizeof(sPrefabBinNode) > file.size ||
+		header->materials + (size_t)header->num_materials * sizeof(sPrefabBinMaterial) > file.size ||
+		header->images + (size_t)header->num_images * sizeof(sPrefabBinImage) > file.size ||
+		header->meshes > file.size || (size_t)header->num_meshes * sizeof(sPrefabBinMesh) > file.size - header->meshes ||
+		header->strings + (size_t)header->strings_size > file.size || header->num_nodes < 1 ||
+		file.data[header->strings + header->strings_size - 1] != 0)
+	{
+		std::cout << "[ERROR] loading PBIN: corrupted blocks: " << filename << std::endl;
+		return NULL;
+	}
+
+	if (!check_sources)
+		return header;
+
+	//outdated if any source changed, a different timestamp with the same content is fine (copies, checkouts)
+	const sPrefabBinSource* sources = (const sPrefabBinSource*)(file.data + header->sources);
+	const char* strings = (const char*)(file.data + header->strings);
+	std::vector<long long> times(header->num_sources);
+	bool times_changed = false;
+	for (int i = 0; i < header->num_sources; ++i)
+	{
+		const sPrefabBinSource& source = sources[i];
+		if (source.filename >= header->strings_size)
+			return NULL;
+		std::string source_filename = strings + source.filename;
+		size_t size = 0;
+		unsigned long long hash = 0;
+		if (!getFileInfo(source_filename, size, times[i]) || size != source.size)
+			return NULL;
+		if (times[i] == source.modified_time)
+			continue;
+		if (!hashFile(source_filename, hash) || hash != source.hash)
+			return NULL;
+		times_changed = true;
+	}
+
+	if (times_changed && new_times)
+		new_times->swap(times);
+	return header;
+}
+
+//stores the current timestamps of the sources, so their content is not hashed again on every load
+static void updatePrefabBinTimes(const char* filename, unsigned int sources, const std::vector<long long>& times)
+{
+	FILE* f = fopen(filename, "r+b");
+	if (f == NULL)
+		return;
+	for (size_t i = 0; i < times.size(); ++i)
+	{
+		fseek(f, (long)(sources + i * sizeof(sPrefabBinSource) + offsetof(sPrefabBinSource, modified_time)), SEEK_SET);
+		fwrite(&times[i], sizeof(long long), 1, f);
+	}
+	fclose(f);
+}
+
+//the mesh must have been processed with the current options, otherwise the prefab is cooked again
+static bool readPrefabBinMesh(const sMappedFile& file, const sPrefabBinMesh& bin_mesh, GFX::Mesh* mesh, bool only_vram, const char* filename)
+{
+	return bin_mesh.offset <= file.size && bin_mesh.size <= file.size - bin_mesh.offset &&
+		mesh->readBinData(file.data + bin_mesh.offset, (size_t)bin_mesh.size, only_vram, false, filename) &&
+		(!GFX::Mesh::optimize_meshes || mesh->is_optimized) && (!GFX::Mesh::generate_lods || mesh->lods_generated) && (!GFX::Mesh::build_meshlets || mesh->meshlets_built);
+}
+
+bool Prefab::readBinMeshes(const char* filename, std::vector<GFX::Mesh*>& meshes)
+{
+	sMappedFile file;
+	if (!mapFile(filename, file))
+		return false;
+
+	std::vector<long long> new_times;
+	const sPrefabBinHeader* header = checkPrefabBin(file, filename, true, &new_times);
+	unsigned int sources = header ? header->sources : 0;
+	bool valid = header != NULL;
+	if (valid)
+	{
+		//streams to RAM, no OpenGL here
+		const sPrefabBinMesh* bin_meshes = (const sPrefabBinMesh*)(file.data + header->meshes);
+		for (int i = 0; i < header->num_meshes && valid; ++i)
+		{
+			GFX::Mesh* mesh = new GFX::Mesh();
+			meshes.push_back(mesh);
+			valid = readPrefabBinMesh(file, bin_meshes[i], mesh, false, filename);
+		}
+	}
+	unmapFile(file);
+
+	if (!valid)
+	{
+		for (size_t i = 0; i < meshes.size(); ++i)
+			delete meshes[i];
+		meshes.clear();
+		return false;
+	}
+	if (new_times.size())
+		updatePrefabBinTimes(filename, sources, new_times);
+	return true;
+}
+
+static void gatherNodes(Node* node, std::vector<Node*>& nodes)
+{
+	nodes.push_back(node);
+	for (size_t i = 0; i < node->children.size(); ++i)
+		gatherNodes(node->children[i], nodes);
+}
+
+bool Prefab::getSourceInfo(const std::string& filename, sPrefabSource& source)
+{
+	//time before the hash, if it changes meanwhile the next load hashes it again
+	source.filename = filename;
+	return getFileInfo(filename, source.size, source.modified_time) && hashFile(filename, source.hash);
+}
+
+//everything in a .pbin, gathered from the prefab in the main thread so the file can be written in any thread
+struct sPrefabBinData {
+	sPrefabBinStrings strings;
+	std::vector<sPrefabBinSource> sources;
+	std::vector<sPrefabBinNode> nodes;
+	std::vector<sPrefabBinMaterial> materials;
+	std::vector<sPrefabBinImage> images;
+	std::vector<sPrefabBinMesh> bin_meshes;
+	std::vector<GFX::Mesh*> meshes;
+};
+
+static bool gatherPrefabBin(Prefab* prefab, const std::vector<sPrefabSource>& sources, sPrefabBinData& bin)
+{
+	//nodes in depth order, so parents go first
+	std::vector<Node*> nodes;
+	gatherNodes(&prefab->root, nodes);
+
+	sPrefabBinStrings& strings = bin.strings;
+	std::vector<sPrefabBinNode>& bin_nodes = bin.nodes;
+	std::vector<sPrefabBinMaterial>& bin_materials = bin.materials;
+	std::vector<GFX::Mesh*>& meshes = bin.meshes;
+	std::map<Node*, int> node_ids;
+	std::map<Material*, int> material_ids;
+	std::map<GFX::Mesh*, int> mesh_ids;
+	std::map<GFX::Texture*, int> image_ids;
+	bin_nodes.resize(nodes.size());
+
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		Node* node = nodes[i];
+		sPrefabBinNode& bin_node = bin_nodes[i];
+		node_ids[node] = (int)i;
+		bin_node.parent = i ? node_ids[node->parent] : -1;
+		bin_node.name = strings.add(node->name);
+		bin_node.visible = node->visible ? 1 : 0;
+		bin_node.model = node->model;
+		bin_node.mesh = bin_node.material = -1;
+
+		if (node->mesh)
+		{
+			auto it = mesh_ids.find(node->mesh);
+			if (it == mesh_ids.end())
+			{
+				//meshes uploaded from a bin dont keep their streams
+				if (!node->mesh->hasCPUData())
+				{
+					std::cout << "[WARN] prefab not cooked, mesh not in RAM: " << node->mesh->name << std::endl;
+					return false;
+				}
+				//meshes already in use are not modified by the writer
+				if (!node->mesh->loading)
+					node->mesh->getUVDensity();
+				it = mesh_ids.insert(std::make_pair(node->mesh, (int)meshes.size())).first;
+				meshes.push_back(node->mesh);
+			}
+			bin_node.mesh = it->second;
+		}
+
+		if (node->material)
+		{
+			auto it = material_ids.find(node->material);
+			if (it == material_ids.end())
+			{
+				Material* material = node->material;
+				sPrefabBinMaterial bin_material = {};
+				bin_material.name = strings.add(material->name);
+				bin_material.alpha_mode = material->alpha_mode;
+				bin_material.alpha_cutoff = material->alpha_cutoff;
+				bin_material.two_sided = material->two_sided ? 1 : 0;
+				bin_material.color = material->color;
+				bin_material.roughness_factor = material->roughness_factor;
+				bin_material.metallic_factor = material->metallic_factor;
+				bin_material.emissive_factor = material->emissive_factor;
+				for (int j = 0; j < eTextureChannel::ALL; ++j)
+				{
+					GFX::Texture* texture = material->textures[j].texture;
+					bin_material.uv_channels[j] = material->textures[j].uv_channel;
+					bin_material.images[j] = -1;
+					if (!texture)
+						continue;
+
+					//embedded ones are ranges of the sources, not copied
+					auto embedded = prefab->embedded_images.find(texture);
+					if (embedded != prefab->embedded_images.end())
+					{
+						auto image_it = image_ids.find(texture);
+						if (image_it == image_ids.end())
+						{
+							const sPrefabImage& image = embedded->second;
+							sPrefabBinImage bin_image;
+							memset(&bin_image, 0, sizeof(bin_image));
+							bin_image.name = strings.add(texture->filename);
+							bin_image.mime = strings.add(image.mime);
+							bin_image.source = image.source;
+							bin_image.offset = image.offset;
+							bin_image.size = image.size;
+							bin_image.hash = texture->content_hash;
+							image_it = image_ids.insert(std::make_pair(texture, (int)bin.images.size())).first;
+							bin.images.push_back(bin_image);
+						}
+						bin_material.images[j] = image_it->second;
+						continue;
+					}
+
+					//the rest must be files (base64 images inside a gltf are not stored)
+					size_t size = 0;
+					long long modified_time = 0;
+					if (!getFileInfo(texture->filename, size, modified_time))
+					{
+						std::cout << "[WARN] prefab not cooked, texture not in a file: " << material->name << std::endl;
+						return false;
+					}
+					bin_material.textures[j] = strings.add(texture->filename);
+				}
+				it = material_ids.insert(std::make_pair(material, (int)bin_materials.size())).first;
+				bin_materials.push_back(bin_material);
+			}
+			bin_node.material = it->second;
+		}
+	}
+
+	bin.sources.resize(sources.size());
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		sPrefabBinSource& source = bin.sources[i];
+		memset(&source, 0, sizeof(source));
+		source.filename = strings.add(sources[i].filename);
+		source.size = sources[i].size;
+		source.modified_time = sources[i].modified_time;
+		source.hash = sources[i].hash;
+	}
+
+	bin.bin_meshes.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); ++i)
+		bin.bin_meshes[i].name = strings.add(meshes[i]->name);
+	return true;
+}
+
+static bool writePrefabBin(const char* filename, sPrefabBinData& bin)
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write prefab BIN: " << filename << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("PBIN", sizeof(char), 4, f);
+
+	//written again at the end with the offsets
+	sPrefabBinHeader header;
+	memset(&header, 0, sizeof(header));
+	header.version = PREFAB_BIN_VERSION;
+	header.header_bytes = sizeof(sPrefabBinHeader);
+	header.num_sources = (int)bin.sources.size();
+	header.num_nodes = (int)bin.nodes.size();
+	header.num_materials = (int)bin.materials.size();
+	header.num_images = (int)bin.images.size();
+	header.num_meshes = (int)bin.bin_meshes.size();
+	fwrite(&header, sizeof(header), 1, f);
+
+	header.sources = (unsigned int)ftell(f);
+	if (bin.sources.size())
+		fwrite(&bin.sources[0], sizeof(sPrefabBinSource), bin.sources.size(), f);
+	header.nodes = (unsigned int)ftell(f);
+	fwrite(&bin.nodes[0], sizeof(sPrefabBinNode), bin.nodes.size(), f);
+	header.materials = (unsigned int)ftell(f);
+	if (bin.materials.size())
+		fwrite(&bin.materials[0], sizeof(sPrefabBinMaterial), bin.materials.size(), f);
+	header.images = (unsigned int)ftell(f);
+	if (bin.images.size())
+		fwrite(&bin.images[0], sizeof(sPrefabBinImage), bin.images.size(), f);
+	header.strings = (unsigned int)ftell(f);
+	header.strings_size = (unsigned int)bin.strings.data.size();
+	fwrite(bin.strings.data.c_str(), 1, bin.strings.data.size(), f);
+
+	//every mesh aligned, so their streams can be uploaded straight from the mapping
+	static const char zeros[MESH_BIN_ALIGNMENT] = { 0 };
+	for (size_t i = 0; i < bin.meshes.size(); ++i)
+	{
+		unsigned long long pos = tellFile(f);
+		if (pos % MESH_BIN_ALIGNMENT)
+			fwrite(zeros, (size_t)(MESH_BIN_ALIGNMENT - pos % MESH_BIN_ALIGNMENT), 1, f);
+		bin.bin_meshes[i].offset = tellFile(f);
+		bin.meshes[i]->writeBinData(f);
+		bin.bin_meshes[i].size = tellFile(f) - bin.bin_meshes[i].offset;
+	}
+
+	header.meshes = tellFile(f);
+	if (bin.bin_meshes.size())
+		fwrite(&bin.bin_meshes[0], sizeof(sPrefabBinMesh), bin.bin_meshes.size(), f);
+
+	fseek(f, 4, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+	fclose(f);
+	return true;
+}
+
+bool Prefab::writeBin(const char* filename)
+{
+	std::vector<sPrefabSource> sources(source_files.size());
+	for (size_t i = 0; i < source_files.size(); ++i)
+		if (!getSourceInfo(source_files[i], sources[i]))
+		{
+			std::cout << "[WARN] prefab not cooked, source not found: " << source_files[i] << std::endl;
+			return false;
+		}
+
+	sPrefabBinData bin;
+	return gatherPrefabBin(this, sources, bin) && writePrefabBin(filename, bin);
+}
+
+void Prefab::writeBinAsync(const char* filename, const std::vector<sPrefabSource>& sources, const std::vector<GFX::Mesh*>& uploads)
+{
+	sPrefabBinData* bin = new sPrefabBinData();
+	std::vector<GFX::Mesh*> meshes = uploads;
+	if (!gatherPrefabBin(this, sources, *bin))
+	{
+		delete bin;
+		for (size_t i = 0; i < meshes.size(); ++i)
+			TaskManager::foreground.addTask(new UploadMeshTask(meshes[i]));
+		return;
+	}
+
+	//the meshes are not uploaded until they are written, so nothing else uses them meanwhile
+	std::string bin_filename = filename;
+	TaskManager::background.addTask(new Task([bin, bin_filename, meshes]() {
+		writePrefabBin(bin_filename.c_str(), *bin);
+		delete bin;
+		for (size_t i = 0; i < meshes.size(); ++i)
+			TaskManager::foreground.addTask(new UploadMeshTask(meshes[i]));
+	}));
+}
+
+//shared if it is already decoded, otherwise decoded from its source
+static GFX::Texture* readPrefabBinImage(const sPrefabBinImage& bin_image, const char* source, const char* name, const char* mime)
+{
+	GFX::Texture* texture = NULL;
+	if (*name)
+		texture = GFX::Texture::Find(name);
+	if (!texture && bin_image.hash)
+		texture = GFX::Texture::FindByContent(bin_image.hash);
+	if (texture)
+		return texture;
+
+	sMappedFile file;
+	if (!mapFile(source, file))
+		return NULL;
+	if (bin_image.offset + bin_image.size <= file.size)
+		texture = decodeGLTFImage(file.data + bin_image.offset, (size_t)bin_image.size, mime, bin_image.hash, *name ? name : NULL);
+	unmapFile(file);
+	return texture;
+}
+
+bool Prefab::readBin(const char* filename, std::vector<GFX::Mesh*>* parsed_meshes)
+{
+	sMappedFile file;
+	if (!mapFile(filename, file))
+		return false;
+
+	double time = getTime();
+	std::vector<long long> new_times;
+	const sPrefabBinHeader* header = checkPrefabBin(file, filename, !parsed_meshes, &new_times);
+	if (!header || (parsed_meshes && parsed_meshes->size() != (size_t)header->num_meshes))
+	{
+		unmapFile(file);
+		return false;
+	}
+
+	const sPrefabBinSource* bin_sources = (const sPrefabBinSource*)(file.data + header->sources);
+	const sPrefabBinNode* bin_nodes = (const sPrefabBinNode*)(file.data + header->nodes);
+	const sPrefabBinMaterial* bin_materials = (const sPrefabBinMaterial*)(file.data + header->materials);
+	const sPrefabBinImage* bin_images = (const sPrefabBinImage*)(file.data + header->images);
+	const sPrefabBinMesh* bin_meshes = (const sPrefabBinMesh*)(file.data + header->meshes);
+	const char* strings = (const char*)(file.data + header->strings);
+	auto getString = [&](unsigned int offset) -> const char* { return offset < header->strings_size ? strings + offset : ""; };
+
+	//meshes first, if any of them cannot be used the prefab is cooked again from the gltf
+	bool only_vram = GFX::Mesh::auto_upload_to_vram && !GFX::Mesh::keep_cpu_data && !GFX::Mesh::use_compact_vertices;
+	std::vector<GFX::Mesh*> meshes(header->num_meshes, (GFX::Mesh*)NULL);
+	std::vector<GFX::Mesh*> new_meshes;
+	bool valid = true;
+	for (int i = 0; i < header->num_meshes && valid; ++i)
+	{
+		const sPrefabBinMesh& bin_mesh = bin_meshes[i];
+		const char* name = getString(bin_mesh.name);
+		if (*name)
+			meshes[i] = GFX::Mesh::Get(name, true);
+		if (meshes[i])
+			continue;
+
+		//read in the background, it is not rendered until its own upload task
+		if (parsed_meshes)
+		{
+			meshes[i] = (*parsed_meshes)[i];
+			meshes[i]->loading = true;
+			continue;
+		}
+
+		GFX::Mesh* mesh = new GFX::Mesh();
+		new_meshes.push_back(mesh);
+		if (!readPrefabBinMesh(file, bin_mesh, mesh, only_vram, filename))
+		{
+			valid = false;
+			break;
+		}
+
+		if (!mesh->hasCPUData())
+		{
+			//collisions read the streams again from here
+			mesh->bin_filename = filename;
+			mesh->bin_offset = (size_t)bin_mesh.offset;
+		}
+		else if (GFX::Mesh::auto_upload_to_vram)
+			mesh->uploadToVRAM(GFX::Mesh::use_compact_vertices);
+		meshes[i] = mesh;
+	}
+
+	if (!valid)
+	{
+		for (size_t i = 0; i < new_meshes.size(); ++i)
+			delete new_meshes[i];
+		unmapFile(file);
+		return false;
+	}
+
+	for (int i = 0; i < header->num_meshes; ++i)
+		if (bin_meshes[i].name && meshes[i]->name.empty())
+			meshes[i]->registerMesh(getString(bin_meshes[i].name));
+
+	//embedded textures are decoded in this thread, like in the gltf loader
+	embedded_images.clear();
+	std::vector<GFX::Texture*> images(header->num_images, (GFX::Texture*)NULL);
+	for (int i = 0; i < header->num_images; ++i)
+	{
+		const sPrefabBinImage& bin_image = bin_images[i];
+		if (bin_image.source < 0 || bin_image.source >= header->num_sources)
+			continue;
+		images[i] = readPrefabBinImage(bin_image, getString(bin_sources[bin_image.source].filename), getString(bin_image.name), getString(bin_image.mime));
+		if (!images[i])
+			continue;
+		sPrefabImage& image = embedded_images[images[i]];
+		image.mime = getString(bin_image.mime);
+		image.source = bin_image.source;
+		image.offset = (size_t)bin_image.offset;
+		image.size = (size_t)bin_image.size;
+	}
+
+	//materials, shared by name like in the gltf loader
+	std::vector<Material*> materials(header->num_materials, (Material*)NULL);
+	for (int i = 0; i < header->num_materials; ++i)
+	{
+		const sPrefabBinMaterial& bin_material = bin_materials[i];
+		const char* name = getString(bin_material.name);
+		if (*name)
+			materials[i] = Material::Get(name);
+		if (materials[i])
+			continue;
+
+		Material* material = new Material();
+		if (*name)
+			material->registerMaterial(name);
+		material->alpha_mode = (eAlphaMode)bin_material.alpha_mode;
+		material->alpha_cutoff = bin_material.alpha_cutoff;
+		material->two_sided = bin_material.two_sided != 0;
+		material->color = bin_material.color;
+		material->roughness_factor = bin_material.roughness_factor;
+		material->metallic_factor = bin_material.metallic_factor;
+		material->emissive_factor = bin_material.emissive_factor;
+		for (int j = 0; j < eTextureChannel::ALL; ++j)
+		{
+			material->textures[j].uv_channel = bin_material.uv_channels[j];
+			if (bin_material.images[j] >= 0 && bin_material.images[j] < header->num_images)
+				material->textures[j].texture = images[bin_material.images[j]];
+			if (!bin_material.textures[j])
+				continue;
+			GFX::eTextureUsage usage = GFX::TEXTURE_LINEAR;
+			if (j == eTextureChannel::ALBEDO || j == eTextureChannel::EMISSIVE)
+				usage = GFX::TEXTURE_COLOR;
+			else if (j == eTextureChannel::NORMALMAP)
+				usage = GFX::TEXTURE_NORMALMAP;
+			//the mips of alpha tested albedos keep their coverage
+			float alpha_cutoff = j == eTextureChannel::ALBEDO && material->alpha_mode == eAlphaMode::MASK ? material->alpha_cutoff : 0.0f;
+			material->textures[j].texture = GFX::Texture::GetAsync(getString(bin_material.textures[j]), true, true, 0.0f, usage, alpha_cutoff);
+		}
+		materials[i] = material;
+	}
+
+	//nodes, the first one is the root
+	std::vector<Node*> nodes(header->num_nodes, (Node*)NULL);
+	root.clear();
+	for (int i = 0; i < header->num_nodes; ++i)
+	{
+		const sPrefabBinNode& bin_node = bin_nodes[i];
+		Node* node = i ? new Node() : &root;
+		node->name = getString(bin_node.name);
+		node->visible = bin_node.visible != 0;
+		node->model = bin_node.model;
+		node->mesh = bin_node.mesh >= 0 && bin_node.mesh < header->num_meshes ? meshes[bin_node.mesh] : NULL;
+		node->material = bin_node.material >= 0 && bin_node.material < header->num_materials ? materials[bin_node.material] : NULL;
+		nodes[i] = node;
+		if (i)
+			nodes[bin_node.parent >= 0 && bin_node.parent < i ? bin_node.parent : 0]->addChild(node);
+	}
+
+	source_files.resize(header->num_sources);
+	for (int i = 0; i < header->num_sources; ++i)
+		source_files[i] = getString(bin_sources[i].filename);
+
+	int num_meshes = header->num_meshes;
+	unsigned int sources = header->sources;
+	unmapFile(file);
+	if (new_times.size())
+		updatePrefabBinTimes(filename, sources, new_times);
+	updateNodesByName();
+	std::cout << " + Prefab cooked: " << filename <<  " [OK PBIN]  Meshes: " << num_meshes << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	return true;
+}
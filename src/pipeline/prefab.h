@@ -45,6 +45,7 @@ namespace SCN {
 		Matrix44 global_model;	//the matrix that defines where is the object (in relation to the world)
 
 		BoundingBox aabb; //node bounding box in world space
+		int lod; //LOD used in the last frame, to apply hysteresis
 
 		//info to create the tree
 		Node* parent;
@@ -85,6 +86,22 @@ namespace SCN {
 		void operator = (const Node& node);
 	};
 
+	//a file the prefab was loaded from when it was read, the cooked version is outdated if it changes
+	struct sPrefabSource {
+		std::string filename;
+		size_t size = 0;
+		long long modified_time = 0;
+		unsigned long long hash = 0;
+	};
+
+	//image without file, embedded in one of the sources (binary chunk of a glb or buffer file)
+	struct sPrefabImage {
+		std::string mime;
+		int source = 0; //index in source_files
+		size_t offset = 0;
+		size_t size = 0;
+	};
+
 	//a Prefab represent a set of objects in a tree structure
 	//used to load info from GLTF files
 	class Prefab
@@ -98,6 +115,9 @@ namespace SCN {
 		//root node which contains the tree
 		Node root;
 		BoundingBox bounding;
+		bool loading; //parsing in the background, root is empty until then
+		std::vector<std::string> source_files; //gltf and buffers it was loaded from, to know when the cooked version is outdated
+		std::map<GFX::Texture*, sPrefabImage> embedded_images; //where the textures without file are, the cooked version decodes them from there
 
 		//ctor and dtor
 		Prefab();
@@ -107,9 +127,19 @@ namespace SCN {
 		void updateNodesByName();
 		Node* getNodeByName(const char* name);
 
+		//cooked version: nodes, materials and mesh bins in a single file mapped when loading
+		static bool use_binary; //prefabs are cooked in a .pbin next to the gltf on the first load and read from it afterwards
+		static std::string getBinFilename(const char* filename) { return std::string(filename) + ".pbin"; }
+		static bool readBinMeshes(const char* filename, std::vector<GFX::Mesh*>& meshes); //for background threads: validates the bin (same version, sources unchanged) and reads its meshes to RAM
+		bool readBin(const char* filename, std::vector<GFX::Mesh*>* parsed_meshes = NULL); //parsed_meshes: from readBinMeshes, the used ones are left loading to be uploaded in their own tasks
+		bool writeBin(const char* filename);
+		void writeBinAsync(const char* filename, const std::vector<sPrefabSource>& sources, const std::vector<GFX::Mesh*>& uploads); //tables gathered now, the file is written in a background task and then the meshes are queued for upload
+		static bool getSourceInfo(const std::string& filename, sPrefabSource& source); //reads the whole file for the hash
+
 		//Manager to cache loaded prefabs
 		static std::map<std::string, Prefab*> sPrefabsLoaded;
 		static Prefab* Get(const char* filename);
+		static Prefab* GetAsync(const char* filename); //returns an empty prefab that is filled once loaded
 		void registerPrefab(std::string name);
 	};
 
@@ -1,14 +1,20 @@
 #include "renderer.h"
 
 #include <algorithm> //sort
+#include <set>
+#include <cstring>
 
 #include "camera.h"
 #include "../gfx/gfx.h"
 #include "../gfx/shader.h"
 #include "../gfx/mesh.h"
+#include "../gfx/geometryarena.h"
 #include "../gfx/texture.h"
 #include "../gfx/fbo.h"
+#include "../gfx/readback.h"
+#include "../gfx/texturepacker.h"
 #include "../pipeline/prefab.h"
+#include "../pipeline/memorystats.h"
 #include "../pipeline/material.h"
 #include "../pipeline/animation.h"
 #include "../utils/utils.h"
@@ -91,6 +97,14 @@ void Renderer::setupScene(Camera* camera)
 	processEntities();
 
 	processRenderCalls(camera);
+
+	//the textures completed since the last pack, once the loads stop so the arrays are not made while they keep arriving
+	if (use_texture_arrays && packed_completed != GFX::Texture::num_completed && TaskManager::background.pending.isDone() && TaskManager::foreground.pending.isDone())
+		packMaterialTextures();
+
+	//after the render calls requested the levels of their textures
+	GFX::Texture::updateStreaming();
+	GFX::Readback::update(); //callbacks of the reads the GPU has finished
 	
 	if(current_mode != eRenderMode::FLAT)
 		generateShadowMaps();
@@ -126,6 +140,11 @@ void SCN::Renderer::processEntities()
 	for (int i = 0; i < scene->entities.size(); ++i)
 	{
 		BaseEntity* ent = scene->entities[i];
+
+		//prefabs loaded in the background get their nodes once ready
+		if (ent->getType() == eEntityType::PREFAB)
+			((SCN::PrefabEntity*)ent)->updatePrefab();
+
 		if (!ent->visible)
 			continue;
 
@@ -481,7 +500,7 @@ void Renderer::renderMeshWithMaterial(RenderCall* rc)
 		glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
 
 	//do the draw call that renders the mesh into the screen
-	rc->mesh->render(GL_TRIANGLES);
+	drawRenderCall(rc);
 
 	//disable shader
 	shader->disable();
@@ -536,7 +555,7 @@ void Renderer::renderMeshWithMaterialFlat(RenderCall* rc)
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 	//do the draw call that renders the mesh into the screen
-	rc->mesh->render(GL_TRIANGLES);
+	drawRenderCall(rc);
 
 	//disable shader
 	shader->disable();
@@ -622,7 +641,7 @@ void Renderer::renderMeshWithMaterialLight(RenderCall* rc)
 	if (visible_lights.size() == 0)
 	{
 		shader->setUniform("u_light_info", vec4((int)eLightType::NO_LIGHT, 0, 0, 0));
-		rc->mesh->render(GL_TRIANGLES);
+		drawRenderCall(rc);
 		//disable shader
 		shader->disable();
 
@@ -678,7 +697,7 @@ void SCN::Renderer::renderMultipass(GFX::Shader* shader, RenderCall* rc)
 		
 		shader->setUniform("u_enable_reflections", capture_reflectance ? false : enable_reflections);
 		//do the draw call that renders the mesh into the screen
-		rc->mesh->render(GL_TRIANGLES);
+		drawRenderCall(rc);
 
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
@@ -740,7 +759,7 @@ void SCN::Renderer::renderSinglepass(GFX::Shader* shader, RenderCall* rc)
 	shader->setUniform2Array("u_lights_cone", (float*)lights_cone, MAX_LIGHTS);
 
 	//do the draw call that renders the mesh into the screen
-	rc->mesh->render(GL_TRIANGLES);
+	drawRenderCall(rc);
 
 	shader->setUniform("u_ambient_light", vec3(0.0));
 	shader->setUniform("u_emissive_factor", vec3(0.0));
@@ -771,8 +790,6 @@ void SCN::Renderer::renderDeferredGBuffers(RenderCall* rc)
 	GFX::Shader* shader = NULL;
 
 	Camera* camera = Camera::current;
-	
-	GFX::Texture* normal_texture = rc->material->textures[SCN::eTextureChannel::NORMALMAP].texture;
 
 	glDisable(GL_BLEND);
 
@@ -798,26 +815,33 @@ void SCN::Renderer::renderDeferredGBuffers(RenderCall* rc)
 	//upload uniforms
 	shader->setUniform("u_model", rc->model);
 	cameraToShader(camera, shader);
-	materialToShader(shader, rc->material);
+	gbuffersMaterialToShader(shader, rc->material);
+
+	drawRenderCall(rc);
+
+	shader->disable();
+}
+
+void SCN::Renderer::gbuffersMaterialToShader(GFX::Shader* shader, SCN::Material* material)
+{
+	GFX::Texture* normal_texture = material->textures[SCN::eTextureChannel::NORMALMAP].texture;
+
+	materialToShader(shader, material);
 	float t = getTime();
 	shader->setUniform("u_time", t);
-	shader->setUniform("u_emissive_factor", rc->material->emissive_factor);
+	shader->setUniform("u_emissive_factor", material->emissive_factor);
 	if (normal_texture && enable_normalmap)
 	{
 		shader->setUniform("u_normal_texture", normal_texture, 3);
 	}
 	shader->setUniform("u_enable_normalmaps", enable_normalmap);
 
-	shader->setUniform("u_alpha_cutoff", rc->material->alpha_mode == SCN::eAlphaMode::MASK ? rc->material->alpha_cutoff : 0.001f);
+	shader->setUniform("u_alpha_cutoff", material->alpha_mode == SCN::eAlphaMode::MASK ? material->alpha_cutoff : 0.001f);
 
-	if (enable_dithering && rc->material->alpha_mode == eAlphaMode::BLEND)
+	if (enable_dithering && material->alpha_mode == eAlphaMode::BLEND)
 		shader->setUniform("u_enable_dithering", 1.0f);
 	else
 		shader->setUniform("u_enable_dithering", 0.0f);
-
-	rc->mesh->render(GL_TRIANGLES);
-
-	shader->disable();
 }
 
 void SCN::Renderer::renderDeferred()
@@ -1235,7 +1259,7 @@ void Renderer::renderMultipassTransparencies(GFX::Shader* shader, RenderCall* rc
 		lightToShader(light, shader);
 
 		//do the draw call that renders the mesh into the screen
-		rc->mesh->render(GL_TRIANGLES);
+		drawRenderCall(rc);
 
 		shader->setUniform("u_ambient_light", vec3(0.0));
 		shader->setUniform("u_emissive_factor", vec3(0.0));
@@ -1259,9 +1283,18 @@ void SCN::Renderer::renderIrradianceProbe(sProbe& probe)
 	sphere.render(GL_TRIANGLES);
 }
 
-void SCN::Renderer::captureIrradianceProbe(sProbe& probe)
+//the six views of a probe while they are read back, the SH are projected in a job once all of them are in the CPU
+struct sProbeCapture {
+	sProbe* probe;
+	FloatImage images[6];
+	int num_read;
+};
+
+void SCN::Renderer::captureIrradianceProbe(sProbe& probe, JobCounter* sh_jobs)
 {
-	FloatImage images[6]; //here we will store the six views
+	sProbeCapture* capture = new sProbeCapture();
+	capture->probe = &probe;
+	capture->num_read = 0;
 
 	Camera* app_camera = Camera::current;
 	Camera cam;
@@ -1270,11 +1303,12 @@ void SCN::Renderer::captureIrradianceProbe(sProbe& probe)
 
 	eShaders state_shader = current_shader;
 	current_shader = eShaders::sLIGHTS_MULTI;
+	current_lod_bias = probe_lod_bias;
 	
 	if (!irr_fbo)
 	{
 		irr_fbo = new GFX::FBO();
-		irr_fbo->create(64, 64, 1, GL_RGB, GL_FLOAT);
+		irr_fbo->create(64, 64, 1, GL_RGB, GL_HALF_FLOAT); //read back as halfs, converted on the CPU
 	}
 
 	for (int i = 0; i < 6; ++i) //for every cubemap face
@@ -1297,14 +1331,20 @@ void SCN::Renderer::captureIrradianceProbe(sProbe& probe)
 			renderByPriority(eRenderMode::LIGHTS);
 		irr_fbo->unbind();
 
-		//read the pixels back and store in a FloatImage
-		images[i].fromTexture(irr_fbo->color_textures[0]);
+		//read the pixels back without waiting, the next views are rendered meanwhile
+		capture->images[i].fromTextureAsync(irr_fbo->color_textures[0], [capture, sh_jobs]() {
+			if (++capture->num_read < 6)
+				return;
+			//compute the coefficients given the six images
+			JobSystem::run([capture]() {
+				capture->probe->sh = computeSH(capture->images);
+				delete capture;
+			}, sh_jobs);
+		});
 	}
 
-	//compute the coefficients given the six images
-	probe.sh = computeSH(images);
-
 	current_shader = state_shader;
+	current_lod_bias = 0;
 
 }
 
@@ -1353,12 +1393,16 @@ void SCN::Renderer::captureIrradiance()
 
 	show_probes = false;
 	//now compute the coeffs for every probe
+	JobCounter sh_jobs;
 	for (int iP = 0; iP < probes.size(); ++iP)
 	{
 		int probe_index = iP;
 		sProbe& p = probes[iP];
-		captureIrradianceProbe(p);
+		captureIrradianceProbe(p, &sh_jobs);
+		GFX::Readback::update(); //the SH of the probes already read start in the workers
 	}
+	GFX::Readback::finishAll();
+	JobSystem::wait(&sh_jobs);
 	show_probes = last_state;
 
 	irradiance_cache_info.dims = dim;
@@ -1481,7 +1525,7 @@ void SCN::Renderer::captureReflection()
 
 	Camera camera;
 	camera.setPerspective(90, 1, 0.1, 1000);
-
+	current_lod_bias = probe_lod_bias;
 
 	//define the corners of the axis aligned grid
 	//this can be done using the boundings of our scene
@@ -1544,6 +1588,7 @@ void SCN::Renderer::captureReflection()
 				reflection_probes.push_back(p);
 
 			}
+	current_lod_bias = 0;
 }
 
 void SCN::Renderer::renderReflectionProbe(sReflectionProbe& probe)
@@ -1682,6 +1727,45 @@ void Renderer::showUI()
 		
 	ImGui::Checkbox("Wireframe", &render_wireframe);
 	ImGui::Checkbox("Boundaries", &render_boundaries);
+	//LODS
+	if (ImGui::TreeNode("LODs"))
+	{
+		ImGui::Checkbox("Use LODs", &use_lods);
+		ImGui::SliderFloat("Max screen error", &lod_threshold, 0.1f, 10.0f);
+		ImGui::SliderFloat("Hysteresis", &lod_hysteresis, 0.0f, 0.9f);
+		ImGui::SliderInt("Shadow bias", &shadow_lod_bias, 0, 4);
+		ImGui::SliderInt("Probe bias", &probe_lod_bias, 0, 4);
+		ImGui::Checkbox("Meshlet culling", &use_meshlet_culling);
+		ImGui::Checkbox("Indirect draw (gbuffers, shadows)", &use_indirect_draw);
+		ImGui::Checkbox("Texture arrays (gbuffers)", &use_texture_arrays);
+		ImGui::SameLine();
+		if (ImGui::Button("Repack textures"))
+			packMaterialTextures(true);
+		ImGui::Text("%d textures in %d arrays, %.1f MB", GFX::TexturePacker::num_packed, (int)GFX::TexturePacker::arrays.size(), GFX::TexturePacker::packed_bytes / (1024.0f * 1024.0f));
+		ImGui::TreePop();
+	}
+	//MEMORY
+	if (ImGui::TreeNode("Memory"))
+	{
+		if (ImGui::Button("Compute"))
+			computeMemoryStats();
+		const float MB = 1.0f / (1024.0f * 1024.0f);
+		for (int i = 0; i < NUM_MEMORY_TYPES; ++i)
+		{
+			const sMemoryUsage& usage = MemoryStats::types[i];
+			ImGui::Text("%s: %d, RAM %.1f MB, VRAM %.1f MB", MemoryStats::getTypeName((eMemoryType)i), usage.count, usage.ram_bytes * MB, usage.vram_bytes * MB);
+		}
+		if (ImGui::TreeNode("Entities"))
+		{
+			for (size_t i = 0; i < MemoryStats::entities.size(); ++i)
+			{
+				const sEntityMemory& entity = MemoryStats::entities[i];
+				ImGui::Text("%s (%s): %d, RAM %.1f MB, VRAM %.1f MB", entity.name.c_str(), entity.type, entity.usage.count, entity.usage.ram_bytes * MB, entity.usage.vram_bytes * MB);
+			}
+			ImGui::TreePop();
+		}
+		ImGui::TreePop();
+	}
 	//RENDER PRIORITY
 	if (ImGui::TreeNode("Rendering Priority"))
 	{
@@ -2041,8 +2125,8 @@ void Renderer::storeDrawCall(SCN::Node* node, Camera* camera)
 	//compute global matrix
 	Matrix44 node_model = node->getGlobalMatrix(true);
 
-	//does this node have a mesh? then we must render it
-	if (node->mesh && node->material)
+	//does this node have a mesh? then we must render it (meshes loading in the background or that failed to load are skipped)
+	if (node->mesh && node->material && !node->mesh->loading && node->mesh->getNumVertices())
 	{
 		//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
 		BoundingBox world_bounding = transformBoundingBox(node_model, node->mesh->box);
@@ -2057,6 +2141,8 @@ void Renderer::storeDrawCall(SCN::Node* node, Camera* camera)
 			rc.model = node_model;
 			rc.distance_2_camera = camera->eye.distance(nodepos);
 			rc.bounding = world_bounding;
+			rc.lod = computeLOD(node, world_bounding, camera);
+			requestTextures(node->material, node->mesh, world_bounding, camera);
 
 			rc.material->alpha_mode == eAlphaMode::NO_ALPHA ? render_calls_opaque.push_back(rc) : render_calls.push_back(rc);
 		}
@@ -2075,8 +2161,8 @@ void Renderer::storeDrawCallNoPriority(SCN::Node* node, Camera* camera)
 	//compute global matrix
 	Matrix44 node_model = node->getGlobalMatrix(true);
 
-	//does this node have a mesh? then we must render it
-	if (node->mesh && node->material)
+	//does this node have a mesh? then we must render it (meshes loading in the background or that failed to load are skipped)
+	if (node->mesh && node->material && !node->mesh->loading && node->mesh->getNumVertices())
 	{
 		//compute the bounding box of the object in world space (by using the mesh bounding box transformed to world space)
 		BoundingBox world_bounding = transformBoundingBox(node_model, node->mesh->box);
@@ -2090,6 +2176,8 @@ void Renderer::storeDrawCallNoPriority(SCN::Node* node, Camera* camera)
 			rc.material = node->material;
 			rc.model = node_model;
 			rc.bounding = world_bounding;
+			rc.lod = computeLOD(node, world_bounding, camera);
+			requestTextures(node->material, node->mesh, world_bounding, camera);
 
 			render_calls.push_back(rc);
 		}
@@ -2100,8 +2188,91 @@ void Renderer::storeDrawCallNoPriority(SCN::Node* node, Camera* camera)
 		storeDrawCallNoPriority(node->children[i], camera);
 }
 
+void Renderer::drawRenderCall(RenderCall* rc)
+{
+	//meshlets only exist for the full mesh, back faces can be skipped if the GPU would cull them anyway
+	if (use_meshlet_culling && rc->lod == 0 && rc->mesh->meshlets.size() > 1)
+		rc->mesh->renderMeshlets(GL_TRIANGLES, rc->model, Camera::current, !rc->material->two_sided);
+	else
+		rc->mesh->render(GL_TRIANGLES, -1, 0, rc->lod);
+}
+
+int Renderer::computeLOD(SCN::Node* node, const BoundingBox& world_bounding, Camera* camera)
+{
+	GFX::Mesh* mesh = node->mesh;
+	if (!use_lods || !mesh->lods.size())
+		return 0;
+
+	//errors are relative to the radius, so we only need the projected radius
+	float projected_radius = camera->getProjectedScale(world_bounding.center, world_bounding.halfsize.length());
+
+	int lod = 0;
+	for (int i = 0; i < (int)mesh->lods.size(); ++i)
+	{
+		//to switch to a coarser LOD the error must be clearly below the threshold, avoids popping back and forth
+		float threshold = lod_threshold;
+		if (i + 1 > node->lod)
+			threshold *= 1.0f - lod_hysteresis;
+		if (mesh->lods[i].error * projected_radius > threshold)
+			break;
+		lod = i + 1;
+	}
+
+	node->lod = lod;
+	return lod;
+}
+
+void Renderer::requestTextures(SCN::Material* material, GFX::Mesh* mesh, const BoundingBox& world_bounding, Camera* camera)
+{
+	//maps that change less the final color can wait
+	static const float channel_weights[eTextureChannel::ALL] = { 1.0f, 1.0f, 1.0f, 0.5f, 0.25f, 0.5f }; //albedo, emissive, opacity, metallic, occlusion, normal
+
+	//drawn only by the gbuffers batches with its textures in arrays, the originals dont need their finer levels
+	GFX::Texture* arrays[4];
+	bool from_arrays = current_mode == eRenderMode::DEFERRED && use_indirect_draw && use_texture_arrays && mesh->arena &&
+		material->alpha_mode == eAlphaMode::NO_ALPHA && isPackedMaterial(material, arrays);
+
+	float projected_radius = -1.0f;
+	float texels_per_size = -1.0f; //texels across the radius per texel of the texture size, divided by the pixels it covers
+	for (int i = 0; i < eTextureChannel::ALL; ++i)
+	{
+		GFX::Texture* texture = material->textures[i].texture;
+		if (!texture)
+			continue;
+		if (from_arrays && material->textures[i].array)
+			continue;
+
+		if (texture->loading)
+		{
+			if (projected_radius < 0.0f)
+				projected_radius = camera->getProjectedScale(world_bounding.center, world_bounding.halfsize.length());
+			texture->raiseLoadImportance(projected_radius * channel_weights[i]);
+			continue;
+		}
+
+		if (!texture->streamed)
+			continue;
+		if (texels_per_size < 0.0f)
+		{
+			//pixels of the radius in a perspective camera, orthographic ones ask for the full texture
+			float radius = world_bounding.halfsize.length();
+			float distance = camera->eye.distance(world_bounding.center);
+			float pixel_radius = 1e10f;
+			if (camera->type == Camera::PERSPECTIVE && distance > radius)
+				pixel_radius = radius * CORE::getWindowSize().y * 0.5f / (tan(camera->fov * 0.5f * DEG2RAD) * distance);
+			texels_per_size = mesh->getUVDensity() * mesh->radius / std::max(pixel_radius, 1.0f);
+		}
+		float texels = std::max(texture->width, texture->height) * texels_per_size;
+		texture->requestLevel((int)floor(log2(std::max(texels, 1.0f))));
+	}
+}
+
 void Renderer::renderByPriority(eRenderMode mode)
 {
+	//opaque geometry of the gbuffers and shadowmaps goes in batches first, the rest call by call
+	eRenderMode pass_mode = (mode == eRenderMode::NULLMODE) ? current_mode : mode;
+	bool indirect = use_indirect_draw && (pass_mode == eRenderMode::DEFERRED || pass_mode == eRenderMode::SHADOWMAP) && renderIndirect(pass_mode);
+
 	switch (current_priority)
 	{
 	case(eRenderPriority::NOPRIORITY):
@@ -2109,6 +2280,8 @@ void Renderer::renderByPriority(eRenderMode mode)
 		for (int i = 0; i < render_calls.size(); ++i)
 		{
 			RenderCall rc = render_calls[i];
+			if (indirect && isIndirectCall(rc))
+				continue;
 			renderRenderCalls(&rc, mode);
 		}
 		break;
@@ -2119,6 +2292,8 @@ void Renderer::renderByPriority(eRenderMode mode)
 		for (int i = 0; i < render_calls_opaque.size(); ++i)
 		{
 			RenderCall rc = render_calls_opaque[i];
+			if (indirect && isIndirectCall(rc))
+				continue;
 			renderRenderCalls(&rc, mode);
 		}
 
@@ -2126,6 +2301,8 @@ void Renderer::renderByPriority(eRenderMode mode)
 		for (int i = 0; i < render_calls.size(); ++i)
 		{
 			RenderCall rc = render_calls[i];
+			if (indirect && isIndirectCall(rc))
+				continue;
 			renderRenderCalls(&rc, mode);
 		}
 		break;
@@ -2136,6 +2313,8 @@ void Renderer::renderByPriority(eRenderMode mode)
 		for (int i = 0; i < render_calls_opaque.size(); ++i)
 		{
 			RenderCall rc = render_calls_opaque[i];
+			if (indirect && isIndirectCall(rc))
+				continue;
 			renderRenderCalls(&rc, mode);
 		}
 
@@ -2143,6 +2322,8 @@ void Renderer::renderByPriority(eRenderMode mode)
 		for (int i = 0; i < render_calls.size(); ++i)
 		{
 			RenderCall rc = render_calls[i];
+			if (indirect && isIndirectCall(rc))
+				continue;
 			renderRenderCalls(&rc);
 		}
 		break;
@@ -2150,9 +2331,240 @@ void Renderer::renderByPriority(eRenderMode mode)
 	}
 }
 
+bool Renderer::isIndirectCall(const RenderCall& rc)
+{
+	return rc.mesh && rc.material && rc.mesh->arena && rc.material->alpha_mode == eAlphaMode::NO_ALPHA;
+}
+
+//channels of the materials batched with texture arrays, in the order of sIndirectMaterial::layers
+static const eTextureChannel packed_channels[4] = { eTextureChannel::ALBEDO, eTextureChannel::EMISSIVE, eTextureChannel::METALLIC_ROUGHNESS, eTextureChannel::NORMALMAP };
+static const char* packed_uniforms[4] = { "u_albedo_array", "u_emissive_array", "u_metallic_roughness_array", "u_normal_array" };
+
+//a call of the batches, the packed materials are grouped by their arrays instead of by material
+struct sIndirectCall
+{
+	RenderCall* rc;
+	bool packed;
+	GFX::Texture* arrays[4];
+};
+
+static bool sameIndirectBatch(const sIndirectCall& a, const sIndirectCall& b, bool shadowmap)
+{
+	if (a.rc->mesh->arena != b.rc->mesh->arena)
+		return false;
+	if (shadowmap)
+		return a.rc->material->two_sided == b.rc->material->two_sided;
+	if (a.packed != b.packed)
+		return false;
+	if (!a.packed)
+		return a.rc->material == b.rc->material;
+	return a.rc->material->two_sided == b.rc->material->two_sided && memcmp(a.arrays, b.arrays, sizeof(a.arrays)) == 0;
+}
+
+bool Renderer::isPackedMaterial(Material* material, GFX::Texture* arrays[4])
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		const Sampler& sampler = material->textures[packed_channels[i]];
+		arrays[i] = NULL;
+		if (!sampler.texture)
+			continue;
+		if (!sampler.array || sampler.pack_version != GFX::TexturePacker::version)
+			return false;
+		arrays[i] = sampler.array;
+	}
+	return true;
+}
+
+void Renderer::packMaterialTextures(bool rebuild)
+{
+	if (rebuild)
+		GFX::TexturePacker::clear();
+	packed_completed = GFX::Texture::num_completed;
+
+	//the registered materials and the ones being rendered
+	std::set<Material*> materials;
+	for (auto it : Material::sMaterials)
+		materials.insert(it.second);
+	for (size_t i = 0; i < render_calls_opaque.size(); ++i)
+		materials.insert(render_calls_opaque[i].material);
+	for (size_t i = 0; i < render_calls.size(); ++i)
+		materials.insert(render_calls[i].material);
+	materials.erase(NULL);
+
+	std::vector<GFX::Texture*> textures;
+	std::map<GFX::Texture*, size_t> indices;
+	for (Material* material : materials)
+		for (int i = 0; i < 4; ++i)
+		{
+			GFX::Texture* texture = material->textures[packed_channels[i]].texture;
+			if (texture && indices.find(texture) == indices.end())
+			{
+				indices[texture] = textures.size();
+				textures.push_back(texture);
+			}
+		}
+
+	std::vector<GFX::sTextureLayer> layers;
+	unsigned int num_new = GFX::TexturePacker::pack(textures, layers);
+	for (Material* material : materials)
+		for (int i = 0; i < 4; ++i)
+		{
+			Sampler& sampler = material->textures[packed_channels[i]];
+			sampler.array = NULL;
+			sampler.layer = 0;
+			sampler.pack_version = GFX::TexturePacker::version;
+			if (!sampler.texture)
+				continue;
+			const GFX::sTextureLayer& entry = layers[indices[sampler.texture]];
+			sampler.array = entry.array;
+			sampler.layer = entry.layer;
+		}
+	if (num_new)
+		std::cout << " * Packed " << num_new << " textures, " << GFX::TexturePacker::num_packed << " of " << textures.size() << " in " << GFX::TexturePacker::arrays.size() << " arrays" << std::endl;
+}
+
+void Renderer::computeMemoryStats()
+{
+	MemoryStats::addProbeFBO(irr_fbo);
+	MemoryStats::addProbeTexture(probes_texture);
+	MemoryStats::addProbeRAM(probes.capacity() * sizeof(sProbe));
+	MemoryStats::addProbeFBO(reflections_fbo);
+	for (size_t i = 0; i < reflection_probes.size(); ++i)
+		MemoryStats::addProbeTexture(reflection_probes[i].cubemap);
+	MemoryStats::addProbeRAM(reflection_probes.capacity() * sizeof(sReflectionProbe));
+	MemoryStats::compute(scene);
+}
+
+bool Renderer::renderIndirect(eRenderMode mode)
+{
+	bool shadowmap = mode == eRenderMode::SHADOWMAP;
+	GFX::Shader* shader = GFX::Shader::Get(shadowmap ? "flat_indirect" : "gbuffers_indirect");
+	if (!shader)
+		return false;
+	//materials with their textures in arrays are drawn together
+	GFX::Shader* arrays_shader = (shadowmap || !use_texture_arrays) ? NULL : GFX::Shader::Get("gbuffers_arrays");
+	Camera* camera = Camera::current;
+
+	static std::vector<sIndirectCall> calls;
+	calls.clear();
+	auto addCall = [&](RenderCall& rc) {
+		if (!isIndirectCall(rc))
+			return;
+		sIndirectCall call;
+		call.rc = &rc;
+		call.packed = arrays_shader && isPackedMaterial(rc.material, call.arrays);
+		calls.push_back(call);
+	};
+	for (size_t i = 0; i < render_calls_opaque.size(); ++i)
+		addCall(render_calls_opaque[i]);
+	for (size_t i = 0; i < render_calls.size(); ++i)
+		addCall(render_calls[i]);
+
+	//groups share the state: the material (or the arrays) in the gbuffers, only the culling in the shadowmaps
+	std::sort(calls.begin(), calls.end(), [shadowmap](const sIndirectCall& a, const sIndirectCall& b) {
+		Material* material_a = a.rc->material;
+		Material* material_b = b.rc->material;
+		if ((shadowmap || a.packed) && material_a->two_sided != material_b->two_sided)
+			return material_a->two_sided < material_b->two_sided;
+		if (a.packed != b.packed)
+			return a.packed > b.packed;
+		if (a.packed)
+		{
+			for (int i = 0; i < 4; ++i)
+				if (a.arrays[i] != b.arrays[i])
+					return a.arrays[i] < b.arrays[i];
+		}
+		else if (!shadowmap && material_a != material_b)
+			return material_a < material_b;
+		return a.rc->mesh->arena < b.rc->mesh->arena;
+	});
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	if (render_wireframe && shadowmap)
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+	static GFX::IndirectDrawList list;
+	GFX::Shader* current_shader = NULL;
+	for (size_t i = 0; i < calls.size(); )
+	{
+		const sIndirectCall& first = calls[i];
+		Material* material = first.rc->material;
+
+		GFX::Shader* batch_shader = first.packed ? arrays_shader : shader;
+		if (batch_shader != current_shader)
+		{
+			current_shader = batch_shader;
+			current_shader->enable();
+			cameraToShader(camera, current_shader);
+		}
+
+		//select if render both sides of the triangles
+		if (material->two_sided)
+			glDisable(GL_CULL_FACE);
+		else
+			glEnable(GL_CULL_FACE);
+		if (first.packed)
+		{
+			for (int k = 0; k < 4; ++k)
+				if (first.arrays[k])
+					current_shader->setTexture(packed_uniforms[k], first.arrays[k], k);
+				else
+					current_shader->setUniform(packed_uniforms[k], k);
+			current_shader->setUniform("u_enable_normalmaps", enable_normalmap);
+		}
+		else if (!shadowmap)
+			gbuffersMaterialToShader(current_shader, material);
+
+		list.clear();
+		for (; i < calls.size() && sameIndirectBatch(calls[i], first, shadowmap); ++i)
+		{
+			RenderCall* rc = calls[i].rc;
+
+			//the calls were culled with the main camera
+			if (shadowmap && !camera->testBoxInFrustum(rc->bounding.center, rc->bounding.halfsize))
+				continue;
+
+			//shadows and probes do not need the same detail as the main view
+			int lod = rc->lod;
+			if (current_lod_bias && use_lods)
+				lod = std::min(lod + current_lod_bias, (int)rc->mesh->lods.size());
+
+			//the material goes with the draw
+			if (calls[i].packed)
+			{
+				GFX::sIndirectMaterial& packed = list.material;
+				packed.color = rc->material->color;
+				packed.emissive.set(rc->material->emissive_factor, 0.0f);
+				float* layers = &packed.layers.x;
+				for (int k = 0; k < 4; ++k)
+				{
+					const Sampler& sampler = rc->material->textures[packed_channels[k]];
+					layers[k] = sampler.texture ? (float)sampler.layer : -1.0f;
+				}
+			}
+
+			list.add(rc->mesh, rc->model, lod, use_meshlet_culling ? camera : NULL, !material->two_sided);
+		}
+		list.draw(current_shader, GL_TRIANGLES);
+	}
+
+	if (current_shader)
+		current_shader->disable();
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+	//after the batches, it uses its own shader
+	if (render_boundaries)
+		for (size_t i = 0; i < calls.size(); ++i)
+			calls[i].rc->mesh->renderBounding(calls[i].rc->model, true);
+	return true;
+}
+
 void Renderer::generateShadowMaps()
 {
 	GFX::startGPULabel("Generate shadowmaps");
+	current_lod_bias = shadow_lod_bias;
 
 	for (auto light : lights)
 	{
@@ -2206,6 +2618,7 @@ void Renderer::generateShadowMaps()
 
 		light->shadow_viewproj = camera->viewprojection_matrix;
 	}
+	current_lod_bias = 0;
 	GFX::endGPULabel();
 }
 
@@ -2239,6 +2652,14 @@ void Renderer::renderRenderCalls(RenderCall* rc, eRenderMode mode)
 {
 	if (rc->mesh && rc->material)
 	{
+		//shadows and probes do not need the same detail as the main view
+		if (current_lod_bias && use_lods)
+		{
+			rc->lod += current_lod_bias;
+			if (rc->lod > (int)rc->mesh->lods.size())
+				rc->lod = (int)rc->mesh->lods.size();
+		}
+
 		if(render_boundaries)
 			rc->mesh->renderBounding(rc->model, true);
 
@@ -34,6 +34,7 @@ namespace SCN {
 		Material* material;
 		Matrix44 model;
 		BoundingBox bounding;
+		int lod = 0; //0 is the full mesh
 
 		float distance_2_camera;
 	};
@@ -151,6 +152,18 @@ namespace SCN {
 
 		bool show_shadowmaps = false;
 
+		//LODs
+		bool use_lods = true;
+		float lod_threshold = 1.0f; //max error allowed on screen (approx. pixels)
+		float lod_hysteresis = 0.25f; //a coarser LOD must be this fraction below the threshold to be used
+		int shadow_lod_bias = 1; //extra levels for the shadowmaps
+		int probe_lod_bias = 2; //extra levels when capturing irradiance and reflection probes
+		int current_lod_bias = 0; //applied to all the render calls, set by the passes above
+		bool use_meshlet_culling = true; //big meshes are culled by parts (frustum and normal cones)
+		bool use_indirect_draw = true; //opaque meshes of the gbuffers and shadowmaps are drawn in batches from the geometry arenas
+		bool use_texture_arrays = true; //in the gbuffers batches, the materials with their textures packed in arrays are drawn together
+		unsigned int packed_completed = 0; //GFX::Texture::num_completed of the last pack
+
 		bool enable_specular = false;
 		bool enable_normalmap = false;
 
@@ -272,6 +285,9 @@ namespace SCN {
 		//to render one mesh given its material and transformation matrix
 		void renderMeshWithMaterial(RenderCall* rc);
 
+		//the draw call of the mesh with the current shader, culls its meshlets with the current camera
+		void drawRenderCall(RenderCall* rc);
+
 		void renderMeshWithMaterialFlat(RenderCall* rc);
 
 		void renderMeshWithMaterialLight(RenderCall* rc);
@@ -300,7 +316,7 @@ namespace SCN {
 
 		// irradiance
 		void renderIrradianceProbe(sProbe& probe);
-		void captureIrradianceProbe(sProbe& probe);
+		void captureIrradianceProbe(sProbe& probe, JobCounter* sh_jobs); //the coefficients are ready when the jobs of the counter finish
 		void captureIrradiance();
 		void uploadIrradianceCache();
 		void applyIrradiance();
@@ -323,13 +339,27 @@ namespace SCN {
 		void lightToShader(LightEntity* light, GFX::Shader* shader); //sends light uniforms to shader
 		void bufferToShader(GFX::Shader* shader);
 		void materialToShader(GFX::Shader* shader, SCN::Material* material);
+		void gbuffersMaterialToShader(GFX::Shader* shader, SCN::Material* material); //material uniforms of the gbuffers shaders
 
 		void storeDrawCall(SCN::Node* node, Camera* camera);
+		int computeLOD(SCN::Node* node, const BoundingBox& world_bounding, Camera* camera); //from the projected size, updates node->lod
+		void requestTextures(SCN::Material* material, GFX::Mesh* mesh, const BoundingBox& world_bounding, Camera* camera); //importance of the textures still loading in the background, levels of the streamed ones
 
 		void storeDrawCallNoPriority(SCN::Node* node, Camera* camera);
 
 		void renderByPriority(eRenderMode mode = eRenderMode::NULLMODE);
 
+		//opaque calls with the mesh in a geometry arena are grouped by state and drawn with an indirect call per group
+		bool isIndirectCall(const RenderCall& rc);
+		bool renderIndirect(eRenderMode mode); //false if the pass cannot be batched, then nothing is rendered
+		//copies the small textures of the materials to texture arrays (GFX::TexturePacker), the ones not packed yet or all of them again
+		//it is called when the textures loaded in the background are complete
+		void packMaterialTextures(bool rebuild = false);
+		bool isPackedMaterial(SCN::Material* material, GFX::Texture* arrays[4]); //all its textures are in arrays, given in the order of sIndirectMaterial::layers
+
+		//memory of the resources by type and entity (SCN::MemoryStats), with the probes of the renderer
+		void computeMemoryStats();
+
 		void renderRenderCalls(RenderCall* rc, eRenderMode mode = eRenderMode::NULLMODE);
 
 		void renderShadowmaps();
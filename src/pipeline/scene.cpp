@@ -265,9 +265,12 @@ SCN::BaseEntity* SCN::BaseEntity::createEntity(const char* type)
 	return it->second->clone();
 }
 
+bool SCN::PrefabEntity::load_async = true;
+
 SCN::PrefabEntity::PrefabEntity()
 {
 	prefab = NULL;
+	prefab_pending = false;
 }
 
 void SCN::PrefabEntity::configure(cJSON* json)
@@ -288,13 +291,31 @@ void SCN::PrefabEntity::loadPrefab(const char* filename)
 {
 	assert(scene && "Cannot assign filename without scene (to extract base folder)");
 	std::string fullpath = scene->base_folder + "/" + filename;
-	prefab = SCN::Prefab::Get(fullpath.c_str());
+	prefab = load_async ? SCN::Prefab::GetAsync(fullpath.c_str()) : SCN::Prefab::Get(fullpath.c_str());
+	prefab_pending = false;
 	if (!prefab)
 		return;
-	
+
+	root.clear();
+	if (prefab->loading)
+	{
+		prefab_pending = true;
+		return;
+	}
+
+	SCN::Node* child = new SCN::Node();
+	*child = prefab->root;
+	root.addChild(child);
+}
+
+void SCN::PrefabEntity::updatePrefab()
+{
+	if (!prefab_pending || !prefab || prefab->loading)
+		return;
+
+	prefab_pending = false;
 	SCN::Node* child = new SCN::Node();
 	*child = prefab->root;
-	root.clear();
 	root.addChild(child);
 }
 
@@ -362,35 +383,27 @@ SCN::RayTestResult SCN::Scene::testRay(Ray& ray, uint8 layers)
 	result.t = 1000000.0f;
 	result.collided = false;
 	result.entity = nullptr;
-	Vector3f collision;
 
-	//TODO: optimal way:
-	//- prebuild BVH (check https://github.com/xelatihy/yocto-gl/blob/main/libs/yocto/yocto_bvh.h )
-	//- get all nodes which bounding intersects ray
-	//- sort by distance to ray origin
-	//- test ray with closer one, if no collision, continue
-	//- if collision check if collision point inside any other node bounding, and test only in those
+	if (ray_bvh.needsUpdate(this))
+		ray_bvh.build(this);
+	ray_bvh.testRay(ray, layers, result);
 
+	return result;
+}
 
-	float max_dist = result.t;
-	for (auto& ent : entities)
-	{
-		if (!(ent->layers & layers))
-			continue;
 
-		if (!ent->testRay(ray, collision, max_dist))
-			continue;
-
-		float t = ray.origin.distance(collision);
-		if (t > result.t)
-			continue;
-		result.t = t;
-		result.collision = collision;
-		result.entity = ent;
-		result.collided = true;
+void SCN::Scene::testRays(const std::vector<Ray>& rays, std::vector<RayTestResult>& results, uint8 layers)
+{
+	results.resize(rays.size());
+	for (auto& result : results)
+	{
+		result.t = 1000000.0f;
+		result.collided = false;
+		result.entity = nullptr;
 	}
 
-	return result;
+	if (ray_bvh.needsUpdate(this))
+		ray_bvh.build(this);
+	ray_bvh.testRays(rays, results, layers);
 }
 
-
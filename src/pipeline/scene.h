@@ -6,6 +6,7 @@
 #include "camera.h"
 #include "animation.h"
 #include "prefab.h"
+#include "scenebvh.h"
 
 
 //forward declaration
@@ -97,6 +98,9 @@ namespace SCN {
 	public:
 		std::string filename;
 		Prefab* prefab;
+		bool prefab_pending; //the prefab was still loading, its nodes are copied once it finishes
+
+		static bool load_async; //prefabs are parsed in a background thread, the entity is empty until then
 		
 		PrefabEntity();
 
@@ -105,6 +109,7 @@ namespace SCN {
 		virtual void configure(cJSON* json);
 		virtual void serialize(cJSON* json);
 		void loadPrefab(const char* filename);
+		void updatePrefab(); //copies the nodes of a prefab that finished loading
 
 		bool testRay(const Ray& ray, Vector3f& coll, float max_dist = 100000.0f);
 	};
@@ -169,7 +174,10 @@ namespace SCN {
 
 		BaseEntity* getEntity(std::string name);
 
+		SceneBVH ray_bvh; //rebuilt by the ray tests when the nodes changed
+
 		RayTestResult testRay( Ray& ray, uint8 layers = 0xFF );
+		void testRays(const std::vector<Ray>& rays, std::vector<RayTestResult>& results, uint8 layers = 0xFF);
 	};
 
 };
@@ -0,0 +1,420 @@
+#include "scenebvh.h"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <mutex>
+
+#include "scene.h"
+#include "prefab.h"
+#include "material.h"
+#include "../gfx/mesh.h"
+#include "../core/jobs.h"
+
+namespace SCN {
+
+static void collectNodeStates(Node* node, BaseEntity* entity, int parent, std::vector<sRayNodeState>& states)
+{
+	sRayNodeState s;
+	s.node = node;
+	s.entity = entity;
+	s.parent = parent;
+	s.mesh = node->mesh;
+	s.material = node->material;
+	s.blend = node->material && node->material->alpha_mode == eAlphaMode::BLEND;
+	s.loading = node->mesh && node->mesh->loading;
+	s.layers = entity->layers;
+	s.model = node->model;
+
+	int index = (int)states.size();
+	states.push_back(s);
+	for (size_t i = 0; i < node->children.size(); ++i)
+		collectNodeStates(node->children[i], entity, index, states);
+}
+
+//same rules as PrefabEntity::testRay, it is the only entity that can be hit
+static void collectSceneStates(Scene* scene, std::vector<sRayNodeState>& states)
+{
+	states.clear();
+	for (auto ent : scene->entities)
+		if (ent->getType() == eEntityType::PREFAB)
+			collectNodeStates(&ent->root, ent, -1, states);
+}
+
+bool SceneBVH::needsUpdate(Scene* scene)
+{
+	if (pending)
+		return true;
+
+	std::vector<sRayNodeState> current;
+	current.reserve(state.size());
+	collectSceneStates(scene, current);
+	if (current.size() != state.size())
+		return true;
+
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		const sRayNodeState& a = current[i];
+		const sRayNodeState& b = state[i];
+		if (a.node != b.node || a.entity != b.entity || a.parent != b.parent || a.mesh != b.mesh || a.material != b.material ||
+			a.blend != b.blend || a.loading != b.loading || a.layers != b.layers || memcmp(a.model.m, b.model.m, sizeof(a.model.m)) != 0)
+			return true;
+	}
+	return false;
+}
+
+static inline float halfArea(const Vector3f& min, const Vector3f& max)
+{
+	Vector3f size = max - min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+void SceneBVH::build(Scene* scene)
+{
+	collectSceneStates(scene, state);
+	instances.clear();
+	nodes.clear();
+	pending = false;
+
+	//global matrices in one pass, parents always go before their children
+	std::vector<Matrix44> global_models(state.size());
+	for (size_t i = 0; i < state.size(); ++i)
+	{
+		const sRayNodeState& s = state[i];
+		global_models[i] = s.parent == -1 ? s.model : s.model * global_models[s.parent];
+
+		//meshes loading in the background have no bounds yet
+		if (s.loading)
+			pending = true;
+		if (!s.mesh || !s.material || s.blend || s.loading)
+			continue;
+
+		sRayInstance instance;
+		instance.mesh = s.mesh;
+		instance.bvh = NULL;
+		instance.entity = s.entity;
+		instance.layers = s.layers;
+		instance.model = global_models[i];
+		instance.inv_model = instance.model;
+		instance.inv_model.inverse();
+		BoundingBox box = transformBoundingBox(instance.model, s.mesh->box);
+		instance.min = box.center - box.halfsize;
+		instance.max = box.center + box.halfsize;
+		instances.push_back(instance);
+	}
+
+	if (!instances.size())
+		return;
+
+	GFX::sBVHNode root;
+	root.first = root.count = 0;
+	nodes.reserve(instances.size() * 2);
+	nodes.push_back(root);
+	subdivide(0, 0, (uint32)instances.size(), 0);
+}
+
+void SceneBVH::subdivide(uint32 node_index, uint32 start, uint32 count, int depth)
+{
+	Vector3f min(3.4e+38F), max(-3.4e+38F), cmin(3.4e+38F), cmax(-3.4e+38F);
+	for (uint32 i = start; i < start + count; ++i)
+	{
+		const sRayInstance& instance = instances[i];
+		Vector3f centroid = (instance.min + instance.max) * 0.5f;
+		for (int k = 0; k < 3; ++k)
+		{
+			min.v[k] = std::min(min.v[k], instance.min.v[k]);
+			max.v[k] = std::max(max.v[k], instance.max.v[k]);
+			cmin.v[k] = std::min(cmin.v[k], centroid.v[k]);
+			cmax.v[k] = std::max(cmax.v[k], centroid.v[k]);
+		}
+	}
+	GFX::sBVHNode& node = nodes[node_index];
+	node.min = min;
+	node.max = max;
+	node.first = start;
+	node.count = count;
+	if (count == 1)
+		return;
+
+	//binned SAH, every instance costs the same (the deepest levels use the median, like GFX::TriangleBVH, so the traversal stack is enough)
+	int best_axis = -1;
+	float best_split = 0.0f;
+	float best_cost = 3.4e+38F;
+	for (int axis = 0; axis < 3 && depth < BVH_MAX_DEPTH / 2; ++axis)
+	{
+		float extent = cmax.v[axis] - cmin.v[axis];
+		if (extent <= 0.0f)
+			continue;
+		for (int b = 1; b < SCENEBVH_NUM_BINS; ++b)
+		{
+			float split = cmin.v[axis] + extent * b / SCENEBVH_NUM_BINS;
+			Vector3f left_min(3.4e+38F), left_max(-3.4e+38F), right_min(3.4e+38F), right_max(-3.4e+38F);
+			uint32 left_count = 0;
+			for (uint32 i = start; i < start + count; ++i)
+			{
+				const sRayInstance& instance = instances[i];
+				bool left = (instance.min.v[axis] + instance.max.v[axis]) * 0.5f < split;
+				Vector3f& side_min = left ? left_min : right_min;
+				Vector3f& side_max = left ? left_max : right_max;
+				for (int k = 0; k < 3; ++k)
+				{
+					side_min.v[k] = std::min(side_min.v[k], instance.min.v[k]);
+					side_max.v[k] = std::max(side_max.v[k], instance.max.v[k]);
+				}
+				if (left)
+					left_count++;
+			}
+			if (!left_count || left_count == count)
+				continue;
+			float cost = halfArea(left_min, left_max) * left_count + halfArea(right_min, right_max) * (count - left_count);
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = split;
+			}
+		}
+	}
+
+	uint32 left_count = 0;
+	if (best_axis != -1)
+	{
+		sRayInstance* middle = std::partition(&instances[start], &instances[start] + count, [&](const sRayInstance& instance) {
+			return (instance.min.v[best_axis] + instance.max.v[best_axis]) * 0.5f < best_split;
+		});
+		left_count = (uint32)(middle - &instances[start]);
+	}
+	else
+	{
+		//all the centroids in the same place, they stay in the same leaf
+		Vector3f extent = cmax - cmin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		if (extent.v[axis] <= 0.0f)
+			return;
+
+		//too deep, halves at the median of the longest axis
+		left_count = count / 2;
+		std::nth_element(&instances[start], &instances[start] + left_count, &instances[start] + count, [&](const sRayInstance& a, const sRayInstance& b) {
+			return a.min.v[axis] + a.max.v[axis] < b.min.v[axis] + b.max.v[axis];
+		});
+	}
+
+	//both children together, node can be invalidated by the push_back
+	uint32 first = (uint32)nodes.size();
+	nodes[node_index].first = first;
+	nodes[node_index].count = 0;
+	GFX::sBVHNode empty;
+	empty.first = empty.count = 0;
+	nodes.push_back(empty);
+	nodes.push_back(empty);
+	subdivide(first, start, left_count, depth + 1);
+	subdivide(first + 1, start + left_count, count - left_count, depth + 1);
+}
+
+void SceneBVH::prepareQuery(const Ray* rays, const RayTestResult* results, size_t num_rays, uint8 layers)
+{
+	bool complete = true;
+	for (size_t i = 0; i < instances.size(); ++i)
+	{
+		instances[i].bvh = instances[i].mesh->collision_model;
+		if (!instances[i].bvh)
+			complete = false;
+	}
+	if (complete)
+		return;
+
+	//only the meshes the rays can reach are worth building, a scene full of meshes never tested does not stall the first query
+	std::vector<uint32> missing;
+	std::mutex missing_mutex;
+	JobSystem::parallelFor((unsigned int)num_rays, SCENEBVH_MIN_RAYS_PER_JOB, [&](unsigned int start, unsigned int end) {
+		std::vector<uint32> local;
+		for (unsigned int i = start; i < end; ++i)
+			collectMissing(rays[i], layers, results[i].t, local);
+		std::lock_guard<std::mutex> lock(missing_mutex);
+		missing.insert(missing.end(), local.begin(), local.end());
+	});
+	if (!missing.size())
+		return;
+
+	//one mesh per job, so the traversal never has to wait for one
+	std::set<GFX::Mesh*> unique;
+	for (size_t i = 0; i < missing.size(); ++i)
+		unique.insert(instances[missing[i]].mesh);
+	std::vector<GFX::Mesh*> meshes(unique.begin(), unique.end());
+	JobSystem::parallelFor((unsigned int)meshes.size(), 1, [&](unsigned int start, unsigned int end) {
+		for (unsigned int i = start; i < end; ++i)
+			meshes[i]->createCollisionModel();
+	});
+
+	for (size_t i = 0; i < instances.size(); ++i)
+		instances[i].bvh = instances[i].mesh->collision_model;
+}
+
+//slab test, returns the entry distance or a negative value if the ray misses the box before max_t
+static inline float rayBox(const Vector3f& min, const Vector3f& max, const Vector3f& origin, const Vector3f& inv_dir, float max_t)
+{
+	float t_near = 0.0f;
+	float t_far = max_t;
+	for (int k = 0; k < 3; ++k)
+	{
+		float t1 = (min.v[k] - origin.v[k]) * inv_dir.v[k];
+		float t2 = (max.v[k] - origin.v[k]) * inv_dir.v[k];
+		t_near = std::max(t_near, std::min(t1, t2));
+		t_far = std::min(t_far, std::max(t1, t2));
+	}
+	return t_near <= t_far ? t_near : -1.0f;
+}
+
+void SceneBVH::collectMissing(const Ray& ray, uint8 layers, float max_t, std::vector<uint32>& missing) const
+{
+	if (nodes.empty())
+		return;
+
+	Vector3f inv_dir;
+	for (int k = 0; k < 3; ++k)
+		inv_dir.v[k] = 1.0f / (std::fabs(ray.direction.v[k]) > 1e-20f ? ray.direction.v[k] : (ray.direction.v[k] < 0.0f ? -1e-20f : 1e-20f));
+
+	//every node hit, without hits there is no closest one to skip the rest
+	uint32 stack[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size)
+	{
+		const GFX::sBVHNode& node = nodes[stack[--stack_size]];
+		if (rayBox(node.min, node.max, ray.origin, inv_dir, max_t) < 0.0f)
+			continue;
+		if (!node.count)
+		{
+			assert(stack_size + 2 <= BVH_MAX_DEPTH);
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = node.first + 1;
+			continue;
+		}
+		for (uint32 i = node.first; i < node.first + node.count; ++i)
+		{
+			const sRayInstance& instance = instances[i];
+			if (!instance.bvh && (instance.layers & layers) && rayBox(instance.min, instance.max, ray.origin, inv_dir, max_t) >= 0.0f)
+				missing.push_back(i);
+		}
+	}
+}
+
+bool SceneBVH::traverse(const Ray& ray, uint8 layers, RayTestResult& result) const
+{
+	if (nodes.empty())
+		return false;
+
+	Vector3f inv_dir;
+	for (int k = 0; k < 3; ++k)
+		inv_dir.v[k] = 1.0f / (std::fabs(ray.direction.v[k]) > 1e-20f ? ray.direction.v[k] : (ray.direction.v[k] < 0.0f ? -1e-20f : 1e-20f));
+
+	float best_t = result.t;
+	const sRayInstance* best_instance = NULL;
+	Vector3f best_triangle[3];
+
+	//nearest first, the nodes behind the closest hit are skipped
+	uint32 stack[BVH_MAX_DEPTH];
+	float stack_t[BVH_MAX_DEPTH];
+	int stack_size = 0;
+	float root_t = rayBox(nodes[0].min, nodes[0].max, ray.origin, inv_dir, best_t);
+	if (root_t >= 0.0f)
+	{
+		stack[0] = 0;
+		stack_t[stack_size++] = root_t;
+	}
+
+	while (stack_size)
+	{
+		stack_size--;
+		if (stack_t[stack_size] > best_t)
+			continue;
+		const GFX::sBVHNode& node = nodes[stack[stack_size]];
+
+		if (!node.count)
+		{
+			float t0 = rayBox(nodes[node.first].min, nodes[node.first].max, ray.origin, inv_dir, best_t);
+			float t1 = rayBox(nodes[node.first + 1].min, nodes[node.first + 1].max, ray.origin, inv_dir, best_t);
+			if (t0 < 0.0f)
+				t0 = 3.4e+38F;
+			if (t1 < 0.0f)
+				t1 = 3.4e+38F;
+			//the far one goes first so the near one is popped next
+			bool first_near = t0 <= t1;
+			float near_t = first_near ? t0 : t1;
+			float far_t = first_near ? t1 : t0;
+			assert(stack_size + 2 <= BVH_MAX_DEPTH);
+			if (far_t < 3.4e+38F)
+			{
+				stack[stack_size] = first_near ? node.first + 1 : node.first;
+				stack_t[stack_size++] = far_t;
+			}
+			if (near_t < 3.4e+38F)
+			{
+				stack[stack_size] = first_near ? node.first : node.first + 1;
+				stack_t[stack_size++] = near_t;
+			}
+			continue;
+		}
+
+		for (uint32 i = node.first; i < node.first + node.count; ++i)
+		{
+			const sRayInstance& instance = instances[i];
+			if (!(instance.layers & layers))
+				continue;
+			if (rayBox(instance.min, instance.max, ray.origin, inv_dir, best_t) < 0.0f)
+				continue;
+
+			GFX::TriangleBVH* bvh = instance.bvh;
+			if (!bvh)
+				continue;
+
+			//the direction is not normalized in object space so t is still in world units
+			float t;
+			Vector3f triangle[3];
+			if (!bvh->testRay(instance.inv_model * ray.origin, instance.inv_model.rotateVector(ray.direction), best_t, t, triangle))
+				continue;
+			best_t = t;
+			best_instance = &instance;
+			for (int k = 0; k < 3; ++k)
+				best_triangle[k] = triangle[k];
+		}
+	}
+
+	if (!best_instance)
+		return false;
+
+	result.collided = true;
+	result.t = best_t;
+	result.collision = ray.origin + ray.direction * best_t;
+	result.entity = best_instance->entity;
+	Vector3f v1 = best_instance->model * best_triangle[1] - best_instance->model * best_triangle[0];
+	Vector3f v2 = best_instance->model * best_triangle[2] - best_instance->model * best_triangle[0];
+	v1.normalize();
+	v2.normalize();
+	result.normal = v1.cross(v2);
+	return true;
+}
+
+bool SceneBVH::testRay(const Ray& ray, uint8 layers, RayTestResult& result)
+{
+	prepareQuery(&ray, &result, 1, layers);
+	return traverse(ray, layers, result);
+}
+
+void SceneBVH::testRays(const std::vector<Ray>& rays, std::vector<RayTestResult>& results, uint8 layers)
+{
+	assert(results.size() == rays.size());
+	if (rays.empty())
+		return;
+	prepareQuery(&rays[0], &results[0], rays.size(), layers);
+
+	//ranges of rays as jobs, the calling thread takes part too
+	JobSystem::parallelFor((unsigned int)rays.size(), SCENEBVH_MIN_RAYS_PER_JOB, [&](unsigned int start, unsigned int end) {
+		for (unsigned int i = start; i < end; ++i)
+			traverse(rays[i], layers, results[i]);
+	});
+}
+
+};
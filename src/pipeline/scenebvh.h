@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+#include "../core/math.h"
+#include "../gfx/bvh.h"
+
+//Two level acceleration structure for the ray tests of the scene: a BVH over the world bounds of the nodes with a mesh (top level)
+//whose leaves test the BVH of the mesh with the ray in object space (bottom level, GFX::TriangleBVH)
+
+//forward declaration
+namespace GFX {
+	class Mesh;
+};
+
+namespace SCN {
+
+	class Scene;
+	class BaseEntity;
+	class Node;
+	class Material;
+	struct RayTestResult;
+
+	#define SCENEBVH_NUM_BINS 8 //split candidates per axis
+	#define SCENEBVH_MIN_RAYS_PER_JOB 64 //smaller batches are not worth a job
+
+	//a node with a mesh that can be hit
+	struct sRayInstance
+	{
+		GFX::Mesh* mesh;
+		GFX::TriangleBVH* bvh; //taken from the mesh before every query, created the first time a ray reaches its bounds
+		BaseEntity* entity;
+		uint8 layers;
+		Matrix44 model; //global
+		Matrix44 inv_model;
+		Vector3f min; //world bounds
+		Vector3f max;
+	};
+
+	//what the build depends on, one per node of the prefab entities in depth first order
+	struct sRayNodeState
+	{
+		Node* node;
+		BaseEntity* entity;
+		int parent; //index in the states, -1 for the root of the entity
+		GFX::Mesh* mesh;
+		Material* material;
+		bool blend; //alpha blended nodes are not hit
+		bool loading;
+		uint8 layers;
+		Matrix44 model;
+	};
+
+	class SceneBVH
+	{
+	public:
+		std::vector<GFX::sBVHNode> nodes; //like GFX::TriangleBVH, but the leaves are ranges of instances
+		std::vector<sRayInstance> instances;
+
+		SceneBVH() { pending = true; }
+
+		//the scene is compared with the state of the last build, so moved, added or removed nodes are detected without notifications
+		bool needsUpdate(Scene* scene);
+		void build(Scene* scene);
+
+		//closest hit closer than result.t, returns true if result was updated
+		bool testRay(const Ray& ray, uint8 layers, RayTestResult& result);
+		//many rays at once, ranges of them are tested in the threads of the JobSystem
+		void testRays(const std::vector<Ray>& rays, std::vector<RayTestResult>& results, uint8 layers);
+
+	private:
+		std::vector<sRayNodeState> state; //of the last build
+		bool pending; //built with meshes still loading, rebuilt on every query until they finish
+
+		void subdivide(uint32 node_index, uint32 start, uint32 count, int depth);
+		void prepareQuery(const Ray* rays, const RayTestResult* results, size_t num_rays, uint8 layers); //takes the BVHs of the meshes, creates the ones the rays need
+		void collectMissing(const Ray& ray, uint8 layers, float max_t, std::vector<uint32>& missing) const; //instances without BVH whose bounds are hit
+		bool traverse(const Ray& ray, uint8 layers, RayTestResult& result) const; //can run in several threads
+	};
+
+};
@@ -22,7 +22,7 @@ std::string base_folder;
 	bool load_textures = true; //must textures be loadead?
 #endif
 
-void parseGLTFBufferVector4(std::vector<Vector4f>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+void parseGLTFBufferVector4(std::vector<Vector4f>& container, cgltf_accessor* acc)
 {
 	int i = 0;
 
@@ -34,8 +34,6 @@ void parseGLTFBufferVector4(std::vector<Vector4f>& container, cgltf_accessor* ac
 		//assert(!"TO DO");
 	}
 	int num_elements = acc->count;
-	std::vector<Vector4f> unindexed;
-	unindexed.resize(num_elements);
 
 	std::vector<float> values;
 
@@ -86,47 +84,21 @@ void parseGLTFBufferVector4(std::vector<Vector4f>& container, cgltf_accessor* ac
 	}
 
 	//assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec4);
+	container.resize(num_elements);
 	if (acc->stride == sizeof(Vector4f))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector4f));
+		memcpy(&container[0], data, num_elements * sizeof(Vector4f));
 	else
 	{
 		//read every element one by one to jump the gap between them
 		for (int i = 0; i < num_elements; ++i)
 		{
-			memcpy(&unindexed[i], data, sizeof(Vector4f));
+			memcpy(&container[i], data, sizeof(Vector4f));
 			data += acc->stride;
 		}
 	}
-
-	if (!indices_acc)
-	{
-		container = unindexed;
-		return;
-	}
-
-	//deindex
-	container.resize(indices_acc->count);
-
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (size_t i = 0; i < indices_acc->count; ++i)
-	{
-		size_t index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
-		{
-		case cgltf_component_type_r_8u: index = (int)*pos; break;
-		case cgltf_component_type_r_16u: index = (int)*(unsigned short*)pos; break;
-		case cgltf_component_type_r_32u: index = (int)*(unsigned int*)pos; break;
-		}
-		if (index < unindexed.size()) //sometimes indices are out of bounds
-			container[i] = unindexed[index];
-		else
-			std::cout << "index out of bounds:" << index << std::endl;
-	}
 }
 
-void parseGLTFBufferVector3(std::vector<Vector3f>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+void parseGLTFBufferVector3(std::vector<Vector3f>& container, cgltf_accessor* acc)
 {
 	int i = 0;
 
@@ -138,49 +110,21 @@ void parseGLTFBufferVector3(std::vector<Vector3f>& container, cgltf_accessor* ac
 		assert(!"TO DO");
 	}
 	int num_elements = acc->count;
-	std::vector<Vector3f> unindexed;
-	unindexed.resize(num_elements);
+	container.resize(num_elements);
 	assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec3);
 	if (acc->stride == sizeof(Vector3f))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector3f));
+		memcpy(&container[0], data, num_elements * sizeof(Vector3f));
 	else
 	{
 		for (int i = 0; i < num_elements; ++i)
 		{
-			memcpy(&unindexed[i], data, sizeof(Vector3f));
+			memcpy(&container[i], data, sizeof(Vector3f));
 			data += acc->stride;
 		}
 	}
-
-	if (!indices_acc)
-	{
-		container = unindexed;
-		return;
-	}
-
-	//deindex
-	container.resize(indices_acc->count);
-
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (size_t i = 0; i < indices_acc->count; ++i)
-	{
-		size_t index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
-		{
-		case cgltf_component_type_r_8u: index = (int)*pos; break;
-		case cgltf_component_type_r_16u: index = (int)*(unsigned short*)pos; break;
-		case cgltf_component_type_r_32u: index = (int)*(unsigned int*)pos; break;
-		}
-		if (index < unindexed.size()) //sometimes indices are out of bounds
-			container[i] = unindexed[index];
-		else
-			std::cout << "index out of bounds:" << index << std::endl;
-	}
 }
 
-void parseGLTFBufferVector2(std::vector<Vector2f>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+void parseGLTFBufferVector2(std::vector<Vector2f>& container, cgltf_accessor* acc)
 {
 	assert(acc->buffer_view->buffer->data);
 	unsigned char* data = (unsigned char*)(acc->buffer_view->buffer->data) + acc->offset + acc->buffer_view->offset;
@@ -190,49 +134,18 @@ void parseGLTFBufferVector2(std::vector<Vector2f>& container, cgltf_accessor* ac
 		assert(!"TO DO");
 	}
 	int num_elements = acc->count;
-	std::vector<Vector2f> unindexed;
-	unindexed.resize(num_elements);
+	container.resize(num_elements);
 	assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec2);
 	if (acc->stride == sizeof(Vector2f))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector2f));
+		memcpy(&container[0], data, num_elements * sizeof(Vector2f));
 	else
 	{
 		for (int i = 0; i < num_elements; ++i)
 		{
-			memcpy(&unindexed[i], data, sizeof(Vector2f));
+			memcpy(&container[i], data, sizeof(Vector2f));
 			data += acc->stride;
 		}
 	}
-
-	if (!indices_acc)
-	{
-		container = unindexed;
-		return;
-	}
-
-	//deindex
-	container.resize(indices_acc->count);
-
-	assert(indices_acc->sparse.count == 0); //sparse not supported yet
-
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (size_t i = 0; i < indices_acc->count; ++i)
-	{
-		unsigned int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
-		{
-		case cgltf_component_type_r_8u: index = static_cast<unsigned int>(*pos); break;
-		case cgltf_component_type_r_16u: index = static_cast<unsigned int>(*(unsigned short*)pos); break;
-		case cgltf_component_type_r_32u: index = static_cast<unsigned int>(*(unsigned int*)pos); break;
-		}
-		if (index < unindexed.size())  //sometimes indices are out of bounds
-			container[i] = unindexed[index];
-		else
-			std::cout << "index out of bounds:" << index << std::endl;
-	}
-
 }
 
 void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor* acc)
@@ -258,6 +171,91 @@ void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor
 	}
 }
 
+//memory used by the meshes of the gltf being loaded, for the log
+size_t gltf_vertex_bytes = 0;
+size_t gltf_index_bytes = 0;
+
+//streams of one primitive with the mesh processing applied, it doesnt call OpenGL so it can run in a background thread
+GFX::Mesh* parseGLTFPrimitive(cgltf_primitive* primitive, const std::string& submesh_name)
+{
+	GFX::Mesh* mesh = new GFX::Mesh();
+
+	//indices are shared by all the streams, so they are parsed only once
+	if (primitive->indices && primitive->indices->count)
+		parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+
+	//streams
+	for (size_t j = 0; j < primitive->attributes_count; ++j)
+	{
+		cgltf_attribute* attr = &primitive->attributes[j];
+
+        //std::string attrname = attr->name;
+		if (attr->type == cgltf_attribute_type_position)
+		{
+			parseGLTFBufferVector3(mesh->vertices, attr->data);
+			if (attr->data->has_min && attr->data->has_max)
+			{
+				mesh->aabb_min = attr->data->min;
+				mesh->aabb_max = attr->data->max;
+				mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
+				mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
+			}
+			else
+				mesh->updateBoundingBox();
+		}
+		else
+		if (attr->type == cgltf_attribute_type_normal)
+			parseGLTFBufferVector3(mesh->normals, attr->data);
+		else
+		if (attr->type == cgltf_attribute_type_texcoord)
+		{
+			if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
+				parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
+			else
+				parseGLTFBufferVector2(mesh->uvs, attr->data);
+		}
+		else
+		if (attr->type == cgltf_attribute_type_color)
+		{
+			parseGLTFBufferVector4(mesh->colors, attr->data);
+		}
+		else
+		if (attr->type == cgltf_attribute_type_weights)
+		{
+			parseGLTFBufferVector4(mesh->weights, attr->data);
+		}
+		else
+		if (attr->type == cgltf_attribute_type_joints)
+		{
+			//parseGLTFBufferVector4(mesh->bones, attr->data);
+		}
+	}
+
+	if ((GFX::Mesh::optimize_meshes || GFX::Mesh::build_meshlets || GFX::Mesh::generate_lods) && primitive->type == cgltf_primitive_type_triangles)
+	{
+		std::cout << "\t<- MESH: " << (submesh_name.size() ? submesh_name : "unnamed") << " ";
+		if (GFX::Mesh::optimize_meshes)
+			mesh->optimize();
+		if (GFX::Mesh::build_meshlets)
+			mesh->buildMeshlets();
+		if (GFX::Mesh::generate_lods)
+			mesh->generateLODs(GFX::Mesh::lod_max_error);
+		std::cout << std::endl;
+	}
+
+	return mesh;
+}
+
+std::string getGLTFSubmeshName(cgltf_mesh* meshdata, const char* basename, size_t index)
+{
+	if (!meshdata->name)
+		return "";
+	return std::string(basename) + std::string("::") + std::string(meshdata->name) + std::string("::") + std::to_string(index);
+}
+
+//primitives already parsed in a background thread, only set while building an async prefab
+std::map<cgltf_mesh*, std::vector<GFX::Mesh*>>* gltf_parsed_meshes = NULL;
+
 std::vector<GFX::Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename)
 {
 	std::vector<GFX::Mesh*> result;
@@ -271,10 +269,9 @@ std::vector<GFX::Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename
 		cgltf_primitive* primitive = &meshdata->primitives[i];
 		GFX::Mesh* mesh = NULL;
 
-		std::string submesh_name;
+		std::string submesh_name = getGLTFSubmeshName(meshdata, basename, i);
 		if (meshdata->name)
 		{
-			submesh_name = std::string(basename) + std::string("::") + std::string(meshdata->name) + std::string("::") + std::to_string(i);
 			mesh = GFX::Mesh::Get(submesh_name.c_str(), true);
 			if (mesh)
 			{
@@ -283,58 +280,19 @@ std::vector<GFX::Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename
 			}
 		}
 
-		mesh = new GFX::Mesh();
-
-        //streams
-		for (size_t j = 0; j < primitive->attributes_count; ++j)
+		if (gltf_parsed_meshes)
 		{
-			cgltf_attribute* attr = &primitive->attributes[j];
-
-            //std::string attrname = attr->name;
-			if (attr->type == cgltf_attribute_type_position)
-			{
-				parseGLTFBufferVector3(mesh->vertices, attr->data);
-				if (attr->data->has_min && attr->data->has_max)
-				{
-					mesh->aabb_min = attr->data->min;
-					mesh->aabb_max = attr->data->max;
-					mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
-					mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
-				}
-				else
-					mesh->updateBoundingBox();
-			}
-			else
-			if (attr->type == cgltf_attribute_type_normal)
-				parseGLTFBufferVector3(mesh->normals, attr->data);
-			else
-			if (attr->type == cgltf_attribute_type_texcoord)
-			{
-				if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
-					parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
-				else
-					parseGLTFBufferVector2(mesh->uvs, attr->data);
-			}
-			else
-			if (attr->type == cgltf_attribute_type_color)
-			{
-				parseGLTFBufferVector4(mesh->colors, attr->data);
-			}
-			else
-			if (attr->type == cgltf_attribute_type_weights)
-			{
-				parseGLTFBufferVector4(mesh->weights, attr->data);
-			}
-			else
-			if (attr->type == cgltf_attribute_type_joints)
-			{
-				//parseGLTFBufferVector4(mesh->bones, attr->data);
-			}
-
-			if (primitive->indices && primitive->indices->count)
-				parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+			//not rendered until the task that built the prefab uploads it
+			mesh = (*gltf_parsed_meshes)[meshdata][i];
+			mesh->loading = true;
+		}
+		else
+		{
+			mesh = parseGLTFPrimitive(primitive, submesh_name);
+			mesh->uploadToVRAM(GFX::Mesh::use_compact_vertices);
 		}
-		mesh->uploadToVRAM();
+		gltf_vertex_bytes += mesh->getVertexBytes();
+		gltf_index_bytes += mesh->getIndexBytes();
 		if (meshdata->name)
 			mesh->registerMesh(submesh_name);
 		result.push_back(mesh);
@@ -344,8 +302,77 @@ std::vector<GFX::Mesh*> parseGLTFMesh(cgltf_mesh* meshdata, const char* basename
 }
 
 int GLTF_TEXTURE_LAST_ID = 1;
+unsigned int gltf_shared_textures = 0; //embedded images found already decoded
+
+//being parsed, to know where its embedded images are so the cooked version can decode them from the same files
+SCN::Prefab* gltf_prefab = NULL;
+cgltf_data* gltf_data = NULL;
+
+static void recordGLTFImage(cgltf_image* image, GFX::Texture* texture)
+{
+	if (!gltf_prefab || !gltf_data)
+		return;
+
+	cgltf_buffer* buffer = image->buffer_view->buffer;
+	SCN::sPrefabImage embedded;
+	embedded.mime = image->mime_type ? image->mime_type : "";
+	embedded.size = image->buffer_view->size;
+	if (!buffer->uri && gltf_data->bin && buffer->data == gltf_data->bin)
+	{
+		//binary chunk of the glb, the first source
+		embedded.source = 0;
+		embedded.offset = ((const char*)gltf_data->bin - (const char*)gltf_data->file_data) + image->buffer_view->offset;
+	}
+	else if (buffer->uri && strncmp(buffer->uri, "data:", 5) != 0)
+	{
+		//same order as getGLTFSourceFiles
+		embedded.source = 1;
+		for (cgltf_buffer* it = gltf_data->buffers; it != buffer; ++it)
+			if (it->uri && strncmp(it->uri, "data:", 5) != 0)
+				embedded.source++;
+		embedded.offset = image->buffer_view->offset;
+	}
+	else
+		return; //base64 inside the gltf, the prefab is not cooked
+	gltf_prefab->embedded_images[texture] = embedded;
+}
 
-GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
+GFX::Texture* decodeGLTFImage(const unsigned char* encoded, size_t size, const char* mime_type, unsigned long long hash, const char* name)
+{
+	Image img;
+	std::vector<unsigned char> buffer;
+	buffer.resize(size);
+	memcpy(&buffer[0], encoded, size);
+
+	if (!strcmp(mime_type, "image/png"))
+		img.loadPNG(buffer);
+	else if (!strcmp(mime_type, "image/jpeg"))
+		img.loadJPG(buffer);
+	else
+	{
+		stdlog(std::string("image format not supported: ") + mime_type);
+		return NULL;
+	}
+	if (!img.width)
+	{
+		stdlog(std::string("image encoding has error: ") + mime_type);
+		return NULL;
+	}
+	GFX::Texture* tex = new GFX::Texture();
+	tex->loadFromImage(&img);
+	tex->setContentHash(hash);
+	if (name)
+	{
+		tex->setName(name);
+		stdlog(std::string("\t<- TEXTURE: ") + name);
+	}
+	else
+		stdlog(std::string(" TEXTURE: UNNAMED ") + mime_type );
+
+	return tex;
+}
+
+GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename, GFX::eTextureUsage usage = GFX::TEXTURE_COLOR, float alpha_cutoff = 0.0f)
 {
 	if (!load_textures || !image )
 		return NULL;
@@ -353,14 +380,18 @@ GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 	std::string fullpath = filename ? filename : "";
 
 	if (image->uri)
-		return GFX::Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str());
+		return GFX::Texture::GetAsync((std::string(base_folder) + "/" + image->uri).c_str(), true, true, 0.0f, usage, alpha_cutoff);
 	else
 	if (filename)
 	{
 		fullpath = std::string(base_folder) + "/" + filename;
 		GFX::Texture* tex = GFX::Texture::Find(fullpath.c_str());
 		if (tex)
+		{
+			if (image->buffer_view)
+				recordGLTFImage(image, tex);
 			return tex;
+		}
 	}
 	else
 	{
@@ -371,35 +402,17 @@ GFX::Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 
 	if (image->buffer_view)
 	{
-		Image img;
-		std::vector<unsigned char> buffer;
-		buffer.resize(image->buffer_view->size);
-		memcpy(&buffer[0], (char*)image->buffer_view->buffer->data + image->buffer_view->offset, image->buffer_view->size);
-
-		if (!strcmp(image->mime_type, "image/png"))
-			img.loadPNG(buffer);
-		else if (!strcmp(image->mime_type, "image/jpeg"))
-			img.loadJPG(buffer);
-		else
-		{
-			stdlog(std::string("image format not supported: ") + image->mime_type);
-			return NULL;
-		}
-		if (!img.width)
-		{
-			stdlog(std::string("image encoding has error: ") + image->mime_type);
-			return NULL;
-		}
-		GFX::Texture* tex = new GFX::Texture();
-		tex->loadFromImage(&img);
-		if (filename)
-		{
-			tex->setName(fullpath.c_str());
-			stdlog(std::string("\t<- TEXTURE: ") + fullpath);
-		}
+		//the same image embedded in several files (or several times) is decoded once, identified by the hash of its encoded bytes
+		const unsigned char* encoded = (const unsigned char*)image->buffer_view->buffer->data + image->buffer_view->offset;
+		size_t encoded_size = image->buffer_view->size;
+		unsigned long long hash = hashBytes(encoded, encoded_size, hashBytes(&encoded_size, sizeof(encoded_size)));
+		GFX::Texture* tex = GFX::Texture::FindByContent(hash);
+		if (tex)
+			gltf_shared_textures++;
 		else
-			stdlog(std::string(" TEXTURE: UNNAMED ") + image->mime_type );
-
+			tex = decodeGLTFImage(encoded, encoded_size, image->mime_type, hash, filename ? fullpath.c_str() : NULL);
+		if (tex)
+			recordGLTFImage(image, tex);
 		return tex;
 	}
 	else
@@ -431,7 +444,7 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	//normalmap
 	if (matdata->normal_texture.texture)
 	{
-		material->textures[SCN::eTextureChannel::NORMALMAP].texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name);
+		material->textures[SCN::eTextureChannel::NORMALMAP].texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name, GFX::TEXTURE_NORMALMAP);
 		material->textures[SCN::eTextureChannel::NORMALMAP].uv_channel = matdata->normal_texture.texcoord;
 	}
 
@@ -444,11 +457,12 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 	}
 
 
-	//pbr
+	//pbr, the mips of alpha tested albedos keep their coverage
+	float albedo_alpha_cutoff = material->alpha_mode == SCN::eAlphaMode::MASK ? material->alpha_cutoff : 0.0f;
 	if (matdata->has_pbr_specular_glossiness)
 	{
 		if (matdata->pbr_specular_glossiness.diffuse_texture.texture)
-			material->textures[SCN::eTextureChannel::ALBEDO].texture = parseGLTFTexture(matdata->pbr_specular_glossiness.diffuse_texture.texture->image, matdata->pbr_specular_glossiness.diffuse_texture.texture->name);
+			material->textures[SCN::eTextureChannel::ALBEDO].texture = parseGLTFTexture(matdata->pbr_specular_glossiness.diffuse_texture.texture->image, matdata->pbr_specular_glossiness.diffuse_texture.texture->name, GFX::TEXTURE_COLOR, albedo_alpha_cutoff);
 	}
 	if (matdata->has_pbr_metallic_roughness)
 	{
@@ -460,12 +474,12 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 		{
 			if (matdata->pbr_metallic_roughness.base_color_texture.texture)
 			{
-				material->textures[SCN::eTextureChannel::ALBEDO].texture = parseGLTFTexture(matdata->pbr_metallic_roughness.base_color_texture.texture->image, matdata->pbr_metallic_roughness.base_color_texture.texture->name);
+				material->textures[SCN::eTextureChannel::ALBEDO].texture = parseGLTFTexture(matdata->pbr_metallic_roughness.base_color_texture.texture->image, matdata->pbr_metallic_roughness.base_color_texture.texture->name, GFX::TEXTURE_COLOR, albedo_alpha_cutoff);
 				material->textures[SCN::eTextureChannel::ALBEDO].uv_channel = matdata->pbr_metallic_roughness.base_color_texture.texcoord;
 			}
 			if (matdata->pbr_metallic_roughness.metallic_roughness_texture.texture)
 			{
-				material->textures[SCN::eTextureChannel::METALLIC_ROUGHNESS].texture = parseGLTFTexture(matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->image, matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->name);
+				material->textures[SCN::eTextureChannel::METALLIC_ROUGHNESS].texture = parseGLTFTexture(matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->image, matdata->pbr_metallic_roughness.metallic_roughness_texture.texture->name, GFX::TEXTURE_LINEAR);
 				material->textures[SCN::eTextureChannel::METALLIC_ROUGHNESS].uv_channel = matdata->pbr_metallic_roughness.metallic_roughness_texture.texcoord;
 			}
 		}
@@ -473,7 +487,7 @@ SCN::Material* parseGLTFMaterial(cgltf_material* matdata, const char* basename)
 
 	if (matdata->occlusion_texture.texture)
 	{
-		material->textures[SCN::eTextureChannel::OCCLUSION].texture = parseGLTFTexture(matdata->occlusion_texture.texture->image, matdata->occlusion_texture.texture->name);
+		material->textures[SCN::eTextureChannel::OCCLUSION].texture = parseGLTFTexture(matdata->occlusion_texture.texture->image, matdata->occlusion_texture.texture->name, GFX::TEXTURE_LINEAR);
 		material->textures[SCN::eTextureChannel::OCCLUSION].uv_channel = matdata->occlusion_texture.texcoord;
 	}
 
@@ -585,10 +599,21 @@ cgltf_result internalOpenMemory(const struct cgltf_memory_options* memory_option
 	return cgltf_result_success;
 }
 
-SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+//creates the nodes, materials and meshes of the prefab, the buffers must be loaded
+//the gltf and its buffer files (embedded buffers are inside the gltf)
+void getGLTFSourceFiles(const char* filename, cgltf_data* data, std::vector<std::string>& files)
 {
-	cgltf_result result;
+	std::string folder = filename;
+	folder = folder.substr(0, folder.find_last_of('/'));
+	files.clear();
+	files.push_back(filename);
+	for (size_t i = 0; i < data->buffers_count; ++i)
+		if (data->buffers[i].uri && strncmp(data->buffers[i].uri, "data:", 5) != 0)
+			files.push_back(folder + "/" + data->buffers[i].uri);
+}
 
+void parseGLTFScene(const char* filename, cgltf_data* data, SCN::Prefab* prefab)
+{
 	if (data->scenes_count > 1)
 		std::cout << "[WARN] more than one scene, skipping the rest" << std::endl;
 
@@ -604,15 +629,14 @@ SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	const char* basename_start = strrchr(filename, '/');
 	strcpy(basename, basename_start+1);
 
-	{
-		result = cgltf_load_buffers(&options, data, filename);
-		if (result != cgltf_result_success) {
-			stdlog(std::string("[BIN NOT FOUND]:") + filename);
-			return NULL;
-		}
-	}
+	gltf_vertex_bytes = gltf_index_bytes = 0;
+	gltf_shared_textures = 0;
 
-	SCN::Prefab* prefab = new SCN::Prefab();
+	//to know when the cooked version is outdated
+	getGLTFSourceFiles(filename, data, prefab->source_files);
+	prefab->embedded_images.clear();
+	gltf_prefab = prefab;
+	gltf_data = data;
 
 	{
 		if (scene->nodes_count > 1)
@@ -649,14 +673,32 @@ SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 	*/
 	//prefab->root.model = model;
 
+	gltf_prefab = NULL;
+	gltf_data = NULL;
 	prefab->updateNodesByName();
 	prefab->updateBounding();
 
+    stdlog( std::string(" - Loaded ") + filename + " (vertices: " + std::to_string(gltf_vertex_bytes / 1024) + "KB, indices: " + std::to_string(gltf_index_bytes / 1024) + "KB, shared images: " + std::to_string(gltf_shared_textures) + ")" );
+}
+
+SCN::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
+{
+	cgltf_result result;
+
+	{
+		result = cgltf_load_buffers(&options, data, filename);
+		if (result != cgltf_result_success) {
+			stdlog(std::string("[BIN NOT FOUND]:") + filename);
+			return NULL;
+		}
+	}
+
+	SCN::Prefab* prefab = new SCN::Prefab();
+	parseGLTFScene(filename, data, prefab);
+
 	//frees all data, including bin
 	cgltf_free(data);
 
-    stdlog( std::string(" - Loaded ") + filename );
-
     return prefab;
 }
 
@@ -697,3 +739,162 @@ SCN::Prefab* loadGLTF(const char* filename)
 	return loadGLTF(filename, data, options);
 }
 
+//*********************
+
+//Async prefabs: the file, the buffers and the meshes are parsed in a background thread, then the nodes,
+//materials and textures are created in the main thread and every mesh is uploaded in its own task
+
+class BuildGLTFPrefabTask : public Task {
+public:
+	std::string filename;
+	cgltf_data* data;
+	std::map<cgltf_mesh*, std::vector<GFX::Mesh*>> meshes;
+	std::vector<SCN::sPrefabSource> sources; //as they were parsed, empty if the prefab is not cooked
+
+	void onExecute()
+	{
+		//in case it was released or loaded while I was parsing it in the background
+		SCN::Prefab* prefab = NULL;
+		auto it = SCN::Prefab::sPrefabsLoaded.find(filename);
+		if (it != SCN::Prefab::sPrefabsLoaded.end() && it->second->loading)
+		{
+			prefab = it->second;
+			gltf_parsed_meshes = &meshes;
+			parseGLTFScene(filename.c_str(), data, prefab);
+			gltf_parsed_meshes = NULL;
+			prefab->loading = false;
+		}
+		else
+			std::cout << "Warning: prefab loaded in background not found in foreground thread" << std::endl;
+
+		//meshes not used by any node (or already loaded by name), the used ones are waiting for the upload
+		std::vector<GFX::Mesh*> uploads;
+		for (auto& mesh_it : meshes)
+			for (size_t i = 0; i < mesh_it.second.size(); ++i)
+				if (!mesh_it.second[i]->loading)
+					delete mesh_it.second[i];
+				else
+					uploads.push_back(mesh_it.second[i]);
+
+		//the cooked version is written in the background, every mesh is uploaded in its own task
+		if (prefab && sources.size())
+			prefab->writeBinAsync(SCN::Prefab::getBinFilename(filename.c_str()).c_str(), sources, uploads);
+		else
+			for (size_t i = 0; i < uploads.size(); ++i)
+				TaskManager::foreground.addTask(new UploadMeshTask(uploads[i]));
+
+		cgltf_free(data);
+	}
+};
+
+class ParseGLTFTask : public Task {
+public:
+	std::string filename;
+	bool skip_bin = false;
+
+	void onExecute();
+};
+
+//the cooked version is up to date and its meshes were read in the background thread, the main thread builds the rest
+class ReadPrefabBinTask : public Task {
+public:
+	std::string filename;
+	std::vector<GFX::Mesh*> meshes;
+
+	void onExecute()
+	{
+		auto it = SCN::Prefab::sPrefabsLoaded.find(filename);
+		if (it != SCN::Prefab::sPrefabsLoaded.end() && it->second->loading)
+		{
+			SCN::Prefab* prefab = it->second;
+			if (prefab->readBin(SCN::Prefab::getBinFilename(filename.c_str()).c_str(), &meshes))
+			{
+				prefab->updateBounding();
+				prefab->loading = false;
+			}
+			else
+			{
+				//cannot be used, back to the gltf
+				ParseGLTFTask* task = new ParseGLTFTask();
+				task->filename = filename;
+				task->skip_bin = true;
+				TaskManager::background.addTask(task);
+			}
+		}
+
+		//every used mesh in its own upload task, the rest were already loaded by name
+		for (size_t i = 0; i < meshes.size(); ++i)
+			if (meshes[i]->loading)
+				TaskManager::foreground.addTask(new UploadMeshTask(meshes[i]));
+			else
+				delete meshes[i];
+	}
+};
+
+void ParseGLTFTask::onExecute()
+{
+	if (!skip_bin && SCN::Prefab::use_binary)
+	{
+		ReadPrefabBinTask* task = new ReadPrefabBinTask();
+		task->filename = filename;
+		if (SCN::Prefab::readBinMeshes(SCN::Prefab::getBinFilename(filename.c_str()).c_str(), task->meshes))
+		{
+			TaskManager::foreground.addTask(task);
+			return;
+		}
+		delete task;
+	}
+
+	cgltf_options options;
+	memset(&options, 0, sizeof(cgltf_options));
+	options.file.read = internalOpenFile;
+	cgltf_data* data = NULL;
+
+	if (cgltf_parse_file(&options, filename.c_str(), &data) != cgltf_result_success)
+	{
+		std::cout << "[ERROR]: Prefab not found: " << filename << std::endl;
+		return;
+	}
+	if (cgltf_load_buffers(&options, data, filename.c_str()) != cgltf_result_success)
+	{
+		std::cout << "[BIN NOT FOUND]:" << filename << std::endl;
+		cgltf_free(data);
+		return;
+	}
+
+	BuildGLTFPrefabTask* task = new BuildGLTFPrefabTask();
+	task->filename = filename;
+	task->data = data;
+
+	//hashed here, so cooking doesnt read them again
+	if (SCN::Prefab::use_binary)
+	{
+		std::vector<std::string> files;
+		getGLTFSourceFiles(filename.c_str(), data, files);
+		task->sources.resize(files.size());
+		for (size_t i = 0; i < files.size(); ++i)
+			if (!SCN::Prefab::getSourceInfo(files[i], task->sources[i]))
+			{
+				std::cout << "[WARN] prefab not cooked, source not found: " << files[i] << std::endl;
+				task->sources.clear();
+				break;
+			}
+	}
+	for (size_t i = 0; i < data->meshes_count; ++i)
+	{
+		cgltf_mesh* meshdata = &data->meshes[i];
+		for (size_t j = 0; j < meshdata->primitives_count; ++j)
+			task->meshes[meshdata].push_back(parseGLTFPrimitive(&meshdata->primitives[j], getGLTFSubmeshName(meshdata, filename.c_str(), j)));
+	}
+
+	//ready to go back to main thread
+	TaskManager::foreground.addTask(task);
+}
+
+void loadGLTFAsync(const char* filename)
+{
+	std::cout << "loading gltf async " << TermColor::YELLOW << filename << TermColor::DEFAULT << " ..." << std::endl;
+	ParseGLTFTask* task = new ParseGLTFTask();
+	task->filename = filename;
+	TaskManager::background.addTask(task);
+}
@@ -5,3 +5,5 @@
 SCN::Prefab* loadGLTF(const char* filename);
 //GTR::Prefab* loadGLTF(const char* filename, cgltf_data* data, cgltf_options& options);
 SCN::Prefab* loadGLTF(const std::vector<unsigned char>& data, const std::string& path);
+void loadGLTFAsync(const char* filename); //fills the prefab registered with this name once parsed (see Prefab::GetAsync)
+GFX::Texture* decodeGLTFImage(const unsigned char* encoded, size_t size, const char* mime_type, unsigned long long hash, const char* name); //png or jpeg embedded in a gltf, name can be NULL
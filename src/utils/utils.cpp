@@ -3,12 +3,20 @@
 #include <cassert>
 #include <iostream>
 #include <algorithm>
+#include <sys/stat.h>
 
 #include "../core/includes.h"
 #include "../core/core.h"
 
+#ifdef WIN32
+	#include <direct.h>
+#endif
+
 #ifndef WIN32
 	#include <sys/time.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
 
 
@@ -118,6 +126,97 @@ bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer
 	return true;
 }
 
+bool mapFile(const std::string& filename, sMappedFile& file)
+{
+	unmapFile(file);
+	#ifdef WIN32
+		HANDLE fh = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fh == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(fh, &size) || size.QuadPart == 0)
+		{
+			CloseHandle(fh);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(fh); //the mapping keeps the file open
+		if (mapping == NULL)
+			return false;
+		void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			return false;
+		}
+		file.handle = mapping;
+		file.size = (size_t)size.QuadPart;
+	#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd == -1)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+		void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); //the mapping keeps the file open
+		if (data == MAP_FAILED)
+			return false;
+		file.size = (size_t)st.st_size;
+	#endif
+	file.data = (const unsigned char*)data;
+	return true;
+}
+
+void unmapFile(sMappedFile& file)
+{
+	if (!file.data)
+		return;
+	#ifdef WIN32
+		UnmapViewOfFile(file.data);
+		CloseHandle((HANDLE)file.handle);
+	#else
+		munmap((void*)file.data, file.size);
+	#endif
+	file.data = nullptr;
+	file.size = 0;
+	file.handle = nullptr;
+}
+
+bool createFolder(const std::string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0)
+		return (st.st_mode & S_IFDIR) != 0;
+	#ifdef WIN32
+		return _mkdir(path.c_str()) == 0;
+	#else
+		return mkdir(path.c_str(), 0755) == 0;
+	#endif
+}
+
+bool getFileInfo(const std::string& filename, size_t& size, long long& modified_time)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	size = (size_t)st.st_size;
+	modified_time = (long long)st.st_mtime;
+	return true;
+}
+
+unsigned long long hashBytes(const void* data, size_t size, unsigned long long hash)
+{
+	//FNV-1a 64 bits
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
 bool writeFile(const std::string& filename, std::string& content)
 {
 	FILE* f = fopen(filename.c_str(), "w");
@@ -19,6 +19,20 @@ bool readFile(const std::string& filename, std::string& content);
 bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer);
 bool writeFile(const std::string& filename, std::string& content);
 
+//read only memory mapping of a whole file, the OS pages it in when accessed (no copy in RAM)
+struct sMappedFile {
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	void* handle = nullptr; //only used in windows
+};
+bool mapFile(const std::string& filename, sMappedFile& file);
+void unmapFile(sMappedFile& file);
+bool createFolder(const std::string& path); //true if it exists (not the parents)
+
+//to know if a file changed since it was processed
+bool getFileInfo(const std::string& filename, size_t& size, long long& modified_time);
+unsigned long long hashBytes(const void* data, size_t size, unsigned long long hash = 14695981039346656037ULL);
+
 //work with file paths
 std::string getFolderName(std::string path);
 std::string getExtension(std::string path);